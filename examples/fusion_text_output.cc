@@ -187,8 +187,8 @@ void loop() {
    * However we allow for possibility of reading several times before fusing
    * (for instance, if we want to collect several magnetometer readings each
    * fusion cycle, since the magnetometer IC doesn't have a FIFO). To take
-   * advantage of this feature, adjust the constants like kLoopsPerMagRead
-   * in sensor_fusion_class.h
+   * advantage of this feature, adjust kLoopsPerRead in the driver traits
+   * in sensor_drivers.h and kLoopsPerFusionCalc in sensor_fusion_class.h
    */
   const unsigned long kLoopIntervalMs = 1000 / LOOP_RATE_HZ;
   const unsigned long kPrintIntervalMs = 100;
@@ -210,10 +210,6 @@ void loop() {
     // run fusion routine according to loops_per_fuse_counter_
     sensor_fusion->RunFusion();
 
-    //create and send Toolbox format packet if fusion has produced new data
-    //This call is optional - if you don't want Toolbox packets, omit it
-//    sensor_fusion->ProduceToolboxOutput();
-
     //Process any incoming commands arriving over serial or TCP port.
     //See control_input.c for list of available commands.
     //This call is optional - if you don't need external control, omit it
@@ -228,6 +224,11 @@ void loop() {
 
   }  // end of if() that reads sensors and runs fusion as needed
 
+  //create a Toolbox format packet if fusion has produced new data, and keep
+  //sending it between fusion cycles, as the UART won't take a frame at once.
+  //This call is optional - if you don't want Toolbox packets, omit it
+//  sensor_fusion->ProduceToolboxOutput();
+
   // Send example output to Serial port
   // A few example parameters are chosen - see sensor_fusion_class.h for
   // a complete list of Get___() methods.
@@ -16,7 +16,9 @@
 #ifndef _BOARD_H_
 #define _BOARD_H_
 
+#if defined(ESP32) || defined(ESP8266)
 #include <Arduino.h>
+#endif
 
 #if defined(__cplusplus)
 extern "C" {
@@ -75,10 +75,13 @@ extern "C" {
 
 /// @name SensorParameters
 // The Output Data Rates (ODR) are set by the calls to *_Init() for each physical sensor.
+// When rate control is enabled (see rate_control.h) they may be lowered at run time.
 // If a sensor has a FIFO, then it can be read once/fusion cycle; if not, then read more often
 #define GYRO_ODR_HZ     400 ///< (int) requested gyroscope ODR Hz
 #define ACCEL_ODR_HZ    200 ///< (int) requested accelerometer ODR Hz (overrides MAG_ODR_HZ for FXOS8700)
 #define MAG_ODR_HZ      200 ///< (int) requested magnetometer ODR Hz (overridden by ACCEL_ODR_HZ for FXOS8700)
+#define GYRO_ODR_IDLE_HZ  100 ///< (int) gyroscope ODR Hz used by the rate controller while stationary (>= 2 * FUSION_HZ)
+#define ACCEL_ODR_IDLE_HZ 100 ///< (int) accelerometer/FXOS8700 mag ODR Hz used while stationary (>= 2 * FUSION_HZ)
 #define LOOP_RATE_HZ     40 //adjust according to the size of the FIFOs on sensors. If no FIFO (e.g. 
 //FXOS8700 magnetometer) and don't want to skip any readings then need to read at same rate as ODR. 
 //If FIFO exists or willing to skip readings, then usually set same as FUSION_HZ. See also sensor_fusion_class.h
@@ -87,6 +90,7 @@ extern "C" {
 // Output data rate parameters
 #define MAXPACKETRATEHZ 40  //max rate at which data packets can practically be sent (e.g. to Fusion Toolbox)
 #define RATERESOLUTION 1000 //When throttling back on output rate, this is the resolution in ms
+#define PREDICT_HORIZON_MS 0 ///< (int) initial time (ms) the predicted quaternion is extrapolated ahead, 0 for none
 
 //Specify which output method(s) to use for sending serial data packets and receiving commands
 //At least one path is needed if using the Orientation Library with the NXP Sensor Toolbox program.
@@ -94,6 +98,34 @@ extern "C" {
 #define F_USE_WIRELESS_UART     0x0000	///< 0x0001 to include, 0x0000 otherwise
 #define F_USE_WIRED_UART        0x0000	///< 0x0002 to include, 0x0000 otherwise
 
+/// Newton steps refining the bit trick estimate of 1/sqrt(x) used to normalize
+/// quaternions (see frsqrt()); 0 uses 1.0F / sqrtf(x) instead. Three steps are
+/// within 1.5E-7 relative error (1/sqrtf() is within 0.9E-7) and avoid the
+/// soft-float sqrtf() and division of the FPU-less ESP8266. May be set by the
+/// build; test/test_rsqrt measures the error and speed of either setting.
+#ifndef RSQRT_NEWTON_STEPS
+#ifdef ESP8266
+#define RSQRT_NEWTON_STEPS 3
+#else
+#define RSQRT_NEWTON_STEPS 0
+#endif
+#endif
+
+/// 1 for the 9DOF Kalman filter to keep its a priori and a posteriori
+/// orientations in quaternion form (see fRun_9DOF_GBY_KALMAN()), 0 for the
+/// original path through rotation matrices and two eCompass calls per cycle.
+/// test/test_replay runs a synthesized ten minute log through the pipeline:
+/// from 30 s after lock the error against the true orientation is 0.596 deg
+/// rms (2.840 max) here and 0.597 deg (2.841) on the matrix path. The two
+/// agree within 0.02 deg, except that the matrix path steps by up to 0.9 deg
+/// in the cycle where the rotation passes through 180 deg (q0 = 0), 5 times
+/// in the log, and takes a few seconds to settle back. runFusion() takes
+/// 1.72 us against 1.78 us on an x86 host. May be set by the build; the
+/// native_matrix_update test environment builds the matrix path.
+#ifndef F_9DOF_QUATERNION_UPDATE
+#define F_9DOF_QUATERNION_UPDATE 1
+#endif
+
 //#define INCLUDE_DEBUG_FUNCTIONS // Comment this line to disable the ApplyPerturbation function
 
 
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+/**
+ * @file fusion_snapshot.h
+ *
+ * Results of one fusion cycle, in the units and axis conventions of the
+ * SensorFusion::Get____() methods.
+ *
+ * SensorFusion::RunFusion() fills in a FusionSnapshot once per fusion cycle,
+ * so the unit conversions are done once rather than on every Get____() call.
+ * The heading, pitch and roll are included once a reader has first asked for
+ * them (until then that reader computes them in its own copy), so that
+ * sketches which only use the quaternion don't pay for the Euler angle
+ * computation. Readers never write the snapshot.
+ * SensorFusion::GetSnapshot() copies it out under a sequence lock: the
+ * writer makes the sequence number odd while it updates the snapshot, and a
+ * reader retries if the number was odd or changed during its copy. Neither
+ * side ever waits for a lock, so a task on the other ESP32 core can read
+ * the results while the fusion task keeps running.
+ */
+
+#ifndef FUSION_SNAPSHOT_H_
+#define FUSION_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "sensor_fusion/sensor_fusion.h"
+
+/**
+ *  Orientation, motion and calibration state at the end of a fusion cycle.
+ *  Plain data, so it can be copied with memcpy() or assignment.
+ */
+struct FusionSnapshot {
+  Quaternion quaternion;     ///< orientation quaternion
+  Quaternion predicted_quaternion;  ///< quaternion extrapolated predict_horizon_s ahead
+  float predict_horizon_s;   ///< prediction horizon (s); 0 when prediction is off
+  float heading_deg;         ///< compass heading, 0 at magnetic north, increasing CW
+  float pitch_deg;           ///< pitch, increasing with bow up
+  float roll_deg;            ///< roll, increasing with starboard roll
+  float heading_rad;         ///< heading_deg in radians
+  float pitch_rad;           ///< pitch_deg in radians
+  float roll_rad;            ///< roll_deg in radians
+  float turn_rate_dps;       ///< turn rate (deg/s), positive turning to starboard
+  float pitch_rate_dps;      ///< pitch rate (deg/s), positive with bow moving up
+  float roll_rate_dps;       ///< roll rate (deg/s), positive with increasing starboard heel
+  float accel_g[3];          ///< acceleration (g); X to bow, Y to port, Z up
+  float temperature_c;       ///< sensor die temperature (C), uncalibrated
+  float mag_fit_error_pc;    ///< fit error (%) of the magnetic calibration in use
+  float mag_b_uT;            ///< geomagnetic field magnitude (uT) of that calibration
+  float mag_noise_cov;       ///< magnetic measurement noise covariance
+  uint8_t mag_solver;        ///< magnetic calibration solver in use: 0, 4, 7 or 10
+  uint8_t status;            ///< fusion system status (see sensor_fusion.h)
+  uint32_t timestamp_us;     ///< micros() at the end of the fusion cycle
+  uint32_t fusion_count;     ///< number of fusion cycles run
+  bool has_angles;           ///< true if the heading, pitch and roll are filled in
+};
+
+#endif /* FUSION_SNAPSHOT_H_ */
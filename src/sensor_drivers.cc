@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020-2021, Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+/**
+ *  \file sensor_drivers.cc
+ *
+ *  @brief    The driver used for each SensorType by
+ *  SensorFusion::InstallSensor(). See sensor_drivers.h.
+ */
+
+#include "sensor_drivers.h"
+
+// Out-of-line definitions of the identities the drivers below point at
+// (needed before C++17 made static constexpr members inline)
+constexpr SensorVariant FXOS8700Identity::kVariants[];
+constexpr SensorIdentity FXOS8700Identity::kIdentity;
+constexpr SensorVariant FXAS21002Traits::kVariants[];
+constexpr SensorIdentity FXAS21002Traits::kIdentity;
+
+/// Default driver for each SensorType. A type with no entry (e.g. kBarometer)
+/// cannot be installed by type.
+static const SensorDriver kSensorDrivers[] = {
+    MakeSensorDriver<FXOS8700AccelTraits>(),
+    MakeSensorDriver<FXOS8700MagTraits>(),
+    MakeSensorDriver<FXOS8700Traits>(),
+    MakeSensorDriver<FXAS21002Traits>(),
+    MakeSensorDriver<FXOS8700ThermTraits>(),
+};
+
+/**
+ * Look up the registered driver for a sensor type.
+ * @param sensor_type the kind of sensor wanted
+ * @return the driver, or NULL if no driver handles sensor_type
+ */
+const SensorDriver *FindSensorDriver(SensorType sensor_type) {
+  for (const SensorDriver &driver : kSensorDrivers) {
+    if (driver.type == sensor_type) return &driver;
+  }
+  return NULL;
+}  // end FindSensorDriver()
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+/**
+ * @file sensor_drivers.h
+ *
+ * Registry of the sensor drivers SensorFusion::InstallSensor() knows about.
+ *
+ * Each driver is described by a traits struct giving its init, read and
+ * (optional) ODR functions from the driver_*.c files, and its SensorIdentity:
+ * the WHO_AM_I register, and the WHO_AM_I value and counts-per-unit scale of
+ * each chip it handles. The library checks the WHO_AM_I and sets the scale
+ * before calling the init function, which then only configures the chip.
+ *
+ * To add a new IC, write its driver_*.c functions, add a traits struct
+ * below and either list it in kSensorDrivers[] (sensor_drivers.cc) under its
+ * SensorType, or install it directly with
+ * SensorFusion::InstallSensor<MyTraits>(addr). Before C++17, the traits'
+ * kIdentity (and the variants it points at) also need a definition in a .cc
+ * file, as in sensor_drivers.cc.
+ */
+
+#ifndef SENSOR_DRIVERS_H_
+#define SENSOR_DRIVERS_H_
+
+#include <stdint.h>
+
+#include "sensor_fusion/sensor_fusion.h"
+#include "sensor_fusion/driver_sensors.h"
+#include "sensor_fusion/driver_fxas21002.h"
+#include "sensor_fusion/driver_fxos8700.h"
+#include "sensor_fusion/driver_fxos8700_registers.h"
+
+/**
+ *  enum constants used to indicate what type of sensor is being installed
+ *  when calling InstallSensor().
+ */
+enum class SensorType {
+  kMagnetometer,
+  kAccelerometer,
+  kMagnetometerAccelerometer,
+  kGyroscope,
+  kBarometer,
+  kThermometer
+};
+
+/**
+ *  Run-time description of a sensor driver, built from its traits struct.
+ */
+struct SensorDriver {
+  SensorType type;                ///< kind of measurement the driver provides
+  initializeSensor_t *initialize; ///< configures the IC
+  readSensor_t *read;             ///< reads the IC FIFO into sfg
+  setSensorODR_t *set_odr;        ///< applies sfg->RateCtrl ODRs, or NULL
+  uint8_t loops_per_read;         ///< main loops per sensor read (normally 1)
+  const SensorIdentity *identity; ///< WHO_AM_I check and scale
+};
+
+/// Builds the SensorDriver entry for a traits struct
+template <class Traits>
+constexpr SensorDriver MakeSensorDriver() {
+  return SensorDriver{Traits::kType, Traits::kInitialize, Traits::kRead,
+                      Traits::kSetODR, Traits::kLoopsPerRead,
+                      &Traits::kIdentity};
+}
+
+/// WHO_AM_I and scales of the FXOS8700, as set up by FXOS8700_Initialization
+/// (driver_fxos8700.c); shared by the FXOS8700 traits below
+struct FXOS8700Identity {
+  static constexpr SensorVariant kVariants[] = {
+      {FXOS8700_WHO_AM_I_PROD_VALUE, FXOS8700_COUNTSPERG, FXOS8700_COUNTSPERUT,
+       0}};
+  static constexpr SensorIdentity kIdentity = {FXOS8700_WHO_AM_I, 1,
+                                               kVariants};
+};
+
+/// FXOS8700 accelerometer only
+struct FXOS8700AccelTraits : FXOS8700Identity {
+  static constexpr SensorType kType = SensorType::kAccelerometer;
+  static constexpr initializeSensor_t *kInitialize = FXOS8700_Accel_Init;
+  static constexpr readSensor_t *kRead = FXOS8700_Accel_Read;
+  static constexpr setSensorODR_t *kSetODR = FXOS8700_SetODR;
+  static constexpr uint8_t kLoopsPerRead = 1;
+};
+
+/// FXOS8700 magnetometer only
+struct FXOS8700MagTraits : FXOS8700Identity {
+  static constexpr SensorType kType = SensorType::kMagnetometer;
+  static constexpr initializeSensor_t *kInitialize = FXOS8700_Mag_Init;
+  static constexpr readSensor_t *kRead = FXOS8700_Mag_Read;
+  static constexpr setSensorODR_t *kSetODR = nullptr;
+  static constexpr uint8_t kLoopsPerRead = 1;
+};
+
+/// FXOS8700 magnetometer and accelerometer in one read
+struct FXOS8700Traits : FXOS8700Identity {
+  static constexpr SensorType kType = SensorType::kMagnetometerAccelerometer;
+  static constexpr initializeSensor_t *kInitialize = FXOS8700_Init;
+  static constexpr readSensor_t *kRead = FXOS8700_Read;
+  static constexpr setSensorODR_t *kSetODR = FXOS8700_SetODR;
+  static constexpr uint8_t kLoopsPerRead = 1;
+};
+
+/// FXOS8700 die temperature. Not precise nor calibrated, but OK.
+struct FXOS8700ThermTraits : FXOS8700Identity {
+  static constexpr SensorType kType = SensorType::kThermometer;
+  static constexpr initializeSensor_t *kInitialize = FXOS8700_Therm_Init;
+  static constexpr readSensor_t *kRead = FXOS8700_Therm_Read;
+  static constexpr setSensorODR_t *kSetODR = nullptr;
+  static constexpr uint8_t kLoopsPerRead = 1;
+};
+
+/// FXAS21002 gyroscope
+struct FXAS21002Traits {
+  static constexpr SensorType kType = SensorType::kGyroscope;
+  static constexpr initializeSensor_t *kInitialize = FXAS21002_Init;
+  static constexpr readSensor_t *kRead = FXAS21002_Read;
+  static constexpr setSensorODR_t *kSetODR = FXAS21002_SetODR;
+  static constexpr uint8_t kLoopsPerRead = 1;
+  static constexpr SensorVariant kVariants[] = {
+      {FXAS21002_WHO_AM_I_WHOAMI_PROD_VALUE, 0, 0, FXAS21002_COUNTSPERDEGPERSEC},
+      {FXAS21002_WHO_AM_I_WHOAMI_PRE_VALUE, 0, 0, FXAS21002_COUNTSPERDEGPERSEC},
+      {FXAS21000_WHO_AM_I_VALUE, 0, 0, FXAS21000_COUNTSPERDEGPERSEC}};
+  static constexpr SensorIdentity kIdentity = {FXAS21002_WHO_AM_I, 3,
+                                               kVariants};
+};
+
+const SensorDriver *FindSensorDriver(SensorType sensor_type);
+
+#endif /* SENSOR_DRIVERS_H_ */
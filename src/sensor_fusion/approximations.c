@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "build.h"
 #include "approximations.h"
 
 // function returns an approximation to angle(deg)=asin(x) for x in the range -1 <= x <= 1
@@ -147,3 +148,207 @@ float fatan_15deg(float x)
     x2 = x * x;
     return (x * (PADE_A + x2 * PADE_B) / (PADE_C + x2));
 }
+
+// Branch-free, four at a time versions of fatan2_deg() and fasin_deg().
+// Both reduce their argument to an octant with min/max, a division and
+// selects, and evaluate one odd minimax polynomial, so all four lanes follow
+// the same path. The comparisons and selects are made on the floats' bit
+// patterns: a compiler turns float selects into branches unless it may
+// ignore floating point exceptions (GCC makes conditional jumps on x86 at
+// -O2), and the FPU-less ESP8266 would call a soft-float comparison for
+// each. The loops have no data-dependent branches or calls, so the
+// compiler can vectorize them where there is SIMD, and elsewhere (Xtensa)
+// interleave the four independent evaluations, hiding the latency of the
+// divide.
+
+// degree 15 minimax polynomial for atan(t) (deg), 0 <= t <= 1, in powers of t^2
+#define ATAN_P0     57.295741445F
+#define ATAN_P1    -19.096603546F
+#define ATAN_P2     11.428540269F
+#define ATAN_P3     -7.9690576893F
+#define ATAN_P4      5.5245720458F
+#define ATAN_P5     -3.2035402480F
+#define ATAN_P6      1.2526551483F
+#define ATAN_P7     -0.23230957163F
+
+#define FLOAT_SIGN_BIT  0x80000000U     // sign bit of a float's bit pattern
+#define FLOAT_MIN_BITS  0x00800000U     // bit pattern of FLT_MIN
+#define FLOAT_180_BITS  0x43340000U     // bit pattern of 180.0F
+
+// float and its bit pattern. Non-negative floats order like their bit
+// patterns as unsigned integers, and all non-NaN floats like theirs as
+// sign and magnitude integers.
+union FloatBits
+{
+    float f;
+    uint32_t i;
+};
+
+// atan2 angle (deg) of one lane, without branches
+static inline float fatan2_deg_lane(float y, float x)
+{
+    static const float fquadrant[2] = {0.0F, 90.0F};   // added when measured from the y axis
+    static const float fhalf[2] = {0.0F, 180.0F};      // added when x < 0
+    static const float fwrap[2] = {0.0F, 360.0F};      // subtracted from +180 deg
+    union FloatBits ux, uy;             // |x|, |y|
+    union FloatBits umin;               // smaller of |x| and |y|
+    union FloatBits umax;               // larger of |x| and |y|, at least FLT_MIN
+    union FloatBits uangle;             // computed angle (deg)
+    uint32_t iswap;                     // 1 if |y| > |x|, so the angle is measured from the y axis
+    uint32_t ixneg;                     // 1 if x < 0 (-0 is not)
+    uint32_t iyneg;                     // 1 if y < 0 (-0 is not)
+    float   t;                          // tangent of the angle to the nearer axis, 0 <= t <= 1
+    float   t2;                         // t^2
+
+    ux.f = x;
+    uy.f = y;
+    ixneg = (ux.i > FLOAT_SIGN_BIT);
+    iyneg = (uy.i > FLOAT_SIGN_BIT);
+    ux.i &= ~FLOAT_SIGN_BIT;
+    uy.i &= ~FLOAT_SIGN_BIT;
+    iswap = (uy.i > ux.i);
+    umin.i = iswap ? ux.i : uy.i;
+    umax.i = iswap ? uy.i : ux.i;
+    // keeping fmax >= FLT_MIN makes y = x = 0 give t = 0 / FLT_MIN = 0
+    umax.i = (umax.i > FLOAT_MIN_BITS) ? umax.i : FLOAT_MIN_BITS;
+    t = umin.f / umax.f;
+    t2 = t * t;
+    uangle.f = t * (ATAN_P0 + t2 * (ATAN_P1 + t2 * (ATAN_P2 + t2 * (ATAN_P3 +
+               t2 * (ATAN_P4 + t2 * (ATAN_P5 + t2 * (ATAN_P6 + t2 * ATAN_P7)))))));
+
+    // undo the reduction: angle = 90 - angle from the y axis, then
+    // 180 - angle for x < 0, then -angle for y < 0
+    uangle.i ^= iswap << 31;
+    uangle.f += fquadrant[iswap];
+    uangle.i ^= ixneg << 31;
+    uangle.f += fhalf[ixneg];
+    uangle.i ^= iyneg << 31;
+    // map +180 deg (y = 0, x < 0) onto the functionally equivalent -180 deg
+    uangle.f -= fwrap[(int32_t) uangle.i >= (int32_t) FLOAT_180_BITS];
+    return uangle.f;
+}
+
+// function returns sqrt(1 - x^2), and 0 for |x| >= 1, without branches
+// 1 - x^2 is formed as (1 - |x|)(1 + |x|) to keep its accuracy as |x| approaches 1
+float fsqrt1mx2(float x)
+{
+    float   ftmp = fabsf(x);
+
+    ftmp = (1.0F - ftmp) * (1.0F + ftmp);
+    return sqrtf((ftmp > 0.0F) ? ftmp : 0.0F);
+}
+
+// function returns four approximate atan2 angles in the range -180 <= angle < 180 deg
+// angle[i] = atan2(y[i], x[i]), and 0 for y[i] = x[i] = 0
+
+// maximum error is 15.2E-6 deg (measured over every float tangent in all octants,
+// see test/test_approximations), which is one float rounding step above 128 deg
+void fatan2_deg4(const float y[], const float x[], float angle[])
+{
+    int8_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        angle[i] = fatan2_deg_lane(y[i], x[i]);
+    }
+
+    return;
+}
+
+// function returns four approximations to angle(deg)=asin(x) and returns
+// -90 <= angle <= 90 deg. Arguments outside -1 <= x <= 1 give +-90 deg.
+
+// maximum error is 10.1E-6 deg (measured over every float in -1 <= x <= 1,
+// see test/test_approximations)
+void fasin_deg4(const float x[], float angle[])
+{
+    float fcos[4];      // sqrt(1 - x^2)
+
+    // asin(x) = atan2(x, sqrt(1 - x^2))
+    fcos[0] = fsqrt1mx2(x[0]);
+    fcos[1] = fsqrt1mx2(x[1]);
+    fcos[2] = fsqrt1mx2(x[2]);
+    fcos[3] = fsqrt1mx2(x[3]);
+    fatan2_deg4(x, fcos, angle);
+
+    return;
+}
+
+// function returns an approximation to 1/sqrt(x) for x > 0
+
+// With RSQRT_NEWTON_STEPS > 0 (see build.h), halving the float exponent
+// by a shift and subtract gives an estimate within 3.5% (the well known
+// 0x5F3759DF bit trick), and each Newton step y = y(1.5 - 0.5xy^2) then
+// roughly squares its relative error: 1.8E-3, 4.7E-6 and 1.5E-7 after one,
+// two and three steps. This is only multiplies and subtracts, without
+// branches, division or sqrtf(). x = 0 gives a large finite value rather
+// than infinity.
+float frsqrt(float x)
+{
+#if RSQRT_NEWTON_STEPS > 0
+    union
+    {
+        float f;
+        uint32_t i;
+    } u;                                // float as its bit pattern
+    float fhalfx = 0.5F * x;
+    float y;                            // estimate of 1/sqrt(x)
+    int8_t i;
+
+    u.f = x;
+    u.i = 0x5F3759DFU - (u.i >> 1);
+    y = u.f;
+    for (i = 0; i < RSQRT_NEWTON_STEPS; i++)
+    {
+        y = y * (1.5F - fhalfx * y * y);
+    }
+
+    return (y);
+#else
+    return (1.0F / sqrtf(x));
+#endif
+}
+
+// function returns an approximation to sqrt(x) for x >= 0, as x * frsqrt(x)
+// when RSQRT_NEWTON_STEPS > 0, so it too needs no sqrtf()
+float fsqrt_fast(float x)
+{
+#if RSQRT_NEWTON_STEPS > 0
+    return (x * frsqrt(x));
+#else
+    return (sqrtf(x));
+#endif
+}
+
+// function returns x * iScale, truncated towards zero like (int32_t) (x * iScale) and
+// saturated to the int32_t range, for a scale 0 < iScale < 65536. A NaN or infinite x
+// (e.g. from a diverged filter) has no meaningful scaled value and returns 0, rather
+// than a saturated value that a caller narrowing to int16_t would wrap.
+
+// The float's 24 bit mantissa (with its implicit leading one) times iScale is an exact
+// integer, which its exponent then shifts into place. That is one integer multiply and
+// a few shifts and masks, without the software float multiply and conversion it
+// replaces on a processor without an FPU (ESP8266). The result can differ from the
+// float expression in the last place, as here the product is not first rounded to float.
+int32_t iScaleFloat(float x, int32_t iScale)
+{
+    union
+    {
+        float f;
+        uint32_t i;
+    } u;                                // float as its bit pattern
+    int32_t iShift;                     // right shift taking the product to an integer
+    uint64_t iProduct;                  // |x| * iScale * 2^iShift
+    int8_t isNegative;                  // sign bit of x
+
+    u.f = x;
+    isNegative = (int8_t) (u.i >> 31);
+    if (0xFF == ((u.i >> 23) & 0xFF)) return 0;        // infinity or NaN
+    iShift = 150 - (int32_t) ((u.i >> 23) & 0xFF);     // 150 = exponent bias 127 + 23 mantissa bits
+    if (iShift >= 40) return 0;         // |x * iScale| < 1 (the product is below 2^40), or zero
+    if (iShift < -8) return isNegative ? INT32_MIN : INT32_MAX;
+    iProduct = (uint64_t) ((u.i & 0x7FFFFFU) | 0x800000U) * (uint32_t) iScale;
+    iProduct = (iShift >= 0) ? (iProduct >> iShift) : (iProduct << -iShift);
+    if (iProduct > INT32_MAX) return isNegative ? INT32_MIN : INT32_MAX;
+    return isNegative ? -(int32_t) iProduct : (int32_t) iProduct;
+}
@@ -10,6 +10,8 @@
 #ifndef APPROXIMATIONS_H
 #define APPROXIMATIONS_H
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif /* __cplusplus */
@@ -28,6 +30,12 @@ float facos_deg(float x);
 float fatan_deg(float x);
 float fatan2_deg(float y, float x);
 float fatan_15deg(float x);
+void fatan2_deg4(const float y[], const float x[], float angle[]);
+void fasin_deg4(const float x[], float angle[]);
+float fsqrt1mx2(float x);
+float frsqrt(float x);
+float fsqrt_fast(float x);
+int32_t iScaleFloat(float x, int32_t iScale);
 
 #if defined(__cplusplus)
 }
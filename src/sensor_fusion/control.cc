@@ -27,55 +27,181 @@
 #include "build.h"
 #include "control.h"
 
+#ifdef ESP32
+  #include <lwip/sockets.h>
+#endif
+
 // global structures
-uint8_t sUARTOutputBuffer[MAX_LEN_SERIAL_OUTPUT_BUF];
+// Output is double buffered: packets are built in one buffer (the back buffer,
+// serial_out_buf) while the previous frame drains from the other (the front
+// buffer, tx_buf) a little at a time, so a slow output never stalls the loop.
+uint8_t sUARTOutputBuffer[2][MAX_LEN_SERIAL_OUTPUT_BUF];
 
-// Blocking function to write multiple bytes to specified output(s): a UART
-//  or a TCP socket
-// On ESP32, hardware UART has internal FIFO of length 0x7f, and once the
-// bytes to be written are all in the FIFO, this routine returns. Actual
-// sending of the data may take a while longer...
-int8_t SendSerialBytesOut(SensorFusionGlobals *sfg)
+// Returns true if the given output is present and able to take data
+bool OutputIsOpen(ControlSubsystem *pComm, uint8_t sink)
 {
-  ControlSubsystem *pComm = sfg->pControlSubsystem;
-  // track number of bytes separately to run wired/wireless output in parallel
-    uint16_t bytes_left_wired = 0;
-    HardwareSerial *serial_port = (HardwareSerial *) (pComm->serial_port);
-    if (serial_port) {
-      bytes_left_wired = pComm->bytes_to_send;
+    const void *tcp_client;
+
+    switch (sink) {
+    case OUTPUT_SINK_UART:
+        return NULL != pComm->serial_port;
+    case OUTPUT_SINK_UDP:
+        return NULL != pComm->udp;
+    default:
+        tcp_client = pComm->tcp_client[sink - OUTPUT_SINK_TCP];
+        return (NULL != tcp_client) && ((WiFiClient *) tcp_client)->connected();
     }
+}//end OutputIsOpen()
+
+// Non-blocking write of up to nbytes to the given serial or TCP output.
+// Returns the number of bytes accepted, which may be 0, or -1 if the output
+// has gone away.
+static int SinkWrite(ControlSubsystem *pComm, uint8_t sink, const uint8_t *buf, uint16_t nbytes)
+{
+    int room;
 
-    uint16_t bytes_left_wireless = 0;
-    WiFiClient *tcp_client = NULL;
-    if (NULL != pComm->tcp_client) {
-      tcp_client = (WiFiClient *)(pComm->tcp_client);
-      // was WiFiClient *tcp_client = (WiFiClient *)(pComm->tcp_client);
-      bytes_left_wireless = pComm->bytes_to_send;
+    if (OUTPUT_SINK_UART == sink) {
+        HardwareSerial *serial_port = (HardwareSerial *) (pComm->serial_port);
+        //write() won't return until all requested are sent, so only ask for what there's room for
+        room = serial_port->availableForWrite();
+        if (room > nbytes) room = nbytes;
+        return (room > 0) ? serial_port->write(buf, room) : 0;
     }
 
-    int bytes_to_write_wired;
+    WiFiClient *tcp_client = (WiFiClient *)(pComm->tcp_client[sink - OUTPUT_SINK_TCP]);
+    if (!tcp_client->connected()) {
+        tcp_client->stop();
+        pComm->tcp_client[sink - OUTPUT_SINK_TCP] = NULL;   // free the slot
+        return -1;
+    }
+#ifdef ESP32
+    // WiFiClient::write() retries for up to several seconds when the peer's
+    // window is full; send directly on the socket instead so it never waits.
+    room = send(tcp_client->fd(), buf, nbytes, MSG_DONTWAIT);
+    if (room < 0) {
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) return 0;
+        tcp_client->stop();
+        pComm->tcp_client[sink - OUTPUT_SINK_TCP] = NULL;
+        return -1;
+    }
+    return room;
+#else
+    room = tcp_client->availableForWrite();
+    if (room > nbytes) room = nbytes;
+    return (room > 0) ? tcp_client->write(buf, room) : 0;
+#endif
+}//end SinkWrite()
 
-    while ((bytes_left_wired > 0) || (bytes_left_wireless > 0)) {
-      if (bytes_left_wired > 0) {
-        bytes_to_write_wired = serial_port->availableForWrite();
-        if( bytes_to_write_wired > bytes_left_wired ) {
-          bytes_to_write_wired = bytes_left_wired;
+// Index of the packet in the front buffer containing byte offset
+static uint8_t PacketAt(const OutputFrameLayout *pLayout, uint16_t offset)
+{
+    uint8_t k = 0;
+
+    while ((k < pLayout->numPackets - 1) && (pLayout->packetEnd[k] <= offset)) k++;
+    return k;
+}//end PacketAt()
+
+// Send the packets of the front buffer wanted by the UDP output as one
+// datagram; every listener receives the same one. Returns false on failure.
+static bool SendDatagram(ControlSubsystem *pComm)
+{
+    const OutputFrameLayout *pLayout = &(pComm->tx_layout);
+    WiFiUDP *udp = (WiFiUDP *) (pComm->udp);
+    uint16_t start = 0;
+    uint8_t k;
+
+    if (!udp->beginPacket(IPAddress(pComm->udp_ip), pComm->udp_port)) return false;
+    if (0 == pLayout->numPackets) {
+        udp->write(pComm->tx_buf, pComm->tx_len);
+    }
+    for (k = 0; k < pLayout->numPackets; k++) {
+        if (pLayout->packetType[k] & pLayout->sinkPackets[OUTPUT_SINK_UDP])
+            udp->write(&(pComm->tx_buf[start]), pLayout->packetEnd[k] - start);
+        start = pLayout->packetEnd[k];
+    }
+    return udp->endPacket();
+}//end SendDatagram()
+
+// Give each output as much of the front buffer as it will take right now,
+// skipping packets the output hasn't subscribed to. Whatever doesn't fit is
+// sent on a later call.
+void DrainSerialBytesOut(SensorFusionGlobals *sfg)
+{
+    ControlSubsystem *pComm = sfg->pControlSubsystem;
+    const OutputFrameLayout *pLayout = &(pComm->tx_layout);
+    uint16_t start, end;
+    uint8_t sink, k;
+    int written;
+    bool dropped;
+
+    for (sink = 0; sink < NUM_OUTPUT_SINKS; sink++) {
+        if (pComm->tx_sent[sink] >= pComm->tx_len) continue;
+        if (OUTPUT_SINK_UDP == sink) {
+            if (SendDatagram(pComm)) pComm->tx_stats[sink].framesSent++;
+            else pComm->tx_stats[sink].framesDropped++;
+            pComm->tx_sent[sink] = pComm->tx_len;
+            continue;
         }
-        //write() won't return until all requested are sent, so only ask for what there's room for
-        serial_port->write(&(pComm->serial_out_buf[pComm->bytes_to_send - bytes_left_wired]), bytes_to_write_wired);
-        bytes_left_wired -= bytes_to_write_wired;
-      };
-      if (bytes_left_wireless > 0) {
-        if( tcp_client->connected() ) {
-        // send data to wifi TCP socket.  write() returns actual # queued, which may be less than requested.
-          bytes_left_wireless -= tcp_client->write(&(pComm->serial_out_buf[pComm->bytes_to_send - bytes_left_wireless]), bytes_left_wireless);
-        }else {
-          tcp_client->stop();
-          bytes_left_wireless = 0;  //don't bother trying to send any remaining bytes
+        dropped = false;
+        while (pComm->tx_sent[sink] < pComm->tx_len) {
+            start = pComm->tx_sent[sink];
+            end = pComm->tx_len;
+            if (pLayout->numPackets) {
+                k = PacketAt(pLayout, start);
+                end = pLayout->packetEnd[k];
+                if (!(pLayout->packetType[k] & pLayout->sinkPackets[sink])) {
+                    pComm->tx_sent[sink] = end;     // not subscribed; skip this packet
+                    continue;
+                }
+            }
+            written = SinkWrite(pComm, sink, &(pComm->tx_buf[start]), end - start);
+            if (written < 0) {
+                //don't bother trying to send any remaining bytes
+                dropped = true;
+                pComm->tx_sent[sink] = pComm->tx_len;
+                break;
+            }
+            pComm->tx_sent[sink] += written;
+            if (pComm->tx_sent[sink] < end) break;  // output is full; continue next call
         }
-      }
-    }//end while() there are unsent bytes
-    pComm->bytes_to_send = 0;
+        if (pComm->tx_sent[sink] >= pComm->tx_len) {
+            if (dropped) pComm->tx_stats[sink].framesDropped++;
+            else pComm->tx_stats[sink].framesSent++;
+        }
+    }
+}//end DrainSerialBytesOut()
+
+// Queue the frame in the back buffer for output(s): a UART, UDP and/or TCP
+// sockets, and start sending it. Doesn't wait for any output. An output that
+// hasn't finished the previous frame drops the rest of it (drop-oldest) and
+// starts on the new one; packets are delimited by 0x7E, so the receiver
+// resynchronizes on the next packet.
+int8_t SendSerialBytesOut(SensorFusionGlobals *sfg)
+{
+    ControlSubsystem *pComm = sfg->pControlSubsystem;
+    uint8_t *tmp;
+    uint8_t sink;
+    bool wanted;
+
+    if (pComm->bytes_to_send > 0) {
+        DrainSerialBytesOut(sfg);   // last chance for the previous frame to finish
+        for (sink = 0; sink < NUM_OUTPUT_SINKS; sink++) {
+            if (pComm->tx_sent[sink] < pComm->tx_len) pComm->tx_stats[sink].framesDropped++;
+        }
+        // swap front and back buffers
+        tmp = pComm->tx_buf;
+        pComm->tx_buf = pComm->serial_out_buf;
+        pComm->serial_out_buf = tmp;
+        pComm->tx_len = pComm->bytes_to_send;
+        pComm->bytes_to_send = 0;
+        pComm->tx_layout = pComm->out_layout;
+        pComm->out_layout.numPackets = 0;
+        for (sink = 0; sink < NUM_OUTPUT_SINKS; sink++) {
+            wanted = (0 == pComm->tx_layout.numPackets) || (0 != pComm->tx_layout.sinkPackets[sink]);
+            pComm->tx_sent[sink] = (wanted && OutputIsOpen(pComm, sink)) ? 0 : pComm->tx_len;
+        }
+    }
+    DrainSerialBytesOut(sfg);
     return (0);
 }//end SendSerialBytesOut()
 
@@ -86,22 +212,31 @@ int8_t SendSerialBytesOut(SensorFusionGlobals *sfg)
 // as it is unlikely one would have multiple simultaneous sources.
 int8_t ReceiveIncomingCommands(SensorFusionGlobals *sfg)
 {
-    uint8_t     data;
-    WiFiClient *tcp_client = (WiFiClient *) sfg->pControlSubsystem->tcp_client;
+    uint8_t     data[MAX_LEN_COMMAND_BLOCK];
+    int         nbytes;
+    uint8_t     i;
+    WiFiClient *tcp_client;
     HardwareSerial *serial_port = (HardwareSerial*) sfg->pControlSubsystem->serial_port;
 
-    // check for incoming bytes from serial UART
+    // check for incoming bytes from serial UART, and decode all that have
+    // arrived in blocks rather than byte by byte
     if( serial_port ) {
-        while (0 < Serial.available() )
-      {   data = serial_port->read(); 
-          DecodeCommandBytes(sfg, &data, 1);
-      }
+        while (0 < (nbytes = serial_port->available())) {
+            if (nbytes > MAX_LEN_COMMAND_BLOCK) nbytes = MAX_LEN_COMMAND_BLOCK;
+            nbytes = serial_port->readBytes((char *) data, nbytes);
+            if (nbytes <= 0) break;
+            DecodeCommandBytes(sfg, data, nbytes);
+        }
     }
-    // check for incoming bytes from TCP socket
-    if (tcp_client) {
-      while (tcp_client->connected() && (0 < tcp_client->available())) {
-        tcp_client->read(&data, 1);
-        DecodeCommandBytes(sfg, &data, 1);
+    // check for incoming bytes from TCP sockets
+    for (i = 0; i < MAX_TCP_CLIENTS; i++) {
+      tcp_client = (WiFiClient *) sfg->pControlSubsystem->tcp_client[i];
+      if (tcp_client) {
+        while (tcp_client->connected() && (0 < tcp_client->available())) {
+          nbytes = tcp_client->read(data, sizeof(data));
+          if (nbytes <= 0) break;
+          DecodeCommandBytes(sfg, data, nbytes);
+        }
       }
     }
 
@@ -113,6 +248,8 @@ bool initializeIOSubsystem(
     ControlSubsystem *pComm,  ///< pointer to the control subystem structure
     const void *serial_port, const void *tcp_client )
 {
+    uint8_t i;
+
     if (pComm)
     { //commands (e.g. from Sensor Toolbox) can change some of these, such as 
       //which packets are enabled
@@ -123,13 +260,34 @@ bool initializeIOSubsystem(
         pComm->RPCPacketOn = true;                  // transmit roll, pitch, compass packet
         pComm->AltPacketOn = false;                 // Altitude packet
         pComm->AccelCalPacketOn = false;
-        pComm->serial_out_buf = sUARTOutputBuffer;
+        pComm->serial_out_buf = sUARTOutputBuffer[0];
+        pComm->bytes_to_send = 0;
+        pComm->tx_buf = sUARTOutputBuffer[1];
+        pComm->tx_len = 0;
+        memset(pComm->tx_sent, 0, sizeof(pComm->tx_sent));
+        memset(pComm->tx_stats, 0, sizeof(pComm->tx_stats));
+        memset(&(pComm->out_layout), 0, sizeof(pComm->out_layout));
+        memset(&(pComm->tx_layout), 0, sizeof(pComm->tx_layout));
+        for (i = 0; i < NUM_OUTPUT_SINKS; i++) {
+            // every output gets all enabled packets at the Toolbox rate
+            pComm->subscription[i].packets = PACKET_ALL;
+            pComm->subscription[i].rateHz = MAXPACKETRATEHZ;
+            pComm->subscription[i].iThrottle = 0;
+        }
         pComm->write = SendSerialBytesOut;
+        pComm->drain = DrainSerialBytesOut;
         pComm->stream = CreateOutgoingPackets;
         pComm->readCommands = ReceiveIncomingCommands;
         pComm->injectCommand = DecodeCommandBytes;
         pComm->serial_port = serial_port;     
-        pComm->tcp_client = tcp_client;
+        memset(pComm->tcp_client, 0, sizeof(pComm->tcp_client));
+        pComm->tcp_client[0] = tcp_client;
+        pComm->udp = NULL;
+        pComm->udp_ip = 0;
+        pComm->udp_port = 0;
+        memset(pComm->config_ack, 0, sizeof(pComm->config_ack));
+        pComm->config_ack_head = 0;
+        pComm->config_ack_count = 0;
 
         return true;
     }
@@ -140,5 +298,54 @@ bool initializeIOSubsystem(
 }//end initializeIOSubsystem()
 
 void UpdateTCPClient(ControlSubsystem *pComm,void *tcp_client) {
-    pComm->tcp_client = tcp_client;
+    uint8_t i;
+
+    // available() keeps returning a connected client; don't give it a second slot
+    if (NULL != tcp_client) {
+        for (i = 0; i < MAX_TCP_CLIENTS; i++) {
+            if (pComm->tcp_client[i] == tcp_client) return;
+        }
+    }
+    pComm->tcp_client[0] = tcp_client;
+    // a new client starts with the next frame, not part way into this one
+    pComm->tx_sent[OUTPUT_SINK_TCP] = pComm->tx_len;
 }//end UpdateTCPClient()
+
+bool AddTCPClient(ControlSubsystem *pComm, void *tcp_client) {
+    uint8_t i;
+    int8_t free_slot = -1;
+
+    for (i = 0; i < MAX_TCP_CLIENTS; i++) {
+        if (pComm->tcp_client[i] == tcp_client) return true;    // already added
+        if ((free_slot < 0) && (NULL == pComm->tcp_client[i])) free_slot = i;
+    }
+    if (free_slot < 0) return false;
+    pComm->tcp_client[free_slot] = tcp_client;
+    pComm->tx_sent[OUTPUT_SINK_TCP + free_slot] = pComm->tx_len;
+    return true;
+}//end AddTCPClient()
+
+void RemoveTCPClient(ControlSubsystem *pComm, void *tcp_client) {
+    uint8_t i;
+
+    for (i = 0; i < MAX_TCP_CLIENTS; i++) {
+        if (pComm->tcp_client[i] == tcp_client) {
+            pComm->tcp_client[i] = NULL;
+            pComm->tx_sent[OUTPUT_SINK_TCP + i] = pComm->tx_len;
+        }
+    }
+}//end RemoveTCPClient()
+
+void SetUDPOutput(ControlSubsystem *pComm, void *udp, uint32_t ip, uint16_t port) {
+    pComm->udp = udp;
+    pComm->udp_ip = ip;
+    pComm->udp_port = port;
+    pComm->tx_sent[OUTPUT_SINK_UDP] = pComm->tx_len;
+}//end SetUDPOutput()
+
+void SetOutputSubscription(ControlSubsystem *pComm, uint8_t sink, uint16_t packets, uint16_t rateHz) {
+    if (sink >= NUM_OUTPUT_SINKS) return;
+    pComm->subscription[sink].packets = packets;
+    pComm->subscription[sink].rateHz = rateHz;
+    pComm->subscription[sink].iThrottle = 0;
+}//end SetOutputSubscription()
@@ -32,6 +32,103 @@ extern "C" {
 #endif
 
 #define MAX_LEN_SERIAL_OUTPUT_BUF   255  // larger than the nominal 124 byte size for outgoing packets
+#define MAX_LEN_COMMAND_BLOCK       64   // bytes of incoming commands read and decoded at a time
+
+#define MAX_TCP_CLIENTS             4    // number of TCP clients that can receive the stream at once
+
+/// Outputs the data stream is sent to. Each frame is formatted once and the
+/// same bytes are sent to every output.
+enum OutputSinkId {
+    OUTPUT_SINK_UART,       ///< wired (or Bluetooth) serial port
+    OUTPUT_SINK_UDP,        ///< UDP datagrams, e.g. to a broadcast or multicast address
+    OUTPUT_SINK_TCP,        ///< first of MAX_TCP_CLIENTS connected TCP clients
+    NUM_OUTPUT_SINKS = OUTPUT_SINK_TCP + MAX_TCP_CLIENTS
+};
+
+/// @name Packet Type Masks
+/// Bit n selects Toolbox packet type n, for use in OutputSubscription
+///@{
+#define PACKET_MAIN                 (1 << 1)    ///< type 1: sensor data and quaternion
+#define PACKET_DEBUG                (1 << 2)    ///< type 2: also needs "DB+"
+#define PACKET_ANGULAR_VELOCITY     (1 << 3)    ///< type 3: also needs "VG+"
+#define PACKET_RPC                  (1 << 4)    ///< type 4: also needs "RPC+"
+#define PACKET_ALTITUDE             (1 << 5)    ///< type 5: also needs "ALT+"
+#define PACKET_MAGNETIC             (1 << 6)    ///< type 6: magnetic calibration
+#define PACKET_KALMAN               (1 << 7)    ///< type 7: Kalman filter state
+#define PACKET_ACCEL_CAL            (1 << 8)    ///< type 8: precision accelerometer calibration
+#define PACKET_CONFIG_ACK           (1 << 9)    ///< type 9: reply to a "CFG:" configuration record
+#define PACKET_PREDICTED            (1 << 10)   ///< type 10: predicted quaternion, when a prediction horizon is set
+#define PACKET_HEALTH               (1 << 11)   ///< type 11: Kalman filter health counts, also needs "DB+"
+#define PACKET_ALL                  0x0FFE      ///< every packet type
+///@}
+#define MAX_PACKETS_PER_FRAME       11          // one of each packet type
+
+/// @name Configuration Records
+/// A configuration record is the 4 characters "CFG:" followed by 8 binary bytes:
+/// [0] op (CFG_OP_*), [1] key (enum ConfigKey), [2] value type (CFG_TYPE_*),
+/// [6-3] value, little endian (uint32_t, or the bits of a float),
+/// [7] checksum, chosen so that the 8 bytes sum to 0 (mod 256).
+/// Each record is answered with a packet type 9 in the Toolbox stream:
+/// [3] op, [4] key, [5] status (CFG_STATUS_*), [6] value type, [10-7] value
+/// now in use (after a CFG_OP_SET, the value actually applied).
+///@{
+#define CONFIG_RECORD_LEN           8
+#define CFG_OP_SET                  1           ///< change the value of key
+#define CFG_OP_GET                  2           ///< report the value of key
+#define CFG_TYPE_UINT               1           ///< value is a uint32_t
+#define CFG_TYPE_FLOAT              2           ///< value is a float
+#define CFG_STATUS_OK               0
+#define CFG_STATUS_BAD_CHECKSUM     1           ///< record corrupted; nothing changed
+#define CFG_STATUS_BAD_OP           2           ///< op is not CFG_OP_SET or CFG_OP_GET
+#define CFG_STATUS_BAD_KEY          3           ///< key unknown, or not in this build
+#define CFG_STATUS_BAD_TYPE         4           ///< value type doesn't match the key
+#define CFG_STATUS_BAD_VALUE        5           ///< value out of range for the key; nothing changed
+///@}
+
+/// Run-time adjustable parameters, addressed by configuration records
+enum ConfigKey {
+    CFG_KEY_GYRO_ODR_HZ = 1,        ///< (uint) full-rate gyro ODR, one of 25, 50 .. 800 and at least GYRO_ODR_IDLE_HZ
+    CFG_KEY_ACCEL_ODR_HZ,           ///< (uint) full-rate accel/FXOS8700 mag ODR, one of 25, 50 .. 400 and at least ACCEL_ODR_IDLE_HZ
+    CFG_KEY_ADAPTIVE_RATES,         ///< (uint) 1 to enable the rate controller (see rate_control.h), 0 to disable
+    CFG_KEY_OUTPUT_RATE_HZ,         ///< (uint) frames per second sent to the UART output, 1 to FUSION_HZ
+    CFG_KEY_KALMAN_QVY,             ///< (float) Kalman gyro noise variance (deg/s)^2
+    CFG_KEY_KALMAN_QVG,             ///< (float) Kalman minimum accelerometer noise variance g^2
+    CFG_KEY_KALMAN_QVB,             ///< (float) 9DOF Kalman minimum magnetometer noise variance uT^2
+    CFG_KEY_KALMAN_QWB,             ///< (float) Kalman gyro offset random walk (deg/s)^2
+    CFG_KEY_MAG_CAL_INTERVAL_SECS,  ///< (uint) interval between regular magnetic calibrations, 10 to 3600 s
+    CFG_KEY_PREDICT_HORIZON_MS      ///< (uint) time the predicted quaternion is extrapolated ahead, 0 (off) to MAX_PREDICT_HORIZON_MS
+};
+
+/// The reply to a configuration record, waiting to be sent
+typedef struct ConfigAck {
+    uint8_t  op;                ///< CFG_OP_* of the record
+    uint8_t  key;               ///< key of the record
+    uint8_t  status;            ///< CFG_STATUS_*
+    uint8_t  type;              ///< CFG_TYPE_* of value
+    uint32_t value;             ///< value in use
+} ConfigAck;
+#define CONFIG_ACK_QUEUE_LEN        8           // replies held for sending, one per frame; the oldest is dropped when full
+
+/// Which packets an output is sent, and how often
+typedef struct OutputSubscription {
+    uint16_t packets;           ///< PACKET_* types wanted. Types switched off by command are not sent regardless.
+    uint16_t rateHz;            ///< frames per second sent to this output (FUSION_HZ or more for every fusion cycle)
+    int32_t  iThrottle;         ///< rate accumulator, in units of 1/RATERESOLUTION frame
+} OutputSubscription;
+
+/// The packets making up an output frame, and which of them go to each output
+typedef struct OutputFrameLayout {
+    uint8_t  numPackets;                        ///< 0 if the frame isn't divided into packets; it then goes whole to every output
+    uint16_t packetType[MAX_PACKETS_PER_FRAME]; ///< PACKET_* type of each packet
+    uint16_t packetEnd[MAX_PACKETS_PER_FRAME];  ///< offset just past the end of each packet
+    uint16_t sinkPackets[NUM_OUTPUT_SINKS];     ///< PACKET_* types each output is sent from this frame
+} OutputFrameLayout;
+
+/// Transmit counters kept for each output
+typedef struct OutputSinkStats {
+    uint32_t framesSent;        ///< frames completely handed to the output
+    uint32_t framesDropped;     ///< frames abandoned because a newer frame was queued before they were sent
+} OutputSinkStats;
 
 /// @name Control Port Function Type Definitions
 /// "write" "stream" and "readCommands" provide three control functions visible at the main()
@@ -41,6 +138,7 @@ typedef int8_t (writePort_t) (SensorFusionGlobals *sfg);
 typedef int8_t (readCommand_t) (SensorFusionGlobals *sfg);
 typedef void (injectCommand_t) (SensorFusionGlobals *sfg, uint8_t input_buffer[], uint16_t nbytes);
 typedef void (streamData_t)(SensorFusionGlobals *sfg);
+typedef void (drainPort_t)(SensorFusionGlobals *sfg);
 ///@}
 
 /// \brief The ControlSubsystem encapsulates command and data streaming functions.
@@ -56,12 +154,26 @@ typedef struct ControlSubsystem {
 	volatile uint8_t RPCPacketOn;			// flag to enable roll, pitch, compass packet
 	volatile uint8_t AltPacketOn;			// flag to enable altitude packet
 	volatile int8_t  AccelCalPacketOn;      // variable used to coordinate accelerometer calibration
-    uint8_t         *serial_out_buf;        //buffer containing the output stream (data packet)
-    uint16_t        bytes_to_send;          //how many bytes in output stream waiting to go out
+    uint8_t         *serial_out_buf;        //back buffer, where the next output frame (data packets) is built
+    uint16_t        bytes_to_send;          //how many bytes in the back buffer waiting to be queued by write()
+    uint8_t         *tx_buf;                //front buffer, holding the frame currently being transmitted
+    uint16_t        tx_len;                 //how many bytes in the front buffer
+    uint16_t        tx_sent[NUM_OUTPUT_SINKS];        //bytes of the front buffer each output has accepted so far
+    OutputSinkStats tx_stats[NUM_OUTPUT_SINKS];       //transmit counters for each output
+    OutputFrameLayout out_layout;           //packets in the back buffer and who they are for
+    OutputFrameLayout tx_layout;            //packets in the front buffer and who they are for
+    OutputSubscription subscription[NUM_OUTPUT_SINKS]; //packets and rate wanted by each output
     const void *serial_port;           //cast to Serial * and used to output to the serial port
-    const void *tcp_client;            //cast to WiFiClient * and used to output to a connected TCP client
-
-    writePort_t *write;  // function to write output buffer to the output(s)
+    const void *tcp_client[MAX_TCP_CLIENTS];   //cast to WiFiClient * and used to output to connected TCP clients; NULL if slot unused
+    void *udp;                         //cast to WiFiUDP * and used to send one datagram per frame, or NULL
+    uint32_t udp_ip;                   //destination IPv4 address of the datagrams, as IPAddress converts to uint32_t
+    uint16_t udp_port;                 //destination UDP port
+    ConfigAck config_ack[CONFIG_ACK_QUEUE_LEN];  //replies to configuration records, oldest at config_ack_head
+    uint8_t config_ack_head;           //index of the next reply to send
+    volatile uint8_t config_ack_count; //replies waiting to be sent
+
+    writePort_t *write;  // function to queue the back buffer for the output(s) and start sending it
+    drainPort_t *drain;  // function to send more of the queued frame, without blocking
     readCommand_t *readCommands;  // function to check for incoming commands and process them
     injectCommand_t *injectCommand;  // function that provides a command directly and processes it
     streamData_t *stream;  // function to create output data packets and place in buffer
@@ -71,15 +183,37 @@ bool initializeIOSubsystem(
     ControlSubsystem *pComm, const void *serial_port,
     const void *tcp_client);  // Initialize structures, ports, etc.
 
-//updates pointer to the TCP client. Call whenever new client connects or disconnects
+//updates pointer to the first TCP client. Call whenever new client connects or disconnects
 void UpdateTCPClient(ControlSubsystem *pComm,void *tcp_client);
+//adds a TCP client to the outputs. Returns false if all MAX_TCP_CLIENTS slots are in use.
+//A client is removed automatically once it disconnects.
+bool AddTCPClient(ControlSubsystem *pComm, void *tcp_client);
+//removes a TCP client from the outputs
+void RemoveTCPClient(ControlSubsystem *pComm, void *tcp_client);
+//sets (or, with udp NULL, clears) the UDP output
+void SetUDPOutput(ControlSubsystem *pComm, void *udp, uint32_t ip, uint16_t port);
+//returns true if the given output (enum OutputSinkId) is present and able to take data
+bool OutputIsOpen(ControlSubsystem *pComm, uint8_t sink);
+//selects the PACKET_* types and frame rate sent to the given output
+void SetOutputSubscription(ControlSubsystem *pComm, uint8_t sink, uint16_t packets, uint16_t rateHz);
 
 // Located in output_stream.c:
 /// Called once per fusion cycle to stream information required by the NXP
 /// Sensor Fusion Toolbox. Packet protocols are defined in the NXP Sensor Fusion
 /// for Kinetis Product Development Kit User Guide.
+/// Only packet types subscribed to by an output that is due a frame this cycle
+/// are built (see OutputSubscription).
 void CreateOutgoingPackets(SensorFusionGlobals *sfg);
 
+// Located in control_compact.c:
+/// Alternative to CreateOutgoingPackets, selected by the "CMP+" command.
+/// Streams a compact (under 24 byte) frame holding the quaternion and angular
+/// velocity every fusion cycle. The frame format is described in control_compact.c.
+void CreateCompactPackets(SensorFusionGlobals *sfg);
+/// The state vector of the algorithm producing quaternions of the given type,
+/// or NULL if that algorithm isn't built in or isn't running.
+SV_ptr SelectedStateVector(SensorFusionGlobals *sfg, quaternion_type quaternionPacketType);
+
 /// Located in control_input.c:
 /// This function is responsible for decoding commands, which can arrive externally
 /// (serial or WiFi) when sent by the NXP Sensor Fusion Toolbox, or by direct call.
@@ -88,6 +222,11 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg);
 /// Packet protocols are defined in the NXP Sensor Fusion for Kinetis Product Development Kit User Guide.
 void DecodeCommandBytes(SensorFusionGlobals *sfg, uint8_t input_buffer[], uint16_t nbytes);
 
+// Located in control_config.c:
+/// Apply or report the parameter addressed by a configuration record (the
+/// CONFIG_RECORD_LEN bytes following "CFG:"), and queue the reply packet.
+void ProcessConfigRecord(SensorFusionGlobals *sfg, const uint8_t record[CONFIG_RECORD_LEN]);
+
 /// Utility function used to place data in output buffer about to be transmitted via UART
 void OutputBufAppendItem(uint8_t *pDest, uint16_t *pIndex, uint8_t *pSource, uint16_t iBytesToCopy);
 
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file control_compact.c
+    \brief Compact binary output stream, an alternative to the Toolbox packets.
+
+    Selected with the "CMP+" command (and "CMP-" to return to the Toolbox
+    packets). One frame is sent per fusion cycle, without throttling, so that
+    every fusion output can be streamed over a 115200 baud UART.
+
+    Frames use the same 0x7E delimiters and 0x7D byte stuffing as the Toolbox
+    packets. Before stuffing, a frame is 15 to 21 bytes:
+    \verbatim
+    [0]      0x7E start byte
+    [1]      header: bits 7-4 = 0xC, bit 3 = keyframe, bits 2-0 = quaternion_type
+    [2]      sequence number, incremented every frame
+    [8-3]    quaternion, "smallest three" form, 48 bits little endian:
+             bits 1-0 index (q0..q3) of the component with the largest magnitude,
+             which is made positive and omitted; bits 16-2, 31-17 and 46-32 the
+             other three components in order, each as a 15 bit code
+             c = (q * sqrt(2) + 1) * 32767 / 2, covering -1/sqrt(2)..1/sqrt(2)
+    [..]     angular velocity x, y, z in 1/20 deg/s, clipped to +/-3276 deg/s,
+             each a 1 to 3 byte zigzag varint
+             (LEB128 of (v << 1) ^ (v >> 31)). Keyframes carry the values,
+             other frames the change since the previous frame.
+    [..]     CRC-16/CCITT-FALSE of bytes [1] onwards, little endian
+    [last]   0x7E end byte
+    \endverbatim
+    A keyframe is sent every COMPACT_KEYFRAME_INTERVAL frames and whenever a
+    fusion cycle has been skipped, so a receiver that misses a frame (detected
+    from the sequence number) can resume at the next keyframe. Roll, pitch and
+    compass are not sent; the receiver computes them from the quaternion.
+*/
+
+#include <math.h>
+
+#include "sensor_fusion.h"  // top level sensor fusion interfaces
+#include "build.h"
+#include "control.h"        // Command/Streaming interface - application specific
+#include "approximations.h" // iScaleFloat()
+
+#define COMPACT_PACKET_TYPE       0xC0  ///< high nibble of the compact frame header
+#define COMPACT_KEYFRAME          0x08  ///< header bit set in keyframes
+#define COMPACT_KEYFRAME_INTERVAL 16    ///< frames between keyframes
+#define COMPACT_MAX_OMEGA         65535 ///< angular velocity clip (1/20 deg/s), keeps each varint within 3 bytes
+#define COMPACT_MAX_FRAME         19    ///< longest frame contents (header to CRC) before byte stuffing
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+static uint16_t Crc16(const uint8_t *pData, uint16_t nbytes)
+{
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+    uint8_t bit;
+
+    for (i = 0; i < nbytes; i++) {
+        crc ^= (uint16_t) pData[i] << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+    }
+    return crc;
+}//end Crc16()
+
+// Append value as a zigzag-encoded varint. Returns the number of bytes (1 to 5).
+static uint8_t AppendVarint(uint8_t *pDest, int32_t value)
+{
+    uint32_t zigzag = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    uint8_t n = 0;
+
+    while (zigzag >= 0x80) {
+        pDest[n++] = (uint8_t) (zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    pDest[n++] = (uint8_t) zigzag;
+    return n;
+}//end AppendVarint()
+
+// Pack a unit quaternion into 6 bytes using smallest-three compression
+static void PackQuaternion(const Quaternion *pq, uint8_t *pDest)
+{
+    float fq[4] = {pq->q0, pq->q1, pq->q2, pq->q3};
+    float fsign;
+    uint64_t bits;
+    uint8_t largest = 0;
+    uint8_t shift = 2;
+    uint8_t i;
+    int32_t code;
+
+    for (i = 1; i < 4; i++) {
+        if (fabsf(fq[i]) > fabsf(fq[largest])) largest = i;
+    }
+    // q and -q are the same rotation; pick the one with the largest component positive
+    fsign = (fq[largest] < 0.0F) ? -1.0F : 1.0F;
+
+    bits = largest;
+    for (i = 0; i < 4; i++) {
+        if (i == largest) continue;
+        code = (int32_t) ((fsign * fq[i] * 1.41421356F + 1.0F) * 16383.5F + 0.5F);
+        if (code < 0) code = 0;
+        if (code > 32767) code = 32767;
+        bits |= (uint64_t) code << shift;
+        shift += 15;
+    }
+    for (i = 0; i < 6; i++) {
+        pDest[i] = (uint8_t) bits;
+        bits >>= 8;
+    }
+}//end PackQuaternion()
+
+// state vector of the algorithm producing the selected quaternion, or NULL if
+// that algorithm isn't built in or isn't running
+SV_ptr SelectedStateVector(SensorFusionGlobals *sfg, quaternion_type quaternionPacketType)
+{
+    switch (quaternionPacketType)
+    {
+#if F_3DOF_G_BASIC
+        case Q3:
+            if (sfg->iFlags & F_3DOF_G_BASIC) return (SV_ptr)&sfg->SV_3DOF_G_BASIC;
+            break;
+#endif
+#if F_3DOF_B_BASIC
+        case Q3M:
+            if (sfg->iFlags & F_3DOF_B_BASIC) return (SV_ptr)&sfg->SV_3DOF_B_BASIC;
+            break;
+#endif
+#if F_3DOF_Y_BASIC
+        case Q3G:
+            if (sfg->iFlags & F_3DOF_Y_BASIC) return (SV_ptr)&sfg->SV_3DOF_Y_BASIC;
+            break;
+#endif
+#if F_6DOF_GB_BASIC
+        case Q6MA:
+            if (sfg->iFlags & F_6DOF_GB_BASIC) return (SV_ptr)&sfg->SV_6DOF_GB_BASIC;
+            break;
+#endif
+#if F_6DOF_GY_KALMAN
+        case Q6AG:
+            if (sfg->iFlags & F_6DOF_GY_KALMAN) return (SV_ptr)&sfg->SV_6DOF_GY_KALMAN;
+            break;
+#endif
+#if F_9DOF_GBY_KALMAN
+        case Q9:
+            if (sfg->iFlags & F_9DOF_GBY_KALMAN) return (SV_ptr)&sfg->SV_9DOF_GBY_KALMAN;
+            break;
+#endif
+        default:
+            break;
+    }
+    return NULL;
+}//end SelectedStateVector()
+
+// prepare one compact frame per fusion cycle
+void CreateCompactPackets(SensorFusionGlobals *sfg)
+{
+    uint8_t         *output_buf = sfg->pControlSubsystem->serial_out_buf;
+    uint8_t         frame[COMPACT_MAX_FRAME];   // frame contents before byte stuffing
+    uint16_t        iFrameLen;                  // bytes used in frame[]
+    uint16_t        iIndex;                     // output buffer counter
+    uint16_t        crc;
+    Quaternion      fq;                         // quaternion to be transmitted
+    int32_t         iOmega[3];                  // angular velocity (1/20 deg/s)
+    int16_t         i;
+    bool            isKeyframe;
+    quaternion_type quaternionPacketType = sfg->pControlSubsystem->QuaternionPacketType;
+    SV_ptr          data = SelectedStateVector(sfg, quaternionPacketType);
+    static int32_t  iLastOmega[3];              // angular velocity sent in the previous frame
+    static int32_t  iLastLoopcounter = -1;      // fusion cycle of the previous frame
+    static uint8_t  iFramesSinceKeyframe = 0;
+    static uint8_t  iSequence = 0;
+
+    if (data) {
+        fq = data->fq;
+        // a non-finite rate is sent as 0 (see iScaleFloat()); finite ones are clipped
+        for (i = CHX; i <= CHZ; i++) {
+            iOmega[i] = iScaleFloat(data->fOmega[i], 20);
+            if (iOmega[i] > COMPACT_MAX_OMEGA) iOmega[i] = COMPACT_MAX_OMEGA;
+            if (iOmega[i] < -COMPACT_MAX_OMEGA) iOmega[i] = -COMPACT_MAX_OMEGA;
+        }
+    } else {
+        fq.q0 = 1.0F;
+        fq.q1 = fq.q2 = fq.q3 = 0.0F;
+        iOmega[CHX] = iOmega[CHY] = iOmega[CHZ] = 0;
+    }
+
+    // deltas are only meaningful if the previous frame was the previous fusion cycle
+    isKeyframe = (iFramesSinceKeyframe >= COMPACT_KEYFRAME_INTERVAL - 1) ||
+                 (sfg->loopcounter != iLastLoopcounter + 1);
+    iLastLoopcounter = sfg->loopcounter;
+    iFramesSinceKeyframe = isKeyframe ? 0 : iFramesSinceKeyframe + 1;
+
+    iFrameLen = 0;
+    frame[iFrameLen++] = COMPACT_PACKET_TYPE | (isKeyframe ? COMPACT_KEYFRAME : 0) |
+                         ((uint8_t) quaternionPacketType & 0x07);
+    frame[iFrameLen++] = iSequence++;
+    PackQuaternion(&fq, &frame[iFrameLen]);
+    iFrameLen += 6;
+    for (i = CHX; i <= CHZ; i++) {
+        iFrameLen += AppendVarint(&frame[iFrameLen],
+                                  isKeyframe ? iOmega[i] : iOmega[i] - iLastOmega[i]);
+        iLastOmega[i] = iOmega[i];
+    }
+    crc = Crc16(frame, iFrameLen);
+    frame[iFrameLen++] = (uint8_t) crc;
+    frame[iFrameLen++] = (uint8_t) (crc >> 8);
+
+    iIndex = 0;
+    output_buf[iIndex++] = 0x7E;
+    OutputBufAppendItem(output_buf, &iIndex, frame, iFrameLen);
+    output_buf[iIndex++] = 0x7E;
+    sfg->pControlSubsystem->bytes_to_send = iIndex;
+    sfg->pControlSubsystem->out_layout.numPackets = 0;   // every output gets every frame
+
+    return;
+}//end CreateCompactPackets()
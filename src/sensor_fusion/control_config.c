@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file control_config.c
+    \brief Run-time configuration records received by the command interpreter.
+
+    A record ("CFG:" followed by CONFIG_RECORD_LEN binary bytes, see control.h)
+    sets or reads one parameter that would otherwise need a rebuild: the
+    full-rate sensor ODRs, the output frame rate, the Kalman filter noise
+    parameters, the magnetic calibration interval and the prediction horizon.
+    Every record is answered with a packet type 9 carrying the status and the
+    value in use. Replies are queued and sent one per frame, in order.
+
+    FUSION_HZ is not adjustable: it is tied to the loop rate of the sketch and
+    to the sizes of several buffers. Lower output or sensor rates are the
+    run-time alternatives.
+*/
+
+#include <string.h>
+
+#include "sensor_fusion.h"
+#include "control.h"
+#include "fusion.h"
+#include "rate_control.h"
+
+/// Type and range of each key
+typedef struct ConfigParam {
+    uint8_t     key;            ///< enum ConfigKey
+    uint8_t     type;           ///< CFG_TYPE_*
+    float       fMin;           ///< smallest value accepted
+    float       fMax;           ///< largest value accepted
+} ConfigParam;
+
+static const ConfigParam kConfigParams[] = {
+    {CFG_KEY_GYRO_ODR_HZ,           CFG_TYPE_UINT,  GYRO_ODR_IDLE_HZ,  800.0F},
+    {CFG_KEY_ACCEL_ODR_HZ,          CFG_TYPE_UINT,  ACCEL_ODR_IDLE_HZ, 400.0F},
+    {CFG_KEY_ADAPTIVE_RATES,        CFG_TYPE_UINT,  0.0F,              1.0F},
+    {CFG_KEY_OUTPUT_RATE_HZ,        CFG_TYPE_UINT,  1.0F,              FUSION_HZ},
+    {CFG_KEY_PREDICT_HORIZON_MS,    CFG_TYPE_UINT,  0.0F,              MAX_PREDICT_HORIZON_MS},
+#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+    {CFG_KEY_KALMAN_QVY,            CFG_TYPE_FLOAT, 1E-3F,             1E5F},
+    {CFG_KEY_KALMAN_QVG,            CFG_TYPE_FLOAT, 1E-6F,             1E0F},
+    {CFG_KEY_KALMAN_QWB,            CFG_TYPE_FLOAT, 1E-6F,             1E1F},
+#endif
+#if F_9DOF_GBY_KALMAN
+    {CFG_KEY_KALMAN_QVB,            CFG_TYPE_FLOAT, 1E-2F,             1E3F},
+#endif
+#if F_USING_MAG
+    {CFG_KEY_MAG_CAL_INTERVAL_SECS, CFG_TYPE_UINT,  10.0F,             3600.0F},
+#endif
+};
+#define NUM_CONFIG_PARAMS   (sizeof(kConfigParams) / sizeof(kConfigParams[0]))
+
+static const ConfigParam *FindConfigParam(uint8_t key)
+{
+    uint8_t i;
+
+    for (i = 0; i < NUM_CONFIG_PARAMS; i++) {
+        if (kConfigParams[i].key == key) return &kConfigParams[i];
+    }
+    return NULL;
+}//end FindConfigParam()
+
+// true if fValue is accepted for pParam. Sensor ODRs must also be a rate the
+// parts can run at, 25 Hz times a power of two, so that the rate reported back
+// is the one programmed (and halving it, as the rate controller does, stays exact).
+static bool IsValidConfigValue(const ConfigParam *pParam, float fValue)
+{
+    uint16_t iODR;
+
+    // written so that a NaN is rejected too
+    if (!((fValue >= pParam->fMin) && (fValue <= pParam->fMax))) return false;
+    if ((pParam->key == CFG_KEY_GYRO_ODR_HZ) || (pParam->key == CFG_KEY_ACCEL_ODR_HZ)) {
+        iODR = (uint16_t) fValue;
+        if (iODR % 25) return false;
+        iODR /= 25;
+        return (iODR & (iODR - 1)) == 0;
+    }
+    return true;
+}//end IsValidConfigValue()
+
+// the value of a parameter, as a float (uint keys are all well within float precision)
+static float GetConfigValue(SensorFusionGlobals *sfg, uint8_t key)
+{
+    switch (key) {
+        case CFG_KEY_GYRO_ODR_HZ:
+            return sfg->RateCtrl.iGyroODRFull;
+        case CFG_KEY_ACCEL_ODR_HZ:
+            return sfg->RateCtrl.iAccelODRFull;
+        case CFG_KEY_ADAPTIVE_RATES:
+            return sfg->RateCtrl.isEnabled ? 1.0F : 0.0F;
+        case CFG_KEY_OUTPUT_RATE_HZ:
+            return sfg->pControlSubsystem->subscription[OUTPUT_SINK_UART].rateHz;
+        case CFG_KEY_PREDICT_HORIZON_MS:
+            return (float) (int32_t) (sfg->fPredictHorizonSecs * 1000.0F + 0.5F);
+#if F_9DOF_GBY_KALMAN
+        case CFG_KEY_KALMAN_QVY:
+            return sfg->SV_9DOF_GBY_KALMAN.fQvY;
+        case CFG_KEY_KALMAN_QVG:
+            return sfg->SV_9DOF_GBY_KALMAN.fQvGMin;
+        case CFG_KEY_KALMAN_QVB:
+            return sfg->SV_9DOF_GBY_KALMAN.fQvBMin;
+        case CFG_KEY_KALMAN_QWB:
+            return sfg->SV_9DOF_GBY_KALMAN.fQwb;
+#elif F_6DOF_GY_KALMAN
+        case CFG_KEY_KALMAN_QVY:
+            return sfg->SV_6DOF_GY_KALMAN.fQvY;
+        case CFG_KEY_KALMAN_QVG:
+            return sfg->SV_6DOF_GY_KALMAN.fQvGMin;
+        case CFG_KEY_KALMAN_QWB:
+            return sfg->SV_6DOF_GY_KALMAN.fQwb;
+#endif
+#if F_USING_MAG
+        case CFG_KEY_MAG_CAL_INTERVAL_SECS:
+            return sfg->MagCal.iCalIntervalSecs;
+#endif
+        default:
+            return 0.0F;
+    }
+}//end GetConfigValue()
+
+// apply a parameter value already checked against kConfigParams[]
+static void SetConfigValue(SensorFusionGlobals *sfg, uint8_t key, float fValue)
+{
+    switch (key) {
+        case CFG_KEY_GYRO_ODR_HZ:
+            fSetFullRateODRs(sfg, (uint16_t) fValue, sfg->RateCtrl.iAccelODRFull);
+            break;
+        case CFG_KEY_ACCEL_ODR_HZ:
+            fSetFullRateODRs(sfg, sfg->RateCtrl.iGyroODRFull, (uint16_t) fValue);
+            break;
+        case CFG_KEY_ADAPTIVE_RATES:
+            fEnableRateControl(sfg, fValue != 0.0F);
+            break;
+        case CFG_KEY_OUTPUT_RATE_HZ:
+            // the other outputs keep the rates given to SetOutputSubscription()
+            sfg->pControlSubsystem->subscription[OUTPUT_SINK_UART].rateHz = (uint16_t) fValue;
+            break;
+        case CFG_KEY_PREDICT_HORIZON_MS:
+            sfg->fPredictHorizonSecs = fValue / 1000.0F;
+            break;
+#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+        // the noise parameters are shared by the Kalman filters
+        case CFG_KEY_KALMAN_QVY:
+        case CFG_KEY_KALMAN_QVG:
+        case CFG_KEY_KALMAN_QVB:
+        case CFG_KEY_KALMAN_QWB:
+        {
+#if F_6DOF_GY_KALMAN
+            struct SV_6DOF_GY_KALMAN *pSV6 = &(sfg->SV_6DOF_GY_KALMAN);
+            fSetNoise_6DOF_GY_KALMAN(pSV6,
+                                     (key == CFG_KEY_KALMAN_QVY) ? fValue : pSV6->fQvY,
+                                     (key == CFG_KEY_KALMAN_QVG) ? fValue : pSV6->fQvGMin,
+                                     (key == CFG_KEY_KALMAN_QWB) ? fValue : pSV6->fQwb);
+#endif
+#if F_9DOF_GBY_KALMAN
+            struct SV_9DOF_GBY_KALMAN *pSV9 = &(sfg->SV_9DOF_GBY_KALMAN);
+            fSetNoise_9DOF_GBY_KALMAN(pSV9,
+                                      (key == CFG_KEY_KALMAN_QVY) ? fValue : pSV9->fQvY,
+                                      (key == CFG_KEY_KALMAN_QVG) ? fValue : pSV9->fQvGMin,
+                                      (key == CFG_KEY_KALMAN_QVB) ? fValue : pSV9->fQvBMin,
+                                      (key == CFG_KEY_KALMAN_QWB) ? fValue : pSV9->fQwb);
+#endif
+            break;
+        }
+#endif
+#if F_USING_MAG
+        case CFG_KEY_MAG_CAL_INTERVAL_SECS:
+            sfg->MagCal.iCalIntervalSecs = (int16_t) fValue;
+            break;
+#endif
+        default:
+            break;
+    }
+}//end SetConfigValue()
+
+void ProcessConfigRecord(SensorFusionGlobals *sfg, const uint8_t record[CONFIG_RECORD_LEN])
+{
+    ControlSubsystem    *pComm = sfg->pControlSubsystem;
+    ConfigAck           *pAck;
+    const ConfigParam   *pParam;
+    uint32_t            iValue;
+    float               fValue;
+    uint8_t             checksum = 0;
+    uint8_t             i;
+
+    // queue a reply for every record; if the host sends records faster than
+    // frames go out, the oldest reply is dropped
+    if (pComm->config_ack_count >= CONFIG_ACK_QUEUE_LEN) {
+        pComm->config_ack_head = (pComm->config_ack_head + 1) % CONFIG_ACK_QUEUE_LEN;
+        pComm->config_ack_count--;
+    }
+    pAck = &(pComm->config_ack[(pComm->config_ack_head + pComm->config_ack_count) % CONFIG_ACK_QUEUE_LEN]);
+    pAck->op = record[0];
+    pAck->key = record[1];
+    pAck->type = record[2];
+    pAck->value = 0;
+    memcpy(&iValue, &record[3], sizeof(iValue));   // little endian, like the Toolbox packets
+    for (i = 0; i < CONFIG_RECORD_LEN; i++) checksum += record[i];
+    pParam = FindConfigParam(record[1]);
+
+    if (checksum != 0) {
+        pAck->status = CFG_STATUS_BAD_CHECKSUM;
+    } else if ((record[0] != CFG_OP_SET) && (record[0] != CFG_OP_GET)) {
+        pAck->status = CFG_STATUS_BAD_OP;
+    } else if (!pParam) {
+        pAck->status = CFG_STATUS_BAD_KEY;
+    } else if ((record[0] == CFG_OP_SET) && (record[2] != pParam->type)) {
+        pAck->status = CFG_STATUS_BAD_TYPE;
+    } else {
+        pAck->status = CFG_STATUS_OK;
+        if (record[0] == CFG_OP_SET) {
+            if (pParam->type == CFG_TYPE_FLOAT)
+                memcpy(&fValue, &iValue, sizeof(fValue));
+            else
+                fValue = (float) iValue;
+            if (!IsValidConfigValue(pParam, fValue))
+                pAck->status = CFG_STATUS_BAD_VALUE;
+            else
+                SetConfigValue(sfg, pParam->key, fValue);
+        }
+        // reply with the value now in use
+        fValue = GetConfigValue(sfg, pParam->key);
+        pAck->type = pParam->type;
+        if (pParam->type == CFG_TYPE_FLOAT)
+            memcpy(&(pAck->value), &fValue, sizeof(fValue));
+        else
+            pAck->value = (uint32_t) fValue;
+    }
+    pComm->config_ack_count++;
+}//end ProcessConfigRecord()
@@ -11,6 +11,8 @@
     Commands sent from the Toolbox (e.g. Save Calibration) are interpreted and acted on.
 */
 
+#include <string.h>
+
 #include "sensor_fusion.h"
 #include "calibration_storage.h"
 #include "control.h"
@@ -18,7 +20,7 @@
 
 // All commands for the command interpreter are exactly 4 characters long.
 // The command interpeter converts the incoming packet to a 32-bit integer, which is then
-// the index into a large switch statement for processing commands.
+// looked up in the kCommands[] table below.
 // The following block of #define statements are responsible for the conversion from 4-characters
 // into an easier to use integer format.
 #define cmd_VGplus      (((((('V' << 8) | 'G') << 8) | '+') << 8) | ' ') // "VG+ " = enable angular velocity packet transmission
@@ -35,6 +37,9 @@
 #define cmd_RPCminus    (((((('R' << 8) | 'P') << 8) | 'C') << 8) | '-') // "RPC-" = Roll/Pitch/Compass off
 #define cmd_ALTplus     (((((('A' << 8) | 'L') << 8) | 'T') << 8) | '+') // "ALT+" = Altitude packet on
 #define cmd_ALTminus    (((((('A' << 8) | 'L') << 8) | 'T') << 8) | '-') // "ALT-" = Altitude packet off
+#define cmd_CMPplus     (((((('C' << 8) | 'M') << 8) | 'P') << 8) | '+') // "CMP+" = stream compact frames instead of Toolbox packets
+#define cmd_CMPminus    (((((('C' << 8) | 'M') << 8) | 'P') << 8) | '-') // "CMP-" = stream Toolbox packets (default)
+#define cmd_CFG         (((((('C' << 8) | 'F') << 8) | 'G') << 8) | ':') // "CFG:" = configuration record follows (see control.h)
 #define cmd_RST         (((((('R' << 8) | 'S') << 8) | 'T') << 8) | ' ') // "RST " = Soft reset
 #define cmd_RINS        (((((('R' << 8) | 'I') << 8) | 'N') << 8) | 'S') // "RINS" = Reset INS inertial navigation velocity and position
 #define cmd_SVAC        (((((('S' << 8) | 'V') << 8) | 'A') << 8) | 'C') // "SVAC" = save all calibrations to non-volatile storage
@@ -67,299 +72,261 @@
 #define cmd_PA10        (((((('P' << 8) | 'A') << 8) | '1') << 8) | '0') // "PA10" average precision accelerometer location 10
 #define cmd_PA11        (((((('P' << 8) | 'A') << 8) | '1') << 8) | '1') // "PA11" average precision accelerometer location 11
 
-void DecodeCommandBytes(SensorFusionGlobals *sfg, uint8_t input_buffer[], uint16_t nbytes)
+// Command handlers. Each is called with the arg given in its kCommands[] entry.
+typedef void (commandHandler_t)(SensorFusionGlobals *sfg, int8_t arg);
+
+static void cmdAngularVelocityPacket(SensorFusionGlobals *sfg, int8_t arg)
 {
-  static char iCommandBuffer[5] = "~~~~";	// 5 bytes long to include the unused terminating \0
-  int32_t isum;		// 32 bit command identifier
-  int16_t i, j;		// loop counters
+    sfg->pControlSubsystem->AngularVelocityPacketOn = arg;
+}
 
-  sfg->setStatus(sfg, RECEIVING_WIRED);
+static void cmdDebugPacket(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->pControlSubsystem->DebugPacketOn = arg;
+}
 
-	// parse all received bytes in sUARTInputBuf into the iCommandBuffer delay line
-	for (i = 0; i < nbytes; i++) {
-		// shuffle the iCommandBuffer delay line and add the new command byte
-		for (j = 0; j < 3; j++)
-			iCommandBuffer[j] = iCommandBuffer[j + 1];
-		iCommandBuffer[3] = input_buffer[i];
-
-		// check if we have a valid command yet
-		isum = ((((((int32_t)iCommandBuffer[0] << 8) | iCommandBuffer[1]) << 8) | iCommandBuffer[2]) << 8) | iCommandBuffer[3];
-		switch (isum) 		{
-		case cmd_VGplus: // "VG+ " = enable angular velocity packet transmission
-                    sfg->pControlSubsystem->AngularVelocityPacketOn = true;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_VGminus: // "VG- " = disable angular velocity packet transmission
-                    sfg->pControlSubsystem->AngularVelocityPacketOn = false;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_DBplus: // "DB+ " = enable debug packet transmission
-                    sfg->pControlSubsystem->DebugPacketOn = true;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_DBminus: // "DB- " = disable debug packet transmission
-                    sfg->pControlSubsystem->DebugPacketOn = false;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_Q3: // "Q3  " = transmit 3-axis accelerometer quaternion in standard packet
-#if F_3DOF_G_BASIC
-                    sfg->pControlSubsystem->QuaternionPacketType = Q3;
-#endif
-                    iCommandBuffer[3] = '~';
-		break;
+static void cmdRPCPacket(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->pControlSubsystem->RPCPacketOn = arg;
+}
 
-		case cmd_Q3M:  // "Q3M " = transmit 3-axis magnetometer quaternion in standard packet
-#if F_3DOF_B_BASIC
-                    sfg->pControlSubsystem->QuaternionPacketType = Q3M;
-#endif
-                    iCommandBuffer[3] = '~';
-		break;
+static void cmdAltPacket(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->pControlSubsystem->AltPacketOn = arg;
+}
 
-		case cmd_Q3G: // "Q3G " = transmit 3-axis gyro quaternion in standard packet
-#if F_3DOF_Y_BASIC
-                    sfg->pControlSubsystem->QuaternionPacketType = Q3G;
-#endif
-                    iCommandBuffer[3] = '~';
-		break;
+static void cmdQuaternionPacketType(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->pControlSubsystem->QuaternionPacketType = (quaternion_type) arg;
+}
 
-		case cmd_Q6MA: // "Q6MA" = transmit 6-axis mag/accel quaternion in standard packet
-#if F_6DOF_GB_BASIC
-                    sfg->pControlSubsystem->QuaternionPacketType = Q6MA;
-#endif
-                    iCommandBuffer[3] = '~';
-		break;
+static void cmdCompactStream(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->pControlSubsystem->stream = arg ? CreateCompactPackets : CreateOutgoingPackets;
+}
 
-		case cmd_Q6AG: // "Q6AG" = transmit 6-axis accel/gyro quaternion in standard packet
-#if F_6DOF_GY_KALMAN
-                    sfg->pControlSubsystem->QuaternionPacketType = Q6AG;
-#endif
-                    iCommandBuffer[3] = '~';
-		break;
+// bytes of a configuration record still to be received, and the bytes so far
+static uint8_t iConfigBytesWanted = 0;
+static uint8_t iConfigRecord[CONFIG_RECORD_LEN];
 
-		case cmd_Q9: // "Q9  " = transmit 9-axis quaternion in standard packet (default)
-#if F_9DOF_GBY_KALMAN
-                    sfg->pControlSubsystem->QuaternionPacketType = Q9;
-#endif
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_RPCplus: // "RPC+" = Roll/Pitch/Compass on
-                    sfg->pControlSubsystem->RPCPacketOn = true;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_RPCminus: // "RPC-" = Roll/Pitch/Compass off
-                    sfg->pControlSubsystem->RPCPacketOn = false;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_ALTplus: // "ALT+" = Altitude packet on
-                    sfg->pControlSubsystem->AltPacketOn = true;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_ALTminus: // "ALT-" = Altitude packet off
-                    sfg->pControlSubsystem->AltPacketOn = false;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_RST: // "RST " = Soft reset
-                    // reset sensor fusion
-                    fInitializeFusion(sfg);
-
-                    // reset magnetic calibration and magnetometer data buffer
+static void cmdConfigRecord(SensorFusionGlobals *sfg, int8_t arg)
+{
+    iConfigBytesWanted = CONFIG_RECORD_LEN;
+}
+
+static void cmdSoftReset(SensorFusionGlobals *sfg, int8_t arg)
+{
+    // reset sensor fusion
+    fInitializeFusion(sfg);
+
+    // reset magnetic calibration and magnetometer data buffer
 #if F_USING_MAG
-                    fInitializeMagCalibration(&sfg->MagCal, &sfg->MagBuffer);
+    fInitializeMagCalibration(&sfg->MagCal, &sfg->MagBuffer);
 #endif
-                    // reset precision accelerometer calibration and accelerometer measurements
+    // reset precision accelerometer calibration and accelerometer measurements
 #if F_USING_ACCEL
-                    fInitializeAccelCalibration(&sfg->AccelCal, &sfg->AccelBuffer, &(sfg->pControlSubsystem->AccelCalPacketOn)) ;
+    fInitializeAccelCalibration(&sfg->AccelCal, &sfg->AccelBuffer, &(sfg->pControlSubsystem->AccelCalPacketOn)) ;
 #endif
-                    iCommandBuffer[3] = '~';
-		break;
+}
 
-		case cmd_RINS: // "RINS" = Reset INS inertial navigation velocity and position
+static void cmdResetINS(SensorFusionGlobals *sfg, int8_t arg)
+{
 #if F_9DOF_GBY_KALMAN
-                    for (i = CHX; i <= CHZ; i++) {
-			sfg->SV_9DOF_GBY_KALMAN.fVelGl[i] = 0.0F;
-			sfg->SV_9DOF_GBY_KALMAN.fDisGl[i] = 0.0F;
-                    }
+    int16_t i;
+
+    for (i = CHX; i <= CHZ; i++) {
+        sfg->SV_9DOF_GBY_KALMAN.fVelGl[i] = 0.0F;
+        sfg->SV_9DOF_GBY_KALMAN.fDisGl[i] = 0.0F;
+        fAccumSet(&sfg->SV_9DOF_GBY_KALMAN.aVelGl[i], 0.0F);
+        fAccumSet(&sfg->SV_9DOF_GBY_KALMAN.aDisGl[i], 0.0F);
+    }
 #endif
-		iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_SVAC: // "SVAC" = save all calibrations to non-volatile storage
-                    SaveMagCalibrationToNVM(sfg);
-                    SaveGyroCalibrationToNVM(sfg);
-                    SaveAccelCalibrationToNVM(sfg);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_SVMC: // "SVMC" = save magnetic calibration to non-volatile storage
-                    SaveMagCalibrationToNVM(sfg);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_SVYC: // "SVYC" = save gyroscope calibration to non-volatile storage
-                    SaveGyroCalibrationToNVM(sfg);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_SVGC: // "SVGC" = save precision accelerometer calibration to non-volatile storage
-                    SaveAccelCalibrationToNVM(sfg);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_ERAC: // "ERAC" = erase all calibrations from non-volatile storage
-                    EraseMagCalibrationFromNVM();
-                    EraseGyroCalibrationFromNVM();
-                    EraseAccelCalibrationFromNVM();
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_ERMC: // "ERMC" = erase magnetic calibration offset 0 bytes from non-volatile storage
-                    EraseMagCalibrationFromNVM();
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_ERYC: // "ERYC" = erase gyro offset calibrationoffset 128 bytes from non-volatile storage
-                    EraseGyroCalibrationFromNVM();
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_ERGC: // "ERGC" = erase precision accelerometer calibration offset 192 bytesfrom non-volatile storage
-                    EraseAccelCalibrationFromNVM();
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_180X: // "180X" perturbation
-                    sfg->iPerturbation = 1;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_180Y: // "180Y" perturbation
-                    sfg->iPerturbation = 2;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_180Z: // "180Z" perturbation
-                    sfg->iPerturbation = 3;
-                  iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_M90X: // "M90X" perturbation
-                    sfg->iPerturbation = 4;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_P90X: // "P90X" perturbation
-                    sfg->iPerturbation = 5;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_M90Y: // "M90Y" perturbation
-                    sfg->iPerturbation = 6;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_P90Y: // "P90Y" perturbation
-                    sfg->iPerturbation = 7;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_M90Z: // "M90Z" perturbation
-                    sfg->iPerturbation = 8;
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_P90Z: // "P90Z" perturbation
-                    sfg->iPerturbation = 9;
-                    iCommandBuffer[3] = '~';
-		break;
+}
+
+// arg bits select the calibrations to save or erase
+#define CAL_MAG         0x01
+#define CAL_GYRO        0x02
+#define CAL_ACCEL       0x04
+#define CAL_ALL         (CAL_MAG | CAL_GYRO | CAL_ACCEL)
+
+static void cmdSaveCalibration(SensorFusionGlobals *sfg, int8_t arg)
+{
+    if (arg & CAL_MAG) SaveMagCalibrationToNVM(sfg);
+    if (arg & CAL_GYRO) SaveGyroCalibrationToNVM(sfg);
+    if (arg & CAL_ACCEL) SaveAccelCalibrationToNVM(sfg);
+}
+
+static void cmdEraseCalibration(SensorFusionGlobals *sfg, int8_t arg)
+{
+    if (arg & CAL_MAG) EraseMagCalibrationFromNVM();
+    if (arg & CAL_GYRO) EraseGyroCalibrationFromNVM();
+    if (arg & CAL_ACCEL) EraseAccelCalibrationFromNVM();
+}
+
+static void cmdPerturbation(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->iPerturbation = arg;
+}
 
 #if F_USING_ACCEL
-		case cmd_PA00: // "PA00" average precision accelerometer location 0
-                    sfg->AccelBuffer.iStoreLocation = 0;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA01: // "PA01" average precision accelerometer location 1
-                    sfg->AccelBuffer.iStoreLocation = 1;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA02: // "PA02" average precision accelerometer location 2
-                    sfg->AccelBuffer.iStoreLocation = 2;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA03: // "PA03" average precision accelerometer location 3
-                    sfg->AccelBuffer.iStoreLocation = 3;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA04: // "PA04" average precision accelerometer location 4
-                    sfg->AccelBuffer.iStoreLocation = 4;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA05: // "PA05" average precision accelerometer location 5
-                    sfg->AccelBuffer.iStoreLocation = 5;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA06: // "PA06" average precision accelerometer location 6
-                    sfg->AccelBuffer.iStoreLocation = 6;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA07: // "PA07" average precision accelerometer location 7
-                    sfg->AccelBuffer.iStoreLocation = 7;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA08: // "PA08" average precision accelerometer location 8
-                    sfg->AccelBuffer.iStoreLocation = 8;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA09: // "PA09" average precision accelerometer location 9
-                    sfg->AccelBuffer.iStoreLocation = 9;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA10: // "PA10" average precision accelerometer location 10
-                    sfg->AccelBuffer.iStoreLocation = 10;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
-
-		case cmd_PA11: // "PA11" average precision accelerometer location 11
-                    sfg->AccelBuffer.iStoreLocation = 11;
-                    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
-                    iCommandBuffer[3] = '~';
-		break;
+static void cmdAccelCalLocation(SensorFusionGlobals *sfg, int8_t arg)
+{
+    sfg->AccelBuffer.iStoreLocation = arg;
+    sfg->AccelBuffer.iStoreCounter = (ACCEL_CAL_AVERAGING_SECS * FUSION_HZ);
+}
+#endif
+
+/// One entry of the command table
+typedef struct Command {
+    int32_t             code;           ///< the 4 characters of the command, as cmd_*
+    commandHandler_t    *handler;       ///< function processing the command
+    int8_t              arg;            ///< passed to handler
+} Command;
+
+static const Command kCommands[] = {
+    {cmd_VGplus,   cmdAngularVelocityPacket, true},     // enable angular velocity packet transmission
+    {cmd_VGminus,  cmdAngularVelocityPacket, false},    // disable angular velocity packet transmission
+    {cmd_DBplus,   cmdDebugPacket,           true},     // enable debug packet transmission
+    {cmd_DBminus,  cmdDebugPacket,           false},    // disable debug packet transmission
+#if F_3DOF_G_BASIC
+    {cmd_Q3,       cmdQuaternionPacketType,  Q3},       // transmit 3-axis accelerometer quaternion in standard packet
+#endif
+#if F_3DOF_B_BASIC
+    {cmd_Q3M,      cmdQuaternionPacketType,  Q3M},      // transmit 3-axis magnetometer quaternion in standard packet
+#endif
+#if F_3DOF_Y_BASIC
+    {cmd_Q3G,      cmdQuaternionPacketType,  Q3G},      // transmit 3-axis gyro quaternion in standard packet
+#endif
+#if F_6DOF_GB_BASIC
+    {cmd_Q6MA,     cmdQuaternionPacketType,  Q6MA},     // transmit 6-axis mag/accel quaternion in standard packet
+#endif
+#if F_6DOF_GY_KALMAN
+    {cmd_Q6AG,     cmdQuaternionPacketType,  Q6AG},     // transmit 6-axis accel/gyro quaternion in standard packet
+#endif
+#if F_9DOF_GBY_KALMAN
+    {cmd_Q9,       cmdQuaternionPacketType,  Q9},       // transmit 9-axis quaternion in standard packet (default)
+#endif
+    {cmd_RPCplus,  cmdRPCPacket,             true},     // Roll/Pitch/Compass on
+    {cmd_RPCminus, cmdRPCPacket,             false},    // Roll/Pitch/Compass off
+    {cmd_ALTplus,  cmdAltPacket,             true},     // Altitude packet on
+    {cmd_ALTminus, cmdAltPacket,             false},    // Altitude packet off
+    {cmd_CMPplus,  cmdCompactStream,         true},     // stream compact frames instead of Toolbox packets
+    {cmd_CMPminus, cmdCompactStream,         false},    // stream Toolbox packets (default)
+    {cmd_CFG,      cmdConfigRecord,          0},        // binary configuration record follows
+    {cmd_RST,      cmdSoftReset,             0},        // soft reset
+    {cmd_RINS,     cmdResetINS,              0},        // reset INS inertial navigation velocity and position
+    {cmd_SVAC,     cmdSaveCalibration,       CAL_ALL},  // save all calibrations to non-volatile storage
+    {cmd_SVMC,     cmdSaveCalibration,       CAL_MAG},  // save magnetic calibration
+    {cmd_SVYC,     cmdSaveCalibration,       CAL_GYRO}, // save gyroscope calibration
+    {cmd_SVGC,     cmdSaveCalibration,       CAL_ACCEL},// save precision accelerometer calibration
+    {cmd_ERAC,     cmdEraseCalibration,      CAL_ALL},  // erase all calibrations from non-volatile storage
+    {cmd_ERMC,     cmdEraseCalibration,      CAL_MAG},  // erase magnetic calibration
+    {cmd_ERYC,     cmdEraseCalibration,      CAL_GYRO}, // erase gyro offset calibration
+    {cmd_ERGC,     cmdEraseCalibration,      CAL_ACCEL},// erase precision accelerometer calibration
+    {cmd_180X,     cmdPerturbation,          1},        // perturbations (see fusion_testing.c)
+    {cmd_180Y,     cmdPerturbation,          2},
+    {cmd_180Z,     cmdPerturbation,          3},
+    {cmd_M90X,     cmdPerturbation,          4},
+    {cmd_P90X,     cmdPerturbation,          5},
+    {cmd_M90Y,     cmdPerturbation,          6},
+    {cmd_P90Y,     cmdPerturbation,          7},
+    {cmd_M90Z,     cmdPerturbation,          8},
+    {cmd_P90Z,     cmdPerturbation,          9},
+#if F_USING_ACCEL
+    {cmd_PA00,     cmdAccelCalLocation,      0},        // average precision accelerometer location 0
+    {cmd_PA01,     cmdAccelCalLocation,      1},
+    {cmd_PA02,     cmdAccelCalLocation,      2},
+    {cmd_PA03,     cmdAccelCalLocation,      3},
+    {cmd_PA04,     cmdAccelCalLocation,      4},
+    {cmd_PA05,     cmdAccelCalLocation,      5},
+    {cmd_PA06,     cmdAccelCalLocation,      6},
+    {cmd_PA07,     cmdAccelCalLocation,      7},
+    {cmd_PA08,     cmdAccelCalLocation,      8},
+    {cmd_PA09,     cmdAccelCalLocation,      9},
+    {cmd_PA10,     cmdAccelCalLocation,      10},
+    {cmd_PA11,     cmdAccelCalLocation,      11},
 #endif // precision accelerometer calibration
+};
+#define NUM_COMMANDS    (sizeof(kCommands) / sizeof(kCommands[0]))
+
+// Commands are found by hashing their 32 bit code into a table of
+// COMMAND_HASH_SLOTS entries. The multiplier was chosen so that every command
+// above has a slot of its own, so a lookup is one multiply, one shift and one
+// compare. Commands added later that collide are still found, by probing the
+// following slots.
+#define COMMAND_HASH_BITS       7
+#define COMMAND_HASH_SLOTS      (1 << COMMAND_HASH_BITS)
+#define COMMAND_HASH_MULTIPLIER 0x0FBD78C3u
+#define COMMAND_SLOT_EMPTY      0xFF
+
+static uint8_t CommandHash(uint32_t code)
+{
+    return (uint8_t) ((code * COMMAND_HASH_MULTIPLIER) >> (32 - COMMAND_HASH_BITS));
+}
 
-		default:
-			// no action
-			break;
-		}
-	} // end of loop over received characters
+// index into kCommands[] of the command for each hash slot
+static uint8_t iCommandSlot[COMMAND_HASH_SLOTS];
+
+static void BuildCommandSlots(void)
+{
+    uint8_t i, slot;
+
+    memset(iCommandSlot, COMMAND_SLOT_EMPTY, sizeof(iCommandSlot));
+    for (i = 0; i < NUM_COMMANDS; i++) {
+        slot = CommandHash((uint32_t) kCommands[i].code);
+        while (iCommandSlot[slot] != COMMAND_SLOT_EMPTY)
+            slot = (slot + 1) & (COMMAND_HASH_SLOTS - 1);
+        iCommandSlot[slot] = i;
+    }
+}
 
-	return;
+// the command whose code is isum, or NULL
+static const Command *FindCommand(int32_t isum)
+{
+    uint8_t slot = CommandHash((uint32_t) isum);
+    uint8_t i;
+
+    while ((i = iCommandSlot[slot]) != COMMAND_SLOT_EMPTY) {
+        if (kCommands[i].code == isum) return &kCommands[i];
+        slot = (slot + 1) & (COMMAND_HASH_SLOTS - 1);
+    }
+    return NULL;
 }
+
+// Commands are not delimited, so a command may start at any byte and may be
+// split between calls, as may a configuration record. The last 3 bytes received are kept in isum, and after
+// each new byte the 4 most recent bytes are looked up as a command.
+void DecodeCommandBytes(SensorFusionGlobals *sfg, uint8_t input_buffer[], uint16_t nbytes)
+{
+  static int32_t isum = 0;              // 32 bit command identifier: the last 4 bytes received
+  static uint8_t iBytesInWindow = 0;    // bytes received since the last command (up to 4)
+  static bool isTableBuilt = false;
+  const Command *pCommand;
+  uint16_t i;
+
+  if (!isTableBuilt) {
+    BuildCommandSlots();
+    isTableBuilt = true;
+  }
+
+  sfg->setStatus(sfg, RECEIVING_WIRED);
+
+  for (i = 0; i < nbytes; i++) {
+    // the bytes following "CFG:" are binary, and not commands
+    if (iConfigBytesWanted) {
+      iConfigRecord[CONFIG_RECORD_LEN - iConfigBytesWanted] = input_buffer[i];
+      if (0 == --iConfigBytesWanted) ProcessConfigRecord(sfg, iConfigRecord);
+      continue;
+    }
+    isum = (int32_t) (((uint32_t) isum << 8) | input_buffer[i]);
+    if (iBytesInWindow < 4) iBytesInWindow++;
+    if (iBytesInWindow < 4) continue;
+
+    pCommand = FindCommand(isum);
+    if (pCommand) {
+      pCommand->handler(sfg, pCommand->arg);
+      // the next command starts after this one
+      iBytesInWindow = 0;
+    }
+  }
+}//end DecodeCommandBytes()
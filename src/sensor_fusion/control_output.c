@@ -12,10 +12,15 @@
     
 */
 
+#include <stddef.h>
+#include <string.h>
+
 #include "sensor_fusion.h"  // top level sensor fusion interfaces
 #include "board.h"
 #include "build.h"
 #include "control.h"        // Command/Streaming interface - application specific
+#include "fusion.h"         // fUpdateDerivedOutputs()
+#include "approximations.h" // iScaleFloat()
 #include "fusion_testing.h" // will include SensorPerturbations for test purposes
 
 // OutputBufAppendItem() appends a variable number of source bytes to a destination buffer
@@ -72,79 +77,430 @@ void OutputBufAppendZeros(uint8_t *pDest, uint16_t *pIndex, uint16_t numZeros) {
     }
 }//end OutputBufAppendZeros()
 
-// utility function for reading common algorithm parameters
+// clip to the range of int16_t
+static int16_t ClipToInt16(int32_t value)
+{
+    if (value > 32767) return 32767;
+    if (value < -32768) return -32768;
+    return (int16_t) value;
+}//end ClipToInt16()
+
+// set iq[] to the quaternion *pq scaled by 30000, as sent in packets
+static void QuaternionToInt16(int16_t iq[], const Quaternion *pq)
+{
+    iq[0] = (int16_t) iScaleFloat(pq->q0, 30000);
+    iq[1] = (int16_t) iScaleFloat(pq->q1, 30000);
+    iq[2] = (int16_t) iScaleFloat(pq->q2, 30000);
+    iq[3] = (int16_t) iScaleFloat(pq->q3, 30000);
+}//end QuaternionToInt16()
+
+// utility function for reading common algorithm parameters. The quaternions
+// are returned scaled by 30000 as sent; all the scaling is integer arithmetic
+// (see iScaleFloat()), which costs much less than float on the ESP8266.
 void ReadCommonParams( SV_ptr data,
-                 Quaternion *fq,
+                 int16_t iq[],
                  int16_t *iPhi,
                  int16_t *iThe,
                  int16_t *iRho,
                  int16_t iOmega[],
-                 uint16_t *isystick) {
-    *fq = data->fq;
-    iOmega[CHX] = (int16_t) (data->fOmega[CHX] * 20.0F);
-    iOmega[CHY] = (int16_t) (data->fOmega[CHY] * 20.0F);
-    iOmega[CHZ] = (int16_t) (data->fOmega[CHZ] * 20.0F);
-    *iPhi = (int16_t) (10.0F * data->fPhi);
-    *iThe = (int16_t) (10.0F * data->fThe);
-    *iRho = (int16_t) (10.0F * data->fRho);
+                 uint16_t *isystick,
+                 int16_t iqPredicted[],
+                 float fHorizonSecs) {
+    Quaternion fqPredicted;
+
+    fUpdateDerivedOutputs(data);        // the Euler angles below
+    QuaternionToInt16(iq, &(data->fq));
+    fPredictQuaternion(&fqPredicted, &(data->fq), data->fOmega, fHorizonSecs);
+    QuaternionToInt16(iqPredicted, &fqPredicted);
+    iOmega[CHX] = ClipToInt16(iScaleFloat(data->fOmega[CHX], 20));
+    iOmega[CHY] = ClipToInt16(iScaleFloat(data->fOmega[CHY], 20));
+    iOmega[CHZ] = ClipToInt16(iScaleFloat(data->fOmega[CHZ], 20));
+    *iPhi = (int16_t) iScaleFloat(data->fPhi, 10);
+    *iThe = (int16_t) iScaleFloat(data->fThe, 10);
+    *iRho = (int16_t) iScaleFloat(data->fRho, 10);
     *isystick = (uint16_t) (data->systick / 20);
 }//end ReadCommonParams()
 
-// Throttle back output stream by fractional multiplier
-bool Throttle()
+#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+// read a Kalman filter's health counts for packet type 11
+static void ReadKalmanHealth(const struct KalmanHealth *pHealth, uint8_t *iLastFaults,
+                             uint32_t *iFaults, uint32_t *iResets)
+{
+    *iLastFaults = pHealth->iLastFaults;
+    *iFaults = pHealth->iFaultCycles;
+    *iResets = pHealth->iResets;
+}//end ReadKalmanHealth()
+#endif
+
+// record the end of a packet just added to the output buffer, so that it is
+// only sent to the outputs subscribed to its type
+static void MarkPacketEnd(ControlSubsystem *pComm, uint16_t packet, uint16_t iIndex)
 {
-    static int32_t iThrottle = 0;
-    bool skip;
+    OutputFrameLayout *pLayout = &(pComm->out_layout);
+
+    if (pLayout->numPackets < MAX_PACKETS_PER_FRAME) {
+        pLayout->packetType[pLayout->numPackets] = packet;
+        pLayout->packetEnd[pLayout->numPackets++] = iIndex;
+    }
+}//end MarkPacketEnd()
+
+// Decide which outputs get a frame this fusion cycle, each at the rate in its
+// subscription, and return the packet types at least one of them wants.
+// Each output has its own fractional rate accumulator.
+static uint16_t ScheduleOutputs(ControlSubsystem *pComm)
+{
+    OutputSubscription *pSub;
+    uint16_t duePackets = 0;
+    uint8_t sink;
     // The UART (serial over USB and over WiFi / Bluetooth)
     // is limited to 115kbps which is more than adequate for the 31kbps
     // needed at the default 25Hz output rate but insufficient for 100Hz or
     // 200Hz output rates.  There is little point is providing output data
     // faster than 25Hz video rates but since the UARTs can
-    // support a higher rate, the limit is set to MAXPACKETRATEHZ=40Hz.
-
-    // the increment applied to iThrottle is in the range 0 to (RATERESOLUTION - 1)
-    iThrottle += ((int32_t) MAXPACKETRATEHZ * (int32_t) RATERESOLUTION) / (int32_t) FUSION_HZ;
-    if (iThrottle >= RATERESOLUTION) {
-        // update the throttle counter and transmit the packets over UART (USB and Bluetooth)
-	iThrottle -= RATERESOLUTION;
-        skip = false;
-    } else {
-        skip = true;
+    // support a higher rate, the default limit is MAXPACKETRATEHZ=40Hz.
+
+    pComm->out_layout.numPackets = 0;
+    for (sink = 0; sink < NUM_OUTPUT_SINKS; sink++) {
+        pSub = &(pComm->subscription[sink]);
+        pComm->out_layout.sinkPackets[sink] = 0;
+        if (!pSub->packets || !OutputIsOpen(pComm, sink)) continue;
+        // the increment applied to iThrottle is in the range 0 to RATERESOLUTION
+        if (pSub->rateHz >= FUSION_HZ)
+            pSub->iThrottle += RATERESOLUTION;
+        else
+            pSub->iThrottle += ((int32_t) pSub->rateHz * (int32_t) RATERESOLUTION) / (int32_t) FUSION_HZ;
+        if (pSub->iThrottle >= RATERESOLUTION) {
+            pSub->iThrottle -= RATERESOLUTION;
+            pComm->out_layout.sinkPackets[sink] = pSub->packets;
+            duePackets |= pSub->packets;
+        }
+    }
+    return(duePackets);
+}//end ScheduleOutputs()
+
+// ************************************************************************
+// Table driven packet serialization
+// Packets with a fixed layout are described by a table of fields. Each field
+// gives where its value is found (a member of SensorFusionGlobals, or of the
+// PacketFrame of values computed once per output frame) and how it is scaled.
+// AppendPacket() walks the table, so a new packet type is a new table.
+// ************************************************************************
+
+/// Fixed-point factors converting sensor counts into Toolbox units
+enum {
+    Q16_ACCEL,                  ///< counts to 8192 counts per g
+    Q16_MAG,                    ///< counts to 10 counts per uT
+    Q16_GYRO,                   ///< counts to 20 counts per deg/s
+    NUM_Q16
+};
+#define Q16_SATURATE    (-1)    // factor for a sensor with unknown scale: send 32767
+
+/// values computed once per output frame and shared by several packets
+typedef struct PacketFrame {
+    uint32_t    iTimeStamp;         ///< 1MHz time stamp
+    int16_t     iq[4];              ///< quaternion to be transmitted (30000 = 1.0)
+    int16_t     iqPredicted[4];     ///< iq predicted sfg->fPredictHorizonSecs ahead
+    int16_t     iOmega[3];          ///< scaled angular velocity vector
+    int16_t     iPhi;               ///< roll (0.1 deg)
+    int16_t     iThe;               ///< pitch (0.1 deg)
+    int16_t     iRho;               ///< compass (0.1 deg)
+    uint16_t    isystick;           ///< algorithm systick time / 20
+    int16_t     iBuild;             ///< software version number
+    uint8_t     iKalmanLastFaults;  ///< KALMAN_FAULT_* flags of the latest Kalman filter cycle
+    uint32_t    iKalmanFaults;      ///< Kalman filter cycles with a numerical fault
+    uint32_t    iKalmanResets;      ///< Kalman filter resets after numerical faults
+    uint8_t     flags;              ///< quaternion type and coordinate system
+    uint8_t     iBoard;             ///< shield (bits 7-5) and Kinetis (bits 4-0)
+    ConfigAck   configAck;          ///< configuration reply sent in this frame
+    int32_t     iQ16[NUM_Q16];      ///< counts to Toolbox units (Q16), 0 to send zero, or Q16_SATURATE
+} PacketFrame;
+
+/// How a field is converted
+enum {
+    FIELD_U8,                   ///< 1 byte copied as is
+    FIELD_U16,                  ///< 2 bytes copied as is
+    FIELD_U32,                  ///< 4 bytes copied as is
+    FIELD_F16,                  ///< float times scale, as int16_t
+    FIELD_F16_CLIP,             ///< float times scale, clipped to int16_t
+    FIELD_F32,                  ///< float times scale, as int32_t
+    FIELD_Q16,                  ///< int16_t counts times iQ16[], clipped to int16_t
+    FIELD_ZERO16                ///< int16_t zero (quantity not computed)
+};
+#define FROM_FRAME  0           ///< offset is into the PacketFrame
+#define FROM_SFG    1           ///< offset is into SensorFusionGlobals
+
+/// One field of a packet
+typedef struct PacketField {
+    uint8_t     kind;           ///< FIELD_*
+    uint8_t     base;           ///< FROM_FRAME or FROM_SFG
+    uint8_t     iQ16;           ///< Q16_* factor for FIELD_Q16
+    uint16_t    offset;         ///< offsetof() the value in its base structure
+    int32_t     iScale;         ///< multiplier for float fields (see iScaleFloat())
+} PacketField;
+
+/// A packet type with fixed layout
+typedef struct PacketLayout {
+    uint8_t             type;           ///< packet type byte
+    uint16_t            mask;           ///< PACKET_* mask of this type
+    uint8_t             numFields;      ///< number of entries in fields
+    const PacketField   *fields;        ///< fields following the packet number byte
+} PacketLayout;
+
+#define MAX_LEN_PACKET  64      // longest packet contents before byte stuffing
+#define LEN_MAGNETIC_PACKET     16  // packet type 6 contents before byte stuffing
+#define LEN_ACCEL_CAL_PACKET    45  // packet type 8 contents before byte stuffing
+
+// true if a packet of n bytes fits at iIndex, assuming the worst case where
+// every byte is stuffed into two, plus the two 0x7E delimiters
+static bool PacketFits(uint16_t iIndex, uint16_t n)
+{
+    return (iIndex + 2 * n + 2 <= MAX_LEN_SERIAL_OUTPUT_BUF);
+}//end PacketFits()
+
+#define FRAME_U8(m)             {FIELD_U8, FROM_FRAME, 0, offsetof(PacketFrame, m), 0}
+#define FRAME_U16(m)            {FIELD_U16, FROM_FRAME, 0, offsetof(PacketFrame, m), 0}
+#define FRAME_U32(m)            {FIELD_U32, FROM_FRAME, 0, offsetof(PacketFrame, m), 0}
+#define SFG_F16(m, s)           {FIELD_F16, FROM_SFG, 0, offsetof(SensorFusionGlobals, m), s}
+#define SFG_F16_CLIP(m, s)      {FIELD_F16_CLIP, FROM_SFG, 0, offsetof(SensorFusionGlobals, m), s}
+#define SFG_F32(m, s)           {FIELD_F32, FROM_SFG, 0, offsetof(SensorFusionGlobals, m), s}
+#define SFG_Q16(m, q)           {FIELD_Q16, FROM_SFG, q, offsetof(SensorFusionGlobals, m), 0}
+#define ZERO16                  {FIELD_ZERO16, FROM_FRAME, 0, 0, 0}
+#define XYZ(F, m, ...)          F(m[CHX], ##__VA_ARGS__), F(m[CHY], ##__VA_ARGS__), F(m[CHZ], ##__VA_ARGS__)
+#define LAYOUT(type, mask, fields)  {type, mask, sizeof(fields) / sizeof(fields[0]), fields}
+
+// packet type 1: [6-3] time stamp, [12-7] accelerometer (8192 counts per g),
+// [18-13] calibrated magnetometer (10 counts per uT), [24-19] gyro (20 counts
+// per deg/s), [32-25] quaternion (30K = 1.0F), [33] flags, [34] board
+static const PacketField kMainFields[] = {
+    FRAME_U32(iTimeStamp),
+#if F_USING_ACCEL
+    XYZ(SFG_Q16, Accel.iGc, Q16_ACCEL),
+#else
+    ZERO16, ZERO16, ZERO16,
+#endif
+#if F_USING_MAG
+    XYZ(SFG_Q16, Mag.iBc, Q16_MAG),
+#else
+    ZERO16, ZERO16, ZERO16,
+#endif
+#if F_USING_GYRO
+    XYZ(SFG_Q16, Gyro.iYs, Q16_GYRO),
+#else
+    ZERO16, ZERO16, ZERO16,
+#endif
+    FRAME_U16(iq[0]), FRAME_U16(iq[1]),
+    FRAME_U16(iq[2]), FRAME_U16(iq[3]),
+    FRAME_U8(flags),
+    FRAME_U8(iBoard)
+};
+static const PacketLayout kMainPacket = LAYOUT(0x01, PACKET_MAIN, kMainFields);
+
+// packet type 2: [4-3] software version number, [6-5] systick count / 20
+// (the layout the Toolbox expects; the Kalman filter health counts are type 11)
+static const PacketField kDebugFields[] = {
+    FRAME_U16(iBuild),
+    FRAME_U16(isystick)
+};
+static const PacketLayout kDebugPacket = LAYOUT(0x02, PACKET_DEBUG, kDebugFields);
+
+// packet type 3: [6-3] time stamp, [12-7] angular velocity (20 counts per deg/s)
+static const PacketField kAngularVelocityFields[] = {
+    FRAME_U32(iTimeStamp),
+    XYZ(FRAME_U16, iOmega)
+};
+static const PacketLayout kAngularVelocityPacket = LAYOUT(0x03, PACKET_ANGULAR_VELOCITY, kAngularVelocityFields);
+
+// packet type 4: [6-3] time stamp, [12-7] roll, pitch, compass (0.1 deg)
+static const PacketField kRPCFields[] = {
+    FRAME_U32(iTimeStamp),
+    FRAME_U16(iPhi),
+    FRAME_U16(iThe),
+    FRAME_U16(iRho)
+};
+static const PacketLayout kRPCPacket = LAYOUT(0x04, PACKET_RPC, kRPCFields);
+
+#if F_USING_PRESSURE
+// packet type 5: [6-3] time stamp, [10-7] altitude (mm), [12-11] temperature (0.01 C)
+static const PacketField kAltitudeFields[] = {
+    FRAME_U32(iTimeStamp),
+    SFG_F32(SV_1DOF_P_BASIC.fLPH, 1000),
+    SFG_F16(SV_1DOF_P_BASIC.fLPT, 100)
+};
+static const PacketLayout kAltitudePacket = LAYOUT(0x05, PACKET_ALTITUDE, kAltitudeFields);
+#endif
+
+// packet type 7: [8-3] fzgErr, [14-9] fgErrPl, [20-15] fzmErr, [26-21] fmErrPl
+// (all scaled by 30000), [32-27] fbPl (0.001 deg/s), [34-33] fDeltaPl (0.01 deg),
+// [40-35] fAccGl (1/8192 g), [46-41] fDisGl (0.01m)
+#if F_6DOF_GY_KALMAN
+static const PacketField kKalman6DOFFields[] = {
+    XYZ(SFG_F16, SV_6DOF_GY_KALMAN.fZErr, 30000),
+    XYZ(SFG_F16, SV_6DOF_GY_KALMAN.fqgErrPl, 30000),
+    ZERO16, ZERO16, ZERO16,
+    ZERO16, ZERO16, ZERO16,
+    XYZ(SFG_F16, SV_6DOF_GY_KALMAN.fbPl, 1000),
+    ZERO16,
+    XYZ(SFG_F16_CLIP, SV_6DOF_GY_KALMAN.fAccGl, 8192),
+    ZERO16, ZERO16, ZERO16
+};
+static const PacketLayout kKalman6DOFPacket = LAYOUT(0x07, PACKET_KALMAN, kKalman6DOFFields);
+#endif
+#if F_9DOF_GBY_KALMAN
+static const PacketField kKalman9DOFFields[] = {
+    XYZ(SFG_F16, SV_9DOF_GBY_KALMAN.fZErr, 30000),
+    XYZ(SFG_F16, SV_9DOF_GBY_KALMAN.fqgErrPl, 30000),
+    SFG_F16(SV_9DOF_GBY_KALMAN.fZErr[3], 30000),
+    SFG_F16(SV_9DOF_GBY_KALMAN.fZErr[4], 30000),
+    SFG_F16(SV_9DOF_GBY_KALMAN.fZErr[5], 30000),
+    XYZ(SFG_F16, SV_9DOF_GBY_KALMAN.fqmErrPl, 30000),
+    XYZ(SFG_F16, SV_9DOF_GBY_KALMAN.fbPl, 1000),
+    SFG_F16(SV_9DOF_GBY_KALMAN.fDeltaPl, 100),
+    XYZ(SFG_F16_CLIP, SV_9DOF_GBY_KALMAN.fAccGl, 8192),
+    XYZ(SFG_F16_CLIP, SV_9DOF_GBY_KALMAN.fDisGl, 100)
+};
+static const PacketLayout kKalman9DOFPacket = LAYOUT(0x07, PACKET_KALMAN, kKalman9DOFFields);
+#endif
+
+// packet type 9: [3] op, [4] key, [5] status, [6] value type, [10-7] value;
+// the reply to a configuration record (see control.h)
+static const PacketField kConfigAckFields[] = {
+    FRAME_U8(configAck.op),
+    FRAME_U8(configAck.key),
+    FRAME_U8(configAck.status),
+    FRAME_U8(configAck.type),
+    FRAME_U32(configAck.value)
+};
+static const PacketLayout kConfigAckPacket = LAYOUT(0x09, PACKET_CONFIG_ACK, kConfigAckFields);
+
+// packet type 10: [6-3] time stamp, [14-7] quaternion predicted
+// sfg->fPredictHorizonSecs ahead (30K = 1.0F), [16-15] horizon (ms)
+static const PacketField kPredictedFields[] = {
+    FRAME_U32(iTimeStamp),
+    FRAME_U16(iqPredicted[0]), FRAME_U16(iqPredicted[1]),
+    FRAME_U16(iqPredicted[2]), FRAME_U16(iqPredicted[3]),
+    SFG_F16(fPredictHorizonSecs, 1000)
+};
+static const PacketLayout kPredictedPacket = LAYOUT(0x0A, PACKET_PREDICTED, kPredictedFields);
+
+#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+// packet type 11: [3] KALMAN_FAULT_* flags of the latest cycle, [7-4] cycles
+// with a numerical fault, [11-8] resets after faults, of the selected Kalman filter
+static const PacketField kHealthFields[] = {
+    FRAME_U8(iKalmanLastFaults),
+    FRAME_U32(iKalmanFaults),
+    FRAME_U32(iKalmanResets)
+};
+static const PacketLayout kHealthPacket = LAYOUT(0x0B, PACKET_HEALTH, kHealthFields);
+#endif
+
+// Q16 factor converting counts (at iCountsPerUnit) into iToolboxPerUnit counts
+static int32_t Q16Factor(int32_t iToolboxPerUnit, int16_t iCountsPerUnit)
+{
+    if (0 == iCountsPerUnit) return Q16_SATURATE;   // avoid divide-by-zero
+    return (iToolboxPerUnit << 16) / iCountsPerUnit;
+}//end Q16Factor()
+
+// Serialize a packet described by pLayout onto the output buffer. Packets
+// that might not fit in the buffer are skipped.
+static void AppendPacket(SensorFusionGlobals *sfg, const PacketLayout *pLayout,
+                         const PacketFrame *pFrame, uint8_t *pPacketNumber, uint16_t *pIndex)
+{
+    uint8_t             *output_buf = sfg->pControlSubsystem->serial_out_buf;
+    uint8_t             packet[MAX_LEN_PACKET];     // packet contents before byte stuffing
+    uint16_t            n = 0;                      // bytes in packet[]
+    const PacketField   *pField;
+    const uint8_t       *pSource;
+    int32_t             scratch32;
+    int16_t             scratch16;
+    uint8_t             i;
+
+    packet[n++] = pLayout->type;
+    packet[n++] = *pPacketNumber;
+    for (i = 0; i < pLayout->numFields; i++) {
+        pField = &(pLayout->fields[i]);
+        pSource = ((FROM_SFG == pField->base) ? (const uint8_t *) sfg : (const uint8_t *) pFrame) + pField->offset;
+        switch (pField->kind) {
+            case FIELD_U8:
+                packet[n++] = *pSource;
+                continue;
+            case FIELD_U16:
+                memcpy(&packet[n], pSource, 2);
+                n += 2;
+                continue;
+            case FIELD_U32:
+                memcpy(&packet[n], pSource, 4);
+                n += 4;
+                continue;
+            case FIELD_F32:
+                scratch32 = iScaleFloat(*(const float *) pSource, pField->iScale);
+                memcpy(&packet[n], &scratch32, 4);
+                n += 4;
+                continue;
+            case FIELD_F16:
+                scratch16 = (int16_t) iScaleFloat(*(const float *) pSource, pField->iScale);
+                break;
+            case FIELD_F16_CLIP:
+                scratch16 = ClipToInt16(iScaleFloat(*(const float *) pSource, pField->iScale));
+                break;
+            case FIELD_Q16:
+                scratch32 = pFrame->iQ16[pField->iQ16];
+                if (Q16_SATURATE == scratch32)
+                    scratch16 = 32767;
+                else
+                    scratch16 = ClipToInt16((int32_t) (((int64_t) *(const int16_t *) pSource * scratch32) >> 16));
+                break;
+            case FIELD_ZERO16:
+            default:
+                scratch16 = 0;
+                break;
+        }
+        memcpy(&packet[n], &scratch16, 2);
+        n += 2;
     }
-    return(skip);
-}//end Throttle()
+
+    if (!PacketFits(*pIndex, n)) return;
+    (*pPacketNumber)++;
+    output_buf[(*pIndex)++] = 0x7E;
+    OutputBufAppendItem(output_buf, pIndex, packet, n);
+    output_buf[(*pIndex)++] = 0x7E;
+    MarkPacketEnd(sfg->pControlSubsystem, pLayout->mask, *pIndex);
+}//end AppendPacket()
 
 // prepare packets to send, e.g. via Bluetooth, or UART to OpenSDA / USB
 void CreateOutgoingPackets(SensorFusionGlobals *sfg)
 {
     uint8_t         *output_buf = sfg->pControlSubsystem->serial_out_buf;
-    Quaternion      fq;                 // quaternion to be transmitted
-    float           ftmp;               // scratch
+    PacketFrame     frame;              // values shared by the table driven packets
     static uint32_t iTimeStamp = 0;     // 1MHz time stamp
     uint16_t        iIndex;             // output buffer counter
-    int32_t         scratch32;          // scratch int32_t
     int16_t         scratch16;          // scratch int16_t
-    int16_t         iPhi,
-                    iThe,
-                    iRho;               // integer angles to be transmitted
     int16_t         iDelta;             // magnetic inclination angle if available
-    int16_t         iOmega[3];          // scaled angular velocity vector
-    uint16_t        isystick;           // algorithm systick time
     int16_t         i, j, k;            // general purpose
     uint8_t         tmpuint8_t;         // scratch uint8_t
-    uint8_t         flags;              // byte of flags
     uint8_t         AngularVelocityPacketOn,
                     DebugPacketOn,
                     RPCPacketOn;
     int8_t          AccelCalPacketOn;
     static uint8_t  iPacketNumber = 0;  // packet number
+    uint16_t        duePackets;         // packet types wanted by outputs due a frame this cycle
 
     // update the 1MHz time stamp counter expected by the PC GUI (independent of project clock rates)
     iTimeStamp += 1000000 / FUSION_HZ;
 
-#if (MAXPACKETRATEHZ < FUSION_HZ)
-    if (Throttle()) return;  // need to skip packet transmission to avoid UART overrun
-#endif
+    // skip packet transmission to outputs not due one, to avoid UART overrun,
+    // and don't format packets that no output will be sent
+    duePackets = ScheduleOutputs(sfg->pControlSubsystem);
+    // a configuration reply goes out at once to every output that takes them
+    if (sfg->pControlSubsystem->config_ack_count) {
+        for (i = 0; i < NUM_OUTPUT_SINKS; i++) {
+            if ((sfg->pControlSubsystem->subscription[i].packets & PACKET_CONFIG_ACK) &&
+                OutputIsOpen(sfg->pControlSubsystem, i)) {
+                sfg->pControlSubsystem->out_layout.sinkPackets[i] |= PACKET_CONFIG_ACK;
+                duePackets |= PACKET_CONFIG_ACK;
+            }
+        }
+    }
+    if (0 == duePackets) return;
 
     // cache local copies of control flags so we don't have to keep dereferencing pointers below
     quaternion_type quaternionPacketType;
@@ -167,166 +523,29 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
     // Magnetic type 6: range 0 to 16 = 18 bytes
     // Kalman packet 7: range 0 to 47 = 48 bytes
     // Precision Accelerometer packet 8: range 0 to 46 = 47 bytes
+    // Predicted quaternion type 10: range 0 to 17 = 18 bytes
+    // Kalman filter health type 11: range 0 to 12 = 13 bytes
     //
-    // Total excluding intermittent packet 8 is:
+    // Total excluding intermittent packet 8 and types 9 to 11 is:
     // 152 bytes vs 256 bytes size of output_buf
     // at 25Hz, data rate is 25*152 = 3800 bytes/sec = 38.0kbaud = 33% of 115.2kbaud
     // at 40Hz, data rate is 40*152 = 6080 bytes/sec = 60.8kbaud = 53% of 115.2kbaud
     // at 50Hz, data rate is 50*152 = 7600 bytes/sec = 76.0kbaud = 66% of 115.2kbaud
     // ************************************************************************
-    // ************************************************************************
-    // fixed length packet type 1
-    // this packet type is always transmitted
-    // total size is 0 to 35 equals 36 bytes
-    // ************************************************************************
-    // [0]: packet start byte (need a iIndex++ here since not using OutputBufAppendItem)
-    output_buf[iIndex++] = 0x7E;
-
-    // [1]: packet type 1 byte (iIndex is automatically updated in OutputBufAppendItem)
-    tmpuint8_t = 0x01;
-    OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-    // [2]: packet number byte
-    OutputBufAppendItem(output_buf, &iIndex, &iPacketNumber, 1);
-    iPacketNumber++;
-
-    // [6-3]: 1MHz time stamp (4 bytes)
-    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iTimeStamp, 4);
-
-    // [12-7]: integer accelerometer data words (scaled to 8192 counts per g for PC GUI)
-    // send non-zero data only if the accelerometer sensor is enabled and used by the selected quaternion
-    if (sfg->iFlags & F_USING_ACCEL) {
-        switch (quaternionPacketType)
-        {
-            case Q3:
-            case Q6MA:
-            case Q6AG:
-            case Q9:
-#if F_USING_ACCEL
-                // accelerometer data is used for the selected quaternion so transmit but clip at 4g
-                if( sfg->Accel.iCountsPerg != 0 ) {
-                    scratch32 = (sfg->Accel.iGc[CHX] * 8192) / sfg->Accel.iCountsPerg;
-                    if (scratch32 > 32767) scratch32 = 32767;
-                    if (scratch32 < -32768) scratch32 = -32768;
-                    scratch16 = (int16_t) (scratch32);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);  //crashes here
-                    scratch32 = (sfg->Accel.iGc[CHY] * 8192) / sfg->Accel.iCountsPerg;
-                    if (scratch32 > 32767) scratch32 = 32767;
-                    if (scratch32 < -32768) scratch32 = -32768;
-                    scratch16 = (int16_t) (scratch32);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    scratch32 = (sfg->Accel.iGc[CHZ] * 8192) / sfg->Accel.iCountsPerg;
-                    if (scratch32 > 32767) scratch32 = 32767;
-                    if (scratch32 < -32768) scratch32 = -32768;
-                    scratch16 = (int16_t) (scratch32);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                }else { //avoid divide-by-zero
-                    scratch16 = 32767;
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                }
-                break;
-#endif // F_USING_ACCEL
-            case Q3M:
-            case Q3G:
-            default:
-                // accelerometer data is not used in currently selected algorithm so transmit zero
-                OutputBufAppendZeros(output_buf, &iIndex, 3);
-                break;
-        }
-     } else {
-                // accelerometer structure is not defined so transmit zero
-                OutputBufAppendZeros(output_buf, &iIndex, 3);
-        }
-    // [18-13]: integer calibrated magnetometer data words (already scaled to 10 count per uT for PC GUI)
-    // send non-zero data only if the magnetometer sensor is enabled and used by the selected quaternion
-    if (sfg->iFlags & F_USING_MAG)
-        switch (quaternionPacketType)
-        {
-            case Q3M:
-            case Q6MA:
-            case Q9:
-#if F_USING_MAG
-                // magnetometer data is used for the selected quaternion so transmit
-                if( sfg->Mag.iCountsPeruT != 0 ) {
-                    scratch16 = (int16_t) (sfg->Mag.iBc[CHX] * 10) / (sfg->Mag.iCountsPeruT);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    scratch16 = (int16_t) ((sfg->Mag.iBc[CHY] * 10) / sfg->Mag.iCountsPeruT);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    scratch16 = (int16_t) ((sfg->Mag.iBc[CHZ] * 10) / sfg->Mag.iCountsPeruT);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                }else { //prevent divide-by-zero
-                  scratch16 = 32767;
-                  OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                  OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                  OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);                  
-                }
-                break;
-#endif
-            // magnetometer data is not used in currently selected algorithm so transmit zero
-            case Q3:
-            case Q3G:
-            case Q6AG:
-            default:
-                OutputBufAppendZeros(output_buf, &iIndex, 3);
-                break;
-        }
-    else
-    {
-        // magnetometer structure is not defined so transmit zero
-        OutputBufAppendZeros(output_buf, &iIndex, 3);
-    }
-
-    // [24-19]: uncalibrated gyro data words (scaled to 20 counts per deg/s for PC GUI)
-    // send non-zero data only if the gyro sensor is enabled and used by the selected quaternion
-    if (sfg->iFlags & F_USING_GYRO)
-    {
-        switch (quaternionPacketType)
-        {
-            case Q3G:
-            case Q6AG:
-#if F_USING_GYRO
-        case Q9:
-
-              // gyro data is used for the selected quaternion so transmit
-                if( sfg->Gyro.iCountsPerDegPerSec != 0 ) {
-                    scratch16 = (int16_t) ((sfg->Gyro.iYs[CHX] * 20) / sfg->Gyro.iCountsPerDegPerSec);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    scratch16 = (int16_t) ((sfg->Gyro.iYs[CHY] * 20) / sfg->Gyro.iCountsPerDegPerSec);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    scratch16 = (int16_t) ((sfg->Gyro.iYs[CHZ] * 20) / sfg->Gyro.iCountsPerDegPerSec);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                }else { //prevent divide-by-zero
-                    scratch16 = 32767;
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                }
-                break;
-#endif
-            case Q3:
-            case Q3M:
-            case Q6MA:
-            default:
-                // gyro data is not used in currently selected algorithm so transmit zero
-                OutputBufAppendZeros(output_buf, &iIndex, 3);
-                break;
-        }
-    }
-    else
-    {
-        // gyro structure is not defined so transmit zero
-        OutputBufAppendZeros(output_buf, &iIndex, 3);
-    }
 
     // initialize default quaternion, flags byte, angular velocity and orientation
-    fq.q0 = 1.0F;
-    fq.q1 = fq.q2 = fq.q3 = 0.0F;
-    flags = 0x00;
-    iOmega[CHX] = iOmega[CHY] = iOmega[CHZ] = 0;
-    iPhi = iThe = iRho = iDelta = 0;
-    isystick = 0;
+    frame.iTimeStamp = iTimeStamp;
+    frame.iq[0] = frame.iqPredicted[0] = 30000;
+    frame.iq[1] = frame.iq[2] = frame.iq[3] = 0;
+    frame.iqPredicted[1] = frame.iqPredicted[2] = frame.iqPredicted[3] = 0;
+    frame.flags = 0x00;
+    frame.iOmega[CHX] = frame.iOmega[CHY] = frame.iOmega[CHZ] = 0;
+    frame.iPhi = frame.iThe = frame.iRho = iDelta = 0;
+    frame.isystick = 0;
+    frame.iBuild = THISBUILD;
+    frame.iKalmanLastFaults = 0;
+    frame.iKalmanFaults = frame.iKalmanResets = 0;
+    frame.iBoard = ((THIS_SHIELD & 0x07) << 5) | (THIS_BOARD & 0x1F);
 
     // flags byte 33: quaternion type in least significant nibble
     // Q3:   coordinate nibble, 1
@@ -346,8 +565,9 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         case Q3:
             if (sfg->iFlags & F_3DOF_G_BASIC)
             {
-                flags |= 0x01;
-                ReadCommonParams((SV_ptr)&sfg->SV_3DOF_G_BASIC, &fq, &iPhi, &iThe, &iRho, iOmega, &isystick);
+                frame.flags |= 0x01;
+                ReadCommonParams((SV_ptr)&sfg->SV_3DOF_G_BASIC, frame.iq, &frame.iPhi, &frame.iThe, &frame.iRho, frame.iOmega, &frame.isystick,
+                                 frame.iqPredicted, sfg->fPredictHorizonSecs);
             }
             break;
 #endif
@@ -355,8 +575,9 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         case Q3M:
             if (sfg->iFlags & F_3DOF_B_BASIC)
             {
-                flags |= 0x06;
-                ReadCommonParams((SV_ptr)&sfg->SV_3DOF_B_BASIC, &fq, &iPhi, &iThe, &iRho, iOmega, &isystick);
+                frame.flags |= 0x06;
+                ReadCommonParams((SV_ptr)&sfg->SV_3DOF_B_BASIC, frame.iq, &frame.iPhi, &frame.iThe, &frame.iRho, frame.iOmega, &frame.isystick,
+                                 frame.iqPredicted, sfg->fPredictHorizonSecs);
             }
             break;
 #endif
@@ -364,8 +585,9 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         case Q3G:
             if (sfg->iFlags & F_3DOF_Y_BASIC)
             {
-                flags |= 0x03;
-                ReadCommonParams((SV_ptr)&sfg->SV_3DOF_Y_BASIC, &fq, &iPhi, &iThe, &iRho, iOmega, &isystick);
+                frame.flags |= 0x03;
+                ReadCommonParams((SV_ptr)&sfg->SV_3DOF_Y_BASIC, frame.iq, &frame.iPhi, &frame.iThe, &frame.iRho, frame.iOmega, &frame.isystick,
+                                 frame.iqPredicted, sfg->fPredictHorizonSecs);
             }
             break;
 #endif
@@ -373,9 +595,10 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         case Q6MA:
             if (sfg->iFlags & F_6DOF_GB_BASIC)
             {
-                flags |= 0x02;
-                iDelta = (int16_t) (10.0F * sfg->SV_6DOF_GB_BASIC.fLPDelta);
-                ReadCommonParams((SV_ptr)&sfg->SV_6DOF_GB_BASIC, &fq, &iPhi, &iThe, &iRho, iOmega, &isystick);
+                frame.flags |= 0x02;
+                iDelta = (int16_t) iScaleFloat(sfg->SV_6DOF_GB_BASIC.fLPDelta, 10);
+                ReadCommonParams((SV_ptr)&sfg->SV_6DOF_GB_BASIC, frame.iq, &frame.iPhi, &frame.iThe, &frame.iRho, frame.iOmega, &frame.isystick,
+                                 frame.iqPredicted, sfg->fPredictHorizonSecs);
             }
             break;
 #endif
@@ -383,8 +606,11 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         case Q6AG:
             if (sfg->iFlags & F_6DOF_GY_KALMAN)
             {
-                flags |= 0x04;
-                ReadCommonParams((SV_ptr)&sfg->SV_6DOF_GY_KALMAN, &fq, &iPhi, &iThe, &iRho, iOmega, &isystick);
+                frame.flags |= 0x04;
+                ReadCommonParams((SV_ptr)&sfg->SV_6DOF_GY_KALMAN, frame.iq, &frame.iPhi, &frame.iThe, &frame.iRho, frame.iOmega, &frame.isystick,
+                                 frame.iqPredicted, sfg->fPredictHorizonSecs);
+                ReadKalmanHealth(&sfg->SV_6DOF_GY_KALMAN.health, &frame.iKalmanLastFaults,
+                                 &frame.iKalmanFaults, &frame.iKalmanResets);
             }
             break;
 #endif
@@ -392,9 +618,12 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         case Q9:
             if (sfg->iFlags & F_9DOF_GBY_KALMAN)
              {
-                flags |= 0x08;
-                iDelta = (int16_t) (10.0F * sfg->SV_9DOF_GBY_KALMAN.fDeltaPl);
-                ReadCommonParams((SV_ptr)&sfg->SV_9DOF_GBY_KALMAN, &fq, &iPhi, &iThe, &iRho, iOmega, &isystick);
+                frame.flags |= 0x08;
+                iDelta = (int16_t) iScaleFloat(sfg->SV_9DOF_GBY_KALMAN.fDeltaPl, 10);
+                ReadCommonParams((SV_ptr)&sfg->SV_9DOF_GBY_KALMAN, frame.iq, &frame.iPhi, &frame.iThe, &frame.iRho, frame.iOmega, &frame.isystick,
+                                 frame.iqPredicted, sfg->fPredictHorizonSecs);
+                ReadKalmanHealth(&sfg->SV_9DOF_GBY_KALMAN.health, &frame.iKalmanLastFaults,
+                                 &frame.iKalmanFaults, &frame.iKalmanResets);
             }
             break;
 #endif
@@ -403,167 +632,71 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
             break;
     }
 
-    // [32-25]: scale the quaternion (30K = 1.0F) and add to the buffer
-    scratch16 = (int16_t) (fq.q0 * 30000.0F);
-    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-    scratch16 = (int16_t) (fq.q1 * 30000.0F);
-    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-    scratch16 = (int16_t) (fq.q2 * 30000.0F);
-    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-    scratch16 = (int16_t) (fq.q3 * 30000.0F);
-    OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-
     // set the coordinate system bits in flags from default NED (00)
 #if THISCOORDSYSTEM == ANDROID
     // set the Android flag bits
-    flags |= 0x10;
+    frame.flags |= 0x10;
 #elif THISCOORDSYSTEM == WIN8
     // set the Win8 flag bits
-    flags |= 0x20;
+    frame.flags |= 0x20;
 #endif // THISCOORDSYSTEM
 
-    // [33]: add the flags byte to the buffer
-    OutputBufAppendItem(output_buf, &iIndex, &flags, 1);
-
-    // [34]: add the shield (bits 7-5) and Kinetis (bits 4-0) byte
-    tmpuint8_t = ((THIS_SHIELD & 0x07) << 5) | (THIS_BOARD & 0x1F);
-    OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-    // [35]: add the tail byte for the standard packet type 1
-    output_buf[iIndex++] = 0x7E;
-
-    // ************************************************************************
-    // Variable length debug packet type 2
-    // total size is 0 to 7 equals 8 bytes
-    // ************************************************************************
-    if (DebugPacketOn)
-    {
-        // [0]: packet start byte
-        output_buf[iIndex++] = 0x7E;
-
-        // [1]: packet type 2 byte
-        tmpuint8_t = 0x02;
-        OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-        // [2]: packet number byte
-        OutputBufAppendItem(output_buf, &iIndex, &iPacketNumber, 1);
-        iPacketNumber++;
-
-        // [4-3] software version number
-        scratch16 = THISBUILD;
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-
-        // [6-5] systick count / 20
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &isystick, 2);
-
-        // [7 in practice but can be variable]: add the tail byte for the debug packet type 2
-        output_buf[iIndex++] = 0x7E;
-    }
-
-    // ************************************************************************
-    // Angular Velocity packet type 3
-    // total bytes for packet type 2 is range 0 to 13 = 14 bytes
-    // ************************************************************************
-    if (AngularVelocityPacketOn)
-    {
-        // [0]: packet start byte
-        output_buf[iIndex++] = 0x7E;
-
-        // [1]: packet type 3 byte (angular velocity)
-        tmpuint8_t = 0x03;
-        OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-        // [2]: packet number byte
-        OutputBufAppendItem(output_buf, &iIndex, &iPacketNumber, 1);
-        iPacketNumber++;
-
-        // [6-3]: time stamp (4 bytes)
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iTimeStamp, 4);
-
-        // [12-7]: add the scaled angular velocity vector to the output buffer
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iOmega[CHX], 2);
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iOmega[CHY], 2);
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iOmega[CHZ], 2);
-
-        // [13]: add the tail byte for the angular velocity packet type 3
-        output_buf[iIndex++] = 0x7E;
-    }
+    // sensor data in packet type 1 is sent only for the sensors used by the
+    // selected quaternion; one divide per sensor turns its scale into a factor
+    frame.iQ16[Q16_ACCEL] = frame.iQ16[Q16_MAG] = frame.iQ16[Q16_GYRO] = 0;
+#if F_USING_ACCEL
+    if ((sfg->iFlags & F_USING_ACCEL) && ((quaternionPacketType == Q3) || (quaternionPacketType == Q6MA) ||
+                                          (quaternionPacketType == Q6AG) || (quaternionPacketType == Q9)))
+        frame.iQ16[Q16_ACCEL] = Q16Factor(8192, sfg->Accel.iCountsPerg);
+#endif
+#if F_USING_MAG
+    if ((sfg->iFlags & F_USING_MAG) && ((quaternionPacketType == Q3M) || (quaternionPacketType == Q6MA) ||
+                                        (quaternionPacketType == Q9)))
+        frame.iQ16[Q16_MAG] = Q16Factor(10, sfg->Mag.iCountsPeruT);
+#endif
+#if F_USING_GYRO
+    if ((sfg->iFlags & F_USING_GYRO) && ((quaternionPacketType == Q3G) || (quaternionPacketType == Q6AG) ||
+                                         (quaternionPacketType == Q9)))
+        frame.iQ16[Q16_GYRO] = Q16Factor(20, sfg->Gyro.iCountsPerDegPerSec);
+#endif
 
     // ************************************************************************
-    // Roll, Pitch, Compass Euler angles packet type 4
-    // total bytes for packet type 4 is range 0 to 13 = 14 bytes
+    // fixed layout packet types 1 to 5, 10 and 11; see the tables above
+    // Main type 1 is sent to every output subscribed to PACKET_MAIN, the
+    // others also need to be enabled by command (type 10 by a prediction horizon)
     // ************************************************************************
-    if (RPCPacketOn)
-    {
-        // [0]: packet start byte
-        output_buf[iIndex++] = 0x7E;
-
-        // [1]: packet type 4 byte (Euler angles)
-        tmpuint8_t = 0x04;
-        OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-        // [2]: packet number byte
-        OutputBufAppendItem(output_buf, &iIndex, &iPacketNumber, 1);
-        iPacketNumber++;
-
-        // [6-3]: time stamp (4 bytes)
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iTimeStamp, 4);
-
-        // [12-7]: add the angles (resolution 0.1 deg per count) to the transmit buffer
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iPhi, 2);
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iThe, 2);
-        OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iRho, 2);
-
-        // [13]: add the tail byte for the roll, pitch, compass angle packet type 4
-        output_buf[iIndex++] = 0x7E;
-    }
+    if (duePackets & PACKET_MAIN)
+        AppendPacket(sfg, &kMainPacket, &frame, &iPacketNumber, &iIndex);
+    if (DebugPacketOn && (duePackets & PACKET_DEBUG))
+        AppendPacket(sfg, &kDebugPacket, &frame, &iPacketNumber, &iIndex);
+#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+    // the health counts are those of the Kalman filter whose quaternion is selected
+    if (DebugPacketOn && (duePackets & PACKET_HEALTH) && ((quaternionPacketType == Q6AG) || (quaternionPacketType == Q9)))
+        AppendPacket(sfg, &kHealthPacket, &frame, &iPacketNumber, &iIndex);
+#endif
+    if (AngularVelocityPacketOn && (duePackets & PACKET_ANGULAR_VELOCITY))
+        AppendPacket(sfg, &kAngularVelocityPacket, &frame, &iPacketNumber, &iIndex);
+    if (RPCPacketOn && (duePackets & PACKET_RPC))
+        AppendPacket(sfg, &kRPCPacket, &frame, &iPacketNumber, &iIndex);
+    if ((sfg->fPredictHorizonSecs > 0.0F) && (duePackets & PACKET_PREDICTED))
+        AppendPacket(sfg, &kPredictedPacket, &frame, &iPacketNumber, &iIndex);
 
-    // ************************************************************************
-    // Altitude / Temperature packet type 5
-    // total bytes for packet type 5 is range 0 to 13 = 14 bytes
-    // ************************************************************************
 #if F_USING_PRESSURE
-    if (sfg->iFlags & F_1DOF_P_BASIC)
-    {
-        if (sfg->pControlSubsystem->AltPacketOn && sfg->Pressure.iWhoAmI)
-        {
-            // [0]: packet start byte
-            output_buf[iIndex++] = 0x7E;
-
-            // [1]: packet type 5 byte
-            tmpuint8_t = 0x05;
-            OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-            // [2]: packet number byte
-            OutputBufAppendItem(output_buf, &iIndex, &iPacketNumber, 1);
-            iPacketNumber++;
-
-            // [6-3]: time stamp (4 bytes)
-            OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &iTimeStamp,
-                           4);
-
-            // [10-7]: altitude (4 bytes, metres times 1000)
-            scratch32 = (int32_t) (sfg->SV_1DOF_P_BASIC.fLPH * 1000.0F);
-            OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch32, 4);
-
-            // [12-11]: temperature (2 bytes, deg C times 100)
-            scratch16 = (int16_t) (sfg->SV_1DOF_P_BASIC.fLPT * 100.0F);
-            OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-
-            // [13]: add the tail byte for the altitude / temperature packet type 5
-            output_buf[iIndex++] = 0x7E;
-        }
-    }
+    if ((sfg->iFlags & F_1DOF_P_BASIC) && sfg->pControlSubsystem->AltPacketOn &&
+        sfg->Pressure.iWhoAmI && (duePackets & PACKET_ALTITUDE))
+        AppendPacket(sfg, &kAltitudePacket, &frame, &iPacketNumber, &iIndex);
 #endif
 
     // ************************************************************************
     // magnetic buffer packet type 6
     // currently total size is 0 to 17 equals 18 bytes
     // this packet is only transmitted if a magnetic algorithm is computed
+    // and there is room for it; otherwise the same ID is sent next time
     // ************************************************************************
 #if F_USING_MAG
     static int16_t  MagneticPacketID = 0;   // magnetic packet number
-    if (sfg->iFlags & F_USING_MAG)
+    if ((sfg->iFlags & F_USING_MAG) && (duePackets & PACKET_MAGNETIC) &&
+        PacketFits(iIndex, LEN_MAGNETIC_PACKET))
     {
         // [0]: packet start byte
         output_buf[iIndex++] = 0x7E;
@@ -581,14 +714,11 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
                        (uint8_t *) &(sfg->MagBuffer.iMagBufferCount), 2);
 
         // [6-5]: fit error (%) with resolution 0.01%
-        if (sfg->MagCal.fFitErrorpc > 327.67F)
-            scratch16 = 32767;
-        else
-            scratch16 = (int16_t) (sfg->MagCal.fFitErrorpc * 100.0F);
+        scratch16 = ClipToInt16(iScaleFloat(sfg->MagCal.fFitErrorpc, 100));
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // [8-7]: geomagnetic field strength with resolution 0.1uT
-        scratch16 = (int16_t) (sfg->MagCal.fB * 10.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->MagCal.fB, 10);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // always calculate magnetic buffer row and column (low overhead and saves warnings)
@@ -635,31 +765,31 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
 
             case 1:
                 // items 1 to 3: hard iron components range -3276uT to +3276uT encoded with 0.1uT resolution
-                scratch16 = (int16_t) (sfg->MagCal.fV[CHX] * 10.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.fV[CHX], 10);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                scratch16 = (int16_t) (sfg->MagCal.fV[CHY] * 10.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.fV[CHY], 10);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                scratch16 = (int16_t) (sfg->MagCal.fV[CHZ] * 10.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.fV[CHZ], 10);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
                 break;
 
             case 2:
                 // items 1 to 3: diagonal soft iron range -32. to +32. encoded with 0.001 resolution
-                scratch16 = (int16_t) (sfg->MagCal.finvW[CHX][CHX] * 1000.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.finvW[CHX][CHX], 1000);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                scratch16 = (int16_t) (sfg->MagCal.finvW[CHY][CHY] * 1000.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.finvW[CHY][CHY], 1000);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                scratch16 = (int16_t) (sfg->MagCal.finvW[CHZ][CHZ] * 1000.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.finvW[CHZ][CHZ], 1000);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
                 break;
 
             case 3:
                 // items 1 to 3: off-diagonal soft iron range -32. to +32. encoded with 0.001 resolution
-                scratch16 = (int16_t) (sfg->MagCal.finvW[CHX][CHY] * 1000.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.finvW[CHX][CHY], 1000);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                scratch16 = (int16_t) (sfg->MagCal.finvW[CHX][CHZ] * 1000.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.finvW[CHX][CHZ], 1000);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-                scratch16 = (int16_t) (sfg->MagCal.finvW[CHY][CHZ] * 1000.0F);
+                scratch16 = (int16_t) iScaleFloat(sfg->MagCal.finvW[CHY][CHZ], 1000);
                 OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
                 break;
 
@@ -691,6 +821,7 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
 
         // [17]: add the tail byte for the magnetic packet type 6
         output_buf[iIndex++] = 0x7E;
+        MarkPacketEnd(sfg->pControlSubsystem, PACKET_MAGNETIC, iIndex);
     }
 #endif
 
@@ -700,160 +831,26 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
     // this packet is only transmitted when a Kalman algorithm is computed
     // and then non-zero data is transmitted only when a Kalman quaternion is selected
     // *******************************************************************************
-    bool kalman = false;
+    if (duePackets & PACKET_KALMAN) {
 #if F_6DOF_GY_KALMAN
-    uint8_t six_axis_kalman = (sfg->iFlags & F_6DOF_GY_KALMAN) && (quaternionPacketType == Q6AG);
-    kalman = six_axis_kalman;
+        if ((sfg->iFlags & F_6DOF_GY_KALMAN) && (quaternionPacketType == Q6AG))
+            AppendPacket(sfg, &kKalman6DOFPacket, &frame, &iPacketNumber, &iIndex);
 #endif
 #if F_9DOF_GBY_KALMAN
-    uint8_t nine_axis_kalman = (sfg->iFlags & F_9DOF_GBY_KALMAN) && (quaternionPacketType == Q9);
-    kalman = kalman | nine_axis_kalman;
-#endif
-#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
-    if (kalman)
-    {
-        if ((quaternionPacketType == Q6AG) || (quaternionPacketType == Q9))
-        {
-            // [0]: packet start byte
-            output_buf[iIndex++] = 0x7E;
-
-            // [1]: packet type 7 byte
-            tmpuint8_t = 0x07;
-            OutputBufAppendItem(output_buf, &iIndex, &tmpuint8_t, 1);
-
-            // [2]: packet number byte
-            OutputBufAppendItem(output_buf, &iIndex, &iPacketNumber, 1);
-            iPacketNumber++;
-
-            // [4-3]: fzgErr[CHX] resolution scaled by 30000
-            // [6-5]: fzgErr[CHY] resolution scaled by 30000
-            // [8-7]: fzgErr[CHZ] resolution scaled by 30000
-            for (i = CHX; i <= CHZ; i++)
-            {
-#if F_6DOF_GY_KALMAN
-                if (six_axis_kalman)    scratch16 = (int16_t) (sfg->SV_6DOF_GY_KALMAN.fZErr[i] * 30000.0F);
-#endif
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   scratch16 = (int16_t) (sfg->SV_9DOF_GBY_KALMAN.fZErr[i] * 30000.0F);
-#endif
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16,2);
-            }
-
-            // [10-9]: fgErrPl[CHX] resolution scaled by 30000
-            // [12-11]: fgErrPl[CHY] resolution scaled by 30000
-            // [14-13]: fgErrPl[CHZ] resolution scaled by 30000
-            for (i = CHX; i <= CHZ; i++)
-            {
-#if F_6DOF_GY_KALMAN
-                if (six_axis_kalman)    scratch16 = (int16_t) (sfg->SV_6DOF_GY_KALMAN.fqgErrPl[i] * 30000.0F);
-#endif
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   scratch16 = (int16_t) (sfg->SV_9DOF_GBY_KALMAN.fqgErrPl[i] * 30000.0F);
-#endif
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16,2);
-            }
-
-            // [16-15]: fzmErr[CHX] resolution scaled by 30000
-            // [18-17]: fzmErr[CHY] resolution scaled by 30000
-            // [20-19]: fzmErr[CHZ] resolution scaled by 30000
-            for (i = CHX; i <= CHZ; i++)
-            {
-#if F_6DOF_GY_KALMAN
-                if (six_axis_kalman)    scratch16 = 0;
-#endif
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   scratch16 = (int16_t) (sfg->SV_9DOF_GBY_KALMAN.fZErr[i + 3] * 30000.0F);
-#endif
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            }
-
-            // [22-21]: fmErrPl[CHX] resolution scaled by 30000
-            // [24-23]: fmErrPl[CHY] resolution scaled by 30000
-            // [26-25]: fmErrPl[CHZ] resolution scaled by 30000
-            for (i = CHX; i <= CHZ; i++)
-            {
-#if F_6DOF_GY_KALMAN
-                if (six_axis_kalman)    scratch16 = 0;
-#endif
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   scratch16 = (int16_t) (sfg->SV_9DOF_GBY_KALMAN.fqmErrPl[i] * 30000.0F);
-#endif
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            }
-
-            // [28-27]: fbPl[CHX] resolution 0.001 deg/sec
-            // [30-29]: fbPl[CHY] resolution 0.001 deg/sec
-            // [32-31]: fbPl[CHZ] resolution 0.001 deg/sec
-            for (i = CHX; i <= CHZ; i++)
-            {
-#if F_6DOF_GY_KALMAN
-                if (six_axis_kalman)    scratch16 = (int16_t) (sfg->SV_6DOF_GY_KALMAN.fbPl[i] * 1000.0F);
-#endif
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   scratch16 = (int16_t) (sfg->SV_9DOF_GBY_KALMAN.fbPl[i] * 1000.0F);
-#endif
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            }
-
-            // [34-33]: fDeltaPl resolution 0.01deg
-            scratch16 = 0;
-#if F_9DOF_GBY_KALMAN
-            if (nine_axis_kalman)       scratch16 = (int16_t) (sfg->SV_9DOF_GBY_KALMAN.fDeltaPl * 100.0F);
-#endif
-            OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-
-            // [36-35]: fAccGl[CHX] resolution 1/8192 g
-            // [38-37]: fAccGl[CHY] resolution 1/8192 g
-            // [40-39]: fAccGl[CHZ] resolution 1/8192 g
-            for (i = CHX; i <= CHZ; i++)
-            {
-                // default to zero data
-                ftmp = 0.0F;
-#if F_6DOF_GY_KALMAN
-                if (six_axis_kalman)    ftmp = sfg->SV_6DOF_GY_KALMAN.fAccGl[i] * 8192.0F;
-#endif
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   ftmp = sfg->SV_9DOF_GBY_KALMAN.fAccGl[i] * 8192.0F;
-#endif
-
-                // check for clipping
-                if (ftmp > 32767.0F)            scratch16 = 32767;
-                else if (ftmp < -32768.0F)      scratch16 = -32768;
-                else                            scratch16 = (int16_t) ftmp;
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            }
-
-            // [42-41]: fDisGl[CHX] resolution 0.01m
-            // [44-43]: fDisGl[CHY] resolution 0.01m
-            // [46-45]: fDisGl[CHZ] resolution 0.01m
-            for (i = CHX; i <= CHZ; i++)
-            {
-                // default to zero data
-                ftmp = 0.0F;
-#if F_9DOF_GBY_KALMAN
-                if (nine_axis_kalman)   ftmp = sfg->SV_9DOF_GBY_KALMAN.fDisGl[i] * 100.0F;
-#endif
-
-                // check for clipping
-                if (ftmp > 32767.0F)            scratch16 = 32767;
-                else if (ftmp < -32768.0F)      scratch16 = -32768;
-                else                            scratch16 = (int16_t) ftmp;
-                OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            }
-
-            // [47]: add the tail byte for the Kalman packet type 7
-            output_buf[iIndex++] = 0x7E;
-        }
-    }   // end of check for Kalman packet
+        if ((sfg->iFlags & F_9DOF_GBY_KALMAN) && (quaternionPacketType == Q9))
+            AppendPacket(sfg, &kKalman9DOFPacket, &frame, &iPacketNumber, &iIndex);
 #endif
+    }
 #if F_USING_ACCEL
     // *************************************************************************
     // fixed length packet type 8 transmitted whenever a precision accelerometer
     // measurement has been stored.
     // total size is 0 to 40 equals 41 bytes
     // *************************************************************************
-    // check to see which packet (if any) is to be transmitted
-    if (AccelCalPacketOn != -1)
+    // check to see which packet (if any) is to be transmitted; if there is
+    // no room it stays pending until the next frame
+    if ((AccelCalPacketOn != -1) && (duePackets & PACKET_ACCEL_CAL) &&
+        PacketFits(iIndex, LEN_ACCEL_CAL_PACKET))
     {
         // [0]: packet start byte (need a iIndex++ here since not using OutputBufAppendItem)
         output_buf[iIndex++] = 0x7E;
@@ -875,11 +872,11 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         if ((AccelCalPacketOn >= 0) &&
             (AccelCalPacketOn < MAX_ACCEL_CAL_ORIENTATIONS))
         {
-            scratch16 = (int16_t) (sfg->AccelBuffer.fGsStored[AccelCalPacketOn][CHX] * 8192.0F);
+            scratch16 = (int16_t) iScaleFloat(sfg->AccelBuffer.fGsStored[AccelCalPacketOn][CHX], 8192);
             OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            scratch16 = (int16_t) (sfg->AccelBuffer.fGsStored[AccelCalPacketOn][CHY] * 8192.0F);
+            scratch16 = (int16_t) iScaleFloat(sfg->AccelBuffer.fGsStored[AccelCalPacketOn][CHY], 8192);
             OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-            scratch16 = (int16_t) (sfg->AccelBuffer.fGsStored[AccelCalPacketOn][CHZ] * 8192.0F);
+            scratch16 = (int16_t) iScaleFloat(sfg->AccelBuffer.fGsStored[AccelCalPacketOn][CHZ], 8192);
             OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
         }
         else
@@ -889,58 +886,76 @@ void CreateOutgoingPackets(SensorFusionGlobals *sfg)
         }
 
         // [15-10]: precision accelerometer offset vector fV (g scaled by 32768.0)
-        scratch16 = (int16_t) (sfg->AccelCal.fV[CHX] * 32768.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fV[CHX], 32768);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fV[CHY] * 32768.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fV[CHY], 32768);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fV[CHZ] * 32768.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fV[CHZ], 32768);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // [21-16]: precision accelerometer inverse gain matrix diagonal finvW - 1.0 (scaled by 10000.0)
-        scratch16 = (int16_t) ((sfg->AccelCal.finvW[CHX][CHX] - 1.0F) * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.finvW[CHX][CHX] - 1.0F, 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) ((sfg->AccelCal.finvW[CHY][CHY] - 1.0F) * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.finvW[CHY][CHY] - 1.0F, 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) ((sfg->AccelCal.finvW[CHZ][CHZ] - 1.0F) * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.finvW[CHZ][CHZ] - 1.0F, 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // [27-22]: precision accelerometer inverse gain matrix off-diagonal finvW (scaled by 10000)
-        scratch16 = (int16_t) (sfg->AccelCal.finvW[CHX][CHY] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.finvW[CHX][CHY], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.finvW[CHX][CHZ] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.finvW[CHX][CHZ], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.finvW[CHY][CHZ] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.finvW[CHY][CHZ], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // [33-28]: precision accelerometer rotation matrix diagonal fR0 (scaled by 10000)
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHX][CHX] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHX][CHX], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHY][CHY] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHY][CHY], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHZ][CHZ] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHZ][CHZ], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // [45-34]: precision accelerometer inverse rotation matrix off-diagonal fR0 (scaled by 10000)
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHX][CHY] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHX][CHY], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHX][CHZ] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHX][CHZ], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHY][CHX] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHY][CHX], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHY][CHZ] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHY][CHZ], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHZ][CHX] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHZ][CHX], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
-        scratch16 = (int16_t) (sfg->AccelCal.fR0[CHZ][CHY] * 10000.0F);
+        scratch16 = (int16_t) iScaleFloat(sfg->AccelCal.fR0[CHZ][CHY], 10000);
         OutputBufAppendItem(output_buf, &iIndex, (uint8_t *) &scratch16, 2);
 
         // [46]: add the tail byte for the packet type 8
         output_buf[iIndex++] = 0x7E;
+        MarkPacketEnd(sfg->pControlSubsystem, PACKET_ACCEL_CAL, iIndex);
 
         // disable future packets of this type until a new measurement has been obtained
         sfg->pControlSubsystem->AccelCalPacketOn = -1;
     }
 #endif  // F_USING_ACCEL
+
+    // ************************************************************************
+    // configuration reply packet type 9, see control.h
+    // ************************************************************************
+    // the oldest reply is removed from the queue once it is in a frame
+    if (duePackets & PACKET_CONFIG_ACK) {
+        ControlSubsystem *pComm = sfg->pControlSubsystem;
+        uint16_t iStart = iIndex;
+
+        frame.configAck = pComm->config_ack[pComm->config_ack_head];
+        AppendPacket(sfg, &kConfigAckPacket, &frame, &iPacketNumber, &iIndex);
+        if (iIndex != iStart) {
+            pComm->config_ack_head = (pComm->config_ack_head + 1) % CONFIG_ACK_QUEUE_LEN;
+            pComm->config_ack_count--;
+        }
+    }
+
     // ********************************************************************************
     // all packets have now been constructed in the output buffer.
     // The final iIndex++ gives the number of bytes to transmit which is one more than
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file data_logger.c
+    \brief Ring buffer and record encoding of the high-rate data logger.
+
+    See data_logger.h for the record format. The fusion loop owns iHead and
+    the flusher owns iTail; each publishes its index with a release store and
+    reads the other's with an acquire load, so no lock is needed between
+    them, even when they run on different ESP32 cores.
+*/
+
+#include <string.h>
+
+#include "sensor_fusion.h"
+#include "control.h"
+#include "status.h"
+#include "data_logger.h"
+#include "approximations.h"
+
+#if (LOG_RING_BYTES % LOG_BLOCK_BYTES) || (LOG_BLOCK_BYTES % LOG_RECORD_BYTES)
+#error LOG_RING_BYTES must be a multiple of LOG_BLOCK_BYTES, and that of LOG_RECORD_BYTES
+#endif
+
+// store a 16 bit value little endian
+static void PutU16(uint8_t *pDest, uint16_t value)
+{
+    pDest[0] = (uint8_t) value;
+    pDest[1] = (uint8_t) (value >> 8);
+}//end PutU16()
+
+// clip to the range of int16_t
+static int16_t ClipToInt16(int32_t value)
+{
+    if (value > 32767) return 32767;
+    if (value < -32768) return -32768;
+    return (int16_t) value;
+}//end ClipToInt16()
+
+// fill in the common part of a record
+static void StartRecord(uint8_t *pRecord, uint8_t type, uint8_t index,
+                        SensorFusionGlobals *sfg, uint32_t iTimeStamp)
+{
+    memset(pRecord, 0, LOG_RECORD_BYTES);
+    pRecord[0] = type;
+    pRecord[1] = index;
+    PutU16(&pRecord[2], (uint16_t) sfg->loopcounter);
+    PutU16(&pRecord[4], (uint16_t) iTimeStamp);
+    PutU16(&pRecord[6], (uint16_t) (iTimeStamp >> 16));
+}//end StartRecord()
+
+// Check there is room for nRecords more records in the ring. If not, they
+// are counted as dropped.
+static bool ReserveRecords(DataLogger *pLog, uint16_t nRecords)
+{
+    uint32_t iTail = __atomic_load_n(&pLog->iTail, __ATOMIC_ACQUIRE);
+
+    if ((uint32_t) nRecords * LOG_RECORD_BYTES > LOG_RING_BYTES - (pLog->iHead - iTail)) {
+        pLog->stats.recordsDropped += nRecords;
+        return false;
+    }
+    return true;
+}//end ReserveRecords()
+
+// Where the record iRecord places after the head goes. The ring holds a whole
+// number of records, so a record never wraps.
+static uint8_t *RecordAt(DataLogger *pLog, uint16_t iRecord)
+{
+    return &pLog->pRing[(pLog->iHead + (uint32_t) iRecord * LOG_RECORD_BYTES) % LOG_RING_BYTES];
+}//end RecordAt()
+
+// make records written after the head visible to the flusher
+static void CommitRecords(DataLogger *pLog, uint16_t nRecords)
+{
+    pLog->stats.recordsLogged += nRecords;
+    __atomic_store_n(&pLog->iHead, pLog->iHead + (uint32_t) nRecords * LOG_RECORD_BYTES,
+                     __ATOMIC_RELEASE);
+}//end CommitRecords()
+
+// Write the samples of a sensor FIFO as records, starting iRecord places
+// after the head. Returns the number of records written.
+static uint16_t AppendFifoRecords(DataLogger *pLog, uint16_t iRecord, uint8_t type,
+                                  int16_t fifo[][3], uint8_t iFIFOCount, uint16_t iFIFOExceeded,
+                                  SensorFusionGlobals *sfg, uint32_t iTimeStamp)
+{
+    uint16_t i;
+    uint8_t *pRecord;
+
+    for (i = 0; i < iFIFOCount; i++) {
+        pRecord = RecordAt(pLog, iRecord + i);
+        StartRecord(pRecord, type, (uint8_t) i, sfg, iTimeStamp);
+        PutU16(&pRecord[8], (uint16_t) fifo[i][CHX]);
+        PutU16(&pRecord[10], (uint16_t) fifo[i][CHY]);
+        PutU16(&pRecord[12], (uint16_t) fifo[i][CHZ]);
+        PutU16(&pRecord[14], iFIFOExceeded);
+    }
+    return iFIFOCount;
+}//end AppendFifoRecords()
+
+bool startDataLogger(DataLogger *pLog, SensorFusionGlobals *sfg, uint8_t *pRing,
+                     logWriteBlock_t *writeBlock, logClose_t *close, void *pStorage,
+                     uint32_t iTimeStamp)
+{
+    uint8_t *pRecord;
+
+    if (pLog->state != LOG_OFF) return false;
+    pLog->pRing = pRing;
+    pLog->writeBlock = writeBlock;
+    pLog->close = close;
+    pLog->pStorage = pStorage;
+    memset(&pLog->stats, 0, sizeof(pLog->stats));
+    pLog->iCycleStart = iTimeStamp;
+    pLog->iHead = 0;
+    __atomic_store_n(&pLog->iTail, 0, __ATOMIC_RELEASE);
+
+    pRecord = RecordAt(pLog, 0);           // the ring is empty, so there is room
+    StartRecord(pRecord, LOG_RECORD_HEADER, FUSION_HZ, sfg, iTimeStamp);
+    PutU16(&pRecord[8], LOG_FORMAT_VERSION);
+#if F_USING_ACCEL
+    PutU16(&pRecord[10], (uint16_t) sfg->Accel.iCountsPerg);
+#endif
+#if F_USING_GYRO
+    PutU16(&pRecord[12], (uint16_t) sfg->Gyro.iCountsPerDegPerSec);
+#endif
+#if F_USING_MAG
+    PutU16(&pRecord[14], (uint16_t) sfg->Mag.iCountsPeruT);
+#endif
+    CommitRecords(pLog, 1);
+
+    // the flusher only looks at the ring once the state says it is running
+    __atomic_store_n(&pLog->state, LOG_RUNNING, __ATOMIC_RELEASE);
+    return true;
+}//end startDataLogger()
+
+void stopDataLogger(DataLogger *pLog)
+{
+    if (pLog->state == LOG_RUNNING)
+        __atomic_store_n(&pLog->state, LOG_STOPPING, __ATOMIC_RELEASE);
+}//end stopDataLogger()
+
+void logSensorSamples(DataLogger *pLog, SensorFusionGlobals *sfg, uint32_t iTimeStamp)
+{
+    uint16_t nRecords = 0;
+    uint32_t iInterval;
+
+    if (pLog->state != LOG_RUNNING) return;
+    // the gap since the previous cycle shows how long the loop was held up,
+    // e.g. by a flash write
+    iInterval = iTimeStamp - pLog->iCycleStart;
+    pLog->iCycleStart = iTimeStamp;
+    if (iInterval > pLog->stats.maxCycleIntervalUs) pLog->stats.maxCycleIntervalUs = iInterval;
+    if (iInterval > 2 * (1000000 / FUSION_HZ)) pLog->stats.lateCycles++;
+#if F_USING_ACCEL
+    nRecords += sfg->Accel.iFIFOCount;
+#endif
+#if F_USING_MAG
+    nRecords += sfg->Mag.iFIFOCount;
+#endif
+#if F_USING_GYRO
+    nRecords += sfg->Gyro.iFIFOCount;
+#endif
+    if (nRecords == 0) return;
+    if (!ReserveRecords(pLog, nRecords)) return;
+
+    nRecords = 0;
+#if F_USING_ACCEL
+    nRecords += AppendFifoRecords(pLog, nRecords, LOG_RECORD_ACCEL,
+                                  sfg->Accel.iGsFIFO, sfg->Accel.iFIFOCount,
+                                  sfg->Accel.iFIFOExceeded, sfg, iTimeStamp);
+#endif
+#if F_USING_MAG
+    nRecords += AppendFifoRecords(pLog, nRecords, LOG_RECORD_MAG,
+                                  sfg->Mag.iBsFIFO, sfg->Mag.iFIFOCount,
+                                  sfg->Mag.iFIFOExceeded, sfg, iTimeStamp);
+#endif
+#if F_USING_GYRO
+    nRecords += AppendFifoRecords(pLog, nRecords, LOG_RECORD_GYRO,
+                                  sfg->Gyro.iYsFIFO, sfg->Gyro.iFIFOCount,
+                                  sfg->Gyro.iFIFOExceeded, sfg, iTimeStamp);
+#endif
+    CommitRecords(pLog, nRecords);
+}//end logSensorSamples()
+
+void logFusionOutput(DataLogger *pLog, SensorFusionGlobals *sfg, uint32_t iTimeStamp)
+{
+    quaternion_type quaternionType = sfg->pControlSubsystem->QuaternionPacketType;
+    SV_ptr data = SelectedStateVector(sfg, quaternionType);
+    uint8_t *pRecord;
+    int16_t i;
+
+    if (pLog->state != LOG_RUNNING) return;
+    if (!ReserveRecords(pLog, 2)) return;
+
+    pRecord = RecordAt(pLog, 0);
+    StartRecord(pRecord, LOG_RECORD_QUATERNION, (uint8_t) quaternionType, sfg, iTimeStamp);
+    if (data) {
+        PutU16(&pRecord[8], (uint16_t) (int16_t) iScaleFloat(data->fq.q0, 30000));
+        PutU16(&pRecord[10], (uint16_t) (int16_t) iScaleFloat(data->fq.q1, 30000));
+        PutU16(&pRecord[12], (uint16_t) (int16_t) iScaleFloat(data->fq.q2, 30000));
+        PutU16(&pRecord[14], (uint16_t) (int16_t) iScaleFloat(data->fq.q3, 30000));
+    } else {
+        PutU16(&pRecord[8], 30000);
+    }
+
+    pRecord = RecordAt(pLog, 1);
+    StartRecord(pRecord, LOG_RECORD_RATE, (uint8_t) sfg->pStatusSubsystem->status,
+                sfg, iTimeStamp);
+    if (data) {
+        for (i = CHX; i <= CHZ; i++)
+            PutU16(&pRecord[8 + 2 * i], (uint16_t) ClipToInt16(iScaleFloat(data->fOmega[i], 20)));
+    }
+    CommitRecords(pLog, 2);
+}//end logFusionOutput()
+
+uint32_t serviceDataLogger(DataLogger *pLog)
+{
+    logger_state_t state = __atomic_load_n(&pLog->state, __ATOMIC_ACQUIRE);
+    uint32_t iHead;
+    uint32_t iStart;
+    uint32_t iWritten = 0;
+    uint16_t len;
+    bool isOK = true;
+
+    if (state == LOG_OFF) return 0;
+    iHead = __atomic_load_n(&pLog->iHead, __ATOMIC_ACQUIRE);
+
+    // whole blocks; the ring is a whole number of blocks, so they never wrap
+    while (isOK && (iHead - pLog->iTail >= LOG_BLOCK_BYTES)) {
+        iStart = pLog->iTail % LOG_RING_BYTES;
+        isOK = pLog->writeBlock(pLog->pStorage, &pLog->pRing[iStart], LOG_BLOCK_BYTES);
+        if (isOK) {
+            __atomic_store_n(&pLog->iTail, pLog->iTail + LOG_BLOCK_BYTES, __ATOMIC_RELEASE);
+            iWritten += LOG_BLOCK_BYTES;
+        }
+    }
+
+    // A stopping log also writes what is left (iHead no longer moves). That
+    // is less than a block, but may wrap around the end of the ring.
+    while (isOK && (state == LOG_STOPPING) && (iHead != pLog->iTail)) {
+        iStart = pLog->iTail % LOG_RING_BYTES;
+        len = (uint16_t) (iHead - pLog->iTail);
+        if (iStart + len > LOG_RING_BYTES) len = (uint16_t) (LOG_RING_BYTES - iStart);
+        isOK = pLog->writeBlock(pLog->pStorage, &pLog->pRing[iStart], len);
+        if (isOK) {
+            __atomic_store_n(&pLog->iTail, pLog->iTail + len, __ATOMIC_RELEASE);
+            iWritten += len;
+        }
+    }
+
+    pLog->stats.bytesWritten += iWritten;
+    if (!isOK) pLog->stats.writeErrors++;
+    if (!isOK || (state == LOG_STOPPING)) {
+        // stop recording before the storage goes away
+        __atomic_store_n(&pLog->state, LOG_STOPPING, __ATOMIC_RELEASE);
+        if (pLog->close) pLog->close(pLog->pStorage);
+        __atomic_store_n(&pLog->state, LOG_OFF, __ATOMIC_RELEASE);
+    }
+    return iWritten;
+}//end serviceDataLogger()
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file data_logger.h
+    \brief High-rate binary logging of sensor samples and fusion outputs
+
+    Every sample read from the sensor FIFOs, and the quaternion and angular
+    velocity of every fusion cycle, are appended as fixed-size records to a
+    RAM ring. A separate, low priority caller (an idle-priority task on ESP32,
+    SensorFusion::ServiceLogging() from loop() on ESP8266) writes the ring out
+    in whole LOG_BLOCK_BYTES blocks through a writeBlock function, e.g. to a
+    SPIFFS file (see log_storage.h) or, on a host, to a stdio file.
+
+    The fusion side never waits for the ring: it has one writer (the fusion
+    loop) and one reader (the flusher), each owning one index. If the flusher
+    falls behind and a fusion cycle's records don't fit, all of that cycle's
+    records are dropped and counted. The flash write itself can still hold up
+    the fusion loop: on ESP32 a SPIFFS write or erase disables the flash cache
+    on both cores, and on ESP8266 the flusher runs in loop(). The longest gap
+    between fusion cycles while logging is kept in DataLoggerStats.
+
+    Records are LOG_RECORD_BYTES long, little endian, so a log file is simply
+    an array of records:
+    \verbatim
+    [0]      record type (LOG_RECORD_*)
+    [1]      sample records: index of the sample within the fusion cycle
+             LOG_RECORD_QUATERNION: quaternion_type of the quaternion
+             LOG_RECORD_RATE: fusion status
+             LOG_RECORD_HEADER: FUSION_HZ
+    [3-2]    fusion cycle number (low 16 bits of sfg->loopcounter)
+    [7-4]    time stamp (us) taken at the start of the fusion cycle
+    [15-8]   payload:
+             LOG_RECORD_HEADER: [9-8] LOG_FORMAT_VERSION, [11-10] accel
+               counts per g, [13-12] gyro counts per deg/s, [15-14] mag
+               counts per uT
+             LOG_RECORD_ACCEL/MAG/GYRO: [13-8] x, y, z (counts, as read into
+               the software FIFO, before conditionSensorReadings() applies
+               the HAL axis remap), [15-14] samples lost this cycle because
+               the software FIFO was full
+             LOG_RECORD_QUATERNION: [15-8] q0..q3 (30000 = 1.0)
+             LOG_RECORD_RATE: [13-8] angular velocity x, y, z (20 = 1 deg/s)
+    \endverbatim
+    A log starts with one LOG_RECORD_HEADER. Each fusion cycle then adds its
+    sample records followed by one LOG_RECORD_QUATERNION and one
+    LOG_RECORD_RATE. Sample counts per cycle give the ODRs in use, so a replay
+    driver can feed the samples back into the FIFOs at their original timing.
+    Gaps in the fusion cycle number show where records were dropped.
+*/
+
+#ifndef DATA_LOGGER_H
+#define DATA_LOGGER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @name Data Logger Constants
+///@{
+#define LOG_FORMAT_VERSION      1       ///< sent in the header record
+#define LOG_RECORD_BYTES        16      ///< every record is this long
+#ifndef LOG_RING_BYTES
+#ifdef ESP32
+#define LOG_RING_BYTES          16384   ///< RAM ring size, a multiple of LOG_BLOCK_BYTES (about 1 s of records)
+#define LOG_BLOCK_BYTES         4096    ///< bytes written at a time; one flash sector
+#else
+#define LOG_RING_BYTES          4096    ///< RAM ring size, a multiple of LOG_BLOCK_BYTES
+#define LOG_BLOCK_BYTES         1024    ///< bytes written at a time
+#endif
+#endif
+#define LOG_SERVICE_MS          10      ///< flusher sleep when there is no full block to write
+///@}
+
+/// @name Data Logger Record Types
+///@{
+#define LOG_RECORD_HEADER       0x01    ///< format version and sensor scale factors
+#define LOG_RECORD_ACCEL        0x02    ///< one accelerometer FIFO sample
+#define LOG_RECORD_MAG          0x03    ///< one magnetometer FIFO sample
+#define LOG_RECORD_GYRO         0x04    ///< one gyroscope FIFO sample
+#define LOG_RECORD_QUATERNION   0x05    ///< fusion output quaternion
+#define LOG_RECORD_RATE         0x06    ///< fusion output angular velocity
+///@}
+
+/// Logger states
+typedef enum {
+    LOG_OFF,                    ///< not logging; the ring may be restarted
+    LOG_RUNNING,                ///< fusion cycles are being recorded
+    LOG_STOPPING                ///< no more records; the flusher writes what is left and closes
+} logger_state_t;
+
+/// Writes len bytes (a whole block, or the remainder when stopping) to storage.
+/// Returns false on a write error, which stops the log.
+typedef bool (logWriteBlock_t)(void *pStorage, const uint8_t *pData, uint16_t len);
+/// Closes the storage once the log has been flushed
+typedef void (logClose_t)(void *pStorage);
+
+/// Counters kept by the logger
+typedef struct DataLoggerStats {
+    uint32_t recordsLogged;     ///< records placed in the ring
+    uint32_t recordsDropped;    ///< records discarded because the ring was full
+    uint32_t bytesWritten;      ///< bytes handed to writeBlock
+    uint32_t writeErrors;       ///< writeBlock failures (each stops the log)
+    uint32_t maxCycleIntervalUs;    ///< longest time between the starts of two fusion cycles (us)
+    uint32_t lateCycles;        ///< fusion cycles started more than two periods after the previous one
+} DataLoggerStats;
+
+/// Ring buffer and storage of a log
+typedef struct DataLogger {
+    uint8_t             *pRing;         ///< LOG_RING_BYTES of records, provided by startDataLogger()'s caller
+    uint32_t            iHead;          ///< bytes ever added; written by the fusion loop only
+    uint32_t            iTail;          ///< bytes ever flushed; written by the flusher only
+    volatile logger_state_t state;      ///< see logger_state_t
+    DataLoggerStats     stats;          ///< counters
+    uint32_t            iCycleStart;    ///< time stamp of the latest fusion cycle (us)
+    logWriteBlock_t     *writeBlock;    ///< storage write function
+    logClose_t          *close;         ///< storage close function
+    void                *pStorage;      ///< passed to writeBlock and close
+} DataLogger;
+
+struct SensorFusionGlobals;
+
+/// Start a log, writing its header record. Returns false if a log is
+/// already open (running, or stopping but not yet flushed).
+bool startDataLogger(
+    DataLogger *pLog,                       ///< logger
+    struct SensorFusionGlobals *sfg,        ///< source of the header scale factors
+    uint8_t *pRing,                         ///< LOG_RING_BYTES of RAM for the ring
+    logWriteBlock_t *writeBlock,            ///< storage write function
+    logClose_t *close,                      ///< storage close function, or NULL
+    void *pStorage,                         ///< storage handle for writeBlock and close
+    uint32_t iTimeStamp                     ///< current time (us)
+);
+/// Stop recording. The flusher then writes the rest of the ring and closes the storage.
+void stopDataLogger(
+    DataLogger *pLog                        ///< logger
+);
+/// Record the FIFO samples read since the last fusion cycle. Call just
+/// before conditionSensorReadings(), while the FIFOs are still full.
+void logSensorSamples(
+    DataLogger *pLog,                       ///< logger
+    struct SensorFusionGlobals *sfg,        ///< top level fusion structure
+    uint32_t iTimeStamp                     ///< time (us) at the start of the fusion cycle
+);
+/// Record the outputs of the fusion cycle just run. Call after runFusion().
+void logFusionOutput(
+    DataLogger *pLog,                       ///< logger
+    struct SensorFusionGlobals *sfg,        ///< top level fusion structure
+    uint32_t iTimeStamp                     ///< time (us) at the start of the fusion cycle
+);
+/// Write any complete blocks in the ring to storage, and finish a stopping
+/// log. Called by the flusher only; it may block for as long as the storage
+/// write takes. Returns the number of bytes written.
+uint32_t serviceDataLogger(
+    DataLogger *pLog                        ///< logger
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DATA_LOGGER_H
@@ -22,9 +22,6 @@
 #define FXAS21000_CTRL_REG0             0x0D
 #define FXAS21000_CTRL_REG1             0x13
 #define FXAS21000_CTRL_REG2             0x14
-#define FXAS21000_WHO_AM_I_VALUE        0xD1    // engineering and production
-#define FXAS21000_COUNTSPERDEGPERSEC    20      // 1600dps range
-#define FXAS21002_COUNTSPERDEGPERSEC    16      // for 2000dps=32000 counts
 
 #if F_USING_GYRO
 
@@ -40,12 +37,6 @@ const registerReadlist_t    FXAS21002_F_STATUS_READ[] =
     { .readFrom = FXAS21002_STATUS, .numBytes = 1 }, __END_READ_DATA__
 };
 
-// Command definition to read the gyro FIFO.
-registerReadlist_t          FXAS21002_DATA_READ[] =
-{
-    { .readFrom = FXAS21002_OUT_X_MSB, .numBytes = 6 }, __END_READ_DATA__
-};
-
 // Each entry in a RegisterWriteList is composed of: register address, value to write, bit-mask to apply to write (0 enables)
 const registerwritelist_t   FXAS21000_INITIALIZATION[] =
 {
@@ -178,19 +169,28 @@ int8_t FXAS21002_Init(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
     uint8_t reg;
     int8_t status = SENSOR_ERROR_NONE;
 
-    if (I2CReadByte(sensor->addr, FXAS21002_WHO_AM_I, &reg)) {
+    // a sensor installed with a SensorIdentity has already been checked and
+    // scaled (see FXAS21002Traits in sensor_drivers.h)
+    if (NULL == sensor->identity) {
+        if (SENSOR_ERROR_NONE != Sensor_I2C_Read_Register(&sensor->deviceInfo, sensor->addr,
+                                                          FXAS21002_WHO_AM_I, 1, &reg)) {
+            return SENSOR_ERROR_INIT; // return with error
+        }
         sfg->Gyro.iWhoAmI = reg;
         switch (reg) {
+        case FXAS21002_WHO_AM_I_WHOAMI_OLD_VALUE:
+            sfg->Gyro.iCountsPerDegPerSec = FXAS21000_COUNTSPERDEGPERSEC;
+            sfg->Gyro.fDegPerSecPerCount = 1.0F / FXAS21000_COUNTSPERDEGPERSEC;
+            break;
         case FXAS21002_WHO_AM_I_WHOAMI_PROD_VALUE:
         case FXAS21002_WHO_AM_I_WHOAMI_PRE_VALUE:
-        case FXAS21002_WHO_AM_I_WHOAMI_OLD_VALUE: 
+            sfg->Gyro.iCountsPerDegPerSec = FXAS21002_COUNTSPERDEGPERSEC;
+            sfg->Gyro.fDegPerSecPerCount = 1.0F / FXAS21002_COUNTSPERDEGPERSEC;
             break;
         default:
             // whoAmI will retain default value of zero
             return SENSOR_ERROR_INIT; // return with error
         }
-    } else {
-        return SENSOR_ERROR_INIT; // return with error
     }
 
     // configure FXAS21000 or FXAS21002 depending on WHOAMI value read
@@ -199,14 +199,10 @@ int8_t FXAS21002_Init(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
         // Configure and start the FXAS21000 sensor.  This does multiple register writes
         // (see FXAS21009_Initialization definition above)
         status = Sensor_I2C_Write_List(&sensor->deviceInfo, sensor->addr, FXAS21000_INITIALIZATION );
-        sfg->Gyro.iCountsPerDegPerSec = FXAS21000_COUNTSPERDEGPERSEC;
-        sfg->Gyro.fDegPerSecPerCount = 1.0F / FXAS21000_COUNTSPERDEGPERSEC;
         break;
     case (FXAS21002_WHO_AM_I_WHOAMI_PRE_VALUE):
     case (FXAS21002_WHO_AM_I_WHOAMI_PROD_VALUE):
         status = Sensor_I2C_Write_List(&sensor->deviceInfo, sensor->addr, FXAS21002_INITIALIZATION );
-        sfg->Gyro.iCountsPerDegPerSec = FXAS21002_COUNTSPERDEGPERSEC;
-        sfg->Gyro.fDegPerSecPerCount = 1.0F / FXAS21002_COUNTSPERDEGPERSEC;
         break;
     }
     sfg->Gyro.iFIFOCount=0;
@@ -218,11 +214,12 @@ int8_t FXAS21002_Init(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
 // read FXAS21002 gyro over I2C
 int8_t FXAS21002_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
 {
-    uint8_t     I2C_Buffer[6 * GYRO_FIFO_SIZE]; // I2C read buffer
+    uint8_t     I2C_Buffer[6 * GYRO_FIFO_SIZE] __attribute__((aligned(4))); // I2C read buffer
     uint8_t      j;                              // scratch
     uint8_t     fifo_packet_count = 1;
     int32_t     status;
-    int16_t     sample[3];
+    // read command, on the stack as sensors on other buses may be read concurrently
+    registerReadlist_t dataRead[] = { { .readFrom = FXAS21002_OUT_X_MSB, .numBytes = 6 }, __END_READ_DATA__ };
 
      if (sensor->isInitialized != F_USING_GYRO) {
       return SENSOR_ERROR_INIT;
@@ -249,23 +246,17 @@ int8_t FXAS21002_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
           if (sfg->Gyro.iWhoAmI == FXAS21002_WHO_AM_I_WHOAMI_OLD_VALUE) {
 //    if (true) {
             // read six sequential gyro output bytes
-            FXAS21002_DATA_READ[0].readFrom = FXAS21002_OUT_X_MSB;
-            FXAS21002_DATA_READ[0].numBytes = 6;
 
             // for FXAS21000, perform sequential 6 byte reads
             for (j = 0; j < fifo_packet_count; j++) {
               // read one set of measurements totalling 6 bytes
               status = Sensor_I2C_Read(&sensor->deviceInfo,
-                                       sensor->addr, FXAS21002_DATA_READ,
+                                       sensor->addr, dataRead,
                                        I2C_Buffer);
 
               if (status == SENSOR_ERROR_NONE) {
                 // place the measurements read into the gyroscope buffer structure
-                sample[CHX] = (I2C_Buffer[0] << 8) | I2C_Buffer[1];
-                sample[CHY] = (I2C_Buffer[2] << 8) | I2C_Buffer[3];
-                sample[CHZ] = (I2C_Buffer[4] << 8) | I2C_Buffer[5];
-                conditionSample(sample);  // truncate negative values to -32767
-                addToFifo((union FifoSensor*) &(sfg->Gyro), GYRO_FIFO_SIZE, sample);
+                addBlockToFifo((union FifoSensor*) &(sfg->Gyro), GYRO_FIFO_SIZE, I2C_Buffer, 1);
             }
         }
     }   // end of FXAS21000 FIFO read
@@ -274,27 +265,22 @@ int8_t FXAS21002_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
         // for FXAS21002, clear the FIFO in burst reads using WRAPTOONE feature, which decreases read time to 2 ms. 
         //Noticed that I2C reads > 126 bytes don't work, so limit the number of FIFO packets per burst read.
 #define MAX_FIFO_PACKETS_PER_READ 11        
-        FXAS21002_DATA_READ[0].readFrom = FXAS21002_OUT_X_MSB;
         while( (fifo_packet_count > 0)  && (status==SENSOR_ERROR_NONE)) {
             if( MAX_FIFO_PACKETS_PER_READ < fifo_packet_count ) {
-               FXAS21002_DATA_READ[0].numBytes = MAX_FIFO_PACKETS_PER_READ * 6;
+               dataRead[0].numBytes = MAX_FIFO_PACKETS_PER_READ * 6;
                fifo_packet_count -= MAX_FIFO_PACKETS_PER_READ;
             }else {
-                FXAS21002_DATA_READ[0].numBytes = fifo_packet_count * 6;
+                dataRead[0].numBytes = fifo_packet_count * 6;
                 fifo_packet_count = 0;
             }
             status = Sensor_I2C_Read(&sensor->deviceInfo,
-                                     sensor->addr, FXAS21002_DATA_READ,
+                                     sensor->addr, dataRead,
                                      I2C_Buffer);
             if (status==SENSOR_ERROR_NONE) {
-                for (j = 0; j < FXAS21002_DATA_READ[0].numBytes; j+=6) {
-                    // place the measurements read into the gyroscope buffer structure
-                    sample[CHX] = (I2C_Buffer[j + 0] << 8) | I2C_Buffer[j + 1];
-                    sample[CHY] = (I2C_Buffer[j + 2] << 8) | I2C_Buffer[j + 3];
-                    sample[CHZ] = (I2C_Buffer[j + 4] << 8) | I2C_Buffer[j + 5];
-                    conditionSample(sample);  // truncate negative values to -32767
-                    addToFifo((union FifoSensor*) &(sfg->Gyro), GYRO_FIFO_SIZE, sample);
-                }
+                // place the measurements read into the gyroscope buffer structure,
+                // truncating negative values to -32767
+                addBlockToFifo((union FifoSensor*) &(sfg->Gyro), GYRO_FIFO_SIZE,
+                               I2C_Buffer, dataRead[0].numBytes / 6);
             }
         }
     }   // end of optimized FXAS21002 FIFO read
@@ -310,6 +296,51 @@ const registerwritelist_t   FXAS21002_IDLE[] =
     __END_WRITE_DATA__
 };
 
+// CTRL_REG1 value (active) for a requested ODR. Same selections as the GYRO_ODR_HZ
+// chains in the *_INITIALIZATION lists, but made at run time.
+static uint8_t FXAS21002_CtrlReg1ForODR(uint8_t whoAmI, uint16_t odr_hz)
+{
+    if (whoAmI == FXAS21000_WHO_AM_I_VALUE) {
+        if (odr_hz <= 1) return 0x1E;       // 1.5625Hz
+        if (odr_hz <= 3) return 0x1A;       // 3.125Hz
+        if (odr_hz <= 6) return 0x16;       // 6.25Hz
+        if (odr_hz <= 12) return 0x12;      // 12.5Hz
+        if (odr_hz <= 25) return 0x0E;      // 25Hz
+        if (odr_hz <= 50) return 0x0A;      // 50Hz
+        if (odr_hz <= 100) return 0x06;     // 100Hz
+        return 0x02;                        // 200Hz
+    }
+    if (odr_hz <= 12) return 0x1A;          // 12.5Hz
+    if (odr_hz <= 25) return 0x16;          // 25Hz
+    if (odr_hz <= 50) return 0x12;          // 50Hz
+    if (odr_hz <= 100) return 0x0E;         // 100Hz
+    if (odr_hz <= 200) return 0x0A;         // 200Hz
+    if (odr_hz <= 400) return 0x06;         // 400Hz
+    return 0x02;                            // 800Hz
+}
+
+// FXAS21002_SetODR reprograms the gyro ODR to sfg->RateCtrl.iGyroODR, and sets the
+// FIFO watermark to the number of samples expected per fusion cycle (this only
+// affects the watermark status flag and interrupt; reads still drain the whole FIFO).
+int8_t FXAS21002_SetODR(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
+{
+    uint16_t watermark = sfg->RateCtrl.iGyroODR / FUSION_HZ;
+    if (watermark < 1) watermark = 1;
+    if (watermark > FXAS21002_F_SETUP_F_WMRK_MASK) watermark = FXAS21002_F_SETUP_F_WMRK_MASK;
+    // F_SETUP and CTRL_REG1 are at the same addresses on the FXAS21000
+    registerwritelist_t FXAS21002_SET_ODR[] =
+    {
+        { FXAS21002_CTRL_REG1, 0x00, 0x00 },                    // standby
+        { FXAS21002_F_SETUP, (uint8_t)(0x40 | watermark), 0x00 },  // FIFO continuous mode + watermark
+        { FXAS21002_CTRL_REG1, FXAS21002_CtrlReg1ForODR(sfg->Gyro.iWhoAmI, sfg->RateCtrl.iGyroODR), 0x00 },
+        __END_WRITE_DATA__
+    };
+    if (sensor->isInitialized != F_USING_GYRO) {
+        return SENSOR_ERROR_INIT;
+    }
+    return Sensor_I2C_Write_List(&sensor->deviceInfo, sensor->addr, FXAS21002_SET_ODR);
+}
+
 // FXAS21002_Idle places the gyro into READY mode (wakeup time = 1/ODR+5ms)
 int8_t FXAS21002_Idle(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg)
 {
@@ -850,6 +850,11 @@ typedef union {
                                                                     /*  burst read operation.                             */
 /*------------------------------*/
 
+/* The pre-production FXAS21000 is handled by the same driver. */
+#define FXAS21000_WHO_AM_I_VALUE        0xD1    // engineering and production
+#define FXAS21000_COUNTSPERDEGPERSEC    20      // 1600dps range
+#define FXAS21002_COUNTSPERDEGPERSEC    16      // for 2000dps=32000 counts
+
 
 #ifdef __cplusplus
 }
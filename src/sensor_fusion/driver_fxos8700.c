@@ -32,12 +32,6 @@ const registerReadlist_t    FXOS8700_F_STATUS_READ[] =
     { .readFrom = FXOS8700_STATUS, .numBytes = 1 }, __END_READ_DATA__
 };
 
-// Command definition to read the number of entries in the accel FIFO.
-registerReadlist_t          FXOS8700_DATA_READ[] =
-{
-    { .readFrom = FXOS8700_OUT_X_MSB, .numBytes = 6 }, __END_READ_DATA__
-};
-
 // Each entry in a RegisterWriteList is composed of: register address, value to write, bit-mask to apply to write (0 enables)
 const registerwritelist_t   FXOS8700_Initialization[] =
 {
@@ -124,9 +118,6 @@ const registerwritelist_t   FXOS8700_Initialization[] =
     __END_WRITE_DATA__
 };
 
-#define FXOS8700_COUNTSPERG     8192        //assumes +/-4 g range on accelerometer
-#define FXOS8700_COUNTSPERUT    10
-
 // All sensor drivers and initialization functions have a similar prototype
 // sensor = pointer to linked list element used by the sensor fusion subsystem to specify required sensors
 // sfg = pointer to top level data structure for sensor fusion
@@ -154,27 +145,31 @@ int8_t FXOS8700_Init(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg) {
     int32_t status;
     uint8_t reg;
 
-    status = Sensor_I2C_Read_Register(&sensor->deviceInfo, sensor->addr, FXOS8700_WHO_AM_I, 1, &reg);
+    // a sensor installed with a SensorIdentity has already been checked and
+    // scaled (see FXOS8700Traits in sensor_drivers.h)
+    if (NULL == sensor->identity) {
+        status = Sensor_I2C_Read_Register(&sensor->deviceInfo, sensor->addr, FXOS8700_WHO_AM_I, 1, &reg);
 
-    if (status==SENSOR_ERROR_NONE) {
+        if (status==SENSOR_ERROR_NONE) {
 #if F_USING_ACCEL
-       sfg->Accel.iWhoAmI = reg;
-       sfg->Accel.iCountsPerg = FXOS8700_COUNTSPERG;
-       sfg->Accel.fgPerCount = 1.0F / FXOS8700_COUNTSPERG;
+           sfg->Accel.iWhoAmI = reg;
+           sfg->Accel.iCountsPerg = FXOS8700_COUNTSPERG;
+           sfg->Accel.fgPerCount = 1.0F / FXOS8700_COUNTSPERG;
 #endif
 #if F_USING_MAG
-       sfg->Mag.iWhoAmI = reg;
-       sfg->Mag.iCountsPeruT = FXOS8700_COUNTSPERUT;
-       sfg->Mag.fCountsPeruT = (float) FXOS8700_COUNTSPERUT;
-       sfg->Mag.fuTPerCount = 1.0F / FXOS8700_COUNTSPERUT;
+           sfg->Mag.iWhoAmI = reg;
+           sfg->Mag.iCountsPeruT = FXOS8700_COUNTSPERUT;
+           sfg->Mag.fCountsPeruT = (float) FXOS8700_COUNTSPERUT;
+           sfg->Mag.fuTPerCount = 1.0F / FXOS8700_COUNTSPERUT;
 #endif
-       if (reg != FXOS8700_WHO_AM_I_PROD_VALUE) {
-          return SENSOR_ERROR_INIT;  // The whoAmI did not match
-       }
-    } else {
-        // whoAmI will retain default value of zero
-        // return with error
-        return status;
+           if (reg != FXOS8700_WHO_AM_I_PROD_VALUE) {
+              return SENSOR_ERROR_INIT;  // The whoAmI did not match
+           }
+        } else {
+            // whoAmI will retain default value of zero
+            // return with error
+            return status;
+        }
     }
 
     // Configure and start the fxos8700 sensor.  This does multiple register writes
@@ -193,11 +188,11 @@ int8_t FXOS8700_Init(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg) {
 
 #if F_USING_ACCEL
 int8_t FXOS8700_Accel_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg) {
-    uint8_t                     I2C_Buffer[6 * ACCEL_FIFO_SIZE];    // I2C read buffer
+    uint8_t                     I2C_Buffer[6 * ACCEL_FIFO_SIZE] __attribute__((aligned(4)));    // I2C read buffer
     int32_t                     status;         // I2C transaction status
-    int8_t                      j;              // scratch
     uint8_t                     fifo_packet_count;
-    int16_t                     sample[3];
+    // read command, on the stack as sensors on other buses may be read concurrently
+    registerReadlist_t          dataRead[] = { { .readFrom = FXOS8700_OUT_X_MSB, .numBytes = 6 }, __END_READ_DATA__ };
 
     if(!(sensor->isInitialized & F_USING_ACCEL)) {
        return SENSOR_ERROR_INIT;
@@ -229,27 +224,21 @@ int8_t FXOS8700_Accel_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *s
     // auto-increment and wrap turned on, the registers are read
     // 0x01,0x02,...0x05,0x06,0x01,0x02,...  So we read 6 bytes per packet.
 #define MAX_FIFO_PACKETS_PER_READ 15  // for max of 90 bytes per I2C xaction.
-    FXOS8700_DATA_READ[0].readFrom = FXOS8700_OUT_X_MSB;  
     while ((fifo_packet_count > 0) && (status == SENSOR_ERROR_NONE)) {
       if (MAX_FIFO_PACKETS_PER_READ < fifo_packet_count) {
-        FXOS8700_DATA_READ[0].numBytes = 6 * MAX_FIFO_PACKETS_PER_READ;
+        dataRead[0].numBytes = 6 * MAX_FIFO_PACKETS_PER_READ;
         fifo_packet_count -= MAX_FIFO_PACKETS_PER_READ;
       } else {
-        FXOS8700_DATA_READ[0].numBytes = 6 * fifo_packet_count;
+        dataRead[0].numBytes = 6 * fifo_packet_count;
         fifo_packet_count = 0;
       }
       status = Sensor_I2C_Read(&sensor->deviceInfo,
-                               sensor->addr, FXOS8700_DATA_READ, I2C_Buffer);
+                               sensor->addr, dataRead, I2C_Buffer);
       if (status == SENSOR_ERROR_NONE) {
-        for (j = 0; j < FXOS8700_DATA_READ[0].numBytes; j+=6) {
-            // place the measurements read into the accelerometer buffer structure 
-            sample[CHX] = (I2C_Buffer[j + 0] << 8) | (I2C_Buffer[j + 1]); 
-            sample[CHY] = (I2C_Buffer[j + 2] << 8) | (I2C_Buffer[j + 3]); 
-            sample[CHZ] = (I2C_Buffer[j + 4] << 8) | (I2C_Buffer[j + 5]);
-            conditionSample(sample);  //truncate negative values to -32767
-            // place the 6 bytes read into the 16 bit accelerometer structure 
-            addToFifo((union FifoSensor*) &(sfg->Accel), ACCEL_FIFO_SIZE, sample);
-        } // end transfer all bytes from each packet
+        // place the measurements read into the accelerometer buffer structure,
+        // truncating negative values to -32767
+        addBlockToFifo((union FifoSensor*) &(sfg->Accel), ACCEL_FIFO_SIZE,
+                       I2C_Buffer, dataRead[0].numBytes / 6);
       } // end processing a burst read
     } // end emptying all packets from FIFO
     return (status);
@@ -259,9 +248,9 @@ int8_t FXOS8700_Accel_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *s
 #if F_USING_MAG
 // read FXOS8700 magnetometer over I2C
 int8_t FXOS8700_Mag_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg) {
-    uint8_t                     I2C_Buffer[6];  // I2C read buffer
+    uint8_t                     I2C_Buffer[6] __attribute__((aligned(4)));  // I2C read buffer
     int32_t                     status;         // I2C transaction status
-    int16_t                     sample[3];
+    registerReadlist_t          dataRead[] = { { .readFrom = FXOS8700_M_OUT_X_MSB, .numBytes = 6 }, __END_READ_DATA__ };
 
     if(!(sensor->isInitialized & F_USING_MAG))
     {
@@ -269,16 +258,10 @@ int8_t FXOS8700_Mag_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg
     }
 
     // read the six sequential magnetometer output bytes
-    FXOS8700_DATA_READ[0].readFrom = FXOS8700_M_OUT_X_MSB;
-    FXOS8700_DATA_READ[0].numBytes = 6;
-    status =  Sensor_I2C_Read(&sensor->deviceInfo, sensor->addr, FXOS8700_DATA_READ, I2C_Buffer );
+    status =  Sensor_I2C_Read(&sensor->deviceInfo, sensor->addr, dataRead, I2C_Buffer );
     if (status==SENSOR_ERROR_NONE) {
         // place the 6 bytes read into the magnetometer structure
-        sample[CHX] = (I2C_Buffer[0] << 8) | I2C_Buffer[1];
-        sample[CHY] = (I2C_Buffer[2] << 8) | I2C_Buffer[3];
-        sample[CHZ] = (I2C_Buffer[4] << 8) | I2C_Buffer[5];
-        conditionSample(sample);  // truncate negative values to -32767
-        addToFifo((union FifoSensor*) &(sfg->Mag), MAG_FIFO_SIZE, sample);
+        addBlockToFifo((union FifoSensor*) &(sfg->Mag), MAG_FIFO_SIZE, I2C_Buffer, 1);
     }
     return status;
 }//end FXOS8700_ReadMagData()
@@ -288,15 +271,14 @@ int8_t FXOS8700_Mag_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg
 int8_t FXOS8700_Therm_Read(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg) {
     int8_t                      I2C_Buffer;     // I2C read buffer
     int32_t                     status;         // I2C transaction status
+    registerReadlist_t          dataRead[] = { { .readFrom = FXOS8700_TEMP, .numBytes = 1 }, __END_READ_DATA__ };
 
     if(!(sensor->isInitialized)) {
         return SENSOR_ERROR_INIT;
     }
 
     // read the Temperature register 0x51
-    FXOS8700_DATA_READ[0].readFrom = FXOS8700_TEMP;
-    FXOS8700_DATA_READ[0].numBytes = 1;
-    status =  Sensor_I2C_Read(&sensor->deviceInfo, sensor->addr, FXOS8700_DATA_READ, (uint8_t*)(&I2C_Buffer) );
+    status =  Sensor_I2C_Read(&sensor->deviceInfo, sensor->addr, dataRead, (uint8_t*)(&I2C_Buffer) );
     if (status==SENSOR_ERROR_NONE) {
         // convert the byte to temperature and place in sfg structure
         sfg->Temp.temperatureC = (float)I2C_Buffer * 0.96; //section 14.3 of manual says 0.96 degC/LSB
@@ -330,6 +312,40 @@ const registerwritelist_t   FXOS8700_FULL_IDLE[] =
     __END_WRITE_DATA__
 };
 
+// CTRL_REG1 value (low noise, active) for a requested ODR. Same selection as
+// the ACCEL_ODR_HZ chain in FXOS8700_Initialization, but made at run time.
+static uint8_t FXOS8700_CtrlReg1ForODR(uint16_t odr_hz) {
+    if (odr_hz <= 1) return 0x3D;           // 0.78Hz
+    if (odr_hz <= 3) return 0x35;           // 3.125Hz
+    if (odr_hz <= 6) return 0x2D;           // 6.25Hz
+    if (odr_hz <= 30) return 0x25;          // 25Hz
+    if (odr_hz <= 50) return 0x1D;          // 50Hz
+    if (odr_hz <= 100) return 0x15;         // 100Hz
+    if (odr_hz <= 200) return 0x0D;         // 200Hz
+    return 0x05;                            // 400Hz
+}
+
+// FXOS8700_SetODR reprograms the accel/mag ODR to sfg->RateCtrl.iAccelODR, and sets
+// the FIFO watermark to the number of samples expected per fusion cycle (this only
+// affects the F_WMRK_FLAG status bit and interrupt; reads still drain the whole FIFO).
+// The part is passed through standby, as required for changing CTRL_REG1 and F_SETUP.
+int8_t FXOS8700_SetODR(struct PhysicalSensor *sensor, SensorFusionGlobals *sfg) {
+    uint16_t watermark = sfg->RateCtrl.iAccelODR / FUSION_HZ;
+    if (watermark < 1) watermark = 1;
+    if (watermark > FXOS8700_F_SETUP_F_WMRK_MASK) watermark = FXOS8700_F_SETUP_F_WMRK_MASK;
+    registerwritelist_t FXOS8700_SET_ODR[] =
+    {
+        { FXOS8700_CTRL_REG1, 0x00, 0x00 },                     // standby
+        { FXOS8700_F_SETUP, (uint8_t)(0x40 | watermark), 0x00 },  // FIFO continuous mode + watermark
+        { FXOS8700_CTRL_REG1, FXOS8700_CtrlReg1ForODR(sfg->RateCtrl.iAccelODR), 0x00 },
+        __END_WRITE_DATA__
+    };
+    if (!(sensor->isInitialized & F_USING_ACCEL)) {
+        return SENSOR_ERROR_INIT;
+    }
+    return Sensor_I2C_Write_List(&sensor->deviceInfo, sensor->addr, FXOS8700_SET_ODR);
+} // end FXOS8700_SetODR()
+
 // FXOS8700_Idle places the entire sensor into STANDBY mode (wakeup time = 1/ODR+1ms)
 // This driver is all-on or all-off. It does not support mag or accel only.
 // If you want that functionality, you can write your own using the initialization
@@ -64,6 +64,10 @@ typedef struct
  *  @brief  Is the Slave Select Pin Active Low or High. */
 #define FXOS8700_SS_ACTIVE_VALUE SPI_SS_ACTIVE_LOW
 
+/*! @brief  Scales set up by FXOS8700_Initialization (driver_fxos8700.c). */
+#define FXOS8700_COUNTSPERG     8192        //assumes +/-4 g range on accelerometer
+#define FXOS8700_COUNTSPERUT    10
+
 /*******************************************************************************
  * APIs
  ******************************************************************************/
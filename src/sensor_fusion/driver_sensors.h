@@ -57,6 +57,11 @@ int8_t FXOS8700_Therm_Read(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
 int8_t FXOS8700_Read(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
 int8_t FXAS21002_Read(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
 
+/// Optional functions applying the run-time ODRs chosen by the rate controller
+/// (see rate_control.h). Installed in PhysicalSensor.setODR.
+int8_t FXOS8700_SetODR(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
+int8_t FXAS21002_SetODR(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
+
 int8_t FXOS8700_Idle(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
 int8_t FXAS21002_Idle(PhysicalSensor *sensor, SensorFusionGlobals *sfg);
 
@@ -96,7 +96,8 @@ typedef struct
 {
     registeridlefunction_t idleFunction;
     void *functionParam;
-    uint8_t deviceInstance;
+    uint8_t deviceInstance; /* I2C bus the device is attached to (0 = Wire, 1 = Wire1).*/
+    uint32_t clockHz;       /* I2C clock used when talking to the device (0 = bus default).*/
 } registerDeviceInfo_t;
 
 
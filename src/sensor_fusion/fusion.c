@@ -13,7 +13,9 @@
     \brief Lower level sensor fusion interface
 */
 
+#include <float.h>
 #include <math.h>
+#include <string.h>
 
 #include "sensor_fusion.h"
 #include "approximations.h"
@@ -53,9 +55,11 @@ void fInitializeFusion(SensorFusionGlobals *sfg)
 #endif
 #if F_6DOF_GY_KALMAN
     sfg->SV_6DOF_GY_KALMAN.resetflag  = true;
+    memset(&sfg->SV_6DOF_GY_KALMAN.health, 0, sizeof(struct KalmanHealth));
 #endif
 #if F_9DOF_GBY_KALMAN
     sfg->SV_9DOF_GBY_KALMAN.resetflag = true;
+    memset(&sfg->SV_9DOF_GBY_KALMAN.health, 0, sizeof(struct KalmanHealth));
 #endif
 
     // reset the loop counter to zero for first iteration
@@ -196,6 +200,9 @@ void fInit_3DOF_G_BASIC(struct SV_3DOF_G_BASIC *pthisSV,
 #endif
     fQuaternionFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPq));
 
+    // the Euler angles and rotation vector follow from the orientation matrix
+    pthisSV->iDerive = DERIVE_ANGLES | DERIVE_NO_YAW;
+
     // clear the reset flag
     pthisSV->resetflag = false;
 
@@ -224,6 +231,9 @@ void fInit_3DOF_B_BASIC(struct SV_3DOF_B_BASIC *pthisSV,
 #endif
     fQuaternionFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPq));
 
+    // the Euler angles and rotation vector follow from the orientation matrix
+    pthisSV->iDerive = DERIVE_ANGLES;
+
     // clear the reset flag
     pthisSV->resetflag = false;
 
@@ -239,6 +249,9 @@ void fInit_3DOF_Y_BASIC(struct SV_3DOF_Y_BASIC *pthisSV)
     f3x3matrixAeqI(pthisSV->fR);
     fqAeq1(&(pthisSV->fq));
 
+    // the Euler angles and rotation vector follow from the orientation matrix
+    pthisSV->iDerive = DERIVE_ANGLES;
+
     // clear the reset flag
     pthisSV->resetflag = false;
 
@@ -270,12 +283,46 @@ void fInit_6DOF_GB_BASIC(struct SV_6DOF_GB_BASIC *pthisSV,
 #endif
     fQuaternionFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPq));
 
+    // the Euler angles and rotation vector follow from the orientation matrix
+    pthisSV->iDerive = DERIVE_ANGLES;
+
     // clear the reset flag
     pthisSV->resetflag = false;
 
     return;
 }   // end fInit_6DOF_GB_BASIC
 
+// function sets the noise parameters of the 6DOF accel + gyro Kalman filter and the
+// product terms derived from them. It may be called while the filter is running.
+void fSetNoise_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV, float fQvY, float fQvG, float fQwb)
+{
+    float fAlphaOver2 = FPIOVER180 / (2.0F * (float) FUSION_HZ);
+
+    pthisSV->fQvY = fQvY;
+    pthisSV->fQvGMin = fQvG;
+    pthisSV->fQwb = fQwb;
+    pthisSV->fQwbOver3 = fQwb / 3.0F;
+    pthisSV->fAlphaQwbOver6 = fAlphaOver2 * pthisSV->fQwbOver3;
+    pthisSV->fAlphaSqQvYQwbOver12 = fAlphaOver2 * fAlphaOver2 * (fQvY + fQwb) / 3.0F;
+    pthisSV->fMaxGyroOffsetChange = sqrtf(fabs(fQwb)) / (float)FUSION_HZ;
+}   // end fSetNoise_6DOF_GY_KALMAN
+
+// function sets the noise parameters of the 9DOF Kalman filter and the
+// product terms derived from them. It may be called while the filter is running.
+void fSetNoise_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, float fQvY, float fQvG, float fQvB, float fQwb)
+{
+    float fAlphaOver2 = FPIOVER180 / (2.0F * (float) FUSION_HZ);
+
+    pthisSV->fQvY = fQvY;
+    pthisSV->fQvGMin = fQvG;
+    pthisSV->fQvBMin = fQvB;
+    pthisSV->fQwb = fQwb;
+    pthisSV->fQwbOver3 = fQwb / 3.0F;
+    pthisSV->fAlphaQwbOver6 = fAlphaOver2 * pthisSV->fQwbOver3;
+    pthisSV->fAlphaSqQvYQwbOver12 = fAlphaOver2 * fAlphaOver2 * (fQvY + fQwb) / 3.0F;
+    pthisSV->fMaxGyroOffsetChange = sqrtf(fabs(fQwb)) / (float)FUSION_HZ;
+}   // end fSetNoise_9DOF_GBY_KALMAN
+
 // function initalizes the 6DOF accel + gyro Kalman filter algorithm
 void fInit_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
                           struct AccelSensor *pthisAccel,
@@ -285,12 +332,10 @@ void fInit_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
 
     // compute and store useful product terms to save floating point calculations later
     pthisSV->fdeltat = 1.0F / (float) FUSION_HZ;
-    pthisSV->fQwbOver3 = FQWB_6DOF_GY_KALMAN / 3.0F;
     pthisSV->fAlphaOver2 = FPIOVER180 * pthisSV->fdeltat / 2.0F;
     pthisSV->fAlphaSqOver4 = pthisSV->fAlphaOver2 * pthisSV->fAlphaOver2;
-    pthisSV->fAlphaQwbOver6 = pthisSV->fAlphaOver2 * pthisSV->fQwbOver3;
-    pthisSV->fAlphaSqQvYQwbOver12 = pthisSV->fAlphaSqOver4 * (FQVY_6DOF_GY_KALMAN + FQWB_6DOF_GY_KALMAN) / 3.0F;
-    pthisSV->fMaxGyroOffsetChange = sqrtf(fabs(FQWB_6DOF_GY_KALMAN)) / (float)FUSION_HZ;
+    // the noise parameters are kept, as they may have been changed at run time
+    fSetNoise_6DOF_GY_KALMAN(pthisSV, pthisSV->fQvY, pthisSV->fQvGMin, pthisSV->fQwb);
 
     // zero the a posteriori gyro offset and error vectors
     for (i = CHX; i <= CHZ; i++)
@@ -332,6 +377,9 @@ void fInit_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
 #endif
     fQuaternionFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fqPl));
 
+    // the Euler angles and rotation vector follow from the orientation matrix
+    pthisSV->iDerive = DERIVE_ANGLES;
+
     // clear the reset flag
     pthisSV->resetflag = false;
 
@@ -348,12 +396,10 @@ void fInit_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSenso
     // compute and store useful product terms to save floating point calculations later
     pthisSV->fdeltat = 1.0F / (float) FUSION_HZ;
     pthisSV->fgdeltat = GTOMSEC2 * pthisSV->fdeltat;
-    pthisSV->fQwbOver3 = FQWB_9DOF_GBY_KALMAN / 3.0F;
     pthisSV->fAlphaOver2 = FPIOVER180 * pthisSV->fdeltat / 2.0F;
     pthisSV->fAlphaSqOver4 = pthisSV->fAlphaOver2 * pthisSV->fAlphaOver2;
-    pthisSV->fAlphaQwbOver6 = pthisSV->fAlphaOver2 * pthisSV->fQwbOver3;
-    pthisSV->fAlphaSqQvYQwbOver12 = pthisSV->fAlphaSqOver4 * (FQVY_9DOF_GBY_KALMAN + FQWB_9DOF_GBY_KALMAN) / 3.0F;
-    pthisSV->fMaxGyroOffsetChange = sqrtf(fabs(FQWB_9DOF_GBY_KALMAN)) / (float)FUSION_HZ;
+    // the noise parameters are kept, as they may have been changed at run time
+    fSetNoise_9DOF_GBY_KALMAN(pthisSV, pthisSV->fQvY, pthisSV->fQvGMin, pthisSV->fQvBMin, pthisSV->fQwb);
 
     // zero the a posteriori error vectors and inertial outputs
     for (i = CHX; i <= CHZ; i++) {
@@ -362,6 +408,8 @@ void fInit_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSenso
         pthisSV->fbErrPl[i] = 0.0F;
         pthisSV->fVelGl[i] = 0.0F;
         pthisSV->fDisGl[i] = 0.0F;
+        fAccumSet(&pthisSV->aVelGl[i], 0.0F);
+        fAccumSet(&pthisSV->aDisGl[i], 0.0F);
     }
 
     // check to see if a gyro calibration exists in flash
@@ -398,6 +446,9 @@ void fInit_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSenso
 #endif
     fQuaternionFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fqPl));
 
+    // the Euler angles and rotation vector follow from the orientation matrix
+    pthisSV->iDerive = DERIVE_ANGLES;
+
     // clear the reset flag
     pthisSV->resetflag = false;
 
@@ -454,27 +505,9 @@ void fRun_3DOF_G_BASIC(struct SV_3DOF_G_BASIC *pthisSV,
     fLPFOrientationQuaternion(&(pthisSV->fq), &(pthisSV->fLPq), pthisSV->flpf,
                               pthisSV->fdeltat, pthisSV->fOmega);
 
-    // compute the low pass rotation matrix and rotation vector from low pass filtered quaternion
-    fRotationMatrixFromQuaternion(pthisSV->fLPR, &(pthisSV->fLPq));
-    fRotationVectorDegFromQuaternion(&(pthisSV->fLPq), pthisSV->fLPRVec);
-
-    // calculate the Euler angles from the low pass orientation matrix
-#if THISCOORDSYSTEM == NED
-    fNEDAnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                    &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                    &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#elif THISCOORDSYSTEM == ANDROID
-    fAndroidAnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                        &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                        &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#else // WIN8
-    fWin8AnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                     &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                     &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#endif
-
-    // force the yaw and compass angles to zero
-    pthisSV->fLPPsi = pthisSV->fLPRho = 0.0F;
+    // leave the orientation matrix, Euler angles and rotation vector to fUpdateDerivedOutputs()
+    // with the yaw and compass angles forced to zero
+    pthisSV->iDerive = DERIVE_MATRIX | DERIVE_ANGLES | DERIVE_NO_YAW;
 
     return;
 }   // end fRun_3DOF_G_BASIC
@@ -503,24 +536,9 @@ void fRun_3DOF_B_BASIC(struct SV_3DOF_B_BASIC *pthisSV, struct MagSensor *pthisM
     fLPFOrientationQuaternion(&(pthisSV->fq), &(pthisSV->fLPq), pthisSV->flpf,
                               pthisSV->fdeltat, pthisSV->fOmega);
 
-    // compute the low pass rotation matrix and rotation vector from low pass filtered quaternion
-    fRotationMatrixFromQuaternion(pthisSV->fLPR, &(pthisSV->fLPq));
-    fRotationVectorDegFromQuaternion(&(pthisSV->fLPq), pthisSV->fLPRVec);
+    // leave the orientation matrix, Euler angles and rotation vector to fUpdateDerivedOutputs()
+    pthisSV->iDerive = DERIVE_MATRIX | DERIVE_ANGLES;
 
-    // calculate the Euler angles from the low pass orientation matrix
-#if THISCOORDSYSTEM == NED
-    fNEDAnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                    &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                    &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#elif THISCOORDSYSTEM == ANDROID
-    fAndroidAnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                        &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                        &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#else // WIN8
-    fWin8AnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                     &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                     &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#endif
     return;
 }
 
@@ -551,24 +569,9 @@ void fRun_3DOF_Y_BASIC(struct SV_3DOF_Y_BASIC *pthisSV,
     qAeqAxB(&(pthisSV->fq), &ftmpq);
     fqAeqNormqA(&(pthisSV->fq));
 
-    // get the rotation matrix and rotation vector from the orientation quaternion fq
-    fRotationMatrixFromQuaternion(pthisSV->fR, &(pthisSV->fq));
-    fRotationVectorDegFromQuaternion(&(pthisSV->fq), pthisSV->fRVec);
+    // leave the orientation matrix, Euler angles and rotation vector to fUpdateDerivedOutputs()
+    pthisSV->iDerive = DERIVE_MATRIX | DERIVE_ANGLES;
 
-    // compute the Euler angles from the orientation matrix
-#if THISCOORDSYSTEM == NED
-    fNEDAnglesDegFromRotationMatrix(pthisSV->fR, &(pthisSV->fPhi),
-                                    &(pthisSV->fThe), &(pthisSV->fPsi),
-                                    &(pthisSV->fRho), &(pthisSV->fChi));
-#elif THISCOORDSYSTEM == ANDROID
-    fAndroidAnglesDegFromRotationMatrix(pthisSV->fR, &(pthisSV->fPhi),
-                                        &(pthisSV->fThe), &(pthisSV->fPsi),
-                                        &(pthisSV->fRho), &(pthisSV->fChi));
-#else // WIN8
-    fWin8AnglesDegFromRotationMatrix(pthisSV->fR, &(pthisSV->fPhi),
-                                     &(pthisSV->fThe), &(pthisSV->fPsi),
-                                     &(pthisSV->fRho), &(pthisSV->fChi));
-#endif
     return;
 }                       // end fRun_3DOF_Y_BASIC
 
@@ -600,24 +603,8 @@ void fRun_6DOF_GB_BASIC(struct SV_6DOF_GB_BASIC *pthisSV,
     fLPFOrientationQuaternion(&(pthisSV->fq), &(pthisSV->fLPq), pthisSV->flpf,
                               pthisSV->fdeltat, pthisSV->fOmega);
 
-    // compute the low pass rotation matrix and rotation vector from low pass filtered quaternion
-    fRotationMatrixFromQuaternion(pthisSV->fLPR, &(pthisSV->fLPq));
-    fRotationVectorDegFromQuaternion(&(pthisSV->fLPq), pthisSV->fLPRVec);
-
-    // calculate the Euler angles from the low pass orientation matrix
-#if THISCOORDSYSTEM == NED
-    fNEDAnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                    &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                    &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#elif THISCOORDSYSTEM == ANDROID
-    fAndroidAnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                        &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                        &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#else // WIN8
-    fWin8AnglesDegFromRotationMatrix(pthisSV->fLPR, &(pthisSV->fLPPhi),
-                                     &(pthisSV->fLPThe), &(pthisSV->fLPPsi),
-                                     &(pthisSV->fLPRho), &(pthisSV->fLPChi));
-#endif
+    // leave the orientation matrix, Euler angles and rotation vector to fUpdateDerivedOutputs()
+    pthisSV->iDerive = DERIVE_MATRIX | DERIVE_ANGLES;
 
     // low pass filter the geomagnetic inclination angle with a simple exponential filter
     pthisSV->fLPDelta += pthisSV->flpf * (pthisSV->fDelta - pthisSV->fLPDelta);
@@ -625,6 +612,82 @@ void fRun_6DOF_GB_BASIC(struct SV_6DOF_GB_BASIC *pthisSV,
     return;
 }   // end fRun_6DOF_GB_BASIC
 
+#if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+// check the n x n Kalman covariance matrix Qw (row major at pQw): returns KALMAN_FAULT_DIAGONAL if a diagonal
+// element is not positive and finite, and KALMAN_FAULT_SYMMETRY if an element differs from its transpose.
+// The filters build Qw with exactly mirrored elements, so any difference (including a NaN) is a fault.
+static uint8_t iCheckCovariance(const float *pQw, int8_t n)
+{
+    uint8_t     iFaults;            // KALMAN_FAULT_* flags
+    int8_t      i,
+                j;                  // loop counters
+
+    iFaults = 0;
+    for (i = 0; i < n; i++)
+    {
+        // written so that NaN and infinity also fail
+        if (!((pQw[i * n + i] > 0.0F) && (pQw[i * n + i] <= FLT_MAX)))
+            iFaults |= KALMAN_FAULT_DIAGONAL;
+        for (j = i + 1; j < n; j++)
+            if (pQw[i * n + j] != pQw[j * n + i])
+                iFaults |= KALMAN_FAULT_SYMMETRY;
+    }
+
+    return iFaults;
+}   // end iCheckCovariance
+
+// check the a posteriori orientation quaternion and gyro offset vector: returns KALMAN_FAULT_STATE if any
+// component is not finite
+static uint8_t iCheckState(const Quaternion *pq, const float fbPl[])
+{
+    // written so that NaN also fails
+    if ((fabsf(pq->q0) <= FLT_MAX) && (fabsf(pq->q1) <= FLT_MAX) &&
+        (fabsf(pq->q2) <= FLT_MAX) && (fabsf(pq->q3) <= FLT_MAX) &&
+        (fabsf(fbPl[CHX]) <= FLT_MAX) && (fabsf(fbPl[CHY]) <= FLT_MAX) && (fabsf(fbPl[CHZ]) <= FLT_MAX))
+        return 0;
+
+    return KALMAN_FAULT_STATE;
+}   // end iCheckState
+
+// record a cycle's KALMAN_FAULT_* flags in the filter's health counters and request a reset initialization
+// when the filter cannot recover by itself: at once for a faulty Qw or state, which would otherwise feed
+// into every later cycle, and after KALMAN_MAX_GAIN_FAULTS cycles in a row without a Kalman gain, during
+// which the filter has been running on the gyro alone.
+static void fUpdateKalmanHealth(struct KalmanHealth *pHealth, uint8_t iFaults, int8_t *presetflag)
+{
+    pHealth->iLastFaults = iFaults;
+    if (!iFaults)
+    {
+        pHealth->iConsecutiveGainFaults = 0;
+        return;
+    }
+
+    // count the faults
+    pHealth->iFaultCycles++;
+    if (iFaults & KALMAN_FAULT_DIAGONAL) pHealth->iDiagonalFaults++;
+    if (iFaults & KALMAN_FAULT_SYMMETRY) pHealth->iSymmetryFaults++;
+    if (iFaults & KALMAN_FAULT_STATE) pHealth->iStateFaults++;
+    if (iFaults & KALMAN_FAULT_GAIN)
+    {
+        pHealth->iGainFaults++;
+        pHealth->iConsecutiveGainFaults++;
+    }
+    else
+        pHealth->iConsecutiveGainFaults = 0;
+
+    // request a reset initialization for the next cycle if needed
+    if ((iFaults & (KALMAN_FAULT_DIAGONAL | KALMAN_FAULT_SYMMETRY | KALMAN_FAULT_STATE)) ||
+        (pHealth->iConsecutiveGainFaults >= KALMAN_MAX_GAIN_FAULTS))
+    {
+        *presetflag = true;
+        pHealth->iResets++;
+        pHealth->iConsecutiveGainFaults = 0;
+    }
+
+    return;
+}   // end fUpdateKalmanHealth
+#endif // #if F_6DOF_GY_KALMAN || F_9DOF_GBY_KALMAN
+
 // 6DOF accelerometer+gyroscope orientation function implemented using indirect complementary Kalman filter
 void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
                          struct AccelSensor *pthisAccel,
@@ -642,16 +705,11 @@ void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
     Quaternion  ftmpq;              // scratch quaternion
     float       ftmp;               // scratch float
     int8_t        ierror;             // matrix inversion error flag
+    uint8_t     iFaults;            // KALMAN_FAULT_* flags of this cycle
     int8_t        i,
                 j,
                 k;                  // loop counters
 
-    // working arrays for 3x3 matrix inversion
-    float       *pfRows[3];
-    int8_t        iColInd[3];
-    int8_t        iRowInd[3];
-    int8_t        iPivot[3];
-
     // if requested, do a reset initialization with no further processing
     if (pthisSV->resetflag)
     {
@@ -801,7 +859,7 @@ void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
     // calculate the vector fQv containing the diagonal elements of the measurement covariance matrix Qv
     ftmp = fmodGc - 1.0F;
     fQvGQa = 3.0F * ftmp * ftmp;
-    if (fQvGQa < FQVG_6DOF_GY_KALMAN) fQvGQa = FQVG_6DOF_GY_KALMAN;
+    if (fQvGQa < pthisSV->fQvGMin) fQvGQa = pthisSV->fQvGMin;
     pthisSV->fQv = ONEOVER12 * fQvGQa + pthisSV->fAlphaSqQvYQwbOver12;
 
     // calculate the 6x3 Kalman gain matrix K = Qw * C^T * inv(C * Qw * C^T + Qv)
@@ -868,42 +926,26 @@ void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
     ftmpA3x3[2][0] = ftmpA3x3[0][2];
     ftmpA3x3[2][1] = ftmpA3x3[1][2];
 
-    // invert ftmpA3x3 in situ to give ftmpA3x3 = inv(C * Qw * C^T + Qv) = inv(ftmpA3x3)
-    for (i = 0; i < 3; i++) pfRows[i] = ftmpA3x3[i];
-    fmatrixAeqInvA(pfRows, iColInd, iRowInd, iPivot, 3, &ierror);
-
-    // on successful inversion set Kalman gain matrix fK6x3 = Qw * C^T * inv(C * Qw * C^T + Qv) = fQwCT6x3 * ftmpA3x3
-    if (!ierror)
-    {
-        // normal case
-        for (i = 0; i < 6; i++)     // loop over rows
-        {
-            for (j = 0; j < 3; j++) // loop over columns
-            {
-                pthisSV->fK6x3[i][j] = 0.0F;
-                for (k = 0; k < 3; k++)
-                {
-                    if ((pthisSV->fQwCT6x3[i][k] != 0.0F) &&
-                        (ftmpA3x3[k][j] != 0.0F))
-                    {
-                        pthisSV->fK6x3[i][j] += pthisSV->fQwCT6x3[i][k] * ftmpA3x3[k][j];
-                    }
-                }
-            }
-        }
-    }
-    else
+    // set Kalman gain matrix fK6x3 = Qw * C^T * inv(C * Qw * C^T + Qv) = fQwCT6x3 * inv(ftmpA3x3).
+    // ftmpA3x3 is symmetric positive definite, so this is solved by factoring it
+    // rather than by inverting it
+    for (i = 0; i < 6; i++)
+        for (j = 0; j < 3; j++)
+            pthisSV->fK6x3[i][j] = pthisSV->fQwCT6x3[i][j];
+    fmatrixAeqAxInvSym3x3(pthisSV->fK6x3, 6, ftmpA3x3, &ierror);
+    if (ierror)
     {
-        // ftmpA3x3 was singular so set Kalman gain matrix fK6x3 to zero
-        for (i = 0; i < 6; i++)     // loop over rows
-        {
-            for (j = 0; j < 3; j++) // loop over columns
-            {
+        // ftmpA3x3 was not positive definite so set Kalman gain matrix fK6x3 to zero
+        for (i = 0; i < 6; i++)
+            for (j = 0; j < 3; j++)
                 pthisSV->fK6x3[i][j] = 0.0F;
-            }
-        }
     }
 
+    // check the health of Qw and of the gain
+    iFaults = iCheckCovariance(&(pthisSV->fQw6x6[0][0]), 6);
+    if (ierror)
+        iFaults |= KALMAN_FAULT_GAIN;
+
     // calculate the a posteriori gravity and geomagnetic tilt quaternion errors and gyro offset error vector
     // from the Kalman matrix fK6x3 and from the measurement error vector fZErr.
     for (i = CHX; i <= CHZ; i++)
@@ -939,12 +981,12 @@ void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
     if (ftmp <= 1.0F)
     {
         // normal case
-        ftmpq.q0 = sqrtf(fabsf(1.0F - ftmp));
+        ftmpq.q0 = fsqrt_fast(fabsf(1.0F - ftmp));
     }
     else
     {
         // if vector component exceeds unity then set to 180 degree rotation and force normalization
-        ftmp = 1.0F / sqrtf(ftmp);
+        ftmp = frsqrt(ftmp);
         ftmpq.q0 = 0.0F;
         ftmpq.q1 *= ftmp;
         ftmpq.q2 *= ftmp;
@@ -954,10 +996,9 @@ void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
     // apply the gravity tilt correction quaternion so fqPl = fqMi.(fqgErrPl)* = fqMi.ftmpq and normalize
     qAeqBxC(&(pthisSV->fqPl), &fqMi, &ftmpq);
 
-    // normalize the a posteriori quaternion and compute the a posteriori rotation matrix and rotation vector
+    // normalize the a posteriori quaternion and compute the a posteriori rotation matrix
     fqAeqNormqA(&(pthisSV->fqPl));
     fRotationMatrixFromQuaternion(pthisSV->fRPl, &(pthisSV->fqPl));
-    fRotationVectorDegFromQuaternion(&(pthisSV->fqPl), pthisSV->fRVecPl);
 
     // update the a posteriori gyro offset vector: b+[k] = b-[k] - be+[k] = b+[k] - be+[k] (deg/s)
     // limiting the correction to the maximum permitted by the random walk model
@@ -992,44 +1033,35 @@ void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV,
     pthisSV->fAccGl[CHZ] = -(pthisSV->fAccGl[CHZ] + 1.0F);
 #endif
 
-    // compute the a posteriori Euler angles from the a posteriori orientation matrix fRPl
-#if THISCOORDSYSTEM == NED
-    fNEDAnglesDegFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fPhiPl),
-                                    &(pthisSV->fThePl), &(pthisSV->fPsiPl),
-                                    &(pthisSV->fRhoPl), &(pthisSV->fChiPl));
-#elif THISCOORDSYSTEM == ANDROID
-    fAndroidAnglesDegFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fPhiPl),
-                                        &(pthisSV->fThePl), &(pthisSV->fPsiPl),
-                                        &(pthisSV->fRhoPl), &(pthisSV->fChiPl));
-#else // WIN8
-    fWin8AnglesDegFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fPhiPl),
-                                     &(pthisSV->fThePl), &(pthisSV->fPsiPl),
-                                     &(pthisSV->fRhoPl), &(pthisSV->fChiPl));
-#endif
+    // record the health of the cycle, requesting a reset initialization if the filter has diverged
+    fUpdateKalmanHealth(&(pthisSV->health), iFaults | iCheckState(&(pthisSV->fqPl), pthisSV->fbPl),
+                        &(pthisSV->resetflag));
+
+    // leave the a posteriori Euler angles and rotation vector to fUpdateDerivedOutputs()
+    pthisSV->iDerive = DERIVE_ANGLES;
+
     return;
 }   // end fRun_6DOF_GY_KALMAN
 #if F_9DOF_GBY_KALMAN
-// 9DOF accelerometer+magnetometer+gyroscope orientation function implemented using indirect complementary Kalman filter
-void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
-                          struct AccelSensor *pthisAccel,
-                          struct MagSensor *pthisMag,
-                          struct GyroSensor *pthisGyro,
-                          struct MagCalibration *pthisMagCal)
+// 9DOF a priori (prediction) phase: integrate the gyro FIFO into the a priori orientation fqMi, form the a priori
+// gravity and geomagnetic vectors fgMi and fmMi and the measurement error vector fZErr, and compute the measurement
+// noise covariance fQv6x1
+void fPredict_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
+                              struct AccelSensor *pthisAccel,
+                              struct MagSensor *pthisMag,
+                              struct GyroSensor *pthisGyro,
+                              struct MagCalibration *pthisMagCal)
 {
     // local scalars and arrays
-    float       ftmpA6x6[6][6];     // scratch 6x6 matrix
+#if !F_9DOF_QUATERNION_UPDATE
     float       fRMi[3][3];         // a priori orientation matrix
+#endif
     float       fR6DOF[3][3];       // eCompass (6DOF accelerometer+magnetometer) orientation matrix
     float       fgMi[3];            // a priori estimate of the gravity vector (sensor frame)
     float       fmMi[3];            // a priori estimate of the geomagnetic vector (sensor frame)
-    float       fgPl[3];            // a posteriori estimate of the gravity vector (sensor frame)
-    float       fmPl[3];            // a posteriori estimate of the geomagnetic vector (sensor frame)
-    float       ftmpA3x3[3][3];     // scratch 3x3 matrix
     float       ftmpA3x1[3];        // scratch 3x1 vector
     float       fQvGQa;             // accelerometer noise covariance to 1g sphere
     float       fQvBQd;             // magnetometer noise covariance to geomagnetic sphere
-    float       fC6x9ik;            // element i, k of measurement matrix C
-    float       fC6x9jk;            // element j, k of measurement matrix C
     Quaternion  fqMi;               // a priori orientation quaternion
     Quaternion  fq6DOF;             // eCompass (6DOF accelerometer+magnetometer) orientation quaternion
     Quaternion  ftmpq;              // scratch quaternion used for gyro integration
@@ -1039,22 +1071,8 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
     float       fmodGc;    // modulus of calibrated accelerometer measurement (g)
     float       fmodBc;    // modulus of calibrated magnetometer measurement (uT)
     float       ftmp;               // scratch float
-    int8_t        ierror;             // matrix inversion error flag
     int8_t        i,
-                j,
-                k;                  // loop counters
-
-    // working arrays for 6x6 matrix inversion
-    float       *pfRows[6];
-    int8_t       iColInd[6];
-    int8_t        iRowInd[6];
-    int8_t        iPivot[6];
-
-    // if requested, do a reset initialization with no further processing
-    if (pthisSV->resetflag) {
-      fInit_9DOF_GBY_KALMAN(pthisSV, pthisAccel, pthisMag, pthisGyro, pthisMagCal);
-      return;
-    }
+                j;                  // loop counters
 
     // compute the average angular velocity (used for display only) from the average measurement minus gyro offset
     for (i = CHX; i <= CHZ; i++) pthisSV->fOmega[i] = (float)pthisGyro->iYs[i] * pthisGyro->fDegPerSecPerCount - pthisSV->fbPl[i];
@@ -1081,6 +1099,15 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
         qAeqAxB(&fqMi, &ftmpq);
     }
 
+#if F_9DOF_QUATERNION_UPDATE
+    // compute the moduli of the accelerometer and magnetometer measurements. The normalized 6DOF gravity and
+    // geomagnetic vectors are simply the normalized measurements, so the eCompass orientation fR6DOF is only
+    // needed for the orientation lock below.
+    fmodGc = fsqrt_fast(pthisAccel->fGc[CHX] * pthisAccel->fGc[CHX] + pthisAccel->fGc[CHY] * pthisAccel->fGc[CHY] +
+                        pthisAccel->fGc[CHZ] * pthisAccel->fGc[CHZ]);
+    fmodBc = fsqrt_fast(pthisMag->fBc[CHX] * pthisMag->fBc[CHX] + pthisMag->fBc[CHY] * pthisMag->fBc[CHY] +
+                        pthisMag->fBc[CHZ] * pthisMag->fBc[CHZ]);
+#else
     // compute the a priori orientation matrix fRMi from the new a priori orientation quaternion fqMi
     fRotationMatrixFromQuaternion(fRMi, &fqMi);
 
@@ -1096,31 +1123,79 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
 
     // compute the 6DOF orientation quaternion fq6DOF from the 6DOF orientation matrix fR6OF
     fQuaternionFromRotationMatrix(fR6DOF, &fq6DOF);
+#endif
 
     // calculate the acceleration noise variance relative to 1g sphere
     ftmp = fmodGc - 1.0F;
     fQvGQa = 3.0F * ftmp * ftmp;
-    if (fQvGQa < FQVG_9DOF_GBY_KALMAN)
-    fQvGQa = FQVG_9DOF_GBY_KALMAN;
+    if (fQvGQa < pthisSV->fQvGMin)
+    fQvGQa = pthisSV->fQvGMin;
 
     // calculate magnetic noise variance relative to geomagnetic sphere
     ftmp = fmodBc - pthisMagCal->fB;
     fQvBQd = 3.0F * ftmp * ftmp;
-    if (fQvBQd < FQVB_9DOF_GBY_KALMAN)
-    fQvBQd = FQVB_9DOF_GBY_KALMAN;
+    if (fQvBQd < pthisSV->fQvBMin)
+    fQvBQd = pthisSV->fQvBMin;
 
     // do a once-only orientation lock immediately after the first valid magnetic calibration by:
     // i) setting the a priori and a posteriori orientations to the 6DOF eCompass orientation
     // ii) setting the geomagnetic inclination angle fDeltaPl now that the first calibrated 6DOF estimate is available
     if (pthisMagCal->iValidMagCal && !pthisSV->iFirstAccelMagLock) {
+#if F_9DOF_QUATERNION_UPDATE
+#if THISCOORDSYSTEM == NED
+        feCompassNED(fR6DOF, &fDelta6DOF, &fsinDelta6DOF, &fcosDelta6DOF, pthisMag->fBc, pthisAccel->fGc, &fmodBc, &fmodGc);
+#elif THISCOORDSYSTEM == ANDROID
+        feCompassAndroid(fR6DOF, &fDelta6DOF, &fsinDelta6DOF, &fcosDelta6DOF, pthisMag->fBc, pthisAccel->fGc, &fmodBc, &fmodGc);
+#else // WIN8
+        feCompassWin8(fR6DOF, &fDelta6DOF, &fsinDelta6DOF, &fcosDelta6DOF, pthisMag->fBc, pthisAccel->fGc, &fmodBc, &fmodGc);
+#endif
+        fQuaternionFromRotationMatrix(fR6DOF, &fq6DOF);
+        fqMi = pthisSV->fqPl = fq6DOF;
+#else
         fqMi = pthisSV->fqPl = fq6DOF;
         f3x3matrixAeqB(fRMi, fR6DOF);
+#endif
         pthisSV->fDeltaPl = fDelta6DOF;
         pthisSV->fsinDeltaPl = fsinDelta6DOF;
         pthisSV->fcosDeltaPl = fcosDelta6DOF;
         pthisSV->iFirstAccelMagLock = true;
     }
 
+#if F_9DOF_QUATERNION_UPDATE
+    // set fgMi to the normalized a priori gravity vector and fmMi to the normalized a priori geomagnetic vector
+    // in the sensor frame: the z column and a sum of the x (NED) or y (ENU) and z columns of the rotation matrix
+    // of fqMi (see fRotationMatrixFromQuaternion()), without forming the rest of the matrix
+    fgMi[CHX] = 2.0F * (fqMi.q1 * fqMi.q3 - fqMi.q0 * fqMi.q2);
+    fgMi[CHY] = 2.0F * (fqMi.q2 * fqMi.q3 + fqMi.q0 * fqMi.q1);
+    fgMi[CHZ] = 2.0F * (fqMi.q0 * fqMi.q0 + fqMi.q3 * fqMi.q3) - 1.0F;
+#if THISCOORDSYSTEM == NED
+    fmMi[CHX] = 2.0F * (fqMi.q0 * fqMi.q0 + fqMi.q1 * fqMi.q1) - 1.0F;
+    fmMi[CHY] = 2.0F * (fqMi.q1 * fqMi.q2 - fqMi.q0 * fqMi.q3);
+    fmMi[CHZ] = 2.0F * (fqMi.q1 * fqMi.q3 + fqMi.q0 * fqMi.q2);
+    for (i = CHX; i <= CHZ; i++) fmMi[i] = fmMi[i] * pthisSV->fcosDeltaPl + fgMi[i] * pthisSV->fsinDeltaPl;
+#else // ANDROID and WIN8 (ENU gravity positive)
+    fmMi[CHX] = 2.0F * (fqMi.q1 * fqMi.q2 + fqMi.q0 * fqMi.q3);
+    fmMi[CHY] = 2.0F * (fqMi.q0 * fqMi.q0 + fqMi.q2 * fqMi.q2) - 1.0F;
+    fmMi[CHZ] = 2.0F * (fqMi.q2 * fqMi.q3 - fqMi.q0 * fqMi.q1);
+    for (i = CHX; i <= CHZ; i++) {
+        fmMi[i] = fmMi[i] * pthisSV->fcosDeltaPl - fgMi[i] * pthisSV->fsinDeltaPl;
+        fgMi[i] = -fgMi[i];
+    }
+#endif
+
+    // set ftmpA3x1 to the normalized 6DOF gravity vector, which is the normalized accelerometer measurement,
+    // negated for Android. With no measurement, use the a priori estimate so there is no error.
+    if (fmodGc != 0.0F) {
+#if THISCOORDSYSTEM == ANDROID
+        ftmp = -1.0F / fmodGc;
+#else // NED and WIN8
+        ftmp = 1.0F / fmodGc;
+#endif
+        for (i = CHX; i <= CHZ; i++) ftmpA3x1[i] = pthisAccel->fGc[i] * ftmp;
+    } else {
+        for (i = CHX; i <= CHZ; i++) ftmpA3x1[i] = fgMi[i];
+    }
+#else
     // set ftmpA3x1 to the normalized 6DOF gravity vector and set fgMi to the normalized a priori gravity vector
     // with both estimates computed in the sensor frame
 #if THISCOORDSYSTEM == NED
@@ -1137,6 +1212,7 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
     fgMi[CHX] = -fRMi[CHX][CHZ];
     fgMi[CHY] = -fRMi[CHY][CHZ];
     fgMi[CHZ] = -fRMi[CHZ][CHZ];
+#endif
 #endif
 
     // set ftmpq to the quaternion that rotates the 6DOF gravity tilt vector ftmpA3x1 to the a priori estimate fgMi
@@ -1146,6 +1222,15 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
     pthisSV->fZErr[1] = ftmpq.q2;
     pthisSV->fZErr[2] = ftmpq.q3;
 
+#if F_9DOF_QUATERNION_UPDATE
+    // set ftmpA3x1 to the normalized 6DOF geomagnetic vector, which is the normalized magnetometer measurement
+    if (fmodBc != 0.0F) {
+        ftmp = 1.0F / fmodBc;
+        for (i = CHX; i <= CHZ; i++) ftmpA3x1[i] = pthisMag->fBc[i] * ftmp;
+    } else {
+        for (i = CHX; i <= CHZ; i++) ftmpA3x1[i] = fmMi[i];
+    }
+#else
     // set ftmpA3x1 to the normalized 6DOF geomagnetic vector and set fmMi to the normalized a priori geomagnetic vector
     // with both estimates computed in the sensor frame
 #if THISCOORDSYSTEM == NED
@@ -1162,6 +1247,7 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
     fmMi[CHX] = fRMi[CHX][CHY] * pthisSV->fcosDeltaPl - fRMi[CHX][CHZ] * pthisSV->fsinDeltaPl;
     fmMi[CHY] = fRMi[CHY][CHY] * pthisSV->fcosDeltaPl - fRMi[CHY][CHZ] * pthisSV->fsinDeltaPl;
     fmMi[CHZ] = fRMi[CHZ][CHY] * pthisSV->fcosDeltaPl - fRMi[CHZ][CHZ] * pthisSV->fsinDeltaPl;
+#endif
 #endif
 
     // set ftmpq to the quaternion that rotates the 6DOF geomagnetic tilt vector ftmpA3x1 to the a priori estimate fmMi
@@ -1171,6 +1257,34 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
     pthisSV->fZErr[4] = ftmpq.q2;
     pthisSV->fZErr[5] = ftmpq.q3;
 
+    // calculate the vector fQv6x1 containing the diagonal elements of the measurement covariance matrix Qv
+    pthisSV->fQv6x1[0] = pthisSV->fQv6x1[1] = pthisSV->fQv6x1[2] = ONEOVER12 * fQvGQa + pthisSV->fAlphaSqQvYQwbOver12;
+    pthisSV->fQv6x1[3] = pthisSV->fQv6x1[4] = pthisSV->fQv6x1[5] = ONEOVER12 * fQvBQd / pthisMagCal->fBSq + pthisSV->fAlphaSqQvYQwbOver12;
+
+    // keep the a priori estimates for fCorrect_9DOF_GBY_KALMAN()
+    pthisSV->fqMi = fqMi;
+    for (i = CHX; i <= CHZ; i++) {
+        pthisSV->fgMi[i] = fgMi[i];
+        pthisSV->fmMi[i] = fmMi[i];
+    }
+
+    return;
+} // end fPredict_9DOF_GBY_KALMAN
+
+// 9DOF Kalman gain phase: update Qw from the previous cycle's a posteriori errors, compute the Kalman gain K
+// and from it and fZErr the new a posteriori errors fqgErrPl, fqmErrPl and fbErrPl
+void fGain_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV)
+{
+    // local scalars and arrays
+    float       ftmpA6x6[6][6];     // scratch 6x6 matrix
+    float       ftmpA3x1[3];        // scratch 3x1 vector
+    float       fC6x9ik;            // element i, k of measurement matrix C
+    float       fC6x9jk;            // element j, k of measurement matrix C
+    int8_t        ierror;             // matrix inversion error flag
+    int8_t        i,
+                j,
+                k;                  // loop counters
+
     // update Qw using the a posteriori error vectors from the previous iteration.
     // as Qv increases or Qw decreases, K -> 0 and the Kalman filter is weighted towards the a priori prediction
     // as Qv decreases or Qw increases, KC -> I and the Kalman filter is weighted towards the measurement.
@@ -1215,9 +1329,6 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
         for (j = 0; j < i; j++)
             pthisSV->fQw9x9[i][j] = pthisSV->fQw9x9[j][i];
 
-    // calculate the vector fQv6x1 containing the diagonal elements of the measurement covariance matrix Qv
-    pthisSV->fQv6x1[0] = pthisSV->fQv6x1[1] = pthisSV->fQv6x1[2] = ONEOVER12 * fQvGQa + pthisSV->fAlphaSqQvYQwbOver12;
-    pthisSV->fQv6x1[3] = pthisSV->fQv6x1[4] = pthisSV->fQv6x1[5] = ONEOVER12 * fQvBQd / pthisMagCal->fBSq + pthisSV->fAlphaSqQvYQwbOver12;
 
     // calculate the Kalman gain matrix K = Qw * C^T * inv(C * Qw * C^T + Qv)
     // set fQwCT9x6 = Qw.C^T where Qw has size 9x9 and C^T has size 9x6
@@ -1280,24 +1391,15 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
         for (j = 0; j < i; j++) // loop over below diagonal columns
             ftmpA6x6[i][j] = ftmpA6x6[j][i];
 
-    // invert ftmpA6x6 in situ to give ftmpA6x6 = inv(C * Qw * C^T + Qv) = inv(ftmpA6x6)
-    for (i = 0; i < 6; i++)
-        pfRows[i] = ftmpA6x6[i];
-    fmatrixAeqInvA(pfRows, iColInd, iRowInd, iPivot, 6, &ierror);
-
-    // on successful inversion set Kalman gain matrix K9x6 = Qw * C^T * inv(C * Qw * C^T + Qv) = fQwCT9x6 * ftmpA6x6
-    if (!ierror) {
-    // normal case
-    for (i = 0; i < 9; i++) // loop over rows
-        for (j = 0; j < 6; j++) { // loop over columns
-            pthisSV->fK9x6[i][j] = 0.0F;
-            for (k = 0; k < 6; k++) {
-                if ((pthisSV->fQwCT9x6[i][k] != 0.0F) && (ftmpA6x6[k][j] != 0.0F))
-                    pthisSV->fK9x6[i][j] += pthisSV->fQwCT9x6[i][k] * ftmpA6x6[k][j];
-            }
-        }
-    } else {
-        // ftmpA6x6 was singular so set Kalman gain matrix to zero
+    // set Kalman gain matrix K9x6 = Qw * C^T * inv(C * Qw * C^T + Qv) = fQwCT9x6 * inv(ftmpA6x6).
+    // ftmpA6x6 is symmetric positive definite, so this is solved by factoring it
+    // rather than by inverting it
+    for (i = 0; i < 9; i++)
+        for (j = 0; j < 6; j++)
+            pthisSV->fK9x6[i][j] = pthisSV->fQwCT9x6[i][j];
+    fmatrixAeqAxInvSym6x6(pthisSV->fK9x6, 9, ftmpA6x6, &ierror);
+    if (ierror) {
+        // ftmpA6x6 was not positive definite so set Kalman gain matrix to zero
         for (i = 0; i < 9; i++) // loop over rows
             for (j = 0; j < 6; j++) // loop over columns
                 pthisSV->fK9x6[i][j] = 0.0F;
@@ -1322,27 +1424,107 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
         }
     }
 
+    // check the health of Qw and of the gain, for fCorrect_9DOF_GBY_KALMAN() to record
+    pthisSV->health.iLastFaults = iCheckCovariance(&(pthisSV->fQw9x9[0][0]), 9);
+    if (ierror)
+        pthisSV->health.iLastFaults |= KALMAN_FAULT_GAIN;
+
+    return;
+} // end fGain_9DOF_GBY_KALMAN
+
+// 9DOF a posteriori (correction) phase: apply the a posteriori errors to the a priori orientation and the gyro
+// offset, then compute the linear acceleration, velocity and displacement in the global frame
+void fCorrect_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
+                              struct AccelSensor *pthisAccel)
+{
+    // local scalars and arrays
+#if !F_9DOF_QUATERNION_UPDATE
+    float       fgPl[3];            // a posteriori estimate of the gravity vector (sensor frame)
+#endif
+    float       fmPl[3];            // a posteriori estimate of the geomagnetic vector (sensor frame)
+#if F_9DOF_QUATERNION_UPDATE
+    Quaternion  fqTilt;             // gravity tilt corrected orientation quaternion
+#else
+    float       ftmpA3x3[3][3];     // scratch 3x3 matrix
+    float       fmodGc;             // modulus of the a posteriori gravity vector
+    float       fmodBc;             // modulus of the a posteriori geomagnetic vector
+#endif
+#if F_9DOF_QUATERNION_UPDATE || THISCOORDSYSTEM == ANDROID
+    float       ftmpA3x1[3];        // scratch 3x1 vector
+#endif
+    Quaternion  ftmpq;              // scratch quaternion
+    int8_t        i;                  // loop counter
+
+
     // set ftmpq to the a posteriori gravity tilt correction (conjugate) quaternion
     ftmpq.q1 = -pthisSV->fqgErrPl[CHX];
     ftmpq.q2 = -pthisSV->fqgErrPl[CHY];
     ftmpq.q3 = -pthisSV->fqgErrPl[CHZ];
-    ftmpq.q0 = sqrtf(fabs(1.0F - ftmpq.q1 * ftmpq.q1 - ftmpq.q2 * ftmpq.q2 - ftmpq.q3 * ftmpq.q3));
-
+    ftmpq.q0 = fsqrt_fast(fabsf(1.0F - ftmpq.q1 * ftmpq.q1 - ftmpq.q2 * ftmpq.q2 - ftmpq.q3 * ftmpq.q3));
+
+#if F_9DOF_QUATERNION_UPDATE
+    // the normalized a posteriori estimate of the gravity vector is fgPl = R(ftmpq).fgMi, and R(fqMi.ftmpq)
+    // = R(ftmpq).R(fqMi), so the orientation fqPl = fqMi.ftmpq has the a posteriori gravity vector. It only
+    // remains to correct its yaw (rotation about the global gravity axis) to suit the geomagnetic vector.
+    qAeqBxC(&(pthisSV->fqPl), &(pthisSV->fqMi), &ftmpq);
+#else
     // set ftmpA3x3 to the gravity tilt correction matrix and rotate the normalized a priori estimate of the
     // gravity vector fgMi to obtain the normalized a posteriori estimate of the gravity vector fgPl
     fRotationMatrixFromQuaternion(ftmpA3x3, &ftmpq);
-    fveqRu(fgPl, ftmpA3x3, fgMi, 0);
+    fveqRu(fgPl, ftmpA3x3, pthisSV->fgMi, 0);
+#endif
 
     // set ftmpq to the a posteriori geomagnetic tilt correction (conjugate) quaternion
     ftmpq.q1 = -pthisSV->fqmErrPl[CHX];
     ftmpq.q2 = -pthisSV->fqmErrPl[CHY];
     ftmpq.q3 = -pthisSV->fqmErrPl[CHZ];
-    ftmpq.q0 = sqrtf(fabs(1.0F - ftmpq.q1 * ftmpq.q1 - ftmpq.q2 * ftmpq.q2 - ftmpq.q3 * ftmpq.q3));
+    ftmpq.q0 = fsqrt_fast(fabsf(1.0F - ftmpq.q1 * ftmpq.q1 - ftmpq.q2 * ftmpq.q2 - ftmpq.q3 * ftmpq.q3));
+
+#if F_9DOF_QUATERNION_UPDATE
+    // rotate the normalized a priori estimate of the geomagnetic vector fmMi to obtain the normalized a posteriori
+    // estimate fmPl, and de-rotate that to ftmpA3x1 in the global frame of the gravity corrected orientation
+    fveqRqu(fmPl, &ftmpq, pthisSV->fmMi, 0);
+    fveqRqu(ftmpA3x1, &(pthisSV->fqPl), fmPl, 1);
+
+    // the horizontal component of ftmpA3x1 gives the cosine and the vertical component the sine of the
+    // a posteriori inclination angle. Set ftmpq to the (un-normalized) yaw correction quaternion that rotates
+    // the global geomagnetic vector direction onto ftmpA3x1 using q = {1 + cos(yaw), 0, 0, sin(yaw)} or, far
+    // from zero yaw, the equivalent {sin(yaw), 0, 0, 1 - cos(yaw)}.
+    pthisSV->fcosDeltaPl = fsqrt_fast(ftmpA3x1[CHX] * ftmpA3x1[CHX] + ftmpA3x1[CHY] * ftmpA3x1[CHY]);
+    ftmpq.q1 = ftmpq.q2 = 0.0F;
+#if THISCOORDSYSTEM == NED // global geomagnetic vector is {cos(delta), 0, sin(delta)}
+    pthisSV->fsinDeltaPl = ftmpA3x1[CHZ];
+    if (ftmpA3x1[CHX] >= 0.0F) {
+        ftmpq.q0 = pthisSV->fcosDeltaPl + ftmpA3x1[CHX];
+        ftmpq.q3 = -ftmpA3x1[CHY];
+    } else {
+        ftmpq.q0 = -ftmpA3x1[CHY];
+        ftmpq.q3 = pthisSV->fcosDeltaPl - ftmpA3x1[CHX];
+    }
+#else // ANDROID and WIN8: global geomagnetic vector is {0, cos(delta), -sin(delta)}
+    pthisSV->fsinDeltaPl = -ftmpA3x1[CHZ];
+    if (ftmpA3x1[CHY] >= 0.0F) {
+        ftmpq.q0 = pthisSV->fcosDeltaPl + ftmpA3x1[CHY];
+        ftmpq.q3 = ftmpA3x1[CHX];
+    } else {
+        ftmpq.q0 = ftmpA3x1[CHX];
+        ftmpq.q3 = pthisSV->fcosDeltaPl - ftmpA3x1[CHY];
+    }
+#endif
+    pthisSV->fDeltaPl = fatan2_deg(pthisSV->fsinDeltaPl, pthisSV->fcosDeltaPl);
 
+    // apply the yaw correction in the global frame so fqPl = ftmpq.fqMi.(gravity tilt correction) and normalize.
+    // A vertical geomagnetic vector gives no yaw information, so then leave the yaw uncorrected.
+    if (pthisSV->fcosDeltaPl != 0.0F) {
+        fqTilt = pthisSV->fqPl;
+        qAeqBxC(&(pthisSV->fqPl), &ftmpq, &fqTilt);
+    }
+    fqAeqNormqA(&(pthisSV->fqPl));
+#else
     // set ftmpA3x3 to the geomagnetic tilt correction matrix and rotate the normalized a priori estimate of the
     // geomagnetic vector fmMi to obtain the normalized a posteriori estimate of the geomagnetic vector fmPl
     fRotationMatrixFromQuaternion(ftmpA3x3, &ftmpq);
-    fveqRu(fmPl, ftmpA3x3, fmMi, 0);
+    fveqRu(fmPl, ftmpA3x3, pthisSV->fmMi, 0);
 
     // compute the a posteriori orientation matrix fRPl from the vector product of the a posteriori gravity fgPl
     // and geomagnetic fmPl vectors both of which are normalized
@@ -1360,9 +1542,9 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
     fmPl, fgPl, &fmodBc, &fmodGc);
 #endif
 
-    // compute the a posteriori quaternion fqPl and rotation vector fRVecPl from fRPl
+    // compute the a posteriori quaternion fqPl from fRPl
     fQuaternionFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fqPl));
-    fRotationVectorDegFromQuaternion(&(pthisSV->fqPl), pthisSV->fRVecPl);
+#endif
 
     // update the a posteriori gyro offset vector: b+[k] = b-[k] - be+[k] = b+[k] - be+[k] (deg/s)
     for (i = CHX; i <= CHZ; i++) {
@@ -1380,8 +1562,12 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
 
     // compute the linear acceleration fAccGl in the global frame
     // first de-rotate the accelerometer measurement fGc from the sensor to global frame
-    // using the transpose (inverse) of the orientation matrix fRPl
+    // using the transpose (inverse) of the a posteriori orientation
+#if F_9DOF_QUATERNION_UPDATE
+    fveqRqu(pthisSV->fAccGl, &(pthisSV->fqPl), pthisAccel->fGc, 1);
+#else
     fveqRu(pthisSV->fAccGl, pthisSV->fRPl, pthisAccel->fGc, 1);
+#endif
 
     // subtract the fixed gravity vector in the global frame leaving linear acceleration
 #if THISCOORDSYSTEM == NED
@@ -1401,23 +1587,86 @@ void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
 
     // integrate the acceleration to velocity and displacement in the global frame.
     // Note: integration errors accumulate without limit over time and this code should only be
-    // used for inertial integration of the order of seconds.
+    // used for inertial integration of the order of seconds. The sums are kept in accumulators
+    // (see precision.h) so that they do not also lose the small increments of a long run.
     for (i = CHX; i <= CHZ; i++) {
         // integrate acceleration (in g) to velocity in m/s
-        pthisSV->fVelGl[i] += pthisSV->fAccGl[i] * pthisSV->fgdeltat;
+        fAccumAdd(&pthisSV->aVelGl[i], pthisSV->fAccGl[i] * pthisSV->fgdeltat);
+        pthisSV->fVelGl[i] = fAccumGet(pthisSV->aVelGl[i]);
         // integrate velocity (in m/s) to displacement (m)
-        pthisSV->fDisGl[i] += pthisSV->fVelGl[i] * pthisSV->fdeltat;
+        fAccumAdd(&pthisSV->aDisGl[i], pthisSV->fVelGl[i] * pthisSV->fdeltat);
+        pthisSV->fDisGl[i] = fAccumGet(pthisSV->aDisGl[i]);
     }
 
-    // compute the a posteriori Euler angles from the a posteriori orientation matrix fRPl
+    // leave the a posteriori Euler angles and rotation vector fRVecPl (and, on the quaternion path, the
+    // orientation matrix fRPl) to fUpdateDerivedOutputs()
+#if F_9DOF_QUATERNION_UPDATE
+    pthisSV->iDerive = DERIVE_MATRIX | DERIVE_ANGLES;
+#else
+    pthisSV->iDerive = DERIVE_ANGLES;
+#endif
+
+    // record the health of the cycle from the gain phase's flags, requesting a reset initialization if the
+    // filter has diverged
+    fUpdateKalmanHealth(&(pthisSV->health),
+                        pthisSV->health.iLastFaults | iCheckState(&(pthisSV->fqPl), pthisSV->fbPl),
+                        &(pthisSV->resetflag));
+
+    return;
+} // end fCorrect_9DOF_GBY_KALMAN
+
+// 9DOF accelerometer+magnetometer+gyroscope orientation function implemented using indirect complementary Kalman filter.
+// A cycle runs the prediction, gain and correction phases above in turn; fusion_batch.cc runs the same phases
+// across many filters at once.
+void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV,
+                          struct AccelSensor *pthisAccel,
+                          struct MagSensor *pthisMag,
+                          struct GyroSensor *pthisGyro,
+                          struct MagCalibration *pthisMagCal)
+{
+    // if requested, do a reset initialization with no further processing
+    if (pthisSV->resetflag) {
+      fInit_9DOF_GBY_KALMAN(pthisSV, pthisAccel, pthisMag, pthisGyro, pthisMagCal);
+      return;
+    }
+
+    fPredict_9DOF_GBY_KALMAN(pthisSV, pthisAccel, pthisMag, pthisGyro, pthisMagCal);
+    fGain_9DOF_GBY_KALMAN(pthisSV);
+    fCorrect_9DOF_GBY_KALMAN(pthisSV, pthisAccel);
+
+    return;
+} // end fRun_9DOF_GBY_KALMAN
+#endif // #if F_9DOF_GBY_KALMAN
+
+// compute the outputs of a motion algorithm left pending by its last fusion
+// cycle (see the Derived Output Flags in sensor_fusion.h)
+void fUpdateDerivedOutputs(SV_ptr data)
+{
+    if (data->iDerive & DERIVE_MATRIX)
+    {
+        fRotationMatrixFromQuaternion(data->fRM, &(data->fq));
+    }
+
+    if (data->iDerive & DERIVE_ANGLES)
+    {
+        fRotationVectorDegFromQuaternion(&(data->fq), data->fRVec);
 #if THISCOORDSYSTEM == NED
-    fNEDAnglesDegFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fPhiPl), &(pthisSV->fThePl), &(pthisSV->fPsiPl), &(pthisSV->fRhoPl), &(pthisSV->fChiPl));
+        fNEDAnglesDegFromRotationMatrix(data->fRM, &(data->fPhi), &(data->fThe),
+                                        &(data->fPsi), &(data->fRho), &(data->fChi));
 #elif THISCOORDSYSTEM == ANDROID
-    fAndroidAnglesDegFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fPhiPl), &(pthisSV->fThePl), &(pthisSV->fPsiPl), &(pthisSV->fRhoPl), &(pthisSV->fChiPl));
+        fAndroidAnglesDegFromRotationMatrix(data->fRM, &(data->fPhi), &(data->fThe),
+                                            &(data->fPsi), &(data->fRho), &(data->fChi));
 #else // WIN8
-    fWin8AnglesDegFromRotationMatrix(pthisSV->fRPl, &(pthisSV->fPhiPl), &(pthisSV->fThePl), &(pthisSV->fPsiPl), &(pthisSV->fRhoPl), &(pthisSV->fChiPl));
+        fWin8AnglesDegFromRotationMatrix(data->fRM, &(data->fPhi), &(data->fThe),
+                                         &(data->fPsi), &(data->fRho), &(data->fChi));
 #endif
+        if (data->iDerive & DERIVE_NO_YAW)
+        {
+            data->fPsi = data->fRho = 0.0F;
+        }
+    }
+
+    data->iDerive = 0;
 
     return;
-} // end fRun_9DOF_GBY_KALMAN
-#endif // #if F_9DOF_GBY_KALMAN
+}   // end fUpdateDerivedOutputs
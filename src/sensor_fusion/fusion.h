@@ -66,6 +66,11 @@ extern "C" {
 #define FMAX_9DOF_GBY_BPL		7.0F            ///< maximum permissible power on gyro offsets (deg/s)
 ///@}
 
+/// @name Kalman filter health check constants
+///@{
+#define KALMAN_MAX_GAIN_FAULTS		FUSION_HZ       ///< consecutive cycles without a Kalman gain (1s) before a reset
+///@}
+
 /// @name Fusion Function Prototypes
 /// These functions comprise the core of the basic sensor fusion functions excluding
 /// magnetic and acceleration calibration.  Parameter descriptions are not included here,
@@ -86,6 +91,8 @@ void fInit_6DOF_GB_BASIC(struct SV_6DOF_GB_BASIC *pthisSV, struct AccelSensor *p
 void fInit_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV, struct AccelSensor *pthisAccel, struct GyroSensor *pthisGyro);
 void fInit_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSensor *pthisAccel, struct MagSensor *pthisMag,
 		struct GyroSensor *pthisGyro, struct MagCalibration *pthisMagCal);
+void fSetNoise_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV, float fQvY, float fQvG, float fQwb);
+void fSetNoise_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, float fQvY, float fQvG, float fQvB, float fQwb);
 void fRun_1DOF_P_BASIC(struct SV_1DOF_P_BASIC *pthisSV, struct PressureSensor *pthisPressure);
 void fRun_3DOF_G_BASIC(struct SV_3DOF_G_BASIC *pthisSV, struct AccelSensor *pthisAccel);
 void fRun_3DOF_B_BASIC(struct SV_3DOF_B_BASIC *pthisSV, struct MagSensor *pthisMag);
@@ -93,6 +100,10 @@ void fRun_3DOF_Y_BASIC(struct SV_3DOF_Y_BASIC *pthisSV, struct GyroSensor *pthis
 void fRun_6DOF_GB_BASIC(struct SV_6DOF_GB_BASIC *pthisSV, struct MagSensor *pthisMag, struct AccelSensor *pthisAccel);
 void fRun_6DOF_GY_KALMAN(struct SV_6DOF_GY_KALMAN *pthisSV, struct AccelSensor *pthisAccel, struct GyroSensor *pthisGyro);
 void fRun_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSensor *pthisAccel, struct MagSensor *pthisMag, struct GyroSensor *pthisGyro, struct MagCalibration *pthisMagCal);
+void fPredict_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSensor *pthisAccel, struct MagSensor *pthisMag, struct GyroSensor *pthisGyro, struct MagCalibration *pthisMagCal);
+void fGain_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV);
+void fCorrect_9DOF_GBY_KALMAN(struct SV_9DOF_GBY_KALMAN *pthisSV, struct AccelSensor *pthisAccel);
+void fUpdateDerivedOutputs(SV_ptr data);
 ///@}
 
 
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file fusion_batch.cc
+    \brief Batch runner for the 9DOF Kalman filter; see fusion_batch.h
+*/
+
+#include "fusion_batch.h"
+
+#if !defined(ESP32) && !defined(ESP8266) && F_9DOF_GBY_KALMAN
+
+#include <algorithm>
+#include <thread>
+
+#include "fusion.h"
+
+FusionBatch::FusionBatch(int num_threads)
+    : num_threads_(std::max(num_threads, 1)) {}
+
+int FusionBatch::AddLane(const FusionBatchLane &lane) {
+  lanes_.push_back(lane);
+  blocks_.resize((lanes_.size() + kLanes - 1) / kLanes);
+  return NumLanes() - 1;
+}  // end AddLane()
+
+void FusionBatch::Run(LoadFunction *load, StoreFunction *store,
+                      void *context) {
+  int num_threads = std::min(num_threads_, (int)blocks_.size());
+  std::vector<std::thread> threads;
+
+  // thread t takes blocks t, t + num_threads, ... and the calling thread
+  // takes its share too
+  for (int t = 1; t < num_threads; t++) {
+    threads.emplace_back(&FusionBatch::RunBlocks, this, t, num_threads, load,
+                         store, context);
+  }
+  RunBlocks(0, std::max(num_threads, 1), load, store, context);
+  for (std::thread &thread : threads) thread.join();
+}  // end Run()
+
+void FusionBatch::Step(void) {
+  bool running[kLanes];
+
+  std::fill(running, running + kLanes, true);
+  for (int block = 0; block < (int)blocks_.size(); block++) {
+    StepBlock(block, running);
+  }
+}  // end Step()
+
+// Run each block in turn through all its lanes' cycles.
+void FusionBatch::RunBlocks(int first_block, int block_stride,
+                            LoadFunction *load, StoreFunction *store,
+                            void *context) {
+  for (int block = first_block; block < (int)blocks_.size();
+       block += block_stride) {
+    int first = block * kLanes;
+    int count = std::min(kLanes, NumLanes() - first);
+    bool running[kLanes] = {};
+
+    std::fill(running, running + count, true);
+    for (uint32_t cycle = 0;; cycle++) {
+      bool any = false;
+      for (int l = 0; l < count; l++) {
+        if (running[l]) running[l] = load(first + l, cycle, context);
+        any = any || running[l];
+      }
+      if (!any) break;
+      StepBlock(block, running);
+      if (store) {
+        for (int l = 0; l < count; l++) {
+          if (running[l]) store(first + l, cycle, context);
+        }
+      }
+    }
+  }
+}  // end RunBlocks()
+
+// Run one cycle of the lanes of a block that are running. The result for
+// each is that of fRun_9DOF_GBY_KALMAN().
+void FusionBatch::StepBlock(int block, const bool running[]) {
+  GainBlock *gb = &blocks_[block];
+  int first = block * kLanes;
+  int count = std::min(kLanes, NumLanes() - first);
+  bool correct[kLanes];
+  int ok[kLanes];
+
+  // prediction phase, and gather the gain phase inputs. A lane with a reset
+  // request is just initialized this cycle, as in fRun_9DOF_GBY_KALMAN().
+  for (int l = 0; l < count; l++) {
+    const FusionBatchLane &lane = lanes_[first + l];
+    SV_9DOF_GBY_KALMAN *sv = lane.sv;
+
+    correct[l] = false;
+    if (!running[l]) continue;
+    if (sv->resetflag) {
+      fInit_9DOF_GBY_KALMAN(sv, lane.accel, lane.mag, lane.gyro, lane.mag_cal);
+      continue;
+    }
+    fPredict_9DOF_GBY_KALMAN(sv, lane.accel, lane.mag, lane.gyro,
+                             lane.mag_cal);
+    correct[l] = true;
+
+    for (int i = CHX; i <= CHZ; i++) {
+      gb->qgErr[i][l] = sv->fqgErrPl[i];
+      gb->qmErr[i][l] = sv->fqmErrPl[i];
+      gb->bErr[i][l] = sv->fbErrPl[i];
+    }
+    for (int j = 0; j < 6; j++) gb->zErr[j][l] = sv->fZErr[j];
+    gb->qvG[l] = sv->fQv6x1[0];
+    gb->qvB[l] = sv->fQv6x1[3];
+    gb->alphaOver2[l] = sv->fAlphaOver2;
+    gb->alphaSqOver4[l] = sv->fAlphaSqOver4;
+    gb->alphaSqQvYQwbOver12[l] = sv->fAlphaSqQvYQwbOver12;
+    gb->qwbOver3[l] = sv->fQwbOver3;
+  }
+
+  // gain phase, all lanes of the block at once. Lanes not being corrected
+  // hold stale or zero values; their results are not used.
+  ComputeGain(gb, ok);
+
+  // scatter the new a posteriori errors and the gain's health, then the
+  // correction phase, which records it
+  for (int l = 0; l < count; l++) {
+    const FusionBatchLane &lane = lanes_[first + l];
+    SV_9DOF_GBY_KALMAN *sv = lane.sv;
+
+    if (!correct[l]) continue;
+    for (int i = CHX; i <= CHZ; i++) {
+      sv->fqgErrPl[i] = gb->qgErr[i][l];
+      sv->fqmErrPl[i] = gb->qmErr[i][l];
+      sv->fbErrPl[i] = gb->bErr[i][l];
+    }
+    sv->health.iLastFaults = ok[l] ? 0 : KALMAN_FAULT_GAIN;
+    fCorrect_9DOF_GBY_KALMAN(sv, lane.accel);
+  }
+}  // end StepBlock()
+
+// The gain phase of fGain_9DOF_GBY_KALMAN() for all lanes of a block, in
+// place. Qw couples each axis' gravity (g), geomagnetic (m) and gyro offset
+// (b) errors only with each other, and C only adds each b error into the g
+// and m measurements of its axis, so K = Qw.C^T.inv(C.Qw.C^T + Qv) falls
+// apart into three independent axes, each with a 3x2 block Qw.C^T and a 2x2
+// block C.Qw.C^T + Qv. Each is solved by the same L.D.L^T steps, in the same
+// order, as fmatrixAeqAxInvSym6x6() takes for the whole 6x6 matrix (the
+// other terms being zero), so the results match fRun_9DOF_GBY_KALMAN().
+// ok[l] is set to whether lane l's C.Qw.C^T + Qv was positive definite.
+void FusionBatch::ComputeGain(GainBlock *gb, int ok[]) {
+  for (int l = 0; l < kLanes; l++) ok[l] = 1;
+  for (int i = CHX; i <= CHZ; i++) {
+    for (int l = 0; l < kLanes; l++) {
+      float h = gb->alphaOver2[l];
+      float qg = gb->qgErr[i][l];
+      float qm = gb->qmErr[i][l];
+      float be = gb->bErr[i][l];
+      float zg = gb->zErr[i][l];
+      float zm = gb->zErr[i + 3][l];
+
+      // the non zero Qw terms of the axis: diagonal gg, mm and bb and off
+      // diagonal gb and mb
+      float bb = be * be;
+      float t = gb->alphaSqOver4[l] * bb + gb->alphaSqQvYQwbOver12[l];
+      float qwgg = qg * qg + t;
+      float qwmm = qm * qm + t;
+      float qwbb = bb + gb->qwbOver3[l];
+      float hqwbb = h * qwbb;
+      float qwgb = qg * be - hqwbb;
+      float qwmb = qm * be - hqwbb;
+
+      // Qw.C^T, rows g, m and b and columns g and m
+      float pgg = qwgg - h * qwgb;
+      float pgm = -(h * qwgb);
+      float pmg = -(h * qwmb);
+      float pmm = qwmm - h * qwmb;
+      float pbg = qwgb - h * qwbb;
+      float pbm = qwmb - h * qwbb;
+
+      // S = C.Qw.C^T + Qv and its factors S = L.D.L^T
+      float sgg = (gb->qvG[l] + pgg) - h * pbg;
+      float sgm = pgm - h * pbm;
+      float smm = (gb->qvB[l] + pmm) - h * pbm;
+      float dg = sgg;
+      float lmg = sgm * (1.0F / dg);
+      float dm = smm - lmg * lmg * dg;
+      ok[l] &= (dg > 0.0F) & (dm > 0.0F);
+
+      // each row of K solves S.x = (that row of Qw.C^T)
+      float kgm = (pgm - lmg * pgg) / dm;
+      float kgg = pgg / dg - lmg * kgm;
+      float kmm = (pmm - lmg * pmg) / dm;
+      float kmg = pmg / dg - lmg * kmm;
+      float kbm = (pbm - lmg * pbg) / dm;
+      float kbg = pbg / dg - lmg * kbm;
+
+      // a posteriori errors K.fZErr
+      gb->qgErr[i][l] = kgg * zg + kgm * zm;
+      gb->qmErr[i][l] = kmg * zg + kmm * zm;
+      gb->bErr[i][l] = kbg * zg + kbm * zm;
+    }
+  }
+
+  // as fRun_9DOF_GBY_KALMAN(), K is zero if S was not positive definite
+  for (int i = CHX; i <= CHZ; i++) {
+    for (int l = 0; l < kLanes; l++) {
+      gb->qgErr[i][l] = ok[l] ? gb->qgErr[i][l] : 0.0F;
+      gb->qmErr[i][l] = ok[l] ? gb->qmErr[i][l] : 0.0F;
+      gb->bErr[i][l] = ok[l] ? gb->bErr[i][l] : 0.0F;
+    }
+  }
+}  // end ComputeGain()
+
+#endif  // !ESP32 && !ESP8266 && F_9DOF_GBY_KALMAN
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file fusion_batch.h
+    \brief Runs many independent 9DOF Kalman filters together, for offline
+    reprocessing of recorded sensor streams on a host.
+
+    Each filter (a lane) is an ordinary SV_9DOF_GBY_KALMAN with its own
+    sensor structures, so a lane's results are those of fRun_9DOF_GBY_KALMAN()
+    on the same inputs. A cycle runs the filter's three phases (see fusion.c):
+    the prediction and correction phases lane by lane, as they branch on each
+    lane's data, and the Kalman gain phase, the dense part of the cycle, across
+    blocks of kLanes lanes at once. For the gain the block gathers each lane's
+    state into structure-of-arrays form, where the 9x6 gain separates into one
+    small solve per axis, and runs straight-line loops over the lanes that the
+    compiler vectorizes. The gain phase does not fill in a lane's fQw9x9,
+    fQwCT9x6 and fK9x6, which only it reads. For the same reason a lane's
+    health check (see KalmanHealth) covers its gain and state but not Qw.
+
+    Run() can spread the blocks over several threads. Each block is advanced
+    through its streams independently of the others, so threads never wait
+    for each other until the end of the run.
+
+    Host builds only: it uses std::thread, and the devices run one filter.
+    Besides fusion_batch.cc, a host build compiles fusion.c, orientation.c,
+    matrix.c, approximations.c, matrix_fixed.cc and hal_timer.c (which
+    uses the POSIX clock off the ESP processors), with SIMULATION defined
+    so that fusion.c does not read calibrations from the EEPROM. No Arduino
+    headers are needed: sensor_fusion.h and board.h include Arduino.h only
+    when ESP32 or ESP8266 is defined.
+*/
+
+#ifndef FUSION_BATCH_H
+#define FUSION_BATCH_H
+
+#if !defined(ESP32) && !defined(ESP8266)
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "sensor_fusion.h"
+
+#if F_9DOF_GBY_KALMAN
+
+/// The structures of one filter run by a FusionBatch. They belong to the
+/// caller, who loads each cycle's sensor data into them (see
+/// FusionBatch::LoadFunction); e.g. the members of a SensorFusionGlobals.
+struct FusionBatchLane {
+  struct SV_9DOF_GBY_KALMAN *sv;    ///< filter state
+  struct AccelSensor *accel;        ///< calibrated accelerometer input (fGc)
+  struct MagSensor *mag;            ///< calibrated magnetometer input (fBc)
+  struct GyroSensor *gyro;          ///< gyro input (iYs, iYsFIFO)
+  struct MagCalibration *mag_cal;   ///< magnetic calibration (fB, fBSq, iValidMagCal)
+};
+
+/// Advances N 9DOF Kalman filters together; see fusion_batch.h.
+class FusionBatch {
+ public:
+  /// Lanes whose gain is computed together
+  static constexpr int kLanes = 8;
+
+  /// Load the inputs of cycle number `cycle` of a lane. Returns false when
+  /// the lane's stream has ended, after which it is not called for that lane
+  /// again. When Run() uses several threads, it is called from them, but
+  /// never for the same lane from two at once.
+  typedef bool LoadFunction(int lane, uint32_t cycle, void *context);
+  /// Called once a lane has completed a cycle, e.g. to record its outputs
+  /// (fUpdateDerivedOutputs() completes the Euler angles). Threaded as
+  /// LoadFunction.
+  typedef void StoreFunction(int lane, uint32_t cycle, void *context);
+
+  explicit FusionBatch(int num_threads = 1);
+  /// Add a lane, numbered from 0 in the order added. Its state should be set
+  /// up as for fRun_9DOF_GBY_KALMAN(), e.g. by fSetNoise_9DOF_GBY_KALMAN()
+  /// and a resetflag.
+  int AddLane(const FusionBatchLane &lane);
+  int NumLanes(void) const { return (int)lanes_.size(); }
+  /// Run every lane until its stream ends. store may be NULL.
+  void Run(LoadFunction *load, StoreFunction *store, void *context);
+  /// Advance every lane one cycle, on the calling thread, from the inputs
+  /// the caller has already loaded.
+  void Step(void);
+
+ private:
+  /// Per lane quantities read and written by the gain phase, one array
+  /// element per lane of the block
+  struct GainBlock {
+    alignas(32) float qgErr[3][kLanes];   ///< fqgErrPl
+    alignas(32) float qmErr[3][kLanes];   ///< fqmErrPl
+    alignas(32) float bErr[3][kLanes];    ///< fbErrPl
+    alignas(32) float zErr[6][kLanes];    ///< fZErr
+    alignas(32) float qvG[kLanes];        ///< fQv6x1[0-2]
+    alignas(32) float qvB[kLanes];        ///< fQv6x1[3-5]
+    alignas(32) float alphaOver2[kLanes];           ///< fAlphaOver2
+    alignas(32) float alphaSqOver4[kLanes];         ///< fAlphaSqOver4
+    alignas(32) float alphaSqQvYQwbOver12[kLanes];  ///< fAlphaSqQvYQwbOver12
+    alignas(32) float qwbOver3[kLanes];             ///< fQwbOver3
+  };
+
+  void StepBlock(int block, const bool running[]);
+  void RunBlocks(int first_block, int block_stride, LoadFunction *load,
+                 StoreFunction *store, void *context);
+  static void ComputeGain(GainBlock *gb, int ok[]);
+
+  std::vector<FusionBatchLane> lanes_;
+  std::vector<GainBlock> blocks_;   ///< one per kLanes lanes
+  int num_threads_;
+};
+
+#endif  // F_9DOF_GBY_KALMAN
+
+#endif  // !ESP32 && !ESP8266
+
+#endif  // FUSION_BATCH_H
@@ -25,6 +25,63 @@
 #include "hal_i2c.h"
 
 
+#ifdef ESP32
+static TwoWire *i2c_bus[I2C_NUM_BUSES] = {&Wire, &Wire1};
+#else
+static TwoWire *i2c_bus[I2C_NUM_BUSES] = {&Wire};
+#endif
+static bool i2c_bus_initialized[I2C_NUM_BUSES] = {false};
+static uint32_t i2c_bus_default_clock[I2C_NUM_BUSES] = {0};  ///< clock given to I2CInitializeBus()
+static uint32_t i2c_bus_clock[I2C_NUM_BUSES] = {0};          ///< clock currently programmed
+static int i2c_bus_sda[I2C_NUM_BUSES];                       ///< pins given to I2CInitializeBus()
+static int i2c_bus_scl[I2C_NUM_BUSES];
+
+#ifdef ESP32
+// Each secondary bus gets a worker task so that I2CRunOnAllBuses() can drive
+// all controllers at the same time. Bus 0 is always serviced by the caller.
+static TaskHandle_t i2c_bus_worker[I2C_NUM_BUSES] = {NULL};
+static TaskHandle_t i2c_bus_caller = NULL;
+static i2cBusJob_t *i2c_bus_job = NULL;
+static void *i2c_bus_job_param = NULL;
+
+static void I2CBusWorker(void *arg) {
+  uint8_t bus = (uint8_t)(uintptr_t)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    i2c_bus_job(bus, i2c_bus_job_param);
+    xTaskNotifyGive(i2c_bus_caller);
+  }
+}  // end I2CBusWorker()
+#endif
+
+/**************************************************************************/
+/*!
+    @brief  Return the Wire object for a device, with the bus clock set to
+    the rate requested for that device. The clock is only reprogrammed when
+    it differs from the one used by the previous transaction on that bus.
+    Returns NULL if the bus doesn't exist or hasn't been initialized.
+*/
+/**************************************************************************/
+static TwoWire *I2CSelectBus(const registerDeviceInfo_t *devInfo) {
+  uint8_t bus = 0;
+  uint32_t clock_hz = 0;
+  if (NULL != devInfo) {
+    bus = devInfo->deviceInstance;
+    clock_hz = devInfo->clockHz;
+  }
+  if (bus >= I2C_NUM_BUSES || !i2c_bus_initialized[bus]) {
+    return NULL;
+  }
+  if (0 == clock_hz) {
+    clock_hz = i2c_bus_default_clock[bus];
+  }
+  if (clock_hz != i2c_bus_clock[bus]) {
+    i2c_bus[bus]->setClock(clock_hz);
+    i2c_bus_clock[bus] = clock_hz;
+  }
+  return i2c_bus[bus];
+}  // end I2CSelectBus()
+
 /**************************************************************************/
 /*!
     @brief  Initialize the I2C system at max clock rate supported by sensors.
@@ -35,51 +92,167 @@
 */
 /**************************************************************************/
 bool I2CInitialize( int pin_sda, int pin_scl ) {
-  
- #ifdef ESP32
-    bool success = Wire.begin(pin_sda, pin_scl);
+  return I2CInitializeBus(0, pin_sda, pin_scl, I2C_DEFAULT_CLOCK_HZ);
+}  // end I2CInitialize()
+
+/**************************************************************************/
+/*!
+    @brief  Initialize one of the I2C buses. bus 0 uses Wire, bus 1 (ESP32
+    only) uses Wire1. clock_hz is the default clock for the bus; individual
+    sensors may override it through registerDeviceInfo_t.clockHz.
+
+    Returns true if successful, false if the bus doesn't exist or there
+    was a problem initializing it.
+*/
+/**************************************************************************/
+bool I2CInitializeBus(uint8_t bus, int pin_sda, int pin_scl, uint32_t clock_hz) {
+  if (bus >= I2C_NUM_BUSES) {
+    return false;
+  }
+  if (0 == clock_hz) {
+    clock_hz = I2C_DEFAULT_CLOCK_HZ;
+  }
+#ifdef ESP32
+  bool success = i2c_bus[bus]->begin(pin_sda, pin_scl);
 #endif
 #ifdef ESP8266
-    Wire.begin(pin_sda, pin_scl);
-    bool success = true;    //ESP8266 Wire library doesn't return value from begin()
+  i2c_bus[bus]->begin(pin_sda, pin_scl);
+  bool success = true;    //ESP8266 Wire library doesn't return value from begin()
 #endif
-    Wire.setClock(400000);  // in ESP8266 library, can't set clock in same call
-                            // that sets pins
-    return success;
-}  // end I2CInitialize()
+  i2c_bus[bus]->setClock(clock_hz);  // in ESP8266 library, can't set clock in same call
+                                     // that sets pins
+  i2c_bus_default_clock[bus] = clock_hz;
+  i2c_bus_clock[bus] = clock_hz;
+  i2c_bus_sda[bus] = pin_sda;
+  i2c_bus_scl[bus] = pin_scl;
+  i2c_bus_initialized[bus] = success;
+#ifdef ESP32
+  if (success && bus > 0 && NULL == i2c_bus_worker[bus]) {
+    if (pdPASS != xTaskCreate(I2CBusWorker, "i2c_bus", 4096,
+                              (void *)(uintptr_t)bus, uxTaskPriorityGet(NULL),
+                              &i2c_bus_worker[bus])) {
+      i2c_bus_worker[bus] = NULL;  // bus is still usable, just not concurrently
+    }
+  }
+#endif
+  return success;
+}  // end I2CInitializeBus()
 
 /**************************************************************************/
 /*!
-    @brief  Read single byte from address and place in destination
-    Returns true if successful, false if error
+    @brief  Returns true if the given bus has been successfully initialized.
 */
 /**************************************************************************/
-bool I2CReadByte(byte address, byte reg, byte *destination) {
-  return I2CReadBytes(address, reg, destination, 1);
-}  // end ReadByte()
+bool I2CIsBusInitialized(uint8_t bus) {
+  return (bus < I2C_NUM_BUSES) && i2c_bus_initialized[bus];
+}  // end I2CIsBusInitialized()
 
 /**************************************************************************/
 /*!
-    @brief  Read num_bytes bytes from address starting at register.
-    Assumes device auto-increments the register.
+    @brief  Call job(bus, param) once for every I2C bus, and return when
+    all calls have completed. On ESP32, buses having a worker task are
+    serviced concurrently with bus 0, which runs in the calling task.
+    Other buses are serviced one after the other by the caller. Jobs
+    for different buses must not write to the same data.
+*/
+/**************************************************************************/
+void I2CRunOnAllBuses(i2cBusJob_t *job, void *param) {
+  uint8_t bus;
+#ifdef ESP32
+  uint8_t dispatched = 0;
+  i2c_bus_job = job;
+  i2c_bus_job_param = param;
+  i2c_bus_caller = xTaskGetCurrentTaskHandle();
+  for (bus = 1; bus < I2C_NUM_BUSES; bus++) {
+    if (NULL != i2c_bus_worker[bus]) {
+      xTaskNotifyGive(i2c_bus_worker[bus]);
+      dispatched++;
+    }
+  }
+#endif
+  job(0, param);
+  for (bus = 1; bus < I2C_NUM_BUSES; bus++) {
+#ifdef ESP32
+    if (NULL != i2c_bus_worker[bus]) {
+      continue;  // already being serviced by its worker
+    }
+#endif
+    job(bus, param);
+  }
+#ifdef ESP32
+  while (dispatched > 0) {
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);  // one notification per worker
+    dispatched--;
+  }
+#endif
+}  // end I2CRunOnAllBuses()
+
+/**************************************************************************/
+/*!
+    @brief  Release a bus held by a slave that was interrupted mid-byte and
+    is still driving SDA low. SCL is clocked (up to 9 times) until SDA is
+    released, a STOP is generated, and the bus is re-initialized with its
+    previous pins and clock. Takes roughly 0.1 ms.
+
+    Returns true if SDA is high (bus free) afterwards.
+*/
+/**************************************************************************/
+bool I2CBusClear(uint8_t bus) {
+  if (!I2CIsBusInitialized(bus)) {
+    return false;
+  }
+  // -1 asked for the Arduino default pins
+  int sda = (i2c_bus_sda[bus] < 0) ? SDA : i2c_bus_sda[bus];
+  int scl = (i2c_bus_scl[bus] < 0) ? SCL : i2c_bus_scl[bus];
+
+#ifdef ESP32
+  i2c_bus[bus]->end();  // detach the controller so the pins can be driven as GPIO
+#endif
+  pinMode(sda, INPUT_PULLUP);
+  digitalWrite(scl, HIGH);
+  pinMode(scl, OUTPUT_OPEN_DRAIN);
+  for (int i = 0; i < 9 && LOW == digitalRead(sda); i++) {
+    digitalWrite(scl, LOW);
+    delayMicroseconds(5);
+    digitalWrite(scl, HIGH);
+    delayMicroseconds(5);
+  }
+  // STOP condition: SDA rises while SCL is high
+  digitalWrite(sda, LOW);
+  pinMode(sda, OUTPUT_OPEN_DRAIN);
+  delayMicroseconds(5);
+  digitalWrite(sda, HIGH);
+  delayMicroseconds(5);
+  bool released = (HIGH == digitalRead(sda));
+
+  I2CInitializeBus(bus, i2c_bus_sda[bus], i2c_bus_scl[bus],
+                   i2c_bus_default_clock[bus]);
+  return released;
+}  // end I2CBusClear()
+
+/**************************************************************************/
+/*!
+    @brief  Read num_bytes bytes from address starting at register, on
+    the given bus. Assumes device auto-increments the register.
     Bytes read are placed in destination.
     Returns true if successful, false if error.
 */
 /**************************************************************************/
-bool I2CReadBytes(byte address, byte reg, byte *destination, int num_bytes) {
-  if (NULL == destination) {
+static bool I2CReadBytesFrom(TwoWire *wire, byte address, byte reg,
+                             byte *destination, int num_bytes) {
+  if (NULL == destination || NULL == wire) {
     return false;
   }
-  Wire.beginTransmission(address);
-  if (!Wire.write(reg)) {
-    Wire.endTransmission(true);
+  wire->beginTransmission(address);
+  if (!wire->write(reg)) {
+    wire->endTransmission(true);
     return false;
   }
-  Wire.endTransmission(false);
-  if (num_bytes == Wire.requestFrom(address, (uint8_t)num_bytes)) {
+  wire->endTransmission(false);
+  if (num_bytes == wire->requestFrom(address, (uint8_t)num_bytes)) {
     int return_value;
     for (int i=0; i < num_bytes; i++) {
-        return_value = Wire.read();
+        return_value = wire->read();
         if (return_value >= 0) {
           destination[i] = (byte)return_value;
         } else {
@@ -90,6 +263,55 @@ bool I2CReadBytes(byte address, byte reg, byte *destination, int num_bytes) {
   }
   return false;
 
+}  // end I2CReadBytesFrom()
+
+/**************************************************************************/
+/*!
+    @brief  Write num_bytes bytes starting at register to I2C address, on
+    the given bus. Assumes device auto-increments the register.
+    Returns true if successful, false if error.
+*/
+/**************************************************************************/
+static bool I2CWriteBytesTo(TwoWire *wire, byte address, byte reg,
+                            const byte *value, unsigned int num_bytes) {
+  if (NULL == wire) {
+    return false;
+  }
+  wire->beginTransmission(address);
+  wire->write(reg);
+  if (num_bytes != wire->write(value, num_bytes)) {
+    // error queueing up the bytes
+    wire->endTransmission();
+    return false;
+  }
+  if( I2C_ERROR_OK == wire->endTransmission() ){
+    return true;
+  }else {
+    return false;
+  }
+}  // end I2CWriteBytesTo()
+
+/**************************************************************************/
+/*!
+    @brief  Read single byte from address and place in destination
+    Returns true if successful, false if error
+*/
+/**************************************************************************/
+bool I2CReadByte(byte address, byte reg, byte *destination) {
+  return I2CReadBytes(address, reg, destination, 1);
+}  // end ReadByte()
+
+/**************************************************************************/
+/*!
+    @brief  Read num_bytes bytes from address starting at register, on bus 0.
+    Assumes device auto-increments the register.
+    Bytes read are placed in destination.
+    Returns true if successful, false if error.
+*/
+/**************************************************************************/
+bool I2CReadBytes(byte address, byte reg, byte *destination, int num_bytes) {
+  return I2CReadBytesFrom(I2CSelectBus(NULL), address, reg, destination,
+                          num_bytes);
 }  // end I2CReadBytes()
 
 
@@ -100,37 +322,19 @@ bool I2CReadBytes(byte address, byte reg, byte *destination, int num_bytes) {
 */
 /**************************************************************************/
 bool I2CWriteByte(byte address, byte reg, byte value) {
-  Wire.beginTransmission(address);
-  Wire.write(reg);
-  Wire.write(value);
-  if (I2C_ERROR_OK == Wire.endTransmission()) {
-    return true;
-  } else {
-    return false;
-  }
+  return I2CWriteBytes(address, reg, &value, 1);
 }  // end I2CWriteByte()
 
 /**************************************************************************/
 /*!
-    @brief  Write multiple bytes starting at register to I2C address
+    @brief  Write multiple bytes starting at register to I2C address on bus 0.
     Assumes device auto-increments the I2C register being written to.
     Returns true if successful, false if error.
 */
 /**************************************************************************/
 bool I2CWriteBytes(byte address, byte reg, const byte *value,
                unsigned int num_bytes) {
-  Wire.beginTransmission(address);
-  Wire.write(reg);
-  if (num_bytes != Wire.write(value, num_bytes)) {
-    // error queueing up the bytes
-    Wire.endTransmission();
-    return false;
-  }
-  if( I2C_ERROR_OK == Wire.endTransmission() ){
-    return true;
-  }else {
-    return false;
-  }
+  return I2CWriteBytesTo(I2CSelectBus(NULL), address, reg, value, num_bytes);
 } // end I2CWriteBytes()
 
 /*
@@ -150,6 +354,7 @@ int8_t Sensor_I2C_Write_List(registerDeviceInfo_t *devInfo, uint16_t peripheralA
   }
 
   const registerwritelist_t *pCmd = pRegWriteList;
+  TwoWire *wire = I2CSelectBus(devInfo);
   // Update register values based on register write list until the next Cmd is
   // the list terminator.
   // original method used Repeated starts, but try individual xactions for simplicity. 
@@ -161,7 +366,7 @@ int8_t Sensor_I2C_Write_List(registerDeviceInfo_t *devInfo, uint16_t peripheralA
     // Set the register based on the values in the register value pair
     // was Register_I2C_Write(pCommDrv, devInfo, peripheralAddress, pCmd->writeTo,
     // pCmd->value, pCmd->mask, repeatedStart);
-    if (!I2CWriteByte(peripheralAddress, pCmd->writeTo, pCmd->value)) {
+    if (!I2CWriteBytesTo(wire, peripheralAddress, pCmd->writeTo, &pCmd->value, 1)) {
       return SENSOR_ERROR_WRITE;
     }
     ++pCmd;
@@ -186,14 +391,15 @@ int32_t Sensor_I2C_Read(registerDeviceInfo_t *devInfo,
     return SENSOR_ERROR_BAD_ADDRESS;
   }
   const registerReadlist_t *pCmd = pReadList;
+  TwoWire *wire = I2CSelectBus(devInfo);
 
   // Traverse the read list and read the registers one by one unless the
   // register read list numBytes is zero
   for (pBuf = pOutBuffer; pCmd->numBytes != 0; pCmd++) {
     // was Register_I2C_Read(pCommDrv, devInfo, peripheralAddress,
     // pCmd->readFrom, pCmd->numBytes, pBuf);
-    if (!I2CReadBytes(peripheralAddress, pCmd->readFrom, pBuf,
-                      pCmd->numBytes)) {
+    if (!I2CReadBytesFrom(wire, peripheralAddress, pCmd->readFrom, pBuf,
+                          pCmd->numBytes)) {
       return SENSOR_ERROR_READ;
     }
     pBuf += pCmd->numBytes;
@@ -206,9 +412,8 @@ int32_t Sensor_I2C_Read_Register(registerDeviceInfo_t *devInfo,
                           uint8_t offset,
                           uint8_t length,
                           uint8_t *pOutBuffer) {
-  //TODO - can toss the devInfo parameter, or use it for peripheralAddr
-  if(I2CReadBytes((byte)peripheralAddress, (byte)offset, pOutBuffer,
-                      (int)length) )
+  if(I2CReadBytesFrom(I2CSelectBus(devInfo), (byte)peripheralAddress,
+                      (byte)offset, pOutBuffer, (int)length) )
   { return SENSOR_ERROR_NONE;
   } else
   {
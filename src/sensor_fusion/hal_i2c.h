@@ -32,12 +32,28 @@ extern "C" {
     #define I2C_ERROR_OK (0)  //not defined in ESP8266 Wire library, but is in the ESP32 version
 #endif
 
+// ESP32 has two I2C controllers (Wire and Wire1); ESP8266 has a single software one.
+// A sensor selects its bus via registerDeviceInfo_t.deviceInstance.
+#ifdef ESP32
+    #define I2C_NUM_BUSES (2)
+#else
+    #define I2C_NUM_BUSES (1)
+#endif
+#define I2C_DEFAULT_CLOCK_HZ (400000)   ///< clock used when neither bus nor sensor specify one
+
+/// Function run against one I2C bus by I2CRunOnAllBuses()
+typedef void (i2cBusJob_t)(uint8_t bus, void *param);
+
 /*******************************************************************************
  * API
  ******************************************************************************/
 
 //TODO put these in a class
 bool I2CInitialize(int pin_sda, int pin_scl);
+bool I2CInitializeBus(uint8_t bus, int pin_sda, int pin_scl, uint32_t clock_hz);
+bool I2CIsBusInitialized(uint8_t bus);
+void I2CRunOnAllBuses(i2cBusJob_t *job, void *param);
+bool I2CBusClear(uint8_t bus);
 bool I2CReadByte(uint8_t address, uint8_t reg, uint8_t *destination);
 bool I2CReadBytes(uint8_t address, uint8_t reg, uint8_t *destination, int num_bytes);
 bool I2CWriteByte(uint8_t address, uint8_t reg, uint8_t value);
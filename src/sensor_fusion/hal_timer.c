@@ -1,8 +1,27 @@
+#if defined(ESP32) || defined(ESP8266)
 #include <Arduino.h>
+#else
+#include <time.h>
+#endif
 #include <stdint.h>
 
 #include "hal_timer.h"
 
+#if !defined(ESP32) && !defined(ESP8266)
+// host builds (see fusion_batch.h): micros() and delay() from the POSIX
+// monotonic clock, wrapping at 2^32 us as on the ESP processors
+static uint32_t micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)ts.tv_sec * 1000000u + (uint32_t)(ts.tv_nsec / 1000);
+}
+
+static void delay(uint32_t ms) {
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+#endif
+
 #define CORE_SYSTICK_HZ  1000000     //use the 1us resolution timer available on ESP processors
 #define MICROSECS_IN_SEC 1000000     
 
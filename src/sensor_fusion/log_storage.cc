@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2020-2021, Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file log_storage.cc
+    \brief Provides functions to write data logger blocks to a SPIFFS file
+
+    Written for use on Arduino-Espressif environment where the SPIFFS library
+    is available. The flash must have a SPIFFS partition; it is formatted on
+    first use.
+*/
+#include <stdint.h>
+
+#ifdef ESP32
+#include <SPIFFS.h>
+#endif
+#ifdef ESP8266
+#include <FS.h>
+#endif
+
+#include "log_storage.h"
+
+//Open (and truncate) a log file. Returns the handle passed to
+//LogFileWrite() and LogFileClose(), or NULL if the file can't be created.
+void *LogFileOpen(const char *path) {
+#ifdef ESP32
+  if (!SPIFFS.begin(true)) {  // format the partition if it isn't SPIFFS yet
+    return NULL;
+  }
+  File file = SPIFFS.open(path, FILE_WRITE);
+#endif
+#ifdef ESP8266
+  if (!SPIFFS.begin()) {      // ESP8266 library formats an unformatted partition itself
+    return NULL;
+  }
+  File file = SPIFFS.open(path, "w");
+#endif
+  if (!file) {
+    return NULL;
+  }
+  return new File(file);
+}//end LogFileOpen()
+
+//Append a block to the log file. Returns false if it wasn't all written
+//(e.g. the file system is full).
+bool LogFileWrite(void *pStorage, const uint8_t *pData, uint16_t len) {
+  File *file = (File *)pStorage;
+  return file->write(pData, len) == len;
+}//end LogFileWrite()
+
+void LogFileClose(void *pStorage) {
+  File *file = (File *)pStorage;
+  file->close();
+  delete file;
+}//end LogFileClose()
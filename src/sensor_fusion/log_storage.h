@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2020-2021, Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef LOG_STORAGE_H
+#define LOG_STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \file log_storage.h
+    \brief Provides the SPIFFS file storage used by the data logger (see
+     data_logger.h). The write and close functions match logWriteBlock_t
+     and logClose_t.
+*/
+void *LogFileOpen(const char *path);
+bool LogFileWrite(void *pStorage, const uint8_t *pData, uint16_t len);
+void LogFileClose(void *pStorage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LOG_STORAGE_H
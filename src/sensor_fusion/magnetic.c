@@ -74,6 +74,7 @@ void fInitializeMagCalibration(struct MagCalibration *pthisMagCal,
 #ifndef SIMULATION
     }
 #endif
+    fAccumSet(&pthisMagCal->aFitErrorpc, pthisMagCal->fFitErrorpc);
 
     // initialize remaining elements of the magnetic calibration structure
     pthisMagCal->iCalInProgress = 0;
@@ -321,7 +322,7 @@ void fInvertMagCal(struct MagSensor *pthisMag, struct MagCalibration *pthisMagCa
  * solver. If a calibration is not in progress and has not been done previously,
  * then one is started using the most complex solver suited to the number
  * of measurements available in the buffer. If a calibration is not in progress 
- * but has been done previously, then at CAL_INTERVAL_SECS one is started
+ * but has been done previously, then every iCalIntervalSecs one is started
  * using the most complex solver suited to the number of measurements
  * available in the buffer.
  * 
@@ -381,9 +382,9 @@ void fRunMagCalibration(struct MagCalibration *pthisMagCal, struct MagBuffer *pt
             pthisMagCal->iInitiateMagCal = 4;
         }
 
-        // otherwise start a calibration at regular interval defined by CAL_INTERVAL_SECS
+        // otherwise start a calibration at regular interval defined by iCalIntervalSecs
         else if (!pthisMagCal->iInitiateMagCal &&
-                 !(loopcounter % (CAL_INTERVAL_SECS * FUSION_HZ)))
+                 !(loopcounter % ((int32_t) pthisMagCal->iCalIntervalSecs * FUSION_HZ)))
         {
             if (pthisMagBuffer->iMagBufferCount >= MINMEASUREMENTS10CAL)
             {
@@ -444,6 +445,7 @@ void fRunMagCalibration(struct MagCalibration *pthisMagCal, struct MagBuffer *pt
                 // accept the new calibration
                 pthisMagCal->iValidMagCal = pthisMagCal->iNewCalibrationAvailable;
                 pthisMagCal->fFitErrorpc = pthisMagCal->ftrFitErrorpc;
+                fAccumSet(&pthisMagCal->aFitErrorpc, pthisMagCal->fFitErrorpc);
                 pthisMagCal->fB = pthisMagCal->ftrB;
                 pthisMagCal->fBSq = pthisMagCal->fB * pthisMagCal->fB;
                 for (i = CHX; i <= CHZ; i++)
@@ -471,9 +473,12 @@ void fRunMagCalibration(struct MagCalibration *pthisMagCal, struct MagBuffer *pt
     }           // end of test for new calibration available
 
     // age the existing fit error very slowly to avoid one good calibration locking out future updates.
-    // this prevents a calibration remaining for ever if a unit is never powered down
-    if (pthisMagCal->iValidMagCal)
-        pthisMagCal->fFitErrorpc += 1.0F / ((float) FUSION_HZ * FITERRORAGINGSECS);
+    // this prevents a calibration remaining for ever if a unit is never powered down. The increment is
+    // below the resolution of a float fit error over about 8%, so it is summed in an accumulator.
+    if (pthisMagCal->iValidMagCal) {
+        fAccumAdd(&pthisMagCal->aFitErrorpc, 1.0F / ((float) FUSION_HZ * FITERRORAGINGSECS));
+        pthisMagCal->fFitErrorpc = fAccumGet(pthisMagCal->aFitErrorpc);
+    }
 
     return;
 } // end fRunMagCalibration()
@@ -487,12 +492,6 @@ void fUpdateMagCalibration4Slice(struct MagCalibration *pthisMagCal,
             j,
             k;                  // loop counters
 
-    // working arrays for 4x4 matrix inversion
-    float   *pfRows[4];
-    int8_t    iColInd[4];
-    int8_t    iRowInd[4];
-    int8_t    iPivot[4];
-
     // reset the time slice to zero if iInitiateMagCal is set and then clear iInitiateMagCal
     if (pthisMagCal->iInitiateMagCal)
     {
@@ -627,9 +626,8 @@ void fUpdateMagCalibration4Slice(struct MagCalibration *pthisMagCal,
                 pthisMagCal->fmatB[i][j] = pthisMagCal->fmatB[j][i] = pthisMagCal->fmatA[i][j] = pthisMagCal->fmatA[j][i];
         }
 
-        // set fmatB = inv(fmatB) = inv(X^T.X)
-        for (i = 0; i < 4; i++) pfRows[i] = pthisMagCal->fmatB[i];
-        fmatrixAeqInvA(pfRows, iColInd, iRowInd, iPivot, 4, &ierror);
+        // factor fmatB = X^T.X = L.D.L^T in situ, for the solution in the next time slice
+        fmatrix4x4of10x10FactorLDLT(pthisMagCal->fmatB, &ierror);
 
         // increment the time slice
         (pthisMagCal->itimeslice)++;
@@ -645,13 +643,11 @@ void fUpdateMagCalibration4Slice(struct MagCalibration *pthisMagCal,
         // the trial inverse soft iron matrix invW always equals the identity matrix for 4 element calibration
         f3x3matrixAeqI(pthisMagCal->ftrinvW);
 
-        // calculate solution vector fvecB = beta (4x1) = inv(X^T.X).X^T.Y = fmatB * fvecA (counts)
+        // calculate solution vector fvecB = beta (4x1) = inv(X^T.X).X^T.Y (counts)
+        // from the factors of X^T.X in fmatB
         for (i = 0; i < 4; i++)
-        {
-            pthisMagCal->fvecB[i] = pthisMagCal->fmatB[i][0] * pthisMagCal->fvecA[0];
-            for (j = 1; j < 4; j++)
-                pthisMagCal->fvecB[i] += pthisMagCal->fmatB[i][j] * pthisMagCal->fvecA[j];
-        }
+            pthisMagCal->fvecB[i] = pthisMagCal->fvecA[i];
+        fvecAeqInvBxA4x4of10x10(pthisMagCal->fvecB, pthisMagCal->fmatB);
 
         // compute the hard iron vector (uT) correction for zero mean data
         ftmp = 0.5F * pthisMag->fuTPerCount;
@@ -1446,12 +1442,6 @@ void fComputeMagCalibration4(struct MagCalibration *pthisMagCal,
             k,
             l;          // loop counters
 
-    // working arrays for 4x4 matrix inversion
-    float   *pfRows[4];
-    int8_t    iColInd[4];
-    int8_t    iRowInd[4];
-    int8_t    iPivot[4];
-
     // compute fscaling to reduce multiplications later
     fscaling = pthisMag->fuTPerCount / DEFAULTB;
 
@@ -1549,23 +1539,14 @@ void fComputeMagCalibration4(struct MagCalibration *pthisMagCal,
         }
     }
 
-    // calculate in situ inverse of fmatB = inv(X^T.X) (4x4) while fmatA still holds X^T.X
-    for (i = 0; i < 4; i++)
-    {
-        pfRows[i] = pthisMagCal->fmatB[i];
-    }
-
-    fmatrixAeqInvA(pfRows, iColInd, iRowInd, iPivot, 4, &ierror);
-
-    // calculate fvecA = solution beta (4x1) = inv(X^T.X).X^T.Y = fmatB * fvecB
+    // calculate fvecA = solution beta (4x1) = inv(X^T.X).X^T.Y by factoring
+    // fmatB = X^T.X in situ while fmatA still holds X^T.X
+    fmatrix4x4of10x10FactorLDLT(pthisMagCal->fmatB, &ierror);
     for (i = 0; i < 4; i++)
     {
-        pthisMagCal->fvecA[i] = 0.0F;
-        for (k = 0; k < 4; k++)
-        {
-            pthisMagCal->fvecA[i] += pthisMagCal->fmatB[i][k] * pthisMagCal->fvecB[k];
-        }
+        pthisMagCal->fvecA[i] = pthisMagCal->fvecB[i];
     }
+    fvecAeqInvBxA4x4of10x10(pthisMagCal->fvecA, pthisMagCal->fmatB);
 
     // calculate E = r^T.r = Y^T.Y - 2 * beta^T.(X^T.Y) + beta^T.(X^T.X).beta
     // = fSumBs4 - 2 * fvecA^T.fvecB + fvecA^T.fmatA.fvecA
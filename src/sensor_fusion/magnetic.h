@@ -18,6 +18,8 @@
 #ifndef MAGNETIC_H
 #define MAGNETIC_H
 
+#include "precision.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -72,6 +74,7 @@ struct MagCalibration
 	float ftrinvW[3][3];			        ///< trial inverse soft iron matrix size
 	float ftrB;					///< trial value of geomagnetic field magnitude in uT
 	float ftrFitErrorpc;			        ///< trial value of fit error %
+	accum_t aFitErrorpc;				///< fFitErrorpc accumulator, for its aging (see precision.h)
 	float fA[3][3];					///< ellipsoid matrix A
 	float finvA[3][3];				///< inverse of ellipsoid matrix A
 	float fmatA[10][10];			        ///< scratch 10x10 float matrix used by calibration algorithms
@@ -83,6 +86,7 @@ struct MagCalibration
 	int32_t iMeanBs[3];				///< average magnetic measurement (counts)
 	int32_t itimeslice;				///< counter for tine slicing magnetic calibration calculations
 	int8_t iCalInProgress;			        ///< flag denoting that a calibration is in progress
+	int16_t iCalIntervalSecs;			///< interval (s) between regular calibrations, initially CAL_INTERVAL_SECS
 	int8_t iNewCalibrationAvailable;	        ///< flag denoting that a new calibration has been computed
 	int8_t iInitiateMagCal;			        ///< flag to start a new magnetic calibration
 	int8_t iMagBufferReadOnly;		        ///< flag to denote that the magnetic measurement buffer is temporarily read only
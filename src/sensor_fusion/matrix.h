@@ -87,15 +87,33 @@ void fComputeEigSlice(
     int8_t j, 
     int8_t iMatrixSize
 );
-/// function uses Gauss-Jordan elimination to compute the inverse of matrix A in situ
-/// on exit, A is replaced with its inverse
-void fmatrixAeqInvA(
-    float *A[], 
-    int8_t iColInd[], 
-    int8_t iRowInd[], 
-    int8_t iPivot[], 
-    int8_t isize, 
-    int8_t* pierror
+/// functions set the nrows x n matrix A = A . inv(S) for a symmetric positive
+/// definite n x n matrix S (e.g. a Kalman gain from an innovation covariance),
+/// solving with an L.D.L^T factorization of S rather than inverting it.
+/// S is overwritten by its factors. On error (S not positive definite) A is unchanged.
+void fmatrixAeqAxInvSym3x3(
+    float A[][3],               ///< nrows x 3 matrix, replaced by A . inv(S)
+    int8_t nrows,               ///< number of rows of A
+    float S[][3],               ///< symmetric positive definite matrix (above diagonal elements are used)
+    int8_t *pierror             ///< set true if S is not positive definite
+);
+void fmatrixAeqAxInvSym6x6(
+    float A[][6],               ///< nrows x 6 matrix, replaced by A . inv(S)
+    int8_t nrows,               ///< number of rows of A
+    float S[][6],               ///< symmetric positive definite matrix (above diagonal elements are used)
+    int8_t *pierror             ///< set true if S is not positive definite
+);
+/// function factors a symmetric positive definite 4x4 matrix, held in the top left of a
+/// 10x10 array, in situ as L.D.L^T for fvecAeqInvBxA4x4of10x10. On error (not positive
+/// definite) the matrix is set to the identity matrix.
+void fmatrix4x4of10x10FactorLDLT(
+    float A[][10],              ///< 4x4 matrix (above diagonal elements are used), replaced by its factors
+    int8_t *pierror             ///< set true if A is not positive definite
+);
+/// function sets the 4x1 vector fvecA = inv(B) . fvecA, B having been factored by fmatrix4x4of10x10FactorLDLT
+void fvecAeqInvBxA4x4of10x10(
+    float fvecA[],              ///< right hand side on entry, solution on exit
+    float B[][10]               ///< factors from fmatrix4x4of10x10FactorLDLT
 );
 /// function rotates 3x1 vector u onto 3x1 vector using 3x3 rotation matrix fR.
 /// the rotation is applied in the inverse direction if itranpose is true
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file matrix_fixed.cc
+    \brief C entry points to the fixed-size matrix kernels in matrix_fixed.h
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix.h"
+#include "matrix_fixed.h"
+
+// function sets the nrows x 3 matrix A = A . inv(S) for symmetric positive definite 3x3 S
+void fmatrixAeqAxInvSym3x3(float A[][3], int8_t nrows, float S[][3], int8_t *pierror)
+{
+    int8_t i;
+
+    *pierror = !MatLDLTFactor<3, 3>(S);
+    if (*pierror) return;
+    for (i = 0; i < nrows; i++) MatLDLTSolve<3, 3>(S, A[i]);
+}
+
+// function sets the nrows x 6 matrix A = A . inv(S) for symmetric positive definite 6x6 S
+void fmatrixAeqAxInvSym6x6(float A[][6], int8_t nrows, float S[][6], int8_t *pierror)
+{
+    int8_t i;
+
+    *pierror = !MatLDLTFactor<6, 6>(S);
+    if (*pierror) return;
+    for (i = 0; i < nrows; i++) MatLDLTSolve<6, 6>(S, A[i]);
+}
+
+// function factors the symmetric positive definite 4x4 matrix in the top left
+// of the 10x10 array A in situ as L.D.L^T
+void fmatrix4x4of10x10FactorLDLT(float A[][10], int8_t *pierror)
+{
+    *pierror = !MatLDLTFactor<4, 10>(A);
+}
+
+// function sets fvecA = inv(B) . fvecA, B having been factored by fmatrix4x4of10x10FactorLDLT
+void fvecAeqInvBxA4x4of10x10(float fvecA[], float B[][10])
+{
+    MatLDLTSolve<4, 10>(B, fvecA);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file matrix_fixed.h
+    \brief Fixed-size matrix kernels for C++ callers
+
+    The kernels work in situ on the row-major C arrays used throughout the
+    fusion code, passed as T A[][S]. The dimensions are template
+    parameters, so each kernel is compiled for its size with constant loop
+    bounds the compiler can unroll, and no row pointer arrays are needed.
+    The scalar type is a template parameter too, though the shims only
+    instantiate float.
+
+    C code reaches these kernels through the shims in matrix_fixed.cc,
+    declared in matrix.h.
+
+    There is no matrix class or dense product here. The Kalman filters'
+    covariance products in fusion.c skip the known zero and unit terms of
+    their measurement matrices, which a dense 6x6 or 9x9 product would
+    spend most of its multiplies on, so they stay as written.
+*/
+
+#ifndef MATRIX_FIXED_H
+#define MATRIX_FIXED_H
+
+#ifdef __cplusplus
+
+/// A = I, for the top left N x N corner of an array with S columns
+template <int N, int S, typename T>
+inline void MatSetIdentity(T (*A)[S]) {
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++) A[i][j] = (i == j) ? T(1) : T(0);
+}
+
+/// Factor the symmetric positive definite top left N x N corner of an array
+/// with S columns in situ as A = L.D.L^T, for MatLDLTSolve(). Only the on
+/// and above diagonal elements are read. On exit the below diagonal elements
+/// hold L (whose unit diagonal is not stored) and the diagonal holds D; the
+/// above diagonal elements are unchanged. This takes about N^3 / 6 multiplies,
+/// against N^3 for inversion by Gauss-Jordan elimination, and needs no
+/// pivoting or square roots. Returns false, leaving the corner set to the
+/// identity matrix (so solves return their right hand side), if a diagonal
+/// term of D is not positive, i.e. A is not positive definite.
+template <int N, int S, typename T>
+inline bool MatLDLTFactor(T (*A)[S]) {
+  for (int j = 0; j < N; j++) {
+    T d = A[j][j];
+    for (int k = 0; k < j; k++) d -= A[j][k] * A[j][k] * A[k][k];
+    if (!(d > T(0))) {  // also catches NaN
+      MatSetIdentity<N, S>(A);
+      return false;
+    }
+    A[j][j] = d;
+    T recipd = T(1) / d;
+    for (int i = j + 1; i < N; i++) {
+      T v = A[j][i];
+      for (int k = 0; k < j; k++) v -= A[i][k] * A[j][k] * A[k][k];
+      A[i][j] = v * recipd;
+    }
+  }
+  return true;
+}
+
+/// Solve A.x = b in situ, where LD holds the factors of A from MatLDLTFactor().
+/// On entry x holds b.
+template <int N, int S, typename T>
+inline void MatLDLTSolve(const T (*LD)[S], T x[]) {
+  for (int i = 0; i < N; i++)  // L.y = b
+    for (int k = 0; k < i; k++) x[i] -= LD[i][k] * x[k];
+  for (int i = 0; i < N; i++) x[i] /= LD[i][i];  // D.z = y
+  for (int i = N - 1; i >= 0; i--)  // L^T.x = z
+    for (int k = i + 1; k < N; k++) x[i] -= LD[k][i] * x[k];
+}
+
+#endif  // __cplusplus
+
+#endif  // MATRIX_FIXED_H
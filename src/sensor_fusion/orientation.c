@@ -122,7 +122,7 @@ void f3DOFTiltWin8(float fR[][3], float fGc[])
 	float fmodGxz;			// modulus of the x, z accelerometer readings
 	float frecipmodGxyz;	// reciprocal of modulus
 	float ftmp;				// scratch variable
-	int8 i;					// counter
+	int8_t i;					// counter
 
 	// compute the accelerometer squared magnitudes
 	fmodGxz = fGc[CHX] * fGc[CHX] + fGc[CHZ] * fGc[CHZ];
@@ -342,7 +342,7 @@ void feCompassAndroid(float fR[][3], float *pfDelta, float *pfsinDelta, float *p
 	float fmod[3];					// column moduli
 	float fGcdotBc;					// dot product of vectors G.Bc
 	float ftmp;						// scratch variable
-	int8 i, j;						// loop counters
+	int8_t i, j;						// loop counters
 
 	// set the inclination angle to zero in case it is not computed later
 	*pfDelta = *pfsinDelta = 0.0F;
@@ -416,7 +416,7 @@ void feCompassWin8(float fR[][3], float *pfDelta, float *pfsinDelta, float *pfco
 	float fmod[3];					// column moduli
 	float fGcdotBc;					// dot product of vectors G.Bc
 	float ftmp;						// scratch variable
-	int8 i, j;						// loop counters
+	int8_t i, j;						// loop counters
 
 	// set the inclination angle to zero in case it is not computed later
 	*pfDelta = *pfsinDelta = 0.0F;
@@ -487,11 +487,26 @@ void feCompassWin8(float fR[][3], float *pfDelta, float *pfsinDelta, float *pfco
 void fNEDAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfTheDeg, float *pfPsiDeg,
 		float *pfRhoDeg, float *pfChiDeg)
 {
-	// calculate the pitch angle -90.0 <= Theta <= 90.0 deg
-	*pfTheDeg = fasin_deg(-R[CHX][CHZ]);
-
-	// calculate the roll angle range -180.0 <= Phi < 180.0 deg
-	*pfPhiDeg = fatan2_deg(R[CHY][CHZ], R[CHZ][CHZ]);
+	float fy[4], fx[4];		// atan2 arguments
+	float fangle[4];		// atan2 angles (deg)
+
+	// evaluate the four inverse trig functions together as atan2
+	// pitch angle -90.0 <= Theta <= 90.0 deg is asin(-R[CHX][CHZ])
+	fy[0] = -R[CHX][CHZ];
+	fx[0] = fsqrt1mx2(R[CHX][CHZ]);
+	// roll angle range -180.0 <= Phi < 180.0 deg
+	fy[1] = R[CHY][CHZ];
+	fx[1] = R[CHZ][CHZ];
+	// yaw angle in the general (no gimbal lock) case
+	fy[2] = R[CHX][CHY];
+	fx[2] = R[CHX][CHX];
+	// tilt angle from vertical Chi (0 <= Chi <= 180 deg) is acos(R[CHZ][CHZ])
+	fy[3] = fsqrt1mx2(R[CHZ][CHZ]);
+	fx[3] = R[CHZ][CHZ];
+	fatan2_deg4(fy, fx, fangle);
+
+	*pfTheDeg = fangle[0];
+	*pfPhiDeg = fangle[1];
 
 	// map +180 roll onto the functionally equivalent -180 deg roll
 	if (*pfPhiDeg == 180.0F)
@@ -513,7 +528,7 @@ void fNEDAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfThe
 	else
 	{
 		// general case
-		*pfPsiDeg = fatan2_deg(R[CHX][CHY], R[CHX][CHX]);
+		*pfPsiDeg = fangle[2];
 	}
 
 	// map yaw angle Psi onto range 0.0 <= Psi < 360.0 deg
@@ -531,8 +546,9 @@ void fNEDAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfThe
 	// for NED, the compass heading Rho equals the yaw angle Psi
 	*pfRhoDeg = *pfPsiDeg;
 
-	// calculate the tilt angle from vertical Chi (0 <= Chi <= 180 deg)
-	*pfChiDeg = facos_deg(R[CHZ][CHZ]);
+	// tilt angle from vertical Chi. Its lane has y >= 0, so the only angle
+	// fatan2_deg4() folds is 180 deg (R[CHZ][CHZ] = -1, inverted) to -180.
+	*pfChiDeg = fabsf(fangle[3]);
 
 	return;
 }
@@ -543,11 +559,26 @@ void fNEDAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfThe
 void fAndroidAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfTheDeg, float *pfPsiDeg,
 		float *pfRhoDeg, float *pfChiDeg)
 {
-	// calculate the roll angle -90.0 <= Phi <= 90.0 deg
-	*pfPhiDeg = fasin_deg(R[CHX][CHZ]);
-
-	// calculate the pitch angle -180.0 <= The < 180.0 deg
-	*pfTheDeg = fatan2_deg(-R[CHY][CHZ], R[CHZ][CHZ]);
+	float fy[4], fx[4];		// atan2 arguments
+	float fangle[4];		// atan2 angles (deg)
+
+	// evaluate the four inverse trig functions together as atan2
+	// roll angle -90.0 <= Phi <= 90.0 deg is asin(R[CHX][CHZ])
+	fy[0] = R[CHX][CHZ];
+	fx[0] = fsqrt1mx2(R[CHX][CHZ]);
+	// pitch angle -180.0 <= The < 180.0 deg
+	fy[1] = -R[CHY][CHZ];
+	fx[1] = R[CHZ][CHZ];
+	// yaw angle in the general (no gimbal lock) case
+	fy[2] = -R[CHX][CHY];
+	fx[2] = R[CHX][CHX];
+	// tilt angle from vertical Chi (0 <= Chi <= 180 deg) is acos(R[CHZ][CHZ])
+	fy[3] = fsqrt1mx2(R[CHZ][CHZ]);
+	fx[3] = R[CHZ][CHZ];
+	fatan2_deg4(fy, fx, fangle);
+
+	*pfPhiDeg = fangle[0];
+	*pfTheDeg = fangle[1];
 
 	// map +180 pitch onto the functionally equivalent -180 deg pitch
 	if (*pfTheDeg == 180.0F)
@@ -569,7 +600,7 @@ void fAndroidAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *p
 	else
 	{
 		// general case
-		*pfPsiDeg = fatan2_deg(-R[CHX][CHY], R[CHX][CHX]);
+		*pfPsiDeg = fangle[2];
 	}
 
 	// map yaw angle Psi onto range 0.0 <= Psi < 360.0 deg
@@ -588,8 +619,9 @@ void fAndroidAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *p
 	// this definition is compliant with Motorola Xoom tablet behavior
 	*pfRhoDeg = *pfPsiDeg;
 
-	// calculate the tilt angle from vertical Chi (0 <= Chi <= 180 deg)
-	*pfChiDeg = facos_deg(R[CHZ][CHZ]);
+	// tilt angle from vertical Chi. Its lane has y >= 0, so the only angle
+	// fatan2_deg4() folds is 180 deg (R[CHZ][CHZ] = -1, inverted) to -180.
+	*pfChiDeg = fabsf(fangle[3]);
 
 	return;
 }
@@ -600,6 +632,24 @@ void fAndroidAnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *p
 void fWin8AnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfTheDeg, float *pfPsiDeg,
 		float *pfRhoDeg, float *pfChiDeg)
 {
+	float fy[4], fx[4];		// atan2 arguments
+	float fangle[4];		// atan2 angles (deg)
+
+	// evaluate the four inverse trig functions together as atan2
+	// roll angle -90.0 <= Phi <= 90.0 deg is atan(-R[CHX][CHZ] / R[CHZ][CHZ])
+	fy[0] = (R[CHZ][CHZ] < 0.0F) ? R[CHX][CHZ] : -R[CHX][CHZ];
+	fx[0] = fabsf(R[CHZ][CHZ]);
+	// pitch angle in the range -90.0 <= The <= 90.0 deg is asin(R[CHY][CHZ])
+	fy[1] = R[CHY][CHZ];
+	fx[1] = fsqrt1mx2(R[CHY][CHZ]);
+	// yaw angle in the general (no gimbal lock) case
+	fy[2] = -R[CHY][CHX];
+	fx[2] = R[CHY][CHY];
+	// tilt angle from vertical Chi (0 <= Chi <= 180 deg) is acos(R[CHZ][CHZ])
+	fy[3] = fsqrt1mx2(R[CHZ][CHZ]);
+	fx[3] = R[CHZ][CHZ];
+	fatan2_deg4(fy, fx, fangle);
+
 	// calculate the roll angle -90.0 <= Phi <= 90.0 deg
 	if (R[CHZ][CHZ] == 0.0F)
 	{
@@ -617,11 +667,11 @@ void fWin8AnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfTh
 	else
 	{
 		// general case
-		*pfPhiDeg = fatan_deg(-R[CHX][CHZ] / R[CHZ][CHZ]);
+		*pfPhiDeg = fangle[0];
 	}
 
-	// first calculate the pitch angle The in the range -90.0 <= The <= 90.0 deg
-	*pfTheDeg = fasin_deg(R[CHY][CHZ]);
+	// first take the pitch angle The in the range -90.0 <= The <= 90.0 deg
+	*pfTheDeg = fangle[1];
 
 	// use R[CHZ][CHZ]=cos(Phi)*cos(The) to correct the quadrant of The remembering
 	// cos(Phi) is non-negative so that cos(The) has the same sign as R[CHZ][CHZ].
@@ -651,7 +701,7 @@ void fWin8AnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfTh
 	else
 	{
 		// general case: -180 <= Psi < 180 deg
-		*pfPsiDeg = fatan2_deg(-R[CHY][CHX], R[CHY][CHY]);
+		*pfPsiDeg = fangle[2];
 
 		// correct the quadrant for Psi using the value of The (deg) to give -180 <= Psi < 380 deg
 		if (fabsf(*pfTheDeg) >= 90.0F)
@@ -681,8 +731,9 @@ void fWin8AnglesDegFromRotationMatrix(float R[][3], float *pfPhiDeg, float *pfTh
 		*pfRhoDeg = 0.0F;
 	}
 
-	// calculate the tilt angle from vertical Chi (0 <= Chi <= 180 deg)
-	*pfChiDeg = facos_deg(R[CHZ][CHZ]);
+	// tilt angle from vertical Chi. Its lane has y >= 0, so the only angle
+	// fatan2_deg4() folds is 180 deg (R[CHZ][CHZ] = -1, inverted) to -180.
+	*pfChiDeg = fabsf(fangle[3]);
 
 	return;
 }
@@ -697,10 +748,14 @@ void fQuaternionFromRotationVectorDeg(Quaternion *pq, const float rvecdeg[], flo
 	float fetarad4;			// eta (rad)^4
 	float sinhalfeta;		// sin(eta/2)
 	float fvecsq;			// q1^2+q2^2+q3^2
+	float frecipmod;		// 1 / |rvecdeg|
 	float ftmp;				// scratch variable
 
 	// compute the scaled rotation angle eta (deg) which can be both positve or negative
-	fetadeg = fscaling * sqrtf(rvecdeg[CHX] * rvecdeg[CHX] + rvecdeg[CHY] * rvecdeg[CHY] + rvecdeg[CHZ] * rvecdeg[CHZ]);
+	// |rvecdeg| is formed as |rvecdeg|^2 / |rvecdeg| so that one frsqrt() serves both it and its reciprocal
+	fvecsq = rvecdeg[CHX] * rvecdeg[CHX] + rvecdeg[CHY] * rvecdeg[CHY] + rvecdeg[CHZ] * rvecdeg[CHZ];
+	frecipmod = (fvecsq > 0.0F) ? frsqrt(fvecsq) : 0.0F;
+	fetadeg = fscaling * fvecsq * frecipmod;
 	fetarad = fetadeg * FPIOVER180;
 	fetarad2 = fetarad * fetarad;
 
@@ -727,8 +782,8 @@ void fQuaternionFromRotationVectorDeg(Quaternion *pq, const float rvecdeg[], flo
 	// compute the vector quaternion components q1, q2, q3
 	if (fetadeg != 0.0F)
 	{
-		// general case with non-zero rotation angle
-		ftmp = fscaling * sinhalfeta / fetadeg;
+		// general case with non-zero rotation angle: ftmp = fscaling * sinhalfeta / fetadeg
+		ftmp = sinhalfeta * frecipmod;
 		pq->q1 = rvecdeg[CHX] * ftmp;		// q1 = nx * sin(eta/2)
 		pq->q2 = rvecdeg[CHY] * ftmp;		// q2 = ny * sin(eta/2)
 		pq->q3 = rvecdeg[CHZ] * ftmp;		// q3 = nz * sin(eta/2)
@@ -745,7 +800,7 @@ void fQuaternionFromRotationVectorDeg(Quaternion *pq, const float rvecdeg[], flo
 	if (fvecsq <= 1.0F)
 	{
 		// normal case
-		pq->q0 = sqrtf(1.0F - fvecsq);
+		pq->q0 = fsqrt_fast(1.0F - fvecsq);
 	}
 	else
 	{
@@ -837,6 +892,23 @@ void fRotationMatrixFromQuaternion(float R[][3], const Quaternion *pq)
 	return;
 }
 
+// extrapolates an orientation quaternion forward in time. The rotation over the
+// horizon is applied in the body frame, as the gyro integration in the fusion
+// algorithms does, so the prediction matches what the filter will compute if
+// the angular velocity stays constant.
+void fPredictQuaternion(Quaternion *pqPredicted, const Quaternion *pq, const float fOmega[], float fHorizonSecs)
+{
+	Quaternion ftmpq;		// rotation over the horizon
+
+	*pqPredicted = *pq;
+	if (fHorizonSecs <= 0.0F) return;
+	fQuaternionFromRotationVectorDeg(&ftmpq, fOmega, fHorizonSecs);
+	qAeqAxB(pqPredicted, &ftmpq);
+	fqAeqNormqA(pqPredicted);
+
+	return;
+}
+
 // computes rotation vector (deg) from rotation quaternion
 void fRotationVectorDegFromQuaternion(Quaternion *pq, float rvecdeg[])
 {
@@ -907,14 +979,14 @@ void fLPFOrientationQuaternion(Quaternion *pq, Quaternion *pLPq, float flpf, flo
 
 	// set ftmp to a scaled value which equals flpf in the limit of small rotations (q0=1)
 	// but which rises to 1 (all pass) as the delta rotation angle increases (q0 tends to zero)
-	ftmp = flpf + (1.0F - flpf) * sqrtf(fabs(1.0F - fdeltaq.q0 *  fdeltaq.q0));
+	ftmp = flpf + (1.0F - flpf) * fsqrt_fast(fabsf(1.0F - fdeltaq.q0 *  fdeltaq.q0));
 
 	// scale the vector component of the delta rotation quaternion by the corrected lpf value
 	// and re-compute the scalar component q0 to ensure normalization
 	fdeltaq.q1 *= ftmp;
 	fdeltaq.q2 *= ftmp;
 	fdeltaq.q3 *= ftmp;
-	fdeltaq.q0 = sqrtf(fabsf(1.0F - fdeltaq.q1 * fdeltaq.q1 - fdeltaq.q2 * fdeltaq.q2 - fdeltaq.q3 * fdeltaq.q3));
+	fdeltaq.q0 = fsqrt_fast(fabsf(1.0F - fdeltaq.q1 * fdeltaq.q1 - fdeltaq.q2 * fdeltaq.q2 - fdeltaq.q3 * fdeltaq.q3));
 
 	// calculate the delta rotation vector from fdeltaq and the virtual gyro angular velocity (deg/s)
 	fRotationVectorDegFromQuaternion(&fdeltaq, rvecdeg);
@@ -979,12 +1051,12 @@ void fqAeqNormqA(Quaternion *pqA)
 {
 	float fNorm;					// quaternion Norm
 
-	// calculate the quaternion Norm
-	fNorm = sqrtf(pqA->q0 * pqA->q0 + pqA->q1 * pqA->q1 + pqA->q2 * pqA->q2 + pqA->q3 * pqA->q3);
-	if (fNorm > CORRUPTQUAT)
+	// calculate the square of the quaternion Norm
+	fNorm = pqA->q0 * pqA->q0 + pqA->q1 * pqA->q1 + pqA->q2 * pqA->q2 + pqA->q3 * pqA->q3;
+	if (fNorm > CORRUPTQUAT * CORRUPTQUAT)
 	{
 		// general case
-		fNorm = 1.0F / fNorm;
+		fNorm = frsqrt(fNorm);
 		pqA->q0 *= fNorm;
 		pqA->q1 *= fNorm;
 		pqA->q2 *= fNorm;
@@ -1074,3 +1146,36 @@ void fveqconjgquq(Quaternion *pfq, float fu[], float fv[])
 
 	return;
 }
+
+// function rotates vector u by the rotation quaternion q as v = q*.u.q, which equals fveqRu() with the rotation
+// matrix of q (see fRotationMatrixFromQuaternion()) without forming the matrix, or as v = q.u.q* if itranspose
+// is set. q must be normalized.
+void fveqRqu(float fv[], const Quaternion *pq, const float fu[], int8_t itranspose)
+{
+	float fr[3];				// vector component of q* (or of q if transposed)
+	float ft[3];				// 2 * r x u
+
+	// the rotation by q* is about the vector component of q*
+	if (!itranspose)
+	{
+		fr[CHX] = -pq->q1;
+		fr[CHY] = -pq->q2;
+		fr[CHZ] = -pq->q3;
+	}
+	else
+	{
+		fr[CHX] = pq->q1;
+		fr[CHY] = pq->q2;
+		fr[CHZ] = pq->q3;
+	}
+
+	// v = u + q0 * t + r x t where t = 2 * r x u
+	ft[CHX] = 2.0F * (fr[CHY] * fu[CHZ] - fr[CHZ] * fu[CHY]);
+	ft[CHY] = 2.0F * (fr[CHZ] * fu[CHX] - fr[CHX] * fu[CHZ]);
+	ft[CHZ] = 2.0F * (fr[CHX] * fu[CHY] - fr[CHY] * fu[CHX]);
+	fv[CHX] = fu[CHX] + pq->q0 * ft[CHX] + fr[CHY] * ft[CHZ] - fr[CHZ] * ft[CHY];
+	fv[CHY] = fu[CHY] + pq->q0 * ft[CHY] + fr[CHZ] * ft[CHX] - fr[CHX] * ft[CHZ];
+	fv[CHZ] = fu[CHZ] + pq->q0 * ft[CHZ] + fr[CHX] * ft[CHY] - fr[CHY] * ft[CHX];
+
+	return;
+}
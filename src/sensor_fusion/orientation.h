@@ -160,6 +160,13 @@ void fQuaternionFromRotationVectorDeg(
     const float rvecdeg[],      ///< rotation vector in degrees
     float fscaling              ///< delta Time
 );
+/// extrapolates an orientation quaternion forward in time at a constant angular velocity
+void fPredictQuaternion(
+    Quaternion *pqPredicted,    ///< predicted orientation quaternion (output)
+    const Quaternion *pq,       ///< orientation quaternion now
+    const float fOmega[],       ///< angular velocity (deg/s), gyro offset removed
+    float fHorizonSecs          ///< time (s) to predict ahead; 0 copies pq
+);
 /// computes rotation vector (deg) from rotation quaternion
 void fRotationVectorDegFromQuaternion(
     Quaternion *pq,             ///< quaternion (input)
@@ -180,6 +187,14 @@ void fveqconjgquq(
   float fu[], 
   float fv[]
 );
+/// function rotates vector u by rotation quaternion q as v = q*.u.q (the rotation matrix of q times u,
+/// as fveqRu() does), or as v = q.u.q* (its transpose times u) if itranspose is set
+void fveqRqu(
+    float fv[],                 ///< rotated vector (output)
+    const Quaternion *pq,       ///< normalized rotation quaternion
+    const float fu[],           ///< vector to rotate (input)
+    int8_t itranspose           ///< 0 for v = R.u, otherwise v = R^T.u
+);
 
 #ifdef __cplusplus
 }
@@ -221,12 +221,6 @@ void fComputeAccelCalibration4(AccelBuffer *pthisAccelBuffer,
     float   ftmp;   // scratch
     int8_t  ierror; // flag from matrix inversion
 
-    // working arrays for 4x4 matrix inversion
-    float   *pfRows[4];
-    int8_t  iColInd[4];
-    int8_t  iRowInd[4];
-    int8_t  iPivot[4];
-
     // zero the 4x4 matrix XTX (in upper left of fmatA) and 4x1 vector XTY (in upper fvecA)
     for (i = 0; i < 4; i++)
     {
@@ -288,23 +282,14 @@ void fComputeAccelCalibration4(AccelBuffer *pthisAccelBuffer,
     pthisAccelCal->fmatA[3][CHY] = pthisAccelCal->fmatA[CHY][3];
     pthisAccelCal->fmatA[3][CHZ] = pthisAccelCal->fmatA[CHZ][3];
 
-    // calculate in situ inverse of X^T.X
+    // calculate the solution vector fvecB = inv(X^T.X).X^T.Y by factoring the
+    // symmetric positive definite X^T.X in situ rather than inverting it
+    fmatrix4x4of10x10FactorLDLT(pthisAccelCal->fmatA, &ierror);
     for (i = 0; i < 4; i++)
     {
-        pfRows[i] = pthisAccelCal->fmatA[i];
-    }
-
-    fmatrixAeqInvA(pfRows, iColInd, iRowInd, iPivot, 4, &ierror);
-
-    // calculate the solution vector fvecB = inv(X^T.X).X^T.Y
-    for (i = 0; i < 4; i++)
-    {
-        pthisAccelCal->fvecB[i] = 0.0F;
-        for (j = 0; j < 4; j++)
-        {
-            pthisAccelCal->fvecB[i] += pthisAccelCal->fmatA[i][j] * pthisAccelCal->fvecA[j];
-        }
+        pthisAccelCal->fvecB[i] = pthisAccelCal->fvecA[i];
     }
+    fvecAeqInvBxA4x4of10x10(pthisAccelCal->fvecB, pthisAccelCal->fmatA);
 
     // extract the offset vector
     pthisAccelCal->fV[CHX] = 0.5F * pthisAccelCal->fvecB[CHX];
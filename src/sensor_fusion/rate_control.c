@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file rate_control.c
+    \brief Run-time adaptation of sensor output data rates
+
+    See rate_control.h. The gyro integration in the Kalman filters divides the
+    fusion interval by the number of FIFO samples actually read, so ODR changes
+    do not need any change to the fusion algorithms. ODRs are never taken below
+    the *_ODR_IDLE_HZ values, which must leave at least one new sample in each
+    FIFO per fusion cycle.
+*/
+
+#include "sensor_fusion.h"
+#include "rate_control.h"
+
+#if (GYRO_ODR_IDLE_HZ < 2 * FUSION_HZ) || (ACCEL_ODR_IDLE_HZ < 2 * FUSION_HZ)
+#error "idle ODRs must be at least twice FUSION_HZ so that every fusion cycle has new samples"
+#endif
+
+void fInitializeRateControl(struct RateControl *pthisRateCtrl)
+{
+	pthisRateCtrl->isEnabled = false;
+	pthisRateCtrl->isIdle = false;
+	pthisRateCtrl->iReapply = false;
+	pthisRateCtrl->isPending = false;
+	pthisRateCtrl->iStationaryCount = 0;
+	pthisRateCtrl->iThrottleSteps = 0;
+	pthisRateCtrl->iGyroODR = GYRO_ODR_HZ;
+	pthisRateCtrl->iAccelODR = ACCEL_ODR_HZ;
+	pthisRateCtrl->iGyroODRFull = GYRO_ODR_HZ;
+	pthisRateCtrl->iAccelODRFull = ACCEL_ODR_HZ;
+	pthisRateCtrl->iChanges = 0;
+} // end fInitializeRateControl()
+
+// halve odr once per throttle step, without going below floor
+static uint16_t iThrottledODR(uint16_t odr, uint8_t steps, uint16_t floor)
+{
+	odr >>= steps;
+	return (odr < floor) ? floor : odr;
+}
+
+// request the given ODRs for all sensors supporting it; fApplyPendingRates() programs them
+static void fRequestRates(struct SensorFusionGlobals *sfg, uint16_t iGyroODR, uint16_t iAccelODR)
+{
+	struct RateControl *pthisRateCtrl = &(sfg->RateCtrl);
+
+	pthisRateCtrl->iGyroODR = iGyroODR;
+	pthisRateCtrl->iAccelODR = iAccelODR;
+	pthisRateCtrl->iReapply = false;
+	pthisRateCtrl->isPending = true;
+} // end fRequestRates()
+
+void fApplyPendingRates(struct SensorFusionGlobals *sfg)
+{
+	struct RateControl *pthisRateCtrl = &(sfg->RateCtrl);
+	struct PhysicalSensor *pSensor;
+	uint8_t i;
+
+	if (!pthisRateCtrl->isPending)
+		return;
+	pthisRateCtrl->isPending = false;
+	pthisRateCtrl->iChanges++;
+	for (i = 0; i < sfg->iNumSensors; i++) {
+		pSensor = sfg->pSensorTable[i];
+		if (pSensor->isInitialized && pSensor->setODR) {
+			// a failure leaves the sensor uninitialized; it is re-initialized
+			// by readSensors() and the rates are applied again after that
+			if (pSensor->setODR(pSensor, sfg) != SENSOR_ERROR_NONE)
+				pSensor->isInitialized = F_USING_NONE;
+		}
+	}
+} // end fApplyPendingRates()
+
+void fEnableRateControl(struct SensorFusionGlobals *sfg, bool enable)
+{
+	struct RateControl *pthisRateCtrl = &(sfg->RateCtrl);
+
+	pthisRateCtrl->isEnabled = enable;
+	pthisRateCtrl->isIdle = false;
+	pthisRateCtrl->iStationaryCount = 0;
+	pthisRateCtrl->iThrottleSteps = 0;
+	// when disabling, put the sensors back to the full rates
+	if (!enable && ((pthisRateCtrl->iGyroODR != pthisRateCtrl->iGyroODRFull) ||
+			(pthisRateCtrl->iAccelODR != pthisRateCtrl->iAccelODRFull)))
+		fRequestRates(sfg, pthisRateCtrl->iGyroODRFull, pthisRateCtrl->iAccelODRFull);
+} // end fEnableRateControl()
+
+void fSetFullRateODRs(struct SensorFusionGlobals *sfg, uint16_t iGyroODR, uint16_t iAccelODR)
+{
+	struct RateControl *pthisRateCtrl = &(sfg->RateCtrl);
+
+	pthisRateCtrl->iGyroODRFull = iGyroODR;
+	pthisRateCtrl->iAccelODRFull = iAccelODR;
+	if (pthisRateCtrl->isEnabled)
+		pthisRateCtrl->iReapply = true;     // the controller works out the rates to use
+	else
+		fRequestRates(sfg, iGyroODR, iAccelODR);
+} // end fSetFullRateODRs()
+
+void fRunRateControl(struct SensorFusionGlobals *sfg)
+{
+	struct RateControl *pthisRateCtrl = &(sfg->RateCtrl);
+	float *pfOmega;                 // angular rate used for motion detection (deg/s)
+	float fmodOmegaSq;              // squared magnitude of angular rate
+	int32_t iBusyMicros;            // time spent reading and fusing this cycle
+	int32_t iPeriodMicros = 1000000 / FUSION_HZ;
+	uint16_t iGyroODR;
+	uint16_t iAccelODR;
+
+	if (!pthisRateCtrl->isEnabled) {
+		// a re-initialized sensor is back at the build.h rates
+		if (pthisRateCtrl->iReapply &&
+		    ((pthisRateCtrl->iGyroODR != GYRO_ODR_HZ) || (pthisRateCtrl->iAccelODR != ACCEL_ODR_HZ)))
+			fRequestRates(sfg, pthisRateCtrl->iGyroODR, pthisRateCtrl->iAccelODR);
+		pthisRateCtrl->iReapply = false;
+		return;
+	}
+
+#if F_9DOF_GBY_KALMAN
+	pfOmega = sfg->SV_9DOF_GBY_KALMAN.fOmega;      // gyro offset already removed
+	iBusyMicros = sfg->systick_I2C + sfg->SV_9DOF_GBY_KALMAN.systick;
+#elif F_USING_GYRO
+	pfOmega = sfg->Gyro.fYs;
+	iBusyMicros = sfg->systick_I2C;
+#else
+	return;                         // nothing to base motion detection on
+#endif
+	fmodOmegaSq = pfOmega[CHX] * pfOmega[CHX] + pfOmega[CHY] * pfOmega[CHY] +
+		pfOmega[CHZ] * pfOmega[CHZ];
+
+	// stationary detection with hysteresis between the idle and active thresholds
+	if (pthisRateCtrl->isIdle) {
+		if (fmodOmegaSq > RATECTRL_ACTIVE_DPS * RATECTRL_ACTIVE_DPS) {
+			pthisRateCtrl->isIdle = false;
+			pthisRateCtrl->iStationaryCount = 0;
+		}
+	} else if (fmodOmegaSq < RATECTRL_IDLE_DPS * RATECTRL_IDLE_DPS) {
+		if (++pthisRateCtrl->iStationaryCount >= RATECTRL_IDLE_SECS * FUSION_HZ)
+			pthisRateCtrl->isIdle = true;
+	} else {
+		pthisRateCtrl->iStationaryCount = 0;
+	}
+
+	// loop headroom: re-evaluated once per second so each change can take effect
+	if (!pthisRateCtrl->isIdle && (0 == (sfg->loopcounter % FUSION_HZ))) {
+		if ((iBusyMicros * 100 > RATECTRL_BUSY_PC * iPeriodMicros) &&
+		    (pthisRateCtrl->iGyroODR > GYRO_ODR_IDLE_HZ || pthisRateCtrl->iAccelODR > ACCEL_ODR_IDLE_HZ))
+			pthisRateCtrl->iThrottleSteps++;
+		else if ((iBusyMicros * 100 < RATECTRL_SPARE_PC * iPeriodMicros) &&
+			 (pthisRateCtrl->iThrottleSteps > 0))
+			pthisRateCtrl->iThrottleSteps--;
+	}
+
+	if (pthisRateCtrl->isIdle) {
+		iGyroODR = GYRO_ODR_IDLE_HZ;
+		iAccelODR = ACCEL_ODR_IDLE_HZ;
+	} else {
+		iGyroODR = iThrottledODR(pthisRateCtrl->iGyroODRFull, pthisRateCtrl->iThrottleSteps, GYRO_ODR_IDLE_HZ);
+		iAccelODR = iThrottledODR(pthisRateCtrl->iAccelODRFull, pthisRateCtrl->iThrottleSteps, ACCEL_ODR_IDLE_HZ);
+	}
+
+	if ((iGyroODR == pthisRateCtrl->iGyroODR) && (iAccelODR == pthisRateCtrl->iAccelODR) &&
+	    !pthisRateCtrl->iReapply)
+		return;
+
+	fRequestRates(sfg, iGyroODR, iAccelODR);
+} // end fRunRateControl()
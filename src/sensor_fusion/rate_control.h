@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file rate_control.h
+    \brief Run-time adaptation of sensor output data rates
+
+    The ODRs in build.h are the initial full rates, used while the unit is
+    moving; fSetFullRateODRs() changes them at run time. When the
+    gyro reports little rotation for a while, the sensors are reprogrammed to
+    the lower *_ODR_IDLE_HZ rates, which reduces I2C traffic and the number of
+    samples integrated per fusion cycle. The rate is also stepped down if a
+    read + fusion cycle starts using most of the loop period.
+
+    Rate changes are only decided by these functions. The I2C writes that
+    reprogram the sensors are made by fApplyPendingRates() at the start of
+    the next readSensors(), so they fall in the read phase and never add a
+    bus transaction to a fusion cycle or to a command handler.
+*/
+
+#ifndef RATE_CONTROL_H
+#define RATE_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @name Rate Control Constants
+///@{
+#define RATECTRL_IDLE_DPS 2.0F          ///< gyro magnitude (deg/s) below which the unit is considered stationary
+#define RATECTRL_ACTIVE_DPS 5.0F        ///< gyro magnitude (deg/s) above which the unit is moving again
+#define RATECTRL_IDLE_SECS 2            ///< time (s) stationary before dropping to the idle ODRs
+#define RATECTRL_BUSY_PC 80             ///< step ODRs down when read + fusion exceed this % of the loop period
+#define RATECTRL_SPARE_PC 50            ///< step ODRs back up when read + fusion are below this % of the loop period
+///@}
+
+/// Sensor rate controller state
+struct RateControl
+{
+	bool isEnabled;                 ///< true if the controller may reprogram sensors
+	bool isIdle;                    ///< true while running at the idle ODRs
+	bool iReapply;                  ///< set when a sensor was re-initialized and needs the current rates again
+	bool isPending;                 ///< iGyroODR and iAccelODR are still to be programmed by fApplyPendingRates()
+	int16_t iStationaryCount;       ///< consecutive fusion cycles below RATECTRL_IDLE_DPS
+	uint8_t iThrottleSteps;         ///< number of halvings applied because of insufficient loop headroom
+	uint16_t iGyroODR;              ///< gyro ODR (Hz) programmed, or to be programmed if isPending
+	uint16_t iAccelODR;             ///< accel (and FXOS8700 mag) ODR (Hz) programmed, or to be programmed if isPending
+	uint16_t iGyroODRFull;          ///< gyro ODR (Hz) used while moving (initially GYRO_ODR_HZ)
+	uint16_t iAccelODRFull;         ///< accel ODR (Hz) used while moving (initially ACCEL_ODR_HZ)
+	uint32_t iChanges;              ///< number of times sensors have been reprogrammed
+};
+
+struct SensorFusionGlobals;
+
+/// Set the rate controller to its initial (disabled, full rate) state
+void fInitializeRateControl(
+	struct RateControl *pthisRateCtrl       ///< rate controller state
+);
+/// Enable or disable the rate controller. Disabling restores the full-rate ODRs.
+void fEnableRateControl(
+	struct SensorFusionGlobals *sfg,        ///< top level fusion structure
+	bool enable                             ///< true to let the controller adapt ODRs
+);
+/// Change the full-rate ODRs. They are applied by the next readSensors() if the
+/// rate controller is disabled, otherwise once the next fRunRateControl() has
+/// worked out the rates to use.
+void fSetFullRateODRs(
+	struct SensorFusionGlobals *sfg,        ///< top level fusion structure
+	uint16_t iGyroODR,                      ///< gyro ODR (Hz), at least GYRO_ODR_IDLE_HZ
+	uint16_t iAccelODR                      ///< accel (and FXOS8700 mag) ODR (Hz), at least ACCEL_ODR_IDLE_HZ
+);
+/// Examine motion and loop headroom, and request new sensor ODRs if needed.
+/// Called once per fusion cycle, after the fusion algorithms have run.
+void fRunRateControl(
+	struct SensorFusionGlobals *sfg         ///< top level fusion structure
+);
+/// Program the sensors with any ODRs requested since the last call. Called
+/// by readSensors() before the sensors are read.
+void fApplyPendingRates(
+	struct SensorFusionGlobals *sfg         ///< top level fusion structure
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RATE_CONTROL_H
@@ -10,6 +10,7 @@
     \brief The sensor_fusion.c file implements the top level programming interface
 */
 #include <stdio.h>
+#include <string.h>
 
 #include "sensor_fusion.h"
 
@@ -78,6 +79,7 @@ void initSensorFusionGlobals(SensorFusionGlobals *sfg,
     sfg->systick_I2C = 0;                     // systick counter to benchmark I2C reads
     sfg->systick_Spare = 0;                   // systick counter for counts spare waiting for timing interrupt
     sfg->iPerturbation = 0;                   // no perturbation to be applied
+    sfg->fPredictHorizonSecs = PREDICT_HORIZON_MS / 1000.0F;  // output latency compensation
     sfg->installSensor = installSensor;       // function for installing a new sensor into the structures
     sfg->initializeFusionEngine = initializeFusionEngine;   // initializes fusion variables
     sfg->readSensors = readSensors;           // function for reading a sensor
@@ -91,6 +93,8 @@ void initSensorFusionGlobals(SensorFusionGlobals *sfg,
     sfg->updateStatus = updateStatus;         // function to promote queued status change
     sfg->testStatus = testStatus;             // function for unit testing the status subsystem
     sfg->pSensors = NULL;                     // pointer to linked list of physical sensors
+    sfg->iNumSensors = 0;                     // no entries yet in the table of installed sensors
+    fInitializeRateControl(&sfg->RateCtrl);   // sensors run at the build.h ODRs until enabled
 //  put error value into whoAmI as initial value
 #if F_USING_ACCEL
     sfg->Accel.iWhoAmI = 0;
@@ -103,29 +107,44 @@ void initSensorFusionGlobals(SensorFusionGlobals *sfg,
 #endif
 #if F_USING_PRESSURE
     sfg->Pressure.iWhoAmI = 0;
+#endif
+    // default tuning parameters; configuration records can change them later
+#if F_USING_MAG
+    sfg->MagCal.iCalIntervalSecs = CAL_INTERVAL_SECS;
+#endif
+#if F_6DOF_GY_KALMAN
+    fSetNoise_6DOF_GY_KALMAN(&sfg->SV_6DOF_GY_KALMAN, FQVY_6DOF_GY_KALMAN,
+                             FQVG_6DOF_GY_KALMAN, FQWB_6DOF_GY_KALMAN);
+#endif
+#if F_9DOF_GBY_KALMAN
+    fSetNoise_9DOF_GBY_KALMAN(&sfg->SV_9DOF_GBY_KALMAN, FQVY_9DOF_GBY_KALMAN,
+                              FQVG_9DOF_GBY_KALMAN, FQVB_9DOF_GBY_KALMAN, FQWB_9DOF_GBY_KALMAN);
 #endif
 } // end initSensorFusionGlobals()
 
 /// installSensor is used to instantiate a physical sensor driver into the
 /// sensor fusion system. It doesn't actually communicate with the sensor.
 /// This function is normally invoked via the "sfg." global pointer.
+/// The sensor is added to the fixed table sfg->pSensorTable, which is what
+/// the library walks, and also linked into the list sfg->pSensors.
 int8_t installSensor(
                      SensorFusionGlobals *sfg,  ///< top level fusion structure
                      struct PhysicalSensor *pSensor,    ///< pointer to structure describing physical sensor
                      uint16_t addr,             ///< I2C address for sensor (if applicable)
                      uint16_t schedule,         ///< Sensor is read each time loop_count % schedule == 0
-                     registerDeviceInfo_t *busInfo, ///< information required for bus power management
+                     registerDeviceInfo_t *busInfo, ///< I2C bus and clock for the sensor (NULL for bus 0, default clock)
                      initializeSensor_t *initialize,    ///< pointer to sensor initialization function
                      readSensor_t *read)        ///< pointer to sensor read function
 {
-    if (sfg && pSensor && initialize && read)
+    if (sfg && pSensor && initialize && read && (sfg->iNumSensors < MAX_NUM_SENSORS))
     {
-    /* was  pSensor->deviceInfo.deviceInstance = busInfo->deviceInstance;
-        pSensor->deviceInfo.functionParam = busInfo->functionParam;
+    /* was  pSensor->deviceInfo.functionParam = busInfo->functionParam;
         pSensor->deviceInfo.idleFunction = busInfo->idleFunction;
         but these aren't used. Instead of changing structs everywhere, 
-        we just set to zero. */
-        pSensor->deviceInfo.deviceInstance = 0;
+        we just set to zero. The bus number and clock are taken from
+        busInfo when supplied, otherwise bus 0 at its default clock is used. */
+        pSensor->deviceInfo.deviceInstance = busInfo ? busInfo->deviceInstance : 0;
+        pSensor->deviceInfo.clockHz = busInfo ? busInfo->clockHz : 0;
         pSensor->deviceInfo.functionParam = NULL;
         pSensor->deviceInfo.idleFunction = NULL;
 
@@ -133,9 +152,13 @@ int8_t installSensor(
                                                 // into the proper mode for sensor fusion.
         pSensor->read = read;                   // The read function is responsible for taking sensor readings and
                                                 // loading them into the sensor fusion input structures.
+        pSensor->setODR = NULL;                 // drivers supporting run-time ODR changes set this after install
+        pSensor->identity = NULL;               // as does a driver whose WHO_AM_I check is in a SensorIdentity
+        memset(&pSensor->health, 0, sizeof(pSensor->health));  // SENSOR_HEALTHY, no errors
         pSensor->addr = addr;                   // I2C address if applicable
         pSensor->schedule = schedule;
-        // Now add the new sensor at the head of the linked list
+        // Now add the new sensor to the end of the table and the head of the linked list
+        sfg->pSensorTable[sfg->iNumSensors++] = pSensor;
         pSensor->next = sfg->pSensors;
         sfg->pSensors = pSensor;
         return (0);
@@ -146,16 +169,89 @@ int8_t installSensor(
     }
 } // end installSensor()
 
-// The initializeSensors function traverses the linked list of physical sensor
-// types and calls the initialization function for each one.
+// sensorFailed marks a sensor uninitialized and starts (or lengthens) its
+// backoff interval. The interval doubles with each consecutive failure.
+static void sensorFailed(struct PhysicalSensor *pSensor)
+{
+    struct SensorHealth *pHealth = &(pSensor->health);
+    uint32_t iDelay = SENSOR_RETRY_MIN_MS;
+    uint16_t i;
+
+    pSensor->isInitialized = F_USING_NONE;
+    if (pHealth->iConsecutiveFailures < UINT16_MAX) pHealth->iConsecutiveFailures++;
+    for (i = 1; (i < pHealth->iConsecutiveFailures) && (iDelay < SENSOR_RETRY_MAX_MS); i++) iDelay <<= 1;
+    pHealth->iRetryDelayMs = (iDelay < SENSOR_RETRY_MAX_MS) ? iDelay : SENSOR_RETRY_MAX_MS;
+    SystickStartCount(&(pHealth->iRetryStart));
+    pHealth->state = SENSOR_BACKOFF;
+} // end sensorFailed()
+
+// identifySensor checks the WHO_AM_I value of a sensor installed with a
+// SensorIdentity, and sets the scale of the chip found. A sensor without one
+// is checked by its initialize function.
+static int8_t identifySensor(struct PhysicalSensor *pSensor, SensorFusionGlobals *sfg)
+{
+    const struct SensorIdentity *pIdentity = pSensor->identity;
+    const struct SensorVariant *pVariant;
+    uint8_t         reg;
+    uint8_t         i;
+    int8_t          s;
+
+    if (NULL == pIdentity) return SENSOR_ERROR_NONE;
+    s = (int8_t) Sensor_I2C_Read_Register(&pSensor->deviceInfo, pSensor->addr, pIdentity->whoAmIReg, 1, &reg);
+    if (s != SENSOR_ERROR_NONE) return s;
+    for (i = 0; (i < pIdentity->numVariants) && (pIdentity->variants[i].whoAmI != reg); i++);
+    if (i == pIdentity->numVariants) return SENSOR_ERROR_INIT;  // not a chip this driver handles
+    pVariant = &(pIdentity->variants[i]);
+#if F_USING_ACCEL
+    if (pVariant->iCountsPerg) {
+        sfg->Accel.iWhoAmI = reg;
+        sfg->Accel.iCountsPerg = pVariant->iCountsPerg;
+        sfg->Accel.fgPerCount = 1.0F / pVariant->iCountsPerg;
+    }
+#endif
+#if F_USING_MAG
+    if (pVariant->iCountsPeruT) {
+        sfg->Mag.iWhoAmI = reg;
+        sfg->Mag.iCountsPeruT = pVariant->iCountsPeruT;
+        sfg->Mag.fCountsPeruT = (float) pVariant->iCountsPeruT;
+        sfg->Mag.fuTPerCount = 1.0F / pVariant->iCountsPeruT;
+    }
+#endif
+#if F_USING_GYRO
+    if (pVariant->iCountsPerDegPerSec) {
+        sfg->Gyro.iWhoAmI = reg;
+        sfg->Gyro.iCountsPerDegPerSec = pVariant->iCountsPerDegPerSec;
+        sfg->Gyro.fDegPerSecPerCount = 1.0F / pVariant->iCountsPerDegPerSec;
+    }
+#endif
+    return SENSOR_ERROR_NONE;
+} // end identifySensor()
+
+// initializeSensor identifies a sensor, then calls its initialization function
+static int8_t initializeSensor(struct PhysicalSensor *pSensor, SensorFusionGlobals *sfg)
+{
+    int8_t s = identifySensor(pSensor, sfg);
+
+    if (s != SENSOR_ERROR_NONE) return s;
+    return pSensor->initialize(pSensor, sfg);
+} // end initializeSensor()
+
+// The initializeSensors function walks the table of installed sensors
+// and calls the initialization function for each one.
 int8_t initializeSensors(SensorFusionGlobals *sfg)
 {
     struct PhysicalSensor  *pSensor;
+    uint8_t         i;
     int8_t          s;
     int8_t          status = 0;
-    for (pSensor = sfg->pSensors; pSensor != NULL; pSensor = pSensor->next)
+    for (i = 0; i < sfg->iNumSensors; i++)
     {
-        s = pSensor->initialize(pSensor, sfg);
+        pSensor = sfg->pSensorTable[i];
+        s = initializeSensor(pSensor, sfg);
+        if (s != SENSOR_ERROR_NONE) {
+            pSensor->health.iInitFailures++;
+            sensorFailed(pSensor);              // retried later by readSensors()
+        }
         if (status == 0) status = s;            // will return 1st error flag, but try all sensors
     }
     return (status);
@@ -269,42 +365,136 @@ void processGyroData(SensorFusionGlobals *sfg)
 } // end processGyroData()
 #endif
 
-/// readSensors traverses the linked list of physical sensors, calling the
-/// individual read functions one by one.
-/// This function is normally invoked via the "sfg." global pointer.
-/// If a sensor is flagged as uninitialized, an attempt is made to initialize it.
-/// If a sensor does not respond, it is marked as unintialized.
-int8_t readSensors(
-    SensorFusionGlobals *sfg,   ///< pointer to global sensor fusion data structure
-    uint8_t read_loop_counter  ///< current loop counter (used for multirate processing)
-    ) 
+/// Arguments passed through I2CRunOnAllBuses() to readSensorsOnBus()
+struct ReadSensorsJob {
+    SensorFusionGlobals *sfg;
+    uint8_t read_loop_counter;
+    int8_t status[I2C_NUM_BUSES];       ///< first error flag seen on each bus
+    bool reapply[I2C_NUM_BUSES];        ///< a sensor on the bus was re-initialized (see RateCtrl.iReapply)
+};
+
+/// readSensorsOnBus reads those sensors in the table that are attached
+/// to the given I2C bus, and advances the recovery of any that have failed.
+/// Only one recovery step (bus clear or re-initialization) is made per bus per
+/// pass, so faulty sensors cannot hold up the fusion loop.
+/// It may run concurrently with the same function for other buses, so it must
+/// only touch its own sensors, and the measurement structures (sfg->Accel etc)
+/// they fill, and report anything else through its own entries in the job.
+/// Each measurement structure must therefore be filled from a single bus.
+static void readSensorsOnBus(uint8_t bus, void *param)
 {
+    struct ReadSensorsJob *job = (struct ReadSensorsJob *)param;
+    SensorFusionGlobals *sfg = job->sfg;
     struct PhysicalSensor  *pSensor;
+    struct SensorHealth *pHealth;
+    bool            recovery_step_taken = false;
+    uint8_t         i;
     int8_t          s;
     int8_t          status = SENSOR_ERROR_NONE;
 
-    pSensor = sfg->pSensors;
-
-    for (pSensor = sfg->pSensors; pSensor != NULL; pSensor = pSensor->next)
-    {   if (pSensor->isInitialized) {
-            if ( 0 == (read_loop_counter % pSensor->schedule)) {
+    for (i = 0; i < sfg->iNumSensors; i++)
+    {   pSensor = sfg->pSensorTable[i];
+        if (pSensor->deviceInfo.deviceInstance != bus) {
+            continue;
+        }
+        pHealth = &(pSensor->health);
+        if (pHealth->state == SENSOR_HEALTHY && !pSensor->isInitialized) {
+            sensorFailed(pSensor);              // shut down elsewhere, e.g. by a failed ODR change
+        }
+        switch (pHealth->state) {
+        case SENSOR_HEALTHY:
+            if ( 0 == (job->read_loop_counter % pSensor->schedule)) {
                 //read the sensor if it is its turn (per loop_counter)
                 s = pSensor->read(pSensor, sfg);
                 if(s != SENSOR_ERROR_NONE) {
-                    //sensor reported error, so mark it uninitialized.
-                    //If it becomes reinitialized next loop, init function will set flag back to sensor type
-                    pSensor->isInitialized = F_USING_NONE; 
+                    //sensor reported error, so mark it uninitialized and back off
+                    pHealth->iReadErrors++;
+                    sensorFailed(pSensor);
                 }
                 if (status == SENSOR_ERROR_NONE) status = s; // will return 1st error flag, but try all sensors
             }
-        }else {
-            //sensor not initialized. Make one attempt to init it.
-            //If init succeeds, next time through a sensor read will be attempted
-            s = pSensor->initialize(pSensor, sfg);
-            if (s != SENSOR_ERROR_NONE) {
-              //note that there is still an error
-              status = s;
+            break;
+        case SENSOR_BACKOFF:
+            if (SystickElapsedMicros(pHealth->iRetryStart) >= (int32_t)(pHealth->iRetryDelayMs * 1000)) {
+                pHealth->state = (pHealth->iConsecutiveFailures >= SENSOR_BUS_CLEAR_AFTER) ?
+                                 SENSOR_BUS_CLEAR : SENSOR_REINIT;
+            }
+            if (status == SENSOR_ERROR_NONE) status = SENSOR_ERROR_INIT;
+            break;
+        case SENSOR_BUS_CLEAR:
+            if (!recovery_step_taken) {
+                recovery_step_taken = true;
+                I2CBusClear(bus);
+                pHealth->iBusClears++;
+                pHealth->state = SENSOR_REINIT;
+            }
+            if (status == SENSOR_ERROR_NONE) status = SENSOR_ERROR_INIT;
+            break;
+        case SENSOR_REINIT:
+            if (!recovery_step_taken) {
+                //Make one attempt to init it. A dead sensor fails on the first
+                //(WHO_AM_I) transaction, so this is short unless it succeeds.
+                //If init succeeds, next time through a sensor read will be attempted
+                recovery_step_taken = true;
+                s = initializeSensor(pSensor, sfg);
+                if (s == SENSOR_ERROR_NONE) {
+                    pHealth->state = SENSOR_HEALTHY;
+                    pHealth->iConsecutiveFailures = 0;
+                    pHealth->iRecoveries++;
+                    if (pSensor->setODR) {
+                        //init programmed the build.h ODRs; have the rate controller restore its own
+                        job->reapply[bus] = true;
+                    }
+                } else {
+                    pHealth->iInitFailures++;
+                    sensorFailed(pSensor);
+                }
             }
+            if (pHealth->state != SENSOR_HEALTHY && status == SENSOR_ERROR_NONE) status = SENSOR_ERROR_INIT;
+            break;
+        }
+    }
+    job->status[bus] = status;
+} // end readSensorsOnBus()
+
+/// readSensors walks the table of installed sensors, calling the
+/// individual read functions one by one.
+/// This function is normally invoked via the "sfg." global pointer.
+/// If a sensor does not respond, it is marked as unintialized, and attempts
+/// to re-initialize it are made with exponential backoff (see SensorHealth).
+/// Sensors on different I2C buses are read concurrently where the platform
+/// allows it (see I2CRunOnAllBuses()).
+int8_t readSensors(
+    SensorFusionGlobals *sfg,   ///< pointer to global sensor fusion data structure
+    uint8_t read_loop_counter  ///< current loop counter (used for multirate processing)
+    ) 
+{
+    struct ReadSensorsJob job;
+    uint8_t         bus;
+    uint8_t         i;
+    int8_t          status = SENSOR_ERROR_NONE;
+
+    job.sfg = sfg;
+    job.read_loop_counter = read_loop_counter;
+    for (bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        job.status[bus] = SENSOR_ERROR_NONE;
+        job.reapply[bus] = false;
+    }
+
+    SystickStartCount(&(sfg->systick_I2C));
+    fApplyPendingRates(sfg);                  // ODR changes requested since the last read
+    I2CRunOnAllBuses(readSensorsOnBus, &job);
+    sfg->systick_I2C = SystickElapsedMicros(sfg->systick_I2C);  // time to read and unpack all sensors
+
+    for (bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        if (status == SENSOR_ERROR_NONE) status = job.status[bus];
+        if (job.reapply[bus]) sfg->RateCtrl.iReapply = true;
+    }
+    // sensors assigned to a bus that doesn't exist are never serviced
+    for (i = 0; i < sfg->iNumSensors; i++) {
+        if (sfg->pSensorTable[i]->deviceInfo.deviceInstance >= I2C_NUM_BUSES &&
+            status == SENSOR_ERROR_NONE) {
+            status = SENSOR_ERROR_BAD_ADDRESS;
         }
     }
     if (status == SENSOR_ERROR_NONE) {
@@ -484,6 +674,7 @@ void runFusion(SensorFusionGlobals *sfg)
                  pSV_9DOF_GBY_KALMAN, pAccel, pMag, pGyro,
                  pPressure, pMagCal);
     clearFIFOs(sfg);
+    fRunRateControl(sfg);                     // decide sensor ODRs for the next read from motion and headroom
 } // end runFusion()
 
 /// This function is responsible for initializing the system prior to starting
@@ -578,3 +769,56 @@ void addToFifo(union FifoSensor *sensor, uint16_t maxFifoSize, int16_t sample[3]
     }
 } // end addToFifo()
 
+// Byte-swap the two big-endian 16-bit samples held in a little-endian 32-bit
+// word, and map any -32768 (0x8000) lane to -32767 (0x8001).  The lanes are
+// handled together ("SIMD within a register") without carries between them.
+static inline uint32_t swapAndConditionPair(uint32_t w)
+{
+    uint32_t nonzero;
+    w = ((w & 0x00FF00FFU) << 8) | ((w >> 8) & 0x00FF00FFU);
+    // high bit of each lane is set unless that lane is exactly 0x8000
+    w ^= 0x80008000U;
+    nonzero = (((w & 0x7FFF7FFFU) + 0x7FFF7FFFU) | w) & 0x80008000U;
+    w ^= 0x80008000U;
+    return w + ((~nonzero & 0x80008000U) >> 15);
+}
+
+void addBlockToFifo(union FifoSensor *sensor, uint16_t maxFifoSize,
+                    const uint8_t *buffer, uint16_t numSamples)
+{
+    // Same FIFO semantics as addToFifo(), applied to numSamples back-to-back
+    // X/Y/Z big-endian samples (6 bytes each) as read in a sensor burst.
+    uint8_t fifoCount = sensor->Accel.iFIFOCount;
+    uint16_t room = (fifoCount < maxFifoSize) ? (uint16_t)(maxFifoSize - fifoCount) : 0;
+    uint16_t n = (numSamples < room) ? numSamples : room;
+    int16_t (*fifo)[3] = &sensor->Accel.iGsFIFO[fifoCount];
+    uint16_t i = 0;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    // two samples (12 bytes = 3 words) per pass; memcpy() keeps the word
+    // loads and stores valid at any alignment. Each word is stored on its
+    // own: storing the three through a local array would have the compiler
+    // reload them as wider words, which stalls store forwarding.
+    uint32_t w;
+    uint8_t k;
+    for (; i + 2 <= n; i += 2) {
+        for (k = 0; k < 3; k++) {
+            memcpy(&w, buffer + 6 * i + 4 * k, sizeof(w));
+            w = swapAndConditionPair(w);
+            memcpy((uint8_t *) fifo[i] + 4 * k, &w, sizeof(w));
+        }
+    }
+#endif
+    // remaining (odd) sample, or all samples on a big-endian host
+    for (; i < n; i++) {
+        const uint8_t *p = buffer + 6 * i;
+        fifo[i][CHX] = (int16_t)((p[0] << 8) | p[1]);
+        fifo[i][CHY] = (int16_t)((p[2] << 8) | p[3]);
+        fifo[i][CHZ] = (int16_t)((p[4] << 8) | p[5]);
+        conditionSample(fifo[i]);
+    }
+
+    sensor->Accel.iFIFOCount += n;
+    if (n > 0) sensor->Accel.iFIFOExceeded = 0;
+    sensor->Accel.iFIFOExceeded += numSamples - n;  // samples with no room
+} // end addBlockToFifo()
@@ -18,7 +18,9 @@
 #ifndef SENSOR_FUSION_H
 #define SENSOR_FUSION_H
 
+#if defined(ESP32) || defined(ESP8266)
 #include <Arduino.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,11 +34,13 @@ extern "C" {
 
 #include "board.h"						// Hardware-specific details (e.g. particular sensor ICs)
 #include "build.h"                      // This is where the build parameters are defined
+#include "precision.h"                  // Accumulator precision policy
 #include "driver_sensors_types.h"		// Typedefs for the sensor hardware
 #include "magnetic.h"                   // Magnetic calibration functions/structures
 #include "matrix.h"  					// Matrix math
 #include "orientation.h"                // Functions for manipulating orientations
 #include "precisionAccelerometer.h"     // Accel calibration functions/structures
+#include "rate_control.h"               // Run-time sensor ODR adaptation
 
 /// the quaternion type to be transmitted
 typedef enum quaternion {
@@ -121,6 +125,10 @@ typedef int8_t (readSensor_t) (
     struct PhysicalSensor *sensor,
     struct SensorFusionGlobals *sfg
 ) ;
+typedef int8_t (setSensorODR_t) (
+    struct PhysicalSensor *sensor,
+    struct SensorFusionGlobals *sfg
+) ;
 typedef int8_t (readSensors_t) (
     struct SensorFusionGlobals *sfg,
     uint8_t read_loop_counter
@@ -130,7 +138,7 @@ typedef int8_t (installSensor_t) (
     struct PhysicalSensor *sensor,      ///< SF Structure to store sensor configuration
     uint16_t addr,                      ///< I2C address or SPI_ADDR
     uint16_t schedule,                  ///< Specifies sampling interval
-    registerDeviceInfo_t *busInfo,      ///< information required for bus power management
+    registerDeviceInfo_t *busInfo,      ///< I2C bus number and clock (NULL = bus 0, default clock)
     initializeSensor_t *initialize,     ///< SF Sensor Initialization Function pointer
     readSensor_t *read                  ///< SF Sensor Read Function pointer
 );
@@ -147,12 +155,65 @@ typedef void   (ssSetStatus_t) 			(struct StatusSubsystem *pStatus, fusion_statu
 typedef fusion_status_t   (ssGetStatus_t) 			(struct StatusSubsystem *pStatus);
 typedef void   (ssUpdateStatus_t) 		(struct StatusSubsystem *pStatus);
 
+/// @name Sensor Recovery Constants
+/// Timing of the retries made when a sensor stops responding
+///@{
+#define SENSOR_RETRY_MIN_MS     10      ///< delay before the first re-initialization attempt (shorter than a loop)
+#define SENSOR_RETRY_MAX_MS     5000    ///< longest delay between attempts; doubles from SENSOR_RETRY_MIN_MS up to this
+#define SENSOR_BUS_CLEAR_AFTER  2       ///< consecutive failures after which an I2C bus clear precedes each attempt
+///@}
+
+#define MAX_PREDICT_HORIZON_MS  1000    ///< longest fPredictHorizonSecs accepted, in ms
+
+/// Recovery state of a physical sensor. Each readSensors() pass advances a
+/// faulty sensor by at most one step, so a dead sensor costs at most one
+/// short bus transaction per retry interval.
+typedef enum {
+	SENSOR_HEALTHY,                         ///< being read normally
+	SENSOR_BACKOFF,                         ///< failed; waiting for the retry interval to elapse
+	SENSOR_BUS_CLEAR,                       ///< retry due; clear the I2C bus first
+	SENSOR_REINIT                           ///< retry due; re-initialize the sensor
+} sensor_recovery_t;
+
+/// \brief Per-sensor fault and recovery counters
+struct SensorHealth {
+	sensor_recovery_t state;                ///< current recovery state
+	uint16_t iConsecutiveFailures;          ///< failed reads/inits since the sensor was last healthy
+	uint32_t iReadErrors;                   ///< total failed reads
+	uint32_t iInitFailures;                 ///< total failed re-initialization attempts
+	uint32_t iBusClears;                    ///< total I2C bus clears performed for this sensor
+	uint32_t iRecoveries;                   ///< number of times the sensor returned to health after failing
+	uint32_t iRetryDelayMs;                 ///< current backoff interval
+	int32_t iRetryStart;                    ///< systick at start of the current backoff interval
+};
+
+/// \brief One chip a sensor driver accepts: its WHO_AM_I value and scale.
+/// Scales of 0 are for measurements the chip doesn't make.
+struct SensorVariant {
+	uint8_t whoAmI;                         ///< value of the WHO_AM_I register
+	int16_t iCountsPerg;                    ///< accelerometer counts per g
+	int16_t iCountsPeruT;                   ///< magnetometer counts per uT
+	int16_t iCountsPerDegPerSec;            ///< gyro counts per deg/s
+};
+
+/// \brief The WHO_AM_I check and scale of a sensor driver, given by its
+/// traits (see sensor_drivers.h) and applied before its initialize function
+struct SensorIdentity {
+	uint8_t whoAmIReg;                      ///< register holding the WHO_AM_I value
+	uint8_t numVariants;                    ///< entries in variants
+	const struct SensorVariant *variants;   ///< chips the driver accepts
+};
+
+#ifndef MAX_NUM_SENSORS
+#define MAX_NUM_SENSORS         4       ///< size of the table of installed sensors (pSensorTable)
+#endif
+
 /// \brief An instance of PhysicalSensor structure type should be allocated for each physical sensors (combo devices = 1)
 ///
 /// These structures sit 'on-top-of' the pre-7.0 sensor fusion structures and give us the ability to do run
 /// time driver installation.
 struct PhysicalSensor {
-        registerDeviceInfo_t deviceInfo;        ///< I2C device context
+        registerDeviceInfo_t deviceInfo;        ///< I2C device context (bus number and clock)
         registerDeviceInfo_t *busInfo;          ///< information required for bus power management
 	uint16_t addr;  			///< I2C address if applicable
         uint16_t isInitialized;                 ///< Bitfields to indicate sensor is active (use SensorBitFields from build.h)
@@ -160,6 +221,9 @@ struct PhysicalSensor {
         uint8_t schedule;                      ///< Parameter to control sensor sampling rate
 	initializeSensor_t *initialize;  	///< pointer to function to initialize sensor using the supplied drivers
 	readSensor_t *read;			///< pointer to function to read sensor using the supplied drivers
+	setSensorODR_t *setODR;			///< optional function applying the ODRs in sfg->RateCtrl (NULL if unsupported)
+	const struct SensorIdentity *identity;	///< WHO_AM_I check and scale, or NULL if initialize does them itself
+	struct SensorHealth health;		///< fault counters and recovery state
 };
 
 // Now start "standard" sensor fusion structure definitions
@@ -272,6 +336,18 @@ struct SV_1DOF_P_BASIC
 	int8_t resetflag;			///< flag to request re-initialization on next pass
 };
 
+/// @name Derived Output Flags
+/// Each fusion cycle, a motion algorithm updates its quaternion and angular
+/// velocity, and sets iDerive in its state vector to the outputs derived from
+/// them that it has left to fUpdateDerivedOutputs(). Readers of those outputs
+/// call fUpdateDerivedOutputs() first, so the Euler angle and rotation vector
+/// computation is only paid for when something uses them.
+///@{
+#define DERIVE_MATRIX   0x01    ///< orientation matrix, from the quaternion
+#define DERIVE_ANGLES   0x02    ///< Euler angles, from the orientation matrix, and rotation vector
+#define DERIVE_NO_YAW   0x04    ///< with DERIVE_ANGLES: yaw and compass are forced to zero
+///@}
+
 /// This is the 3DOF basic accelerometer state vector structure.
 struct SV_3DOF_G_BASIC
 {
@@ -286,6 +362,7 @@ struct SV_3DOF_G_BASIC
 	float fLPRVec[3];			///< rotation vector
 	float fOmega[3];			///< angular velocity (deg/s)
 	int32_t systick;			///< systick timer
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 	// end: elements common to all motion state vectors
 	float fR[3][3];				///< unfiltered orientation matrix
 	Quaternion fq;				///< unfiltered orientation quaternion
@@ -308,6 +385,7 @@ struct SV_3DOF_B_BASIC
 	float fLPRVec[3];			///< rotation vector
 	float fOmega[3];			///< angular velocity (deg/s)
 	int32_t systick;			///< systick timer
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 	// end: elements common to all motion state vectors
 	float fR[3][3];				///< unfiltered orientation matrix
 	Quaternion fq;				///< unfiltered orientation quaternion
@@ -330,6 +408,7 @@ struct SV_3DOF_Y_BASIC
 	float fRVec[3];				///< rotation vector
 	float fOmega[3];			///< angular velocity (deg/s)
 	int32_t systick;			///< systick timer
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 	// end: elements common to all motion state vectors
 	float fdeltat;				///< fusion filter sampling interval (s)
 	int8_t resetflag;			///< flag to request re-initialization on next pass
@@ -349,6 +428,7 @@ struct SV_6DOF_GB_BASIC
 	float fLPRVec[3];			///< rotation vector
 	float fOmega[3];			///< virtual gyro angular velocity (deg/s)
 	int32_t systick;			///< systick timer
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 	// end: elements common to all motion state vectors
 	float fR[3][3];				///< unfiltered orientation matrix
 	Quaternion fq;				///< unfiltered orientation quaternion
@@ -359,6 +439,30 @@ struct SV_6DOF_GB_BASIC
 	int8_t resetflag;			///< flag to request re-initialization on next pass
 };
 
+/// @name Kalman Filter Fault Flags
+/// Each cycle the Kalman filters check the numerical health of their
+/// covariance matrix Qw, gain and a posteriori state, and record what they
+/// find in a KalmanHealth structure. A faulty Qw or state would otherwise
+/// persist, so it requests a reset initialization for the next cycle.
+///@{
+#define KALMAN_FAULT_DIAGONAL   0x01    ///< a diagonal element of Qw is not finite and positive
+#define KALMAN_FAULT_SYMMETRY   0x02    ///< Qw is not symmetric (also caught: an off diagonal NaN)
+#define KALMAN_FAULT_GAIN       0x04    ///< C.Qw.C^T + Qv is not positive definite, so K was set to zero
+#define KALMAN_FAULT_STATE      0x08    ///< the a posteriori orientation or gyro offset is not finite
+///@}
+
+/// \brief Numerical health counters of a Kalman filter, kept across its reset initializations
+struct KalmanHealth {
+	uint8_t iLastFaults;                    ///< KALMAN_FAULT_* flags of the latest cycle
+	uint16_t iConsecutiveGainFaults;        ///< cycles in a row with KALMAN_FAULT_GAIN
+	uint32_t iFaultCycles;                  ///< total cycles with any fault
+	uint32_t iDiagonalFaults;               ///< total cycles with KALMAN_FAULT_DIAGONAL
+	uint32_t iSymmetryFaults;               ///< total cycles with KALMAN_FAULT_SYMMETRY
+	uint32_t iGainFaults;                   ///< total cycles with KALMAN_FAULT_GAIN
+	uint32_t iStateFaults;                  ///< total cycles with KALMAN_FAULT_STATE
+	uint32_t iResets;                       ///< reset initializations requested after faults
+};
+
 /// SV_6DOF_GY_KALMAN is the 6DOF Kalman filter accelerometer and gyroscope state vector structure.
 struct SV_6DOF_GY_KALMAN
 {
@@ -373,6 +477,7 @@ struct SV_6DOF_GY_KALMAN
 	float fRVecPl[3];			///< rotation vector
 	float fOmega[3];			///< average angular velocity (deg/s)
 	int32_t systick;			///< systick timer;
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 	// end: elements common to all motion state vectors
 	float fQw6x6[6][6];			///< covariance matrix Qw
 	float fK6x3[6][3];			///< kalman filter gain matrix K
@@ -390,6 +495,10 @@ struct SV_6DOF_GY_KALMAN
 	float fAlphaQwbOver6;			///< (PI / 180 * fdeltat) * Qwb / 6
 	float fQwbOver3;			///< Qwb / 3
 	float fMaxGyroOffsetChange;		///< maximum permissible gyro offset change per iteration (deg/s)
+	float fQvY;				///< gyro sensor noise variance (deg/s)^2, set by fSetNoise_6DOF_GY_KALMAN()
+	float fQvGMin;				///< minimum accelerometer sensor noise variance g^2
+	float fQwb;				///< gyro offset random walk (deg/s)^2
+	struct KalmanHealth health;		///< numerical health counters
 	int8_t resetflag;			///< flag to request re-initialization on next pass
 };
 
@@ -407,12 +516,16 @@ struct SV_9DOF_GBY_KALMAN
 	float fRVecPl[3];			///< rotation vector
 	float fOmega[3];			///< average angular velocity (deg/s)
 	int32_t systick;			///< systick timer;
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 	// end: elements common to all motion state vectors
 	float fQw9x9[9][9];			///< covariance matrix Qw
 	float fK9x6[9][6];			///< kalman filter gain matrix K
 	float fQwCT9x6[9][6];			///< Qw.C^T matrix
 	float fZErr[6];				///< measurement error vector
 	float fQv6x1[6];			///< measurement noise covariance matrix leading diagonal
+	Quaternion fqMi;			///< a priori orientation quaternion (kept between the cycle's phases)
+	float fgMi[3];				///< a priori gravity vector (sensor frame)
+	float fmMi[3];				///< a priori geomagnetic vector (sensor frame)
 	float fDeltaPl;				///< a posteriori inclination angle from Kalman filter (deg)
 	float fsinDeltaPl;			///< sin(fDeltaPl)
 	float fcosDeltaPl;			///< cos(fDeltaPl)
@@ -423,6 +536,8 @@ struct SV_9DOF_GBY_KALMAN
 	float fAccGl[3];			///< linear acceleration (g) in global frame
 	float fVelGl[3];			///< velocity (m/s) in global frame
 	float fDisGl[3];			///< displacement (m) in global frame
+	accum_t aVelGl[3];			///< fVelGl accumulator (see precision.h)
+	accum_t aDisGl[3];			///< fDisGl accumulator (see precision.h)
 	float fdeltat;				///< sensor fusion interval (s)
 	float fgdeltat;				///< g (m/s2) * fdeltat
 	float fAlphaOver2;			///< PI / 180 * fdeltat / 2
@@ -431,7 +546,12 @@ struct SV_9DOF_GBY_KALMAN
 	float fAlphaQwbOver6;			///< (PI / 180 * fdeltat) * Qwb / 6
 	float fQwbOver3;			///< Qwb / 3
 	float fMaxGyroOffsetChange;		///< maximum permissible gyro offset change per iteration (deg/s)
+	float fQvY;				///< gyro sensor noise variance (deg/s)^2, set by fSetNoise_9DOF_GBY_KALMAN()
+	float fQvGMin;				///< minimum accelerometer sensor noise variance g^2
+	float fQvBMin;				///< minimum magnetometer sensor noise variance uT^2
+	float fQwb;				///< gyro offset random walk (deg/s)^2
 	int8_t iFirstAccelMagLock;		///< denotes that 9DOF orientation has locked to 6DOF eCompass
+	struct KalmanHealth health;		///< numerical health counters
 	int8_t resetflag;			///< flag to request re-initialization on next pass
 };
 
@@ -448,6 +568,7 @@ struct SV_COMMON {
 	float fRVec[3];			        ///< rotation vector
 	float fOmega[3];			///< average angular velocity (deg/s)
 	int32_t systick;			///< systick timer;
+	uint8_t iDerive;			///< derived outputs still to be computed this cycle (DERIVE_* flags)
 };
 
 typedef struct SV_COMMON *SV_ptr;
@@ -471,8 +592,11 @@ typedef struct SensorFusionGlobals
         ///@{
         /// @name MiscFields
         uint32_t iFlags;                        ///< a bit-field of sensors and algorithms used
-	struct PhysicalSensor *pSensors;    	        ///< a linked list of physical sensors
+	struct PhysicalSensor *pSensors;    	        ///< a linked list of physical sensors (not used by the library itself)
+	struct PhysicalSensor *pSensorTable[MAX_NUM_SENSORS];  ///< the installed sensors, in the order they are read
+	uint8_t iNumSensors;                            ///< entries used in pSensorTable
 	volatile uint8_t iPerturbation;	        ///< test perturbation to be applied
+	float fPredictHorizonSecs;		///< time (s) output quaternions are predicted ahead, 0 for no prediction
 	// Book-keeping variables
 	int32_t loopcounter;			///< counter incrementing each iteration of sensor fusion (typically 25Hz)
 	int32_t systick_I2C;			///< systick counter to benchmark I2C reads
@@ -500,6 +624,7 @@ typedef struct SensorFusionGlobals
 	struct GyroSensor 	Gyro;                   ///< gyro storage
 #endif
     struct TempSensor Temp;					//temperature storage
+	struct RateControl RateCtrl;            ///< run-time sensor ODR adaptation
 
         ///@}
         ///@{
@@ -597,6 +722,21 @@ void addToFifo(
     int16_t sample[3]                                   ///< the sample to add
 );
 
+/// \brief addBlockToFifo unpacks a burst of big-endian triaxial samples into a software FIFO
+///
+/// addBlockToFifo does, in a single pass over a sensor burst read, what a driver would
+/// otherwise do sample by sample: assemble each 16-bit value from its MSB/LSB pair,
+/// apply conditionSample() and call addToFifo().  Pairs of samples are processed
+/// 32 bits at a time.  A 4-byte aligned buffer gives the fastest path.
+///
+/// example usage: addBlockToFifo((union FifoSensor*) &(sfg->Gyro), GYRO_FIFO_SIZE, I2C_Buffer, numBytes / 6);
+void addBlockToFifo(
+    union FifoSensor *sensor,                           ///< pointer to structure of type AccelSensor, MagSensor or GyroSensor
+    uint16_t maxFifoSize,                               ///< the size of the software (not hardware) FIFO
+    const uint8_t *buffer,                              ///< X, Y, Z MSB/LSB byte pairs, 6 bytes per sample
+    uint16_t numSamples                                 ///< number of samples in buffer
+);
+
 // The following functions are defined in hal_axis_remap.c
 // Please note that these are board-dependent - they account for 
 //various orientations of sensor ICs on the sensor PCB.
@@ -31,6 +31,7 @@
 #include "sensor_fusion/sensor_fusion.h"
 #include "sensor_fusion/control.h"
 #include "sensor_fusion/driver_sensors.h"
+#include "sensor_fusion/log_storage.h"
 #include "sensor_fusion/status.h"
 
 const float kDegToRads = PI / 180.0;   ///< To convert Degrees to Radians, multiply by this constant.
@@ -46,12 +47,9 @@ SensorFusion::SensorFusion() {
   sfg_ = new SensorFusionGlobals();
   control_subsystem_ = new ControlSubsystem;
   status_subsystem_ = new StatusSubsystem;
-  sensors_ = new PhysicalSensor
-      [MAX_NUM_SENSORS];  // this implementation uses up to 4 sensors
-                          // (accel/mag; gyro; baro/thermo)
-                          // TODO - can use std::vector as per
-                          // https://stackoverflow.com/questions/14114686/create-an-array-of-structure-using-new
-                          // which will allow adding arbitrary # of sensors.
+  // sfg_->pSensorTable points at the sensors, so they need a fixed address.
+  // Define MAX_NUM_SENSORS before including the library to change the size.
+  sensors_ = new PhysicalSensor[MAX_NUM_SENSORS];
 
   InitializeInputOutputSubsystem();
   InitializeStatusSubsystem();
@@ -60,9 +58,9 @@ SensorFusion::SensorFusion() {
 }  // end SensorFusion()
 
 /**
- * @brief Install Sensor in linked list
- * The max length of the list is checked, and if there is room, the 
- * given sensor is inserted at the head of the list.
+ * @brief Install Sensor in the sensor table
+ * The sensor type is looked up in the driver registry (sensor_drivers.cc)
+ * and the sensor installed with that driver.
  * An accelerometer and magnetometer may be combined in one IC - if
  * that is the case then only one call is required to install, 
  * provided the associated *_Init() and *_Read() function reads both
@@ -70,56 +68,57 @@ SensorFusion::SensorFusion() {
  * of each sensor are defined in driver_*.* files.
  * @param sensor_i2c_addr is the I2C bus address of the sensor IC
  * @param sensor_type indicates the type of sensor (e.g. magnetometer)
+ * @param i2c_bus is the I2C bus the sensor is attached to. Bus 0 is set up
+ * by Begin(); other buses must be set up with InitializeI2CBus(). 
+ * @param i2c_clock_hz is the I2C clock to use when talking to this sensor,
+ * or 0 to use the clock the bus was initialized with.
  * @return True if sensor installed successfully, else False
  */
 bool SensorFusion::InstallSensor(uint8_t sensor_i2c_addr,
-                                   SensorType sensor_type) {
+                                   SensorType sensor_type, uint8_t i2c_bus,
+                                   uint32_t i2c_clock_hz) {
+  const SensorDriver *driver = FindSensorDriver(sensor_type);
 
-    if( num_sensors_installed_ >= MAX_NUM_SENSORS ) {
-        //already have max number of sensors installed
-      return false;
-    }
-    switch (sensor_type) {
-    case SensorType::kAccelerometer:
-      sfg_->installSensor(sfg_, &sensors_[num_sensors_installed_],
-                          sensor_i2c_addr, kLoopsPerAccelRead, NULL,
-                          FXOS8700_Accel_Init, FXOS8700_Accel_Read);
-      ++num_sensors_installed_;
-      break;
-    case SensorType::kMagnetometer:
-      sfg_->installSensor(sfg_, &sensors_[num_sensors_installed_],
-                          sensor_i2c_addr, kLoopsPerMagRead, NULL,
-                          FXOS8700_Mag_Init, FXOS8700_Mag_Read);
-      ++num_sensors_installed_;
-      break;
-    case SensorType::kMagnetometerAccelerometer:
-      sfg_->installSensor(sfg_, &sensors_[num_sensors_installed_],
-                          sensor_i2c_addr, kLoopsPerAccelRead, NULL,
-                          FXOS8700_Init, FXOS8700_Read);
-      ++num_sensors_installed_;
-      break;
-    case SensorType::kGyroscope:
-      sfg_->installSensor(sfg_, &sensors_[num_sensors_installed_],
-                          sensor_i2c_addr, kLoopsPerGyroRead, NULL,
-                          FXAS21002_Init, FXAS21002_Read);
-      ++num_sensors_installed_;
-      break;
-    case SensorType::kThermometer:
-      // use the thermometer built into FXOS8700. Not precise nor calibrated,
-      // but OK.
-      sfg_->installSensor(sfg_, &sensors_[num_sensors_installed_],
-                          sensor_i2c_addr, kLoopsPerThermRead, NULL,
-                          FXOS8700_Therm_Init, FXOS8700_Therm_Read);
-      ++num_sensors_installed_;
-      break;
-    case SensorType::kBarometer:
-      // TODO define some access functions for this
-      // TODO add barometer sensor
-      break;
-    default:
-      // unrecognized sensor type
-      break;
+  if (driver == NULL) {
+    // no driver registered for this sensor type (e.g. barometer)
+    return false;
+  }
+  return InstallSensor(sensor_i2c_addr, *driver, i2c_bus, i2c_clock_hz);
+}  // end InstallSensor()
+
+/**
+ * @brief Install Sensor in the sensor table using the given driver
+ * If there is room, the sensor is added to the end of the table, which
+ * readSensors() walks in order. Its WHO_AM_I is checked and its scale set
+ * from the driver's SensorIdentity each time it is initialized.
+ * @param sensor_i2c_addr is the I2C bus address of the sensor IC
+ * @param driver holds the driver functions for the IC (see sensor_drivers.h)
+ * @param i2c_bus is the I2C bus the sensor is attached to
+ * @param i2c_clock_hz is the I2C clock to use when talking to this sensor,
+ * or 0 to use the clock the bus was initialized with.
+ * @return True if sensor installed successfully, else False
+ */
+bool SensorFusion::InstallSensor(uint8_t sensor_i2c_addr,
+                                   const SensorDriver &driver, uint8_t i2c_bus,
+                                   uint32_t i2c_clock_hz) {
+  if (num_sensors_installed_ >= MAX_NUM_SENSORS) {
+    // already have max number of sensors installed
+    return false;
+  }
+  if (i2c_bus >= I2C_NUM_BUSES) {
+    return false;
+  }
+  registerDeviceInfo_t bus_info = {NULL, NULL, i2c_bus, i2c_clock_hz};
+  PhysicalSensor *sensor = &sensors_[num_sensors_installed_];
+
+  if (0 != sfg_->installSensor(sfg_, sensor, sensor_i2c_addr,
+                               driver.loops_per_read, &bus_info,
+                               driver.initialize, driver.read)) {
+    return false;
   }
+  sensor->setODR = driver.set_odr;
+  sensor->identity = driver.identity;
+  ++num_sensors_installed_;
   return true;
 }  // end InstallSensor()
 
@@ -137,6 +136,22 @@ bool SensorFusion::InitializeInputOutputSubsystem(const Stream *serial_port,
   return initializeIOSubsystem(control_subsystem_, serial_port, tcp_client);
 }  // end InitializeInputOutputSubsystem()
 
+/**
+ * @brief Initialize an additional I2C bus.
+ * The ESP32 has two I2C controllers; sensors may be split between them
+ * (see InstallSensor()) and the buses are then read concurrently. Call this
+ * before Begin() for any bus other than 0. Bus 0 is initialized by Begin().
+ * @param i2c_bus is the bus number (0 or 1 on ESP32; only 0 on ESP8266)
+ * @param pin_i2c_sda is the SDA pin for the bus
+ * @param pin_i2c_scl is the SCL pin for the bus
+ * @param i2c_clock_hz is the default clock for sensors on this bus
+ * @return True if the bus was initialized, else False
+ */
+bool SensorFusion::InitializeI2CBus(uint8_t i2c_bus, int pin_i2c_sda,
+                                    int pin_i2c_scl, uint32_t i2c_clock_hz) {
+  return I2CInitializeBus(i2c_bus, pin_i2c_sda, pin_i2c_scl, i2c_clock_hz);
+}  // end InitializeI2CBus()
+
 /**
  * Initialize the Sensors. Read calibrations. Set status to Normal.
  */
@@ -145,13 +160,44 @@ void SensorFusion::Begin(int pin_i2c_sda, int pin_i2c_scl) {
       sfg_, pin_i2c_sda, pin_i2c_scl);                      // Initialize sensors and magnetic calibration
   sfg_->setStatus(sfg_, NORMAL);  // Set status state to NORMAL
 //TODO - setStatus should check whether initialize worked.
+  UpdateSnapshot();
 
 }  // end InitializeFusionEngine()
 
+/**
+ * @brief Enable or disable run-time adaptation of the sensor output data rates.
+ * When enabled, the gyro and accelerometer/magnetometer are switched to the
+ * lower GYRO_ODR_IDLE_HZ / ACCEL_ODR_IDLE_HZ rates (build.h) after the unit
+ * has been stationary for a while, and back to full rate once it moves. The
+ * rates are also lowered if reading and fusing use up most of the loop period.
+ * Disabling restores the build.h rates.
+ * @param enable true to enable adaptation
+ */
+void SensorFusion::SetAdaptiveRates(bool enable) {
+  fEnableRateControl(sfg_, enable);
+}  // end SetAdaptiveRates()
+
+/**
+ * @brief Set how far ahead the predicted quaternion is extrapolated.
+ * The prediction rotates the current orientation by the gyro rate (with
+ * the Kalman bias estimate removed) for horizon_ms, which can be used to
+ * make up for the latency between fusion and its use, e.g. in a display.
+ * It is sent as packet type 10 and is available from
+ * GetPredictedQuaternion() and GetSnapshot().
+ * @param horizon_ms prediction horizon in ms, 0 (the default) for none,
+ * limited to MAX_PREDICT_HORIZON_MS
+ */
+void SensorFusion::SetPredictionHorizon(float horizon_ms) {
+  if (!(horizon_ms > 0.0F)) horizon_ms = 0.0F;  // NaN too
+  if (horizon_ms > MAX_PREDICT_HORIZON_MS) horizon_ms = MAX_PREDICT_HORIZON_MS;
+  sfg_->fPredictHorizonSecs = horizon_ms / 1000.0F;
+}  // end SetPredictionHorizon()
+
 /**
  * @brief Update the TCP client pointer.
  * Call when a new TCP connection is made, as reported by WiFiServer::available()
  * When tcp_client is NULL, output via WiFi is not attempted.
+ * This sets the first TCP client; use AddWiFiClient() for additional ones.
  * @param tcp_client A WiFiClient pointer used for input/output
  */
 void SensorFusion::UpdateWiFiStream(void *tcp_client) {
@@ -159,12 +205,45 @@ void SensorFusion::UpdateWiFiStream(void *tcp_client) {
 
 }  // end UpdateTCPClient()
 
+/**
+ * @brief Add a TCP client to receive the output stream.
+ * Up to MAX_TCP_CLIENTS clients receive the same data, and commands are
+ * accepted from all of them. A client is dropped automatically when it
+ * disconnects. The WiFiClient must remain valid until then, or until
+ * RemoveWiFiClient() is called.
+ * @param tcp_client A WiFiClient pointer used for input/output
+ * @return False if there is no room for another client, else True
+ */
+bool SensorFusion::AddWiFiClient(void *tcp_client) {
+  return AddTCPClient(control_subsystem_, tcp_client);
+}  // end AddWiFiClient()
+
+/**
+ * @brief Stop sending the output stream to a TCP client.
+ * @param tcp_client A WiFiClient pointer previously added
+ */
+void SensorFusion::RemoveWiFiClient(void *tcp_client) {
+  RemoveTCPClient(control_subsystem_, tcp_client);
+}  // end RemoveWiFiClient()
+
+/**
+ * @brief Send the output stream as UDP datagrams.
+ * Each frame is sent as one datagram, so any number of listeners on a
+ * broadcast or multicast address receive it for the cost of one send.
+ * @param udp A WiFiUDP pointer, or NULL to stop UDP output
+ * @param ip destination address, e.g. IPAddress(255, 255, 255, 255)
+ * @param port destination UDP port
+ */
+void SensorFusion::SetUDPStream(void *udp, uint32_t ip, uint16_t port) {
+  SetUDPOutput(control_subsystem_, udp, ip, port);
+}  // end SetUDPStream()
+
 /**
  * @brief Reads all sensors.
  * Applies HAL remapping, removes invalid values, and stores data for 
  * later processing. Depending on whether a sensor has a built-in FIFO
  * buffer, that sensor may not be read each time this method is called.
- * See kLoopsPerMagRead, etc., in sensor_fusion_class.h
+ * See loops_per_read in sensor_drivers.h
  */
 void SensorFusion::ReadSensors(void) {
   sfg_->readSensors(
@@ -189,8 +268,15 @@ void SensorFusion::RunFusion(void) {
     return;
   }
 
+  uint32_t cycle_start_us = micros();
+  if (logger_) {
+    logSensorSamples(logger_, sfg_, cycle_start_us);  // before the FIFOs are used up
+  }
   sfg_->conditionSensorReadings(sfg_);  // Pre-processing; Magnetic calibration.
   sfg_->runFusion(sfg_);                // Run fusion algorithms
+  if (logger_) {
+    logFusionOutput(logger_, sfg_, cycle_start_us);
+  }
 
   // Serial.printf(" Algo took %ld us\n", sfg.SV_9DOF_GBY_KALMAN.systick);
   sfg_->loopcounter++;  // loop counter is used to "serialize" mag cal
@@ -206,28 +292,147 @@ void SensorFusion::RunFusion(void) {
   // this resets temporary error conditions (SOFT_FAULT)
   sfg_->queueStatus(sfg_, NORMAL);
 
+  UpdateSnapshot();  // publish results for the Get____() methods
+  toolbox_frame_due_ = true;    // for ProduceToolboxOutput()
   loops_per_fuse_counter_ = 1;  // reset loop counter
 
 }  // end RunFusion()
 
+/**
+ * @brief Fill in the heading, pitch and roll of a snapshot from its quaternion.
+ * These are the Euler angles of the 9DOF Kalman algorithm in THISCOORDSYSTEM,
+ * as fUpdateDerivedOutputs() would compute them, mapped to vessel conventions.
+ * @param snapshot snapshot whose quaternion is set
+ */
+static void SnapshotAngles(FusionSnapshot *snapshot) {
+  float rotation[3][3];
+  float phi, the, psi, rho, chi;
+
+  fRotationMatrixFromQuaternion(rotation, &snapshot->quaternion);
+#if THISCOORDSYSTEM == NED
+  fNEDAnglesDegFromRotationMatrix(rotation, &phi, &the, &psi, &rho, &chi);
+#elif THISCOORDSYSTEM == ANDROID
+  fAndroidAnglesDegFromRotationMatrix(rotation, &phi, &the, &psi, &rho, &chi);
+#else  // WIN8
+  fWin8AnglesDegFromRotationMatrix(rotation, &phi, &the, &psi, &rho, &chi);
+#endif
+  snapshot->heading_deg = (rho <= 90) ? (rho + 270.0) : (rho - 90.0);
+  snapshot->pitch_deg = phi;
+  snapshot->roll_deg = -the;
+  snapshot->heading_rad = snapshot->heading_deg * kDegToRads;
+  snapshot->pitch_rad = snapshot->pitch_deg * kDegToRads;
+  snapshot->roll_rad = snapshot->roll_deg * kDegToRads;
+}  // end SnapshotAngles()
+
+/**
+ * @brief Copy the results of the fusion cycle just run into snapshot_.
+ * The sequence number is odd while the copy is being made, so that
+ * GetSnapshot() on another core can detect and retry a torn read.
+ * See the comments preceding GetHeadingDegrees() for the axis conventions.
+ */
+void SensorFusion::UpdateSnapshot(void) {
+  const SV_9DOF_GBY_KALMAN &kalman = sfg_->SV_9DOF_GBY_KALMAN;
+  uint32_t sequence = snapshot_sequence_.load(std::memory_order_relaxed);
+
+  snapshot_sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  snapshot_.quaternion = kalman.fqPl;
+  fPredictQuaternion(&snapshot_.predicted_quaternion, &kalman.fqPl,
+                     kalman.fOmega, sfg_->fPredictHorizonSecs);
+  snapshot_.predict_horizon_s = sfg_->fPredictHorizonSecs;
+  // the heading, pitch and roll are only computed once a reader has asked
+  // for them, so that a sketch using only the quaternion doesn't pay for them
+  snapshot_.has_angles = angles_wanted_.load(std::memory_order_relaxed);
+  if (snapshot_.has_angles) {
+    SnapshotAngles(&snapshot_);
+  }
+  snapshot_.turn_rate_dps = kalman.fOmega[2];
+  snapshot_.pitch_rate_dps = kalman.fOmega[0];
+  snapshot_.roll_rate_dps = -kalman.fOmega[1];
+  snapshot_.accel_g[0] = sfg_->Accel.fGc[1];
+  snapshot_.accel_g[1] = sfg_->Accel.fGc[0];
+  snapshot_.accel_g[2] = sfg_->Accel.fGc[2];
+  snapshot_.temperature_c = sfg_->Temp.temperatureC;
+  snapshot_.mag_fit_error_pc = sfg_->MagCal.fFitErrorpc;
+  snapshot_.mag_b_uT = sfg_->MagCal.fB;
+  snapshot_.mag_noise_cov = kalman.fQv6x1[3];
+  snapshot_.mag_solver = (uint8_t)sfg_->MagCal.iValidMagCal;
+  snapshot_.status = (uint8_t)sfg_->pStatusSubsystem->status;
+  snapshot_.timestamp_us = micros();
+  snapshot_.fusion_count = (uint32_t)sfg_->loopcounter;
+
+  snapshot_sequence_.store(sequence + 2, std::memory_order_release);
+}  // end UpdateSnapshot()
+
+/**
+ * @brief Copy the results of the latest fusion cycle.
+ * Safe to call from a task on the other core while RunFusion() is running;
+ * if a fusion cycle finishes during the copy, the copy is simply repeated.
+ * Only reads the shared snapshot: the first call asks RunFusion() to include
+ * the heading, pitch and roll from the next cycle on, and until then they are
+ * computed in the caller's copy.
+ * @param snapshot pointer to structure, to be filled by this method
+ * @return False if no fusion cycle has completed since Begin(), else True
+ */
+bool SensorFusion::GetSnapshot(FusionSnapshot *snapshot) const {
+  uint32_t before, after;
+
+  angles_wanted_.store(true, std::memory_order_relaxed);
+  do {
+    before = snapshot_sequence_.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;  // writer is part way through an update
+    }
+    *snapshot = snapshot_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = snapshot_sequence_.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+  if (!snapshot->has_angles) {
+    SnapshotAngles(snapshot);
+    snapshot->has_angles = true;
+  }
+  return snapshot->fusion_count != 0;
+}  // end GetSnapshot()
+
+/**
+ * @brief @return One of the angles of the latest fusion cycle, e.g.
+ * &FusionSnapshot::heading_deg. Read-only like GetSnapshot(), so the angle
+ * getters may be called from any task.
+ */
+float SensorFusion::GetSnapshotAngle(float FusionSnapshot::*angle) const {
+  FusionSnapshot snapshot;
+
+  GetSnapshot(&snapshot);
+  return snapshot.*angle;
+}  // end GetSnapshotAngle()
+
 /**
  * @brief Generate and send out data, formatted for NXP Orientation Sensor Toolbox.
+ * A frame is made once per fusion cycle, but it is sent without waiting for
+ * the serial port or TCP client, and a frame is usually larger than the UART
+ * will take at once. So call this every time through loop(), not just after
+ * RunFusion(): each call sends more of the frame, so that it is complete
+ * before the next one replaces it.
  * It is not mandatory to call this routine, if Toolbox output is not needed.
  */
 void SensorFusion::ProduceToolboxOutput(void) {
   // Make & send data to Sensor Fusion Toolbox or whatever UART is
   // connected to.
-  if (loops_per_fuse_counter_ == 1) {       // only run if fusion has happened
+  if (toolbox_frame_due_) {                 // fusion has run since the last frame
+    toolbox_frame_due_ = false;
     sfg_->pControlSubsystem->stream(sfg_);  // create output packet
-    sfg_->pControlSubsystem->write(sfg_);   // send output packet
+    sfg_->pControlSubsystem->write(sfg_);   // queue and start sending output packet
+  } else {
+    sfg_->pControlSubsystem->drain(sfg_);   // continue sending queued packet
   }
 
 }  // end ProduceToolboxOutput()
 
 /**
- * places data from buffer into Control subsystem's output buffer, and sends
- * it out via serial and/or wifi.  Any existing data in the output buffer
- * that hasn't already been sent will be overwritten.
+ * places data from buffer into Control subsystem's output buffer, and starts
+ * sending it out via serial and/or wifi.  Any earlier frame that hasn't
+ * been completely sent yet is dropped.
  * Returns true on success, false on problem such as data_length too long
  * for the transmit buffer.
  */
@@ -240,10 +445,156 @@ bool SensorFusion::SendArbitraryData(const char *buffer, uint16_t data_length) {
     out_buf[i] = buffer[i];
   }
   sfg_->pControlSubsystem->bytes_to_send = data_length;
+  sfg_->pControlSubsystem->out_layout.numPackets = 0;  // goes to every output
   sfg_->pControlSubsystem->write(sfg_);  // send output packet
   return true;
 }  // end SendArbitraryData()
 
+/**
+ * @brief Choose which Toolbox packets an output is sent, and how often.
+ * By default every output is sent all packets enabled by command, at
+ * MAXPACKETRATEHZ. Packets no output is due this cycle are not formatted.
+ * @param sink is OUTPUT_SINK_UART, OUTPUT_SINK_UDP, or OUTPUT_SINK_TCP + n
+ * for the n'th TCP client slot
+ * @param packets is a combination of PACKET_* masks from control.h, or 0
+ * to send nothing to this output
+ * @param rate_hz is the number of frames per second for this output. Rates
+ * of FUSION_HZ or more send every fusion cycle. A CFG_KEY_OUTPUT_RATE_HZ
+ * configuration record changes the rate of the UART output only.
+ * @return False if sink is not a valid output, else True
+ */
+bool SensorFusion::SetOutputSubscription(uint8_t sink, uint16_t packets,
+                                         uint16_t rate_hz) {
+  if (sink >= NUM_OUTPUT_SINKS) {
+    return false;
+  }
+  ::SetOutputSubscription(control_subsystem_, sink, packets, rate_hz);
+  return true;
+}  // end SetOutputSubscription()
+
+/**
+ * @brief Get transmit counters for one of the outputs.
+ * @param sink is OUTPUT_SINK_UART, OUTPUT_SINK_UDP, or OUTPUT_SINK_TCP + n
+ * for the n'th TCP client slot
+ * @param stats receives the number of frames sent and dropped
+ * @return False if sink is not a valid output, else True
+ */
+bool SensorFusion::GetOutputStats(uint8_t sink, OutputSinkStats *stats) {
+  if (sink >= NUM_OUTPUT_SINKS) {
+    return false;
+  }
+  *stats = control_subsystem_->tx_stats[sink];
+  return true;
+}  // end GetOutputStats()
+
+#ifdef ESP32
+/**
+ * @brief Idle-priority task that writes the log ring to storage, so that the
+ * loop task doesn't wait for the flash writes. It doesn't make them free:
+ * while SPIFFS writes or erases a sector the flash cache is disabled on both
+ * cores, and code running from flash (RunFusion() included) stalls until it
+ * is done. GetLogStats() reports the longest gap between fusion cycles.
+ * @param param the DataLogger to service
+ */
+static void LoggerTask(void *param) {
+  DataLogger *logger = (DataLogger *)param;
+  for (;;) {
+    if (0 == serviceDataLogger(logger)) {
+      vTaskDelay(pdMS_TO_TICKS(LOG_SERVICE_MS));
+    }
+  }
+}  // end LoggerTask()
+#endif
+
+/**
+ * @brief Start logging every sensor sample and fusion output to a file.
+ * Records (see data_logger.h) are buffered in RAM by RunFusion() and written
+ * to the SPIFFS file in blocks: by an idle-priority task on ESP32, and by
+ * ServiceLogging() on ESP8266. The RAM ring (LOG_RING_BYTES) is allocated
+ * on first use. If the flash can't keep up, whole fusion cycles are dropped
+ * rather than RunFusion() waiting for room in the ring. The flash writes can
+ * still delay fusion cycles (see ServiceLogging() and LoggerTask());
+ * GetLogStats() reports how much.
+ * @param path name of the file to create (an existing file is overwritten)
+ * @return False if a log is still open or the file can't be created, else True
+ */
+bool SensorFusion::StartLogging(const char *path) {
+  if (logger_ && logger_->state != LOG_OFF) {
+    return false;
+  }
+  void *file = LogFileOpen(path);
+  if (NULL == file) {
+    return false;
+  }
+  if (NULL == logger_) {
+    log_ring_ = new uint8_t[LOG_RING_BYTES];
+    logger_ = new DataLogger();
+  }
+#ifdef ESP32
+  if (NULL == logger_task_ &&
+      pdPASS != xTaskCreate(LoggerTask, "logger", 4096, logger_,
+                            tskIDLE_PRIORITY, &logger_task_)) {
+    logger_task_ = NULL;  // nothing would write the ring out
+    LogFileClose(file);
+    return false;
+  }
+#endif
+  return startDataLogger(logger_, sfg_, log_ring_, LogFileWrite,
+                         LogFileClose, file, micros());
+}  // end StartLogging()
+
+/**
+ * @brief Stop logging. The records still in RAM are written and the file
+ * closed by the flusher; IsLogging() returns false once that is done.
+ */
+void SensorFusion::StopLogging(void) {
+  if (logger_) {
+    stopDataLogger(logger_);
+  }
+}  // end StopLogging()
+
+/**
+ * @brief @return True while a log is open (including while it is being
+ * flushed after StopLogging())
+ */
+bool SensorFusion::IsLogging(void) {
+  return logger_ && logger_->state != LOG_OFF;
+}  // end IsLogging()
+
+/**
+ * @brief Write buffered log records to the file.
+ * On ESP8266 there is no separate task to do this, so call it from loop()
+ * when there is time to spare, e.g. after ProduceToolboxOutput(). It writes
+ * only whole LOG_BLOCK_BYTES blocks, and returns at once if there are none.
+ * A block write blocks loop() for as long as the flash takes, which is much
+ * longer when SPIFFS has to erase a sector first, so the next ReadSensors()
+ * and RunFusion() are late by that much. Samples wait in the sensor FIFOs
+ * meanwhile, and are lost if those overflow. Check maxCycleIntervalUs and
+ * lateCycles in GetLogStats() against the fusion period (1/FUSION_HZ).
+ * On ESP32 the logger task does this, and the call has no effect.
+ */
+void SensorFusion::ServiceLogging(void) {
+#ifndef ESP32
+  if (logger_) {
+    serviceDataLogger(logger_);
+  }
+#endif
+}  // end ServiceLogging()
+
+/**
+ * @brief Get the counters of the current (or last) log.
+ * @param stats receives the records logged and dropped, bytes written, write
+ * errors, and the longest gap between fusion cycles while logging
+ * @return False if logging has never been started, else True
+ */
+bool SensorFusion::GetLogStats(DataLoggerStats *stats) {
+  if (NULL == logger_) {
+    return false;
+  }
+  *stats = logger_->stats;
+  return true;
+}  // end GetLogStats()
+
 /**
  * @brief Process any incoming commands.
  * Commands may arrive by serial or WiFi connection, depending on which of
@@ -318,8 +669,9 @@ int SensorFusion::GetSystemStatus(void) {
 
 // The following Get____() methods return orientation values
 // calculated by the 9DOF Kalman algorithm (the most advanced).
-// They have been mapped to match the conventions used for
-// vessels:
+// They have been mapped (in SnapshotAngles()) to match the
+// conventions used for vessels, and are those of the latest
+// fusion cycle:
 //  Compass Heading; 0 at magnetic north, and increasing CW.
 //  Pitch; 0 with boat level, increasing with Bow Up.
 //  Roll; 0 with boat level, increasing with Starboard roll.
@@ -331,55 +683,54 @@ int SensorFusion::GetSystemStatus(void) {
 //  breakout board, mounted with X toward the bow, Y to port,
 //  and Z (component side of PCB) facing up.
 // If the sensor orienatation is different than assumed,
-//  you may need to remap the axes below.  If a different
+//  you may need to remap the axes in UpdateSnapshot() and
+//  SnapshotAngles().  If a different
 //  sensor board is used, you may need also to change the
 //  axes mapping in the file hal_axis_remap.c  The latter
 //  mapping is applied *before* the fusion algorithm,
-//  whereas the below mapping is applied *after*.
+//  whereas the SensorFusion mapping is applied *after*.
 
 /**
  * @brief @return Return the Compass Heading in degrees
  */
 float SensorFusion::GetHeadingDegrees(void) {
   // TODO - make generic so it's not dependent on algorithm used
-  return (sfg_->SV_9DOF_GBY_KALMAN.fRhoPl <= 90)
-             ? (sfg_->SV_9DOF_GBY_KALMAN.fRhoPl + 270.0)
-             : (sfg_->SV_9DOF_GBY_KALMAN.fRhoPl - 90.0);
+  return GetSnapshotAngle(&FusionSnapshot::heading_deg);
 }  // end GetHeadingDegrees()
 
 /**
  * @brief @return Return the Compass Heading in radians
  */
 float SensorFusion::GetHeadingRadians(void) {
-  return GetHeadingDegrees() * kDegToRads;
+  return GetSnapshotAngle(&FusionSnapshot::heading_rad);
 }  // end GetHeadingRadians()
 
 /**
  * @brief @return Return the Pitch in degrees
  */
 float SensorFusion::GetPitchDegrees(void) {
-  return sfg_->SV_9DOF_GBY_KALMAN.fPhiPl;
+  return GetSnapshotAngle(&FusionSnapshot::pitch_deg);
 }  // end GetPitchDegrees()
 
 /**
  * @brief @return Return the Pitch in radians
  */
 float SensorFusion::GetPitchRadians(void) {
-  return GetPitchDegrees() * kDegToRads;
+  return GetSnapshotAngle(&FusionSnapshot::pitch_rad);
 }  // end GetPitchRadians()
 
 /**
  * @brief @return Return the Roll in degrees
  */
 float SensorFusion::GetRollDegrees(void) {
-  return -(sfg_->SV_9DOF_GBY_KALMAN.fThePl);
+  return GetSnapshotAngle(&FusionSnapshot::roll_deg);
 }  // end GetRollDegrees()
 
 /**
  * @brief @return Return the Roll in radians
  */
 float SensorFusion::GetRollRadians(void) {
-  return GetRollDegrees() * kDegToRads;
+  return GetSnapshotAngle(&FusionSnapshot::roll_rad);
 }  // end GetRollRadians()
 
 /**
@@ -390,7 +741,7 @@ float SensorFusion::GetRollRadians(void) {
  * that should be calibrated out for best accuracy.
  */
 float SensorFusion::GetTemperatureC(void) {
-  return sfg_->Temp.temperatureC;
+  return snapshot_.temperature_c;
 }  // end GetTemperatureC()
 
 /**
@@ -408,7 +759,7 @@ float SensorFusion::GetTemperatureK(void) {
  * @brief @return Return the Turn Rate in degrees
  */
 float SensorFusion::GetTurnRateDegPerS(void) {
-  return sfg_->SV_9DOF_GBY_KALMAN.fOmega[2];
+  return snapshot_.turn_rate_dps;
 }  // end GetTurnRateDegPerS()
 
 /**
@@ -422,7 +773,7 @@ float SensorFusion::GetTurnRateRadPerS(void) {
  * @brief @return Return the Pitch Rate in degrees/s
  */
 float SensorFusion::GetPitchRateDegPerS(void) {
-  return sfg_->SV_9DOF_GBY_KALMAN.fOmega[0];
+  return snapshot_.pitch_rate_dps;
 }  // end GetPitchRateDegPerS()
 
 /**
@@ -436,7 +787,7 @@ float SensorFusion::GetPitchRateRadPerS(void) {
  * @brief @return Return the Roll Rate in degrees/s
  */
 float SensorFusion::GetRollRateDegPerS(void) {
-  return -(sfg_->SV_9DOF_GBY_KALMAN.fOmega[1]);
+  return snapshot_.roll_rate_dps;
 }  // end GetRollRateDegPerS()
 
 /**
@@ -450,7 +801,7 @@ float SensorFusion::GetRollRateRadPerS(void) {
  * @brief @return Return the X-axis Acceleration in gees
  */
 float SensorFusion::GetAccelXGees(void) {
-  return sfg_->Accel.fGc[1];
+  return snapshot_.accel_g[0];
 }  // end GetAccelXGees()
 
 /**
@@ -464,7 +815,7 @@ float SensorFusion::GetAccelXMPerSS(void) {
  * @brief @return Return the Y-axis Acceleration in gees
  */
 float SensorFusion::GetAccelYGees(void) {
-  return sfg_->Accel.fGc[0];
+  return snapshot_.accel_g[1];
 }  // end GetAccelYGees()
 
 /**
@@ -478,7 +829,7 @@ float SensorFusion::GetAccelYMPerSS(void) {
  * @brief @return Return the Z-axis Acceleration in gees
  */
 float SensorFusion::GetAccelZGees(void) {
-  return sfg_->Accel.fGc[2];
+  return snapshot_.accel_g[2];
 }  // end GetAccelZGees()
 
 /**
@@ -488,17 +839,87 @@ float SensorFusion::GetAccelZMPerSS(void) {
   return GetAccelZGees() * kGeesToMPerSS;
 }  // end GetAccelZMPerSS()
 
+/**
+ * @brief @return Return the gyroscope output data rate currently in use, in Hz
+ */
+int SensorFusion::GetGyroODRHz(void) {
+  return sfg_->RateCtrl.iGyroODR;
+}  // end GetGyroODRHz()
+
+/**
+ * @brief @return Return the accelerometer output data rate currently in use, in Hz
+ */
+int SensorFusion::GetAccelODRHz(void) {
+  return sfg_->RateCtrl.iAccelODR;
+}  // end GetAccelODRHz()
+
+/**
+ * @brief @return Return the number of sensors installed with InstallSensor()
+ */
+uint8_t SensorFusion::GetNumSensors(void) {
+  return num_sensors_installed_;
+}  // end GetNumSensors()
+
+/**
+ * @brief Return the fault counters and recovery state of a sensor
+ * @param sensor_index is the position of the sensor in the order it was
+ * installed with InstallSensor(), starting at 0
+ * @param health pointer to structure, to be filled by this method
+ * @return True if sensor_index refers to an installed sensor, else False
+ */
+bool SensorFusion::GetSensorHealth(uint8_t sensor_index, SensorHealth *health) {
+  if (sensor_index >= num_sensors_installed_ || NULL == health) {
+    return false;
+  }
+  *health = sensors_[sensor_index].health;
+  return true;
+}  // end GetSensorHealth()
+
+/**
+ * @brief @return Return True if the sensor is currently being read normally,
+ * False if it is recovering from a fault (or sensor_index is invalid)
+ * @param sensor_index is the position of the sensor in the order it was
+ * installed with InstallSensor(), starting at 0
+ */
+bool SensorFusion::IsSensorHealthy(uint8_t sensor_index) {
+  if (sensor_index >= num_sensors_installed_) {
+    return false;
+  }
+  return SENSOR_HEALTHY == sensors_[sensor_index].health.state;
+}  // end IsSensorHealthy()
+
+/**
+ * @brief Return the numerical health counters of the 9DOF Kalman filter:
+ * faults found in its covariance, gain and state, and the resets they caused.
+ * The Toolbox stream carries the counts as packet type 11 once "DB+" is sent.
+ * @param health pointer to structure, to be filled by this method
+ * @return True if health was filled, else False
+ */
+bool SensorFusion::GetKalmanHealth(KalmanHealth *health) {
+  if (NULL == health) {
+    return false;
+  }
+  *health = sfg_->SV_9DOF_GBY_KALMAN.health;
+  return true;
+}  // end GetKalmanHealth()
+
 /**
  * @brief Return the orientation as a quaternion
  * @param quat pointer to quaternion structure, to be filled by this method
  */
 void  SensorFusion::GetOrientationQuaternion(Quaternion *quat) {
-  quat->q0 = sfg_->SV_9DOF_GBY_KALMAN.fqPl.q0;
-  quat->q1 = sfg_->SV_9DOF_GBY_KALMAN.fqPl.q1;
-  quat->q2 = sfg_->SV_9DOF_GBY_KALMAN.fqPl.q2;
-  quat->q3 = sfg_->SV_9DOF_GBY_KALMAN.fqPl.q3;
+  *quat = snapshot_.quaternion;
 }  // end GetOrientationQuaternion()
 
+/**
+ * @brief Return the orientation predicted SetPredictionHorizon() ahead.
+ * Equal to GetOrientationQuaternion() when no horizon is set.
+ * @param quat pointer to quaternion structure, to be filled by this method
+ */
+void  SensorFusion::GetPredictedQuaternion(Quaternion *quat) {
+  *quat = snapshot_.predicted_quaternion;
+}  // end GetPredictedQuaternion()
+
 /**
  * @brief @return Return magnetic fit error of trial calibration
  * 
@@ -16,26 +16,17 @@
 
 #include <Stream.h>
 
+#include <atomic>
+
 #include "board.h"
 #include "build.h"
 #include "sensor_fusion/sensor_fusion.h"
 #include "sensor_fusion/control.h"
+#include "sensor_fusion/data_logger.h"
+#include "sensor_fusion/hal_i2c.h"
 #include "sensor_fusion/status.h"
-
-/**
- *  enum constants used to indicate what type of sensor is being installed
- *  when calling InstallSensor().
- */
-enum class SensorType {
-  kMagnetometer,
-  kAccelerometer,
-  kMagnetometerAccelerometer,
-  kGyroscope,
-  kBarometer,
-  kThermometer
-};
-
-#define MAX_NUM_SENSORS  4    //TODO can replace with vector for arbitrary num sensors
+#include "sensor_drivers.h"
+#include "fusion_snapshot.h"
 
 /**
  *  Class that wraps the various mostly-C-style functions of the
@@ -46,19 +37,45 @@ enum class SensorType {
 class SensorFusion {
  public:
   SensorFusion();
-  bool InstallSensor(uint8_t sensor_i2c_addr, SensorType sensor_type);
+  bool InstallSensor(uint8_t sensor_i2c_addr, SensorType sensor_type,
+                     uint8_t i2c_bus = 0, uint32_t i2c_clock_hz = 0);
+  bool InstallSensor(uint8_t sensor_i2c_addr, const SensorDriver &driver,
+                     uint8_t i2c_bus = 0, uint32_t i2c_clock_hz = 0);
+  /// Install a sensor using the driver described by a traits struct
+  /// (see sensor_drivers.h), without it needing a SensorType entry.
+  template <class Traits>
+  bool InstallSensor(uint8_t sensor_i2c_addr, uint8_t i2c_bus = 0,
+                     uint32_t i2c_clock_hz = 0) {
+    return InstallSensor(sensor_i2c_addr, MakeSensorDriver<Traits>(), i2c_bus,
+                         i2c_clock_hz);
+  }
   bool InitializeInputOutputSubsystem(const Stream *serial_port = NULL,
                                       const void *tcp_client = NULL);
+  bool InitializeI2CBus(uint8_t i2c_bus, int pin_i2c_sda, int pin_i2c_scl,
+                        uint32_t i2c_clock_hz = I2C_DEFAULT_CLOCK_HZ);
   void Begin(int pin_i2c_sda = -1, int pin_i2c_scl = -1);
+  void SetAdaptiveRates(bool enable);
+  void SetPredictionHorizon(float horizon_ms);
   void UpdateWiFiStream(void *tcp_client);
+  bool AddWiFiClient(void *tcp_client);
+  void RemoveWiFiClient(void *tcp_client);
+  void SetUDPStream(void *udp, uint32_t ip, uint16_t port);
   void ReadSensors(void);
   void RunFusion(void);
   void ProduceToolboxOutput(void);
   bool SendArbitraryData(const char *buffer, uint16_t data_length);
+  bool SetOutputSubscription(uint8_t sink, uint16_t packets, uint16_t rate_hz);
+  bool GetOutputStats(uint8_t sink, OutputSinkStats *stats);
+  bool StartLogging(const char *path = "/fusion.log");
+  void StopLogging(void);
+  bool IsLogging(void);
+  void ServiceLogging(void);
+  bool GetLogStats(DataLoggerStats *stats);
   void ProcessCommands(void);
   void InjectCommand(const char *command);
   void SaveMagneticCalibration(void);
   bool IsDataValid(void);
+  bool GetSnapshot(FusionSnapshot *snapshot) const;
   int GetSystemStatus(void);
   float GetHeadingDegrees(void);
   float GetPitchDegrees(void);
@@ -81,6 +98,7 @@ class SensorFusion {
   float GetTemperatureC(void);
   float GetTemperatureK(void);
   void  GetOrientationQuaternion(Quaternion *quat);
+  void  GetPredictedQuaternion(Quaternion *quat);
   float GetMagneticFitError(void);
   float GetMagneticFitErrorTrial(void);
   float GetMagneticBMag(void);
@@ -89,39 +107,51 @@ class SensorFusion {
   float GetMagneticInclinationRad(void);
   float GetMagneticNoiseCovariance(void);
   float GetMagneticCalSolver(void);
+  int GetGyroODRHz(void);
+  int GetAccelODRHz(void);
+  uint8_t GetNumSensors(void);
+  bool GetSensorHealth(uint8_t sensor_index, SensorHealth *health);
+  bool IsSensorHealthy(uint8_t sensor_index);
+  bool GetKalmanHealth(KalmanHealth *health);
 
  private:
   void InitializeStatusSubsystem(void);
   void InitializeSensorFusionGlobals(void);
+  void UpdateSnapshot(void);
+  float GetSnapshotAngle(float FusionSnapshot::*angle) const;
 
   SensorFusionGlobals *sfg_;  ///< Primary sensor fusion data structure
   ControlSubsystem
       *control_subsystem_;             ///< command and data streaming structure
   StatusSubsystem *status_subsystem_;  ///< visual status indicator structure
-  PhysicalSensor *sensors_;            ///< linked list of up to 4 sensors
+  PhysicalSensor *sensors_;            ///< storage for up to MAX_NUM_SENSORS sensors
+  DataLogger *logger_ = NULL;          ///< high-rate data log, allocated by StartLogging()
+  uint8_t *log_ring_ = NULL;           ///< LOG_RING_BYTES of records waiting to be written
+#ifdef ESP32
+  TaskHandle_t logger_task_ = NULL;    ///< writes the log ring to storage
+#endif
   uint8_t num_sensors_installed_ =
       0;  ///< tracks how many sensors have been added to list
+  FusionSnapshot snapshot_ = {};  ///< results of the latest fusion cycle
+  mutable std::atomic<bool> angles_wanted_{
+      false};  ///< set by the first reader of the angles; UpdateSnapshot() then fills them in
+  std::atomic<uint32_t> snapshot_sequence_{
+      0};  ///< odd while snapshot_ is being written (see fusion_snapshot.h)
 
   /**
-   * Constants of the form kLoopsPer_____ set the relationship between
-   * number of sensor reads and each execution of the fusion algorithm.
-   * Normally there is a 1:1 relationship (i.e. read, fuse, read, fuse,...)
-   * but other arrangements are possible (e.g. read, read, fuse, read,
-   * read,...) The rate at which main loop() executes is set by
+   * kLoopsPerFusionCalc and the loops_per_read of each SensorDriver set the
+   * relationship between number of sensor reads and each execution of the
+   * fusion algorithm. Normally there is a 1:1 relationship (i.e. read, fuse,
+   * read, fuse,...) but other arrangements are possible (e.g. read, read,
+   * fuse, read, read,...) The rate at which main loop() executes is set by
    * LOOP_RATE_HZ in build.h
    */
-  const uint8_t kLoopsPerMagRead =
-      1;  ///< how often a magnetometer read is performed
-  const uint8_t kLoopsPerThermRead =
-      1;  ///< how often a thermometer read is performed
-  const uint8_t kLoopsPerAccelRead =
-      1;  ///< how often an accelerometer read is performed
-  const uint8_t kLoopsPerGyroRead =
-      1;  ///< how often a gyroscope read is performed
   const uint8_t kLoopsPerFusionCalc =
-      1;  ///< how often to fuse. Usually the max of previous 3 constants.
+      1;  ///< how often to fuse. Usually the max of the drivers' loops_per_read.
   uint8_t loops_per_fuse_counter_ =
       0;  ///< counts how many times through loop have been done
+  bool toolbox_frame_due_ =
+      false;  ///< a fusion cycle has run since ProduceToolboxOutput() made a frame
 
 };  // end SensorFusion
 
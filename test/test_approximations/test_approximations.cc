@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file test_approximations.cc
+    \brief Error bounds and throughput of the four-lane atan2 and asin
+
+    The error tests are exhaustive down to 2^-24: every float tangent
+    2^-24 <= t <= 1 in each of the eight octants for fatan2_deg4(), and every
+    float 2^-24 <= |x| <= 1 for fasin_deg4(), against double precision.
+    Below 2^-24 the polynomials' t^3 terms are under 2^-48 of their first,
+    so the results are t * ATAN_P0 rounded, and every 4096th float is enough
+    (the products there also run at denormal speed on x86). The tests check
+    the maximum errors noted in approximations.c, and report libm's atan2f()
+    and asinf() errors over the same arguments for comparison. Run with
+    "pio test -e native".
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <unity.h>
+
+#include "approximations.h"
+
+namespace {
+
+// the bounds noted beside the functions in approximations.c (deg)
+constexpr double kAtan2MaxError = 15.2E-6;
+constexpr double kAsinMaxError = 10.1E-6;
+
+constexpr double kDegPerRad = 57.295779513082321;
+constexpr uint32_t kOneBits = 0x3F800000;    // 1.0F
+constexpr uint32_t kSweepBits = 0x33800000;  // 2^-24, see the file comment
+constexpr uint32_t kSampleStep = 4096;       // floats apart below 2^-24
+
+// the next float to test after bits
+uint32_t NextBits(uint32_t bits) {
+  return bits + ((bits < kSweepBits) ? kSampleStep : 1);
+}
+
+float FloatFromBits(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// |a - b| for angles (deg), taking -180 and 180 as the same angle
+double AngleError(double a, double b) {
+  double error = fabs(a - b);
+  return (error > 180.0) ? 360.0 - error : error;
+}
+
+void Report(const char *name, double error) {
+  char message[80];
+  snprintf(message, sizeof(message), "%s max error %.4g deg", name, error);
+  TEST_MESSAGE(message);
+}
+
+void test_fatan2_deg4_error(void) {
+  double max_error = 0.0;
+  double max_error_libm = 0.0;
+
+  for (uint32_t bits = 0; bits <= kOneBits; bits = NextBits(bits)) {
+    float t = FloatFromBits(bits);
+    double ref = atan((double)t) * kDegPerRad;
+    // the octants in turn: (y, x) and the exact angle
+    float y[8] = {t, 1.0F, 1.0F, t, -t, -1.0F, -1.0F, -t};
+    float x[8] = {1.0F, t, -t, -1.0F, -1.0F, -t, t, 1.0F};
+    double exact[8] = {ref,          90.0 - ref,  90.0 + ref,  180.0 - ref,
+                       -180.0 + ref, -90.0 - ref, -90.0 + ref, -ref};
+    float angle[8];
+
+    fatan2_deg4(y, x, angle);
+    fatan2_deg4(y + 4, x + 4, angle + 4);
+    for (int i = 0; i < 8; i++) {
+      double error = AngleError(angle[i], exact[i]);
+      if (error > max_error) max_error = error;
+    }
+    double error = AngleError(atan2f(t, 1.0F) * (float)kDegPerRad, ref);
+    if (error > max_error_libm) max_error_libm = error;
+  }
+
+  Report("fatan2_deg4()", max_error);
+  Report("atan2f(), first octant,", max_error_libm);
+  TEST_ASSERT_TRUE(max_error <= kAtan2MaxError);
+}
+
+void test_fasin_deg4_error(void) {
+  double max_error = 0.0;
+  double max_error_libm = 0.0;
+  bool odd = true;
+
+  for (uint32_t bits = 0; bits <= kOneBits; bits = NextBits(bits)) {
+    float v = FloatFromBits(bits);
+    double ref = asin((double)v) * kDegPerRad;
+    float x[4] = {v, -v, v, -v};
+    float angle[4];
+
+    fasin_deg4(x, angle);
+    double error = fabs(angle[0] - ref);
+    if (error > max_error) max_error = error;
+    if (angle[1] != -angle[0]) odd = false;
+    error = fabs(asinf(v) * (float)kDegPerRad - ref);
+    if (error > max_error_libm) max_error_libm = error;
+  }
+
+  Report("fasin_deg4()", max_error);
+  Report("asinf()", max_error_libm);
+  TEST_ASSERT_TRUE(max_error <= kAsinMaxError);
+  // so the sweep over 0 <= x <= 1 covers -1 <= x < 0 too
+  TEST_ASSERT_TRUE(odd);
+}
+
+// Times the four-lane functions against four calls of the scalar ones and
+// of libm, over random angles, and reports ns per angle. Nothing is
+// asserted: the numbers depend on the host.
+constexpr int kBenchAngles = 1 << 14;
+constexpr int kBenchPasses = 200;
+
+template <typename Function>
+double NsPerAngle(Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < kBenchPasses; pass++) function();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ((double)kBenchPasses * kBenchAngles);
+}
+
+void ReportBench(const char *name, double ns, float sink) {
+  char message[80];
+  // printing the sum of the results keeps the compiler from dropping them
+  snprintf(message, sizeof(message), "%s %.2f ns per angle (sum %g)", name, ns,
+           sink);
+  TEST_MESSAGE(message);
+}
+
+void test_atan2_asin_throughput(void) {
+  std::vector<float> y(kBenchAngles), x(kBenchAngles), angle(kBenchAngles);
+  uint32_t seed = 1;
+  float sink = 0.0F;
+
+  for (int i = 0; i < kBenchAngles; i++) {
+    seed = seed * 1664525U + 1013904223U;
+    double theta = (seed >> 8) * (2.0 * M_PI / 16777216.0);
+    y[i] = (float)sin(theta);
+    x[i] = (float)cos(theta);
+  }
+
+  double ns = NsPerAngle([&] {
+    for (int i = 0; i < kBenchAngles; i += 4)
+      fatan2_deg4(&y[i], &x[i], &angle[i]);
+    sink += angle[kBenchAngles - 1];
+  });
+  ReportBench("fatan2_deg4()", ns, sink);
+  ns = NsPerAngle([&] {
+    for (int i = 0; i < kBenchAngles; i++) angle[i] = fatan2_deg(y[i], x[i]);
+    sink += angle[kBenchAngles - 1];
+  });
+  ReportBench("fatan2_deg()", ns, sink);
+  ns = NsPerAngle([&] {
+    for (int i = 0; i < kBenchAngles; i++)
+      angle[i] = atan2f(y[i], x[i]) * (float)kDegPerRad;
+    sink += angle[kBenchAngles - 1];
+  });
+  ReportBench("atan2f()", ns, sink);
+
+  // y holds sines, so it serves as the asin arguments
+  ns = NsPerAngle([&] {
+    for (int i = 0; i < kBenchAngles; i += 4) fasin_deg4(&y[i], &angle[i]);
+    sink += angle[kBenchAngles - 1];
+  });
+  ReportBench("fasin_deg4()", ns, sink);
+  ns = NsPerAngle([&] {
+    for (int i = 0; i < kBenchAngles; i++) angle[i] = fasin_deg(y[i]);
+    sink += angle[kBenchAngles - 1];
+  });
+  ReportBench("fasin_deg()", ns, sink);
+  ns = NsPerAngle([&] {
+    for (int i = 0; i < kBenchAngles; i++)
+      angle[i] = asinf(y[i]) * (float)kDegPerRad;
+    sink += angle[kBenchAngles - 1];
+  });
+  ReportBench("asinf()", ns, sink);
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fatan2_deg4_error);
+  RUN_TEST(test_fasin_deg4_error);
+  RUN_TEST(test_atan2_asin_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file test_fifo.cc
+    \brief addBlockToFifo() against the sample by sample path it replaced
+
+    A driver used to assemble each big-endian sample of a burst, apply
+    conditionSample() and call addToFifo(). addBlockToFifo() must leave the
+    FIFO, its count and its overflow count exactly as that did, for any
+    burst length, FIFO fill and buffer alignment. The benchmark reports ns
+    per sample for both. Run with "pio test -e native".
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include <unity.h>
+
+#include "sensor_fusion.h"
+
+namespace {
+
+constexpr int kMaxBurst = 40;  // samples, more than the largest FIFO
+constexpr int kBurstBytes = 6 * kMaxBurst;
+
+// what a driver did before addBlockToFifo()
+void AddSampleBySample(union FifoSensor *sensor, uint16_t maxFifoSize,
+                       const uint8_t *buffer, uint16_t numSamples) {
+  for (uint16_t i = 0; i < numSamples; i++) {
+    const uint8_t *p = buffer + 6 * i;
+    int16_t sample[3];
+    sample[CHX] = (int16_t)((p[0] << 8) | p[1]);
+    sample[CHY] = (int16_t)((p[2] << 8) | p[3]);
+    sample[CHZ] = (int16_t)((p[4] << 8) | p[5]);
+    conditionSample(sample);
+    addToFifo(sensor, maxFifoSize, sample);
+  }
+}
+
+// fills a burst with random bytes, with 0x8000 (-32768, which
+// conditionSample() changes) in about one value in eight
+void FillBurst(uint8_t *buffer, int bytes, uint32_t *seed) {
+  for (int i = 0; i < bytes; i += 2) {
+    *seed = *seed * 1664525U + 1013904223U;
+    bool special = ((*seed >> 29) == 0);
+    buffer[i] = special ? 0x80 : (uint8_t)(*seed >> 8);
+    buffer[i + 1] = special ? 0x00 : (uint8_t)(*seed >> 16);
+  }
+}
+
+void test_block_matches_sample_by_sample(void) {
+  // spare bytes so the burst can start at any alignment
+  alignas(4) uint8_t storage[kBurstBytes + 4];
+  union FifoSensor block, single;
+  uint32_t seed = 1;
+
+  for (int offset = 0; offset < 4; offset++) {
+    uint8_t *buffer = storage + offset;
+    for (int fill = 0; fill <= ACCEL_FIFO_SIZE; fill++) {
+      for (int samples = 0; samples <= kMaxBurst; samples++) {
+        FillBurst(buffer, 6 * samples, &seed);
+        memset(&block, 0, sizeof(block));
+        block.Accel.iFIFOCount = fill;
+        block.Accel.iFIFOExceeded = 3;  // cleared by any sample that fits
+        memcpy(&single, &block, sizeof(single));
+
+        addBlockToFifo(&block, ACCEL_FIFO_SIZE, buffer, samples);
+        AddSampleBySample(&single, ACCEL_FIFO_SIZE, buffer, samples);
+        TEST_ASSERT_EQUAL_INT(single.Accel.iFIFOCount,
+                              block.Accel.iFIFOCount);
+        TEST_ASSERT_EQUAL_INT(single.Accel.iFIFOExceeded,
+                              block.Accel.iFIFOExceeded);
+        TEST_ASSERT_EQUAL_MEMORY(single.Accel.iGsFIFO, block.Accel.iGsFIFO,
+                                 sizeof(block.Accel.iGsFIFO));
+      }
+    }
+  }
+}
+
+// Times unpacking full GYRO_FIFO_SIZE bursts, as the gyro driver reads them,
+// both ways and at both alignments, and reports ns per sample. Nothing is
+// asserted: the numbers depend on the host.
+constexpr int kBenchBursts = 200000;
+
+template <typename Function>
+double NsPerSample(Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (int burst = 0; burst < kBenchBursts; burst++) function();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ((double)kBenchBursts * GYRO_FIFO_SIZE);
+}
+
+void ReportBench(const char *name, double ns, uint32_t sink) {
+  char message[80];
+  // printing a result keeps the compiler from dropping the work
+  snprintf(message, sizeof(message), "%s %.2f ns per sample (%u)", name, ns,
+           sink);
+  TEST_MESSAGE(message);
+}
+
+void test_block_throughput(void) {
+  alignas(4) uint8_t storage[6 * GYRO_FIFO_SIZE + 4];
+  union FifoSensor fifo;
+  uint32_t seed = 1;
+  uint32_t sink = 0;
+
+  memset(&fifo, 0, sizeof(fifo));
+  FillBurst(storage, sizeof(storage), &seed);
+  for (int offset = 0; offset < 2; offset++) {
+    const uint8_t *buffer = storage + offset;
+    double ns = NsPerSample([&] {
+      fifo.Gyro.iFIFOCount = 0;
+      addBlockToFifo(&fifo, GYRO_FIFO_SIZE, buffer, GYRO_FIFO_SIZE);
+      sink += (uint16_t)fifo.Gyro.iYsFIFO[GYRO_FIFO_SIZE - 1][CHZ];
+    });
+    ReportBench(offset ? "addBlockToFifo(), unaligned"
+                       : "addBlockToFifo(), aligned",
+                ns, sink);
+    ns = NsPerSample([&] {
+      fifo.Gyro.iFIFOCount = 0;
+      AddSampleBySample(&fifo, GYRO_FIFO_SIZE, buffer, GYRO_FIFO_SIZE);
+      sink += (uint16_t)fifo.Gyro.iYsFIFO[GYRO_FIFO_SIZE - 1][CHZ];
+    });
+    ReportBench(offset ? "addToFifo() per sample, unaligned"
+                       : "addToFifo() per sample, aligned",
+                ns, sink);
+  }
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_block_matches_sample_by_sample);
+  RUN_TEST(test_block_throughput);
+  return UNITY_END();
+}
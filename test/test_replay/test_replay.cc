@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file test_replay.cc
+    \brief Replays a data log through the fusion pipeline
+
+    A log in the data_logger.h format is fed back into the software FIFOs
+    cycle by cycle, and run through conditionSensorReadings() and
+    runFusion() as on the board. The log is the file named by the
+    REPLAY_LOG environment variable, e.g. one recorded on a board, or else
+    a synthesized one: ten minutes of a unit tumbling through every
+    orientation for two minutes and turning slowly after that, with sensor
+    noise, a gyro offset and a magnetometer hard iron offset. It is written
+    by the data logger itself, with the true orientation in its
+    LOG_RECORD_QUATERNION records.
+
+    The test reports
+    - the orientation error against the log's quaternions (the truth, or
+      what the board computed), from 30 s after the 9DOF filter first
+      locked to a magnetic calibration;
+    - the mean time of conditionSensorReadings() and of runFusion();
+    - the largest differences of fVelGl and fDisGl from sums of the same
+      increments in double precision kept alongside, i.e. what the build's
+      FUSION_ACCUM_PRECISION loses (see precision.h).
+
+    Each environment builds the library one way, so paths are compared
+    across runs: REPLAY_TRACE names a file to write each cycle's quaternion,
+    fVelGl and fDisGl to, and REPLAY_BASELINE a trace from another run to
+    report the largest differences to. For example:
+    \verbatim
+    REPLAY_TRACE=quaternion.txt pio test -e native -f test_replay -v
+    REPLAY_BASELINE=quaternion.txt pio test -e native_matrix_update -v
+    \endverbatim
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <unity.h>
+
+#include "sensor_fusion.h"
+#include "control.h"
+#include "status.h"
+#include "data_logger.h"
+#include "fusion.h"
+#include "hal_i2c.h"
+
+// A host has no I2C bus. initSensorFusionGlobals() stores pointers to
+// readSensors() and initializeFusionEngine(), which use these; the replay
+// calls neither.
+extern "C" {
+bool I2CInitialize(int pin_sda, int pin_scl) { return false; }
+void I2CRunOnAllBuses(i2cBusJob_t *job, void *param) {}
+bool I2CBusClear(uint8_t bus) { return false; }
+int32_t Sensor_I2C_Read_Register(registerDeviceInfo_t *devInfo,
+                                 uint16_t peripheralAddress, uint8_t offset,
+                                 uint8_t length, uint8_t *pOutBuffer) {
+  return SENSOR_ERROR_READ;
+}
+}
+
+namespace {
+
+constexpr int kCycleUs = 1000000 / FUSION_HZ;
+constexpr int kGyroPerCycle = GYRO_ODR_HZ / FUSION_HZ;
+constexpr int kAccelPerCycle = ACCEL_ODR_HZ / FUSION_HZ;
+static_assert(kGyroPerCycle <= GYRO_FIFO_SIZE &&
+                  kAccelPerCycle <= ACCEL_FIFO_SIZE &&
+                  kGyroPerCycle % kAccelPerCycle == 0,
+              "the synthesized log needs whole FIFOs of samples per cycle");
+
+// the synthesized log
+constexpr int kLogSecs = 600;
+constexpr int kTumbleSecs = 120;
+constexpr int16_t kCountsPerg = 8192;  // FXOS8700 at +/-4 g
+constexpr int16_t kCountsPeruT = 10;   // FXOS8700
+constexpr int16_t kCountsPerDegPerSec = 16;  // FXAS21002 at 2000 deg/s
+constexpr double kGyroOffset[3] = {0.7, -0.4, 0.3};    // deg/s
+constexpr double kHardIron[3] = {20.0, -15.0, 30.0};   // uT
+constexpr double kGeomagneticField = 50.0;             // uT
+constexpr double kInclination = 60.0;                  // deg
+constexpr double kGyroNoise = 0.2;                     // deg/s
+constexpr double kAccelNoise = 0.005;                  // g
+constexpr double kMagNoise = 0.5;                      // uT
+
+constexpr int kSettleCycles = 30 * FUSION_HZ;  // after the first lock
+constexpr int kTimingPasses = 10;
+constexpr double kDegPerRad = 57.295779513082321;
+
+// orientation errors the synthesized log must stay within (deg)
+constexpr double kMaxRmsError = 1.0;
+constexpr double kMaxError = 5.0;
+
+// A quaternion in double precision, for the true orientation. Rotations
+// follow orientation.c: a vector u in the global frame is q*.u.q in the
+// sensor frame, and a rotation by the sensor frame rotation vector r
+// updates q to q.dq.
+struct Rotation {
+  double q0, q1, q2, q3;
+};
+
+Rotation Multiply(const Rotation &a, const Rotation &b) {
+  return Rotation{a.q0 * b.q0 - a.q1 * b.q1 - a.q2 * b.q2 - a.q3 * b.q3,
+                  a.q0 * b.q1 + a.q1 * b.q0 + a.q2 * b.q3 - a.q3 * b.q2,
+                  a.q0 * b.q2 - a.q1 * b.q3 + a.q2 * b.q0 + a.q3 * b.q1,
+                  a.q0 * b.q3 + a.q1 * b.q2 - a.q2 * b.q1 + a.q3 * b.q0};
+}
+
+Rotation FromRotationVectorDeg(const double omega[3], double deltat) {
+  double r[3] = {omega[0] * deltat / kDegPerRad, omega[1] * deltat / kDegPerRad,
+                 omega[2] * deltat / kDegPerRad};
+  double angle = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+  if (angle == 0.0) return Rotation{1.0, 0.0, 0.0, 0.0};
+  double s = sin(0.5 * angle) / angle;
+  return Rotation{cos(0.5 * angle), r[0] * s, r[1] * s, r[2] * s};
+}
+
+void Normalize(Rotation *q) {
+  double r = 1.0 / sqrt(q->q0 * q->q0 + q->q1 * q->q1 + q->q2 * q->q2 +
+                        q->q3 * q->q3);
+  q->q0 *= r;
+  q->q1 *= r;
+  q->q2 *= r;
+  q->q3 *= r;
+}
+
+// the global frame vector u in the sensor frame
+void ToSensorFrame(const Rotation &q, const double u[3], double v[3]) {
+  Rotation conjugate = {q.q0, -q.q1, -q.q2, -q.q3};
+  Rotation p = Multiply(Multiply(conjugate, Rotation{0.0, u[0], u[1], u[2]}), q);
+  v[0] = p.q1;
+  v[1] = p.q2;
+  v[2] = p.q3;
+}
+
+// angle (deg) between two orientations
+double AngleBetween(const Quaternion &a, const Quaternion &b) {
+  double dot = (double)a.q0 * b.q0 + (double)a.q1 * b.q1 +
+               (double)a.q2 * b.q2 + (double)a.q3 * b.q3;
+  double norms = sqrt(((double)a.q0 * a.q0 + (double)a.q1 * a.q1 +
+                       (double)a.q2 * a.q2 + (double)a.q3 * a.q3) *
+                      ((double)b.q0 * b.q0 + (double)b.q1 * b.q1 +
+                       (double)b.q2 * b.q2 + (double)b.q3 * b.q3));
+  double c = fabs(dot) / norms;
+  return 2.0 * acos(c > 1.0 ? 1.0 : c) * kDegPerRad;
+}
+
+// uniform in [-1, 1)
+double Noise(uint32_t *seed) {
+  *seed = *seed * 1664525U + 1013904223U;
+  return (double)((int32_t)*seed) * (1.0 / 2147483648.0);
+}
+
+int16_t Counts(double value) {
+  long counts = lrint(value);
+  if (counts > 32767) return 32767;
+  if (counts < -32767) return -32767;
+  return (int16_t)counts;
+}
+
+// the true angular velocity (deg/s, sensor frame) at time t (s)
+void AngularVelocity(double t, double omega[3]) {
+  double scale = (t < kTumbleSecs) ? 1.0 : 0.1;
+  omega[0] = scale * 80.0 * sin(0.7 * t);
+  omega[1] = scale * 60.0 * sin(1.3 * t + 1.0);
+  omega[2] = scale * 120.0 * sin(0.4 * t + 2.0);
+}
+
+// the status subsystem just keeps the status
+void SetStatus(StatusSubsystem *pStatus, fusion_status_t status) {
+  pStatus->status = status;
+}
+fusion_status_t GetStatus(StatusSubsystem *pStatus) { return pStatus->status; }
+void UpdateStatus(StatusSubsystem *pStatus) {}
+
+// the fusion globals of the synthesizer and of the replay, each too large
+// for the stack
+SensorFusionGlobals synth_sfg, sfg;
+StatusSubsystem status_subsystem;
+ControlSubsystem control_subsystem;
+uint8_t ring[LOG_RING_BYTES];
+
+void InitializeGlobals(SensorFusionGlobals *pSfg) {
+  memset(pSfg, 0, sizeof(*pSfg));
+  memset(&status_subsystem, 0, sizeof(status_subsystem));
+  memset(&control_subsystem, 0, sizeof(control_subsystem));
+  status_subsystem.set = SetStatus;
+  status_subsystem.get = GetStatus;
+  status_subsystem.queue = SetStatus;
+  status_subsystem.update = UpdateStatus;
+  status_subsystem.test = UpdateStatus;
+  initSensorFusionGlobals(pSfg, &status_subsystem, &control_subsystem);
+  control_subsystem.DefaultQuaternionPacketType = Q9;
+  control_subsystem.QuaternionPacketType = Q9;
+  pSfg->setStatus(pSfg, NORMAL);
+}
+
+// logWriteBlock_t for a log kept in a std::vector<uint8_t>
+bool AppendToLog(void *pStorage, const uint8_t *pData, uint16_t len) {
+  std::vector<uint8_t> *log = static_cast<std::vector<uint8_t> *>(pStorage);
+  log->insert(log->end(), pData, pData + len);
+  return true;
+}
+
+// Writes the synthesized log described in the file comment. The samples
+// are made in the fusion frame and stored before the HAL remap, as a driver
+// reads them; each remap in hal_axis_remap.c is its own inverse.
+std::vector<uint8_t> SynthesizeLog(void) {
+  std::vector<uint8_t> log;
+  DataLogger logger = {};
+  Rotation q = {1.0, 0.0, 0.0, 0.0};
+  double omega[3], v[3];
+  uint32_t seed = 1;
+  double sinDelta = sin(kInclination / kDegPerRad);
+  double cosDelta = cos(kInclination / kDegPerRad);
+#if THISCOORDSYSTEM == NED
+  const double gravity[3] = {0.0, 0.0, 1.0};
+  const double field[3] = {kGeomagneticField * cosDelta, 0.0,
+                           kGeomagneticField * sinDelta};
+#elif THISCOORDSYSTEM == ANDROID
+  const double gravity[3] = {0.0, 0.0, 1.0};
+  const double field[3] = {0.0, kGeomagneticField * cosDelta,
+                           -kGeomagneticField * sinDelta};
+#else  // WIN8
+  const double gravity[3] = {0.0, 0.0, -1.0};
+  const double field[3] = {0.0, kGeomagneticField * cosDelta,
+                           -kGeomagneticField * sinDelta};
+#endif
+
+  InitializeGlobals(&synth_sfg);
+  synth_sfg.Accel.iCountsPerg = kCountsPerg;
+  synth_sfg.Mag.iCountsPeruT = kCountsPeruT;
+  synth_sfg.Gyro.iCountsPerDegPerSec = kCountsPerDegPerSec;
+  startDataLogger(&logger, &synth_sfg, ring, AppendToLog, NULL, &log, 0);
+
+  for (int cycle = 0; cycle < kLogSecs * FUSION_HZ; cycle++) {
+    synth_sfg.loopcounter = cycle;
+    for (int i = 0; i < kGyroPerCycle; i++) {
+      AngularVelocity((double)(cycle * kGyroPerCycle + i) / GYRO_ODR_HZ,
+                      omega);
+      q = Multiply(q, FromRotationVectorDeg(omega, 1.0 / GYRO_ODR_HZ));
+      Normalize(&q);
+      for (int j = CHX; j <= CHZ; j++)
+        synth_sfg.Gyro.iYsFIFO[i][j] =
+            Counts((omega[j] + kGyroOffset[j] + kGyroNoise * Noise(&seed)) *
+                   kCountsPerDegPerSec);
+      // the accelerometer samples at the end of each of its periods
+      if ((i + 1) % (kGyroPerCycle / kAccelPerCycle) == 0) {
+        int k = (i + 1) / (kGyroPerCycle / kAccelPerCycle) - 1;
+        ToSensorFrame(q, gravity, v);
+        for (int j = CHX; j <= CHZ; j++)
+          synth_sfg.Accel.iGsFIFO[k][j] =
+              Counts((v[j] + kAccelNoise * Noise(&seed)) * kCountsPerg);
+      }
+    }
+    // one magnetometer sample per cycle, as the FXOS8700 driver reads it
+    ToSensorFrame(q, field, v);
+    for (int j = CHX; j <= CHZ; j++)
+      synth_sfg.Mag.iBsFIFO[0][j] =
+          Counts((v[j] + kHardIron[j] + kMagNoise * Noise(&seed)) *
+                 kCountsPeruT);
+    synth_sfg.Gyro.iFIFOCount = kGyroPerCycle;
+    synth_sfg.Accel.iFIFOCount = kAccelPerCycle;
+    synth_sfg.Mag.iFIFOCount = 1;
+    ApplyAccelHAL(&synth_sfg.Accel);
+    ApplyMagHAL(&synth_sfg.Mag);
+    ApplyGyroHAL(&synth_sfg.Gyro);
+    logSensorSamples(&logger, &synth_sfg, (uint32_t)cycle * kCycleUs);
+
+    // the truth takes the place of the fusion output
+    synth_sfg.SV_9DOF_GBY_KALMAN.fqPl =
+        Quaternion{(float)q.q0, (float)q.q1, (float)q.q2, (float)q.q3};
+    for (int j = CHX; j <= CHZ; j++)
+      synth_sfg.SV_9DOF_GBY_KALMAN.fOmega[j] = (float)omega[j];
+    logFusionOutput(&logger, &synth_sfg, (uint32_t)cycle * kCycleUs);
+    serviceDataLogger(&logger);
+    clearFIFOs(&synth_sfg);
+  }
+  stopDataLogger(&logger);
+  serviceDataLogger(&logger);
+  TEST_ASSERT_EQUAL_INT(0, logger.stats.recordsDropped);
+  return log;
+}
+
+std::vector<uint8_t> ReadLog(const char *name) {
+  std::vector<uint8_t> log;
+  FILE *file = fopen(name, "rb");
+  if (!file) return log;
+  uint8_t block[LOG_BLOCK_BYTES];
+  size_t len;
+  while ((len = fread(block, 1, sizeof(block), file)) > 0)
+    log.insert(log.end(), block, block + len);
+  fclose(file);
+  return log;
+}
+
+uint16_t GetU16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+// a sample record into its software FIFO
+void AddSampleRecord(const uint8_t *pRecord) {
+  union FifoSensor *fifo;
+  uint16_t maxFifoSize;
+  int16_t sample[3] = {(int16_t)GetU16(&pRecord[8]),
+                       (int16_t)GetU16(&pRecord[10]),
+                       (int16_t)GetU16(&pRecord[12])};
+
+  switch (pRecord[0]) {
+    case LOG_RECORD_ACCEL:
+      fifo = (union FifoSensor *)&sfg.Accel;
+      maxFifoSize = ACCEL_FIFO_SIZE;
+      break;
+    case LOG_RECORD_MAG:
+      fifo = (union FifoSensor *)&sfg.Mag;
+      maxFifoSize = MAG_FIFO_SIZE;
+      break;
+    default:
+      fifo = (union FifoSensor *)&sfg.Gyro;
+      maxFifoSize = GYRO_FIFO_SIZE;
+      break;
+  }
+  addToFifo(fifo, maxFifoSize, sample);
+  fifo->Accel.iFIFOExceeded = GetU16(&pRecord[14]);
+}
+
+struct ReplayResult {
+  int cycles;
+  int settled_cycles;      // cycles in the error statistics
+  double rms_error;        // deg
+  double max_error;        // deg
+  double fusion_ns;        // runFusion() per cycle
+  double condition_ns;     // conditionSensorReadings() per cycle
+  double max_vel_error;    // fVelGl against the double sums (m/s)
+  double max_dis_error;    // fDisGl against the double sums (m)
+  double vel_magnitude;    // largest |fVelGl| component seen (m/s)
+  double dis_magnitude;    // largest |fDisGl| component seen (m)
+  int lock_cycle;          // cycle of the first lock, or -1
+  int baseline_cycles;     // cycles compared with the baseline
+  double baseline_angle;   // largest orientation difference (deg)
+  double baseline_vel;     // largest fVelGl difference (m/s)
+  double baseline_dis;     // largest fDisGl difference (m)
+};
+
+ReplayResult Replay(const std::vector<uint8_t> &log, FILE *trace,
+                    FILE *baseline) {
+  struct SV_9DOF_GBY_KALMAN *pSV = &sfg.SV_9DOF_GBY_KALMAN;
+  ReplayResult result = {};
+  result.lock_cycle = -1;
+  double sum_sq_error = 0.0;
+  double fusion_ns = 0.0, condition_ns = 0.0;
+  double vel[3] = {0.0, 0.0, 0.0}, dis[3] = {0.0, 0.0, 0.0};
+
+  InitializeGlobals(&sfg);
+  sfg.Accel.isEnabled = sfg.Mag.isEnabled = sfg.Gyro.isEnabled = true;
+  fInitializeFusion(&sfg);
+  fInitializeMagCalibration(&sfg.MagCal, &sfg.MagBuffer);
+  fInitializeAccelCalibration(&sfg.AccelCal, &sfg.AccelBuffer,
+                              &control_subsystem.AccelCalPacketOn);
+  clearFIFOs(&sfg);
+
+  for (size_t offset = 0; offset + LOG_RECORD_BYTES <= log.size();
+       offset += LOG_RECORD_BYTES) {
+    const uint8_t *pRecord = &log[offset];
+    switch (pRecord[0]) {
+      case LOG_RECORD_HEADER:
+        TEST_ASSERT_EQUAL_INT(LOG_FORMAT_VERSION, GetU16(&pRecord[8]));
+        TEST_ASSERT_EQUAL_INT(FUSION_HZ, pRecord[1]);
+        sfg.Accel.iCountsPerg = (int16_t)GetU16(&pRecord[10]);
+        sfg.Accel.fgPerCount = 1.0F / sfg.Accel.iCountsPerg;
+        sfg.Accel.fCountsPerg = (float)sfg.Accel.iCountsPerg;
+        sfg.Gyro.iCountsPerDegPerSec = (int16_t)GetU16(&pRecord[12]);
+        sfg.Gyro.fDegPerSecPerCount = 1.0F / sfg.Gyro.iCountsPerDegPerSec;
+        sfg.Mag.iCountsPeruT = (int16_t)GetU16(&pRecord[14]);
+        sfg.Mag.fuTPerCount = 1.0F / sfg.Mag.iCountsPeruT;
+        sfg.Mag.fCountsPeruT = (float)sfg.Mag.iCountsPeruT;
+        break;
+      case LOG_RECORD_ACCEL:
+      case LOG_RECORD_MAG:
+      case LOG_RECORD_GYRO:
+        AddSampleRecord(pRecord);
+        break;
+      case LOG_RECORD_QUATERNION: {
+        // the cycle's samples are all in; run it as the board did
+        bool reset = pSV->resetflag;
+        auto start = std::chrono::steady_clock::now();
+        sfg.conditionSensorReadings(&sfg);
+        auto middle = std::chrono::steady_clock::now();
+        sfg.runFusion(&sfg);
+        auto end = std::chrono::steady_clock::now();
+        sfg.loopcounter++;
+        condition_ns += std::chrono::duration<double, std::nano>(middle - start).count();
+        fusion_ns += std::chrono::duration<double, std::nano>(end - middle).count();
+        result.cycles++;
+
+        // the same increments as the accumulators, summed in double
+        for (int i = CHX; i <= CHZ; i++) {
+          if (reset) {
+            vel[i] = dis[i] = 0.0;
+          } else {
+            vel[i] += (double)(pSV->fAccGl[i] * pSV->fgdeltat);
+            dis[i] += vel[i] * pSV->fdeltat;
+          }
+          result.max_vel_error =
+              fmax(result.max_vel_error, fabs(pSV->fVelGl[i] - vel[i]));
+          result.max_dis_error =
+              fmax(result.max_dis_error, fabs(pSV->fDisGl[i] - dis[i]));
+          result.vel_magnitude = fmax(result.vel_magnitude, fabs(vel[i]));
+          result.dis_magnitude = fmax(result.dis_magnitude, fabs(dis[i]));
+        }
+
+        if ((result.lock_cycle < 0) && pSV->iFirstAccelMagLock &&
+            sfg.MagCal.iValidMagCal)
+          result.lock_cycle = result.cycles;
+        if ((result.lock_cycle >= 0) &&
+            (result.cycles >= result.lock_cycle + kSettleCycles)) {
+          Quaternion logged = {(int16_t)GetU16(&pRecord[8]) / 30000.0F,
+                               (int16_t)GetU16(&pRecord[10]) / 30000.0F,
+                               (int16_t)GetU16(&pRecord[12]) / 30000.0F,
+                               (int16_t)GetU16(&pRecord[14]) / 30000.0F};
+          double error = AngleBetween(pSV->fqPl, logged);
+          sum_sq_error += error * error;
+          result.max_error = fmax(result.max_error, error);
+          result.settled_cycles++;
+        }
+
+        if (trace)
+          fprintf(trace, "%.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+                  pSV->fqPl.q0, pSV->fqPl.q1, pSV->fqPl.q2, pSV->fqPl.q3,
+                  pSV->fVelGl[CHX], pSV->fVelGl[CHY], pSV->fVelGl[CHZ],
+                  pSV->fDisGl[CHX], pSV->fDisGl[CHY], pSV->fDisGl[CHZ]);
+        float b[10];
+        if (baseline &&
+            fscanf(baseline, "%g %g %g %g %g %g %g %g %g %g", &b[0], &b[1],
+                   &b[2], &b[3], &b[4], &b[5], &b[6], &b[7], &b[8], &b[9]) == 10) {
+          result.baseline_cycles++;
+          result.baseline_angle =
+              fmax(result.baseline_angle,
+                   AngleBetween(pSV->fqPl, Quaternion{b[0], b[1], b[2], b[3]}));
+          for (int i = CHX; i <= CHZ; i++) {
+            result.baseline_vel =
+                fmax(result.baseline_vel, fabs(pSV->fVelGl[i] - b[4 + i]));
+            result.baseline_dis =
+                fmax(result.baseline_dis, fabs(pSV->fDisGl[i] - b[7 + i]));
+          }
+        }
+        break;
+      }
+      default:  // LOG_RECORD_RATE
+        break;
+    }
+  }
+
+  if (result.settled_cycles > 0)
+    result.rms_error = sqrt(sum_sq_error / result.settled_cycles);
+  if (result.cycles > 0) {
+    result.fusion_ns = fusion_ns / result.cycles;
+    result.condition_ns = condition_ns / result.cycles;
+  }
+
+  return result;
+}
+
+void test_replay(void) {
+  const char *log_name = getenv("REPLAY_LOG");
+  const char *trace_name = getenv("REPLAY_TRACE");
+  const char *baseline_name = getenv("REPLAY_BASELINE");
+  std::vector<uint8_t> log = log_name ? ReadLog(log_name) : SynthesizeLog();
+  TEST_ASSERT_TRUE_MESSAGE(log.size() >= LOG_RECORD_BYTES, "no log to replay");
+
+  FILE *trace = trace_name ? fopen(trace_name, "w") : NULL;
+  FILE *baseline = baseline_name ? fopen(baseline_name, "r") : NULL;
+  ReplayResult result = Replay(log, trace, baseline);
+  if (trace) fclose(trace);
+  if (baseline) fclose(baseline);
+  // the results repeat, and the fastest pass times the code rather than
+  // the host's other work
+  for (int pass = 1; pass < kTimingPasses; pass++) {
+    ReplayResult timing = Replay(log, NULL, NULL);
+    result.fusion_ns = fmin(result.fusion_ns, timing.fusion_ns);
+    result.condition_ns = fmin(result.condition_ns, timing.condition_ns);
+  }
+
+  char message[160];
+  snprintf(message, sizeof(message),
+           "%d cycles, first lock at cycle %d; orientation error over %d "
+           "cycles from 30 s after it: rms %.3f deg, max %.3f deg",
+           result.cycles, result.lock_cycle, result.settled_cycles,
+           result.rms_error, result.max_error);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof(message),
+           "per cycle: runFusion() %.0f ns, conditionSensorReadings() %.0f ns "
+           "(F_9DOF_QUATERNION_UPDATE %d)",
+           result.fusion_ns, result.condition_ns, F_9DOF_QUATERNION_UPDATE);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof(message),
+           "against double sums (FUSION_ACCUM_PRECISION %d): fVelGl %.3g m/s "
+           "of %.4g, fDisGl %.3g m of %.4g",
+           FUSION_ACCUM_PRECISION, result.max_vel_error, result.vel_magnitude,
+           result.max_dis_error, result.dis_magnitude);
+  TEST_MESSAGE(message);
+  if (baseline) {
+    snprintf(message, sizeof(message),
+             "against the baseline over %d cycles: orientation %.3g deg, "
+             "fVelGl %.3g m/s, fDisGl %.3g m",
+             result.baseline_cycles, result.baseline_angle,
+             result.baseline_vel, result.baseline_dis);
+    TEST_MESSAGE(message);
+  }
+
+  TEST_ASSERT_TRUE(result.settled_cycles > 0);
+  // double sums only differ from the outputs by their rounding to float
+#if FUSION_ACCUM_PRECISION == ACCUM_DOUBLE
+  TEST_ASSERT_TRUE(result.max_vel_error <= 1.0E-7 * result.vel_magnitude);
+  TEST_ASSERT_TRUE(result.max_dis_error <= 1.0E-7 * result.dis_magnitude);
+#endif
+  // a board's own log may hold other quaternion types, or an older build
+  if (!log_name) {
+    TEST_ASSERT_TRUE(result.rms_error <= kMaxRmsError);
+    TEST_ASSERT_TRUE(result.max_error <= kMaxError);
+  }
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay);
+  return UNITY_END();
+}
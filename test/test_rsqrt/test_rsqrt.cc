@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020-2021 Bjarne Hansen
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*! \file test_rsqrt.cc
+    \brief Accuracy and speed of frsqrt() and the normalizations built on it
+
+    frsqrt() is compiled with the build's RSQRT_NEWTON_STEPS, so the
+    "native" environment tests 1.0F / sqrtf() and "native_rsqrt" the three
+    Newton steps of the ESP8266 build. Both report 1.0F / sqrtf() alongside
+    for comparison. The error sweep covers every float in [0.25, 4), which
+    holds every mantissa at both exponent parities, so the relative error
+    repeats outside it. Run with "pio test -e native -e native_rsqrt".
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <unity.h>
+
+#include "sensor_fusion.h"
+#include "approximations.h"
+#include "orientation.h"
+
+namespace {
+
+// maximum relative errors of frsqrt() noted in build.h, by number of steps
+#if RSQRT_NEWTON_STEPS == 0
+constexpr double kMaxRelError = 0.9E-7;   // 1.0F / sqrtf()
+#elif RSQRT_NEWTON_STEPS == 2
+constexpr double kMaxRelError = 4.7E-6;
+#elif RSQRT_NEWTON_STEPS >= 3
+constexpr double kMaxRelError = 1.5E-7;
+#else
+constexpr double kMaxRelError = 1.8E-3;
+#endif
+
+constexpr uint32_t kQuarterBits = 0x3E800000;  // 0.25F
+constexpr uint32_t kFourBits = 0x40800000;     // 4.0F
+
+float FloatFromBits(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+void Report(const char *name, double error) {
+  char message[96];
+  snprintf(message, sizeof(message), "%s max relative error %.3g (%d steps)",
+           name, error, RSQRT_NEWTON_STEPS);
+  TEST_MESSAGE(message);
+}
+
+void test_frsqrt_error(void) {
+  double max_error = 0.0;
+  double max_error_sqrt = 0.0;
+  double max_error_libm = 0.0;
+
+  for (uint32_t bits = kQuarterBits; bits < kFourBits; bits++) {
+    float x = FloatFromBits(bits);
+    double exact = sqrt((double)x);
+    double error = fabs(frsqrt(x) * exact - 1.0);
+    if (error > max_error) max_error = error;
+    error = fabs(fsqrt_fast(x) / exact - 1.0);
+    if (error > max_error_sqrt) max_error_sqrt = error;
+    error = fabs((1.0F / sqrtf(x)) * exact - 1.0);
+    if (error > max_error_libm) max_error_libm = error;
+  }
+
+  Report("frsqrt()", max_error);
+  Report("fsqrt_fast()", max_error_sqrt);
+  Report("1.0F / sqrtf()", max_error_libm);
+  TEST_ASSERT_TRUE(max_error <= kMaxRelError);
+  // x * frsqrt(x) adds at most one rounding
+  TEST_ASSERT_TRUE(max_error_sqrt <= kMaxRelError + 0.6E-7);
+}
+
+// a random quaternion, components uniform in [-1, 1)
+Quaternion RandomQuaternion(uint32_t *seed) {
+  float q[4];
+  for (int i = 0; i < 4; i++) {
+    *seed = *seed * 1664525U + 1013904223U;
+    q[i] = (float)((int32_t)*seed) * (1.0F / 2147483648.0F);
+  }
+  return Quaternion{q[0], q[1], q[2], q[3]};
+}
+
+double NormError(const Quaternion &q) {
+  double norm = sqrt((double)q.q0 * q.q0 + (double)q.q1 * q.q1 +
+                     (double)q.q2 * q.q2 + (double)q.q3 * q.q3);
+  return fabs(norm - 1.0);
+}
+
+void test_quaternion_normalization(void) {
+  constexpr int kQuaternions = 1000000;
+  uint32_t seed = 1;
+  double max_error = 0.0;
+  double max_error_rvec = 0.0;
+
+  for (int i = 0; i < kQuaternions; i++) {
+    Quaternion q = RandomQuaternion(&seed);
+    // far from the norm below which orientation.c resets a quaternion as
+    // corrupt
+    if (q.q0 * q.q0 + q.q1 * q.q1 + q.q2 * q.q2 + q.q3 * q.q3 < 0.01F)
+      continue;
+    fqAeqNormqA(&q);
+    double error = NormError(q);
+    if (error > max_error) max_error = error;
+
+    // a rotation of up to 180 deg in one second
+    float rvec[3] = {q.q1 * 180.0F, q.q2 * 180.0F, q.q3 * 180.0F};
+    fQuaternionFromRotationVectorDeg(&q, rvec, 1.0F);
+    error = NormError(q);
+    if (error > max_error_rvec) max_error_rvec = error;
+  }
+
+  char message[96];
+  snprintf(message, sizeof(message),
+           "|q| - 1 after fqAeqNormqA() %.3g, from a rotation vector %.3g",
+           max_error, max_error_rvec);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(max_error < 1.0E-6);
+  TEST_ASSERT_TRUE(max_error_rvec < 1.0E-6);
+}
+
+// Times frsqrt() and 1.0F / sqrtf() over an array, and fqAeqNormqA(), and
+// reports ns per call. Nothing is asserted: the numbers depend on the host.
+constexpr int kBenchValues = 1 << 12;
+constexpr int kBenchPasses = 2000;
+
+template <typename Function>
+double NsPerCall(Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < kBenchPasses; pass++) function();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ((double)kBenchPasses * kBenchValues);
+}
+
+void ReportBench(const char *name, double ns, float sink) {
+  char message[96];
+  // printing a result keeps the compiler from dropping the work
+  snprintf(message, sizeof(message), "%s %.2f ns per call (%d steps, %g)",
+           name, ns, RSQRT_NEWTON_STEPS, sink);
+  TEST_MESSAGE(message);
+}
+
+void test_rsqrt_throughput(void) {
+  std::vector<float> x(kBenchValues), y(kBenchValues);
+  std::vector<Quaternion> q(kBenchValues);
+  uint32_t seed = 1;
+  float sink = 0.0F;
+
+  for (int i = 0; i < kBenchValues; i++) {
+    q[i] = RandomQuaternion(&seed);
+    x[i] = 0.25F + fabsf(q[i].q0) * 3.75F;
+  }
+
+  double ns = NsPerCall([&] {
+    for (int i = 0; i < kBenchValues; i++) y[i] = frsqrt(x[i]);
+    sink += y[kBenchValues - 1];
+  });
+  ReportBench("frsqrt()", ns, sink);
+  ns = NsPerCall([&] {
+    for (int i = 0; i < kBenchValues; i++) y[i] = 1.0F / sqrtf(x[i]);
+    sink += y[kBenchValues - 1];
+  });
+  ReportBench("1.0F / sqrtf()", ns, sink);
+  ns = NsPerCall([&] {
+    // after the first pass the quaternions are unit ones, which take the
+    // same path through fqAeqNormqA()
+    for (int i = 0; i < kBenchValues; i++) fqAeqNormqA(&q[i]);
+    sink += q[kBenchValues - 1].q0;
+  });
+  ReportBench("fqAeqNormqA()", ns, sink);
+}
+
+}  // namespace
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_frsqrt_error);
+  RUN_TEST(test_quaternion_normalization);
+  RUN_TEST(test_rsqrt_throughput);
+  return UNITY_END();
+}